@@ -7,6 +7,7 @@
 // header for AuEngine
 /////////////////////////////////
 #pragma once
+#include <atomic>
 #include <exception>
 #include <string>
 #include <windows.h>
@@ -26,7 +27,7 @@ extern "C"
 void Msg(std::string szMessage);
 void Msg(std::string szMessage, int iNum);
 template<typename T> T freadNum(FILE* f);
-std::string freadStr(FILE* f, size_t len);
+bool freadTag(FILE* f, const char* szTag, size_t len);
 
 #define THROW_EXCEPTION(x) 		throw AuEngine::Exception(x)
 #define DEBUG_BREAK				__debugbreak()		// int 3
@@ -93,10 +94,29 @@ namespace AuEngine
 		AAC_FILE	= 7
 	};	
 
+	enum LatencyProfile
+	{
+		LATENCY_LOW			= 1,		// monitoring, smallest buffers
+		LATENCY_BALANCED	= 2,
+		LATENCY_SAFE		= 3,		// batch playback, large buffers to save CPU
+		LATENCY_CUSTOM		= 4			// explicit frames and seconds
+	};
+
+	DLL_API unsigned long ChooseFramesPerBuffer(LatencyProfile profile, unsigned long customFrames, double dSampleRate);
+	DLL_API double ChooseSuggestedLatency(LatencyProfile profile, double dCustomLatency, const PaDeviceInfo* pDevice,
+		unsigned long frames, double dSampleRate, bool isInput);
+
+	class Graph;
+	class Recorder;
+	struct TimingSnapshot;
+
 	class FileSystem
 	{
 	public:
-		void CreateFileInBuffer(FILE * oFile, size_t szBuffer);
+		DLL_API void CreateFileInBuffer(const char* lpPath, const void* pData, size_t szBuffer,
+			int iChannels, int iSampleRate, PaSampleFormat format);
+		DLL_API void ExportFile(const char* lpSource, const char* lpPath, PaSampleFormat format = 0,
+			std::atomic<int>* pPercent = NULL);
 		void OpenFileByPart(const char * lpPath);
 	};
 	// Exception Class
@@ -130,28 +150,53 @@ namespace AuEngine
 		DLL_API void CreateOutput(const char* lpName);
 		DLL_API const char* GetOutputDevice();
 		DLL_API int GetCPULoadStream(float fLoad);
+		DLL_API void GetCallbackTiming(TimingSnapshot* pSnapshot);
+		DLL_API void ResetCallbackTiming();
 		DLL_API int VUGetCurrentLevels();
+		DLL_API void SetEffectGraph(Graph* pGraph);
+		DLL_API void SetVolume(float fGain);
+		DLL_API float GetPeakLevel(int iChannel);
+		DLL_API void SetLatencyProfile(LatencyProfile profile);
+		DLL_API void SetLatency(unsigned long frames, double dSeconds);
+		DLL_API double GetStreamLatency(double* pInputLatency, unsigned long* pFrames);
 	private:
 		int  VUMeterForSample(int count, float *buffer);
 		void OutputThread(const char* lpName);
 		void FinishedCallbackMsg(void* userData);
 		void ReadChunks();
 		void VUMeterInit();
+		unsigned long ChooseFramesPerBuffer(double dSampleRate);
+		double ChooseSuggestedLatency(const PaDeviceInfo* pDevice, unsigned long frames, double dSampleRate, bool isInput);
 
 		int left_phase;
 		int right_phase;
 		int numDevices, defaultDisplayed;
 		const PaDeviceInfo *deviceInfo;
 		PaStreamParameters inputParameters, outputParameters;
+
+		LatencyProfile latencyProfile = LatencyProfile::LATENCY_SAFE;
+		unsigned long customFrames = 0;
+		double customLatency = 0.0;
+		unsigned long framesPerBuffer = 0;
+		double outputLatency = 0.0;
+		double inputLatency = 0.0;
+		bool isPaHeld = false;					// own Pa_Initialize(), cache rebuild can't terminate it
 	};
 	class Input
 	{
 	public:
+		DLL_API void InitDevices();
+		DLL_API void OnDevicesChanged();
 		DLL_API void GetListOfDevices();
 		DLL_API void ReadAudioFile(const char* lpFileName);
+		DLL_API void StartRecording(const char* lpPath, int iChannels, PaSampleFormat format);
+		DLL_API void StopRecording();
+		DLL_API void SetLatencyProfile(LatencyProfile profile);
 		FILE* oFile;
 
 	private:
+		Recorder* pRecorder = NULL;				// not NULL while PortAudio init is held
+		LatencyProfile latencyProfile = LatencyProfile::LATENCY_LOW;	// monitoring
 		int		numDevices, defaultDisplayed;
 		const	PaDeviceInfo *deviceInfo;
 		PaStreamParameters inputParameters, outputParameters;
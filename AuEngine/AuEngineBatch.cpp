@@ -0,0 +1,351 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineBatch.cpp:
+// batch export
+/////////////////////////////////
+
+/*******************************************
+* Batch export:
+* Workers take jobs by atomic index. Job
+* opens source first (it needs only
+* header), so we know channels and can
+* count memory of job: reader block,
+* render and convert blocks, writer ring,
+* writer staging chunk and buffers of
+* compiled effect chain. Worker waits
+* while this memory doesn't fit to budget.
+* One job which is bigger than budget can
+* run alone, so batch never hangs.
+*
+* Every job writes to "<target>.part" and
+* replaces target only when file is fully
+* written, like FileSystem::ExportFile().
+*******************************************/
+
+#include "AuEngineBatch.h"
+
+/*******************************************
+* AddJob():
+* Add document to batch (before Start())
+*******************************************/
+int AuEngine::BatchExporter::AddJob(const ExportJob& job)
+{
+	JobState* pState = new JobState;
+	pState->job = job;
+	jobs.push_back(pState);
+	return (int)jobs.size() - 1;
+}
+
+/*******************************************
+* Start():
+* Start workers, returns at once
+*******************************************/
+void AuEngine::BatchExporter::Start(int iWorkers, size_t szMemoryBudget)
+{
+	Wait();
+
+	if (iWorkers < 1) { iWorkers = 1; }
+	if (iWorkers > BATCH_MAX_WORKERS) { iWorkers = BATCH_MAX_WORKERS; }
+	if (iWorkers > (int)jobs.size()) { iWorkers = (int)jobs.size(); }
+
+	memoryBudget = szMemoryBudget;
+	memoryUsed = 0;
+	memoryPeak = 0;
+	nextJob = 0;
+	isCanceled = false;
+	jobsLeft = (int)jobs.size();
+
+	for (int i = 0; i < iWorkers; i++)
+	{
+		workers.push_back(std::thread(&BatchExporter::WorkerThread, this));
+	}
+}
+
+/*******************************************
+* Wait():
+* Wait for all jobs
+*******************************************/
+void AuEngine::BatchExporter::Wait()
+{
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		workers[i].join();
+	}
+	workers.clear();
+}
+
+/*******************************************
+* Cancel():
+* Stop jobs and remove not finished files
+*******************************************/
+void AuEngine::BatchExporter::Cancel()
+{
+	{
+		std::lock_guard<std::mutex> lock(memoryMutex);
+		isCanceled = true;
+	}
+	memoryCondition.notify_all();
+	Wait();
+}
+
+/*******************************************
+* Clear():
+* Remove all jobs
+*******************************************/
+void AuEngine::BatchExporter::Clear()
+{
+	Cancel();
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		delete jobs[i];
+	}
+	jobs.clear();
+	jobsLeft = 0;
+}
+
+/*******************************************
+* GetProgress():
+* Percent of job
+*******************************************/
+int AuEngine::BatchExporter::GetProgress(int iJob)
+{
+	if (iJob < 0 || iJob >= (int)jobs.size()) { return 0; }
+	return jobs[iJob]->percent.load(std::memory_order_relaxed);
+}
+
+/*******************************************
+* GetState():
+* State of job
+*******************************************/
+AuEngine::BatchState AuEngine::BatchExporter::GetState(int iJob)
+{
+	if (iJob < 0 || iJob >= (int)jobs.size()) { return BATCH_FAILED; }
+	return (BatchState)jobs[iJob]->state.load(std::memory_order_acquire);
+}
+
+/*******************************************
+* GetTotalProgress():
+* Percent of all batch
+*******************************************/
+int AuEngine::BatchExporter::GetTotalProgress()
+{
+	if (jobs.empty()) { return 100; }
+
+	int sum = 0;
+	for (size_t i = 0; i < jobs.size(); i++)
+	{
+		sum += jobs[i]->state != BATCH_QUEUED && jobs[i]->state != BATCH_RUNNING ? 100 : (int)jobs[i]->percent;
+	}
+	return sum / (int)jobs.size();
+}
+
+/*******************************************
+* GetJobMemory():
+* Bytes of job in flight
+*******************************************/
+size_t AuEngine::BatchExporter::GetJobMemory(int iChannels, size_t frameSize)
+{
+	size_t floatBlock = BATCH_BLOCK_FRAMES * iChannels * sizeof(float);
+	size_t readerBlock = BATCH_BLOCK_FRAMES * iChannels * sizeof(int32_t);	// raw data of TrackReader
+	return 2 * floatBlock + readerBlock + BATCH_BLOCK_FRAMES * frameSize + BATCH_RING_SIZE + WAV_WRITE_CHUNK;
+}
+
+/*******************************************
+* AcquireMemory():
+* Wait for free budget, false if canceled
+*******************************************/
+bool AuEngine::BatchExporter::AcquireMemory(size_t szBytes)
+{
+	std::unique_lock<std::mutex> lock(memoryMutex);
+	memoryCondition.wait(lock, [&]()
+	{
+		size_t used = memoryUsed.load(std::memory_order_relaxed);
+		return isCanceled || !used || used + szBytes <= memoryBudget;
+	});
+	if (isCanceled) { return false; }
+
+	size_t used = memoryUsed.load(std::memory_order_relaxed) + szBytes;
+	memoryUsed.store(used, std::memory_order_relaxed);
+	if (used > memoryPeak.load(std::memory_order_relaxed)) { memoryPeak.store(used, std::memory_order_relaxed); }
+	return true;
+}
+
+/*******************************************
+* ReleaseMemory():
+* Give memory back and wake workers
+*******************************************/
+void AuEngine::BatchExporter::ReleaseMemory(size_t szBytes)
+{
+	{
+		std::lock_guard<std::mutex> lock(memoryMutex);
+		memoryUsed.store(memoryUsed.load(std::memory_order_relaxed) - szBytes, std::memory_order_relaxed);
+	}
+	memoryCondition.notify_all();
+}
+
+/*******************************************
+* WorkerThread():
+* Take jobs while there are any
+*******************************************/
+void AuEngine::BatchExporter::WorkerThread()
+{
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+
+	int index = 0;
+	while ((index = nextJob.fetch_add(1)) < (int)jobs.size())
+	{
+		JobState& job = *jobs[index];
+		if (isCanceled)
+		{
+			job.state = BATCH_CANCELED;
+		}
+		else
+		{
+			RunJob(job);
+		}
+		jobsLeft.fetch_sub(1, std::memory_order_release);
+	}
+}
+
+/*******************************************
+* RunJob():
+* Render one document to file
+*******************************************/
+void AuEngine::BatchExporter::RunJob(JobState& job)
+{
+	TrackReader reader;
+	try
+	{
+		reader.Open(job.job.source.c_str());
+	}
+	catch (AuEngine::Exception&)
+	{
+		job.state = BATCH_FAILED;
+		return;
+	}
+
+	PaSampleFormat format = job.job.format ? job.job.format : reader.GetFormat();
+	int channels = reader.GetChannels();
+	size_t frameSize = channels * Pa_GetSampleSize(format);
+	size_t memory = GetJobMemory(channels, frameSize);
+	if (job.job.pChain) { memory += job.job.pChain->GetMemorySize(BATCH_BLOCK_FRAMES); }
+	if (!AcquireMemory(memory))
+	{
+		job.state = BATCH_CANCELED;
+		return;
+	}
+
+	job.state = BATCH_RUNNING;
+	std::string partPath = job.job.target + ".part";
+	float* pBlock = (float*)malloc(BATCH_BLOCK_FRAMES * channels * sizeof(float) * 2);
+	uint8_t* pConverted = (uint8_t*)malloc(BATCH_BLOCK_FRAMES * frameSize);
+	WavStreamWriter writer;
+	bool isOk = false;
+
+	try
+	{
+		if (!pBlock || !pConverted) { THROW_EXCEPTION(AuEngine::OpSet::MEMORY_ERROR); }
+		if (job.job.pChain) { job.job.pChain->Compile(reader.GetSampleRate(), BATCH_BLOCK_FRAMES, NULL); }
+
+		writer.Open(partPath.c_str(), channels, reader.GetSampleRate(), format, 0, BATCH_RING_SIZE);
+		Render(job, reader, writer, pBlock, pConverted, frameSize);
+		writer.Close();
+		isOk = !writer.IsFailed() && !isCanceled;
+	}
+	catch (AuEngine::Exception&)
+	{
+		writer.Close();
+	}
+
+	reader.Close();
+	free(pBlock);
+	free(pConverted);
+	ReleaseMemory(memory);
+
+	if (isOk && MoveFileExA(partPath.c_str(), job.job.target.c_str(), MOVEFILE_REPLACE_EXISTING))
+	{
+		job.percent = 100;
+		job.state = BATCH_DONE;
+		return;
+	}
+
+	DeleteFileA(partPath.c_str());
+	job.state = isCanceled ? BATCH_CANCELED : BATCH_FAILED;
+}
+
+/*******************************************
+* Render():
+* Play edit list through effect chain.
+* First frames of chain latency are
+* dropped and chain is flushed by silence
+* at the end, so target is aligned with
+* source and has the same length
+*******************************************/
+void AuEngine::BatchExporter::Render(JobState& job, TrackReader& reader, WavStreamWriter& writer,
+	float* pBlock, uint8_t* pConverted, size_t frameSize)
+{
+	int channels = reader.GetChannels();
+	float* pOutput = pBlock + BATCH_BLOCK_FRAMES * channels;
+	PaSampleFormat format = job.job.format ? job.job.format : reader.GetFormat();
+	size_t latency = job.job.pChain ? (size_t)job.job.pChain->GetLatency() : 0;
+	size_t skip = latency;
+
+	auto write = [&](size_t frames)
+	{
+		const float* pSrc = pBlock;
+		if (job.job.pChain)
+		{
+			job.job.pChain->Process(pBlock, pOutput, channels, (int)frames);
+			pSrc = pOutput;
+		}
+
+		size_t dropped = frames < skip ? frames : skip;
+		skip -= dropped;
+		if (frames == dropped) { return; }
+
+		ConvertFromFloat(pSrc + dropped * channels, pConverted, (frames - dropped) * channels, format);
+		writer.WriteBlocking(pConverted, (frames - dropped) * frameSize);
+	};
+
+	std::vector<EditRange> edits = job.job.edits;
+	if (edits.empty()) { edits.push_back({ 0, reader.GetFrames() }); }
+
+	unsigned long long total = 0;
+	for (size_t i = 0; i < edits.size(); i++)
+	{
+		total += edits[i].frames;
+	}
+
+	unsigned long long done = 0;
+	for (size_t i = 0; i < edits.size() && !isCanceled; i++)
+	{
+		reader.Seek(edits[i].start);
+		unsigned long long left = edits[i].frames;
+
+		while (left && !isCanceled)
+		{
+			size_t want = left < BATCH_BLOCK_FRAMES ? (size_t)left : BATCH_BLOCK_FRAMES;
+			size_t read = reader.Read(pBlock, want, channels);
+			if (!read) { break; }			// range is after end of file
+
+			write(read);
+
+			left -= read;
+			done += read;
+			if (total) { job.percent = (int)(done * 99 / total); }
+		}
+	}
+
+	// tail of chain, output is as long as input
+	size_t tail = latency;
+	while (tail && !isCanceled)
+	{
+		size_t frames = tail < BATCH_BLOCK_FRAMES ? tail : BATCH_BLOCK_FRAMES;
+		memset(pBlock, 0, frames * channels * sizeof(float));
+		write(frames);
+		tail -= frames;
+	}
+}
@@ -0,0 +1,119 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineBatch.h:
+// header for batch export
+/////////////////////////////////
+#pragma once
+#include "AuEngine.h"
+#include "AuEngineGraph.h"
+#include "AuEngineTrack.h"
+#include "AuEngineWav.h"
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define BATCH_MEMORY_BUDGET		(256 << 20)			// default limit for all jobs in flight
+#define BATCH_BLOCK_FRAMES		16384				// frames of one render block
+#define BATCH_RING_SIZE			(8 << 20)			// stream writer ring of one job
+#define BATCH_MAX_WORKERS		16
+
+/***********************************************
+* struct EditRange:
+* Part of source file. Edit list is
+* played part by part, empty list is
+* whole file
+***********************************
+* struct ExportJob:
+* One document: source, edit list,
+* effect chain (can be NULL, not owned,
+* must not be shared with other job)
+* and target file
+***********************************
+* class BatchExporter:
+* Renders jobs at worker pool. Every job
+* takes its memory from global budget
+* before it starts and gives it back at
+* the end. If budget is used, worker waits
+* (back-pressure), so memory is bounded
+* for any count of files. Inside job disk
+* is back-pressure too: WriteBlocking()
+* waits for stream writer
+***********************************************/
+namespace AuEngine
+{
+	enum BatchState
+	{
+		BATCH_QUEUED = 0,
+		BATCH_RUNNING,
+		BATCH_DONE,
+		BATCH_FAILED,
+		BATCH_CANCELED
+	};
+
+	struct EditRange
+	{
+		unsigned long long start;
+		unsigned long long frames;
+	};
+
+	struct ExportJob
+	{
+		std::string source;
+		std::string target;
+		PaSampleFormat format = 0;				// 0 - format of source
+		std::vector<EditRange> edits;
+		Graph* pChain = NULL;
+	};
+
+	class BatchExporter
+	{
+	public:
+		BatchExporter() {}
+		~BatchExporter() { Clear(); }
+		DLL_API int  AddJob(const ExportJob& job);
+		DLL_API void Start(int iWorkers, size_t szMemoryBudget = BATCH_MEMORY_BUDGET);
+		DLL_API void Wait();
+		DLL_API void Cancel();
+		DLL_API void Clear();
+		DLL_API int  GetProgress(int iJob);
+		DLL_API BatchState GetState(int iJob);
+		DLL_API int  GetTotalProgress();
+		int  GetJobsCount() const { return (int)jobs.size(); }
+		const char* GetJobName(int iJob) const { return jobs[iJob]->job.source.c_str(); }
+		bool IsDone() const { return jobsLeft.load(std::memory_order_acquire) <= 0; }
+		size_t GetMemoryUsed() const { return memoryUsed.load(std::memory_order_relaxed); }
+		size_t GetPeakMemory() const { return memoryPeak.load(std::memory_order_relaxed); }
+
+	private:
+		struct JobState
+		{
+			ExportJob job;
+			std::atomic<int> state{ BATCH_QUEUED };
+			std::atomic<int> percent{ 0 };
+		};
+
+		void WorkerThread();
+		void RunJob(JobState& job);
+		void Render(JobState& job, TrackReader& reader, WavStreamWriter& writer,
+			float* pBlock, uint8_t* pConverted, size_t frameSize);
+		size_t GetJobMemory(int iChannels, size_t frameSize);
+		bool AcquireMemory(size_t szBytes);
+		void ReleaseMemory(size_t szBytes);
+
+		std::vector<JobState*> jobs;
+		std::vector<std::thread> workers;
+		std::atomic<int> nextJob{ 0 };
+		std::atomic<int> jobsLeft{ 0 };
+		std::atomic<bool> isCanceled{ false };
+
+		std::mutex memoryMutex;					// workers only
+		std::condition_variable memoryCondition;
+		size_t memoryBudget = BATCH_MEMORY_BUDGET;
+		std::atomic<size_t> memoryUsed{ 0 };
+		std::atomic<size_t> memoryPeak{ 0 };
+	};
+};
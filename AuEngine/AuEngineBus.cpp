@@ -0,0 +1,460 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineBus.cpp:
+// shared memory audio bus
+/////////////////////////////////
+
+/*******************************************
+* Bus:
+* Mapping is header, then ring of every
+* channel. Write index is never wrapped
+* (64 bit) and sits at own cache line,
+* every subscriber slot too, so readers
+* don't fight with publisher or each
+* other.
+*
+* Publisher first sets 'writing' index
+* (end of block which is being written),
+* then writes audio, then write index
+* (release). Subscriber copies audio and
+* checks 'writing' after it (like
+* seqlock): if publisher went, or is
+* going, more than ring ahead of copied
+* part, it was overwritten and it's
+* overrun. Block longer than ring is
+* rejected.
+*
+* Wakeup: subscriber sets its waiting
+* flag, checks index again and sleeps on
+* its own auto-reset event. Publisher
+* checks flags after index and calls
+* SetEvent() only for sleeping ones, so
+* Write() has no system call while
+* subscribers poll or are busy. Events
+* are made by publisher at Create(), so
+* audio thread never opens anything.
+*
+* Slot of crashed subscriber is taken
+* back by next Open() when its process
+* is gone.
+*******************************************/
+
+#include "AuEngineBus.h"
+#include "AuEngineRing.h"
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+#define BUS_MAGIC				0x53554241		// "ABUS"
+
+namespace AuEngine
+{
+	struct BusSlot
+	{
+		alignas(RING_CACHE_LINE) std::atomic<unsigned int> processId;	// 0 - free
+		std::atomic<int> waiting;
+	};
+
+	struct BusHeader
+	{
+		unsigned int magic;
+		int channels;
+		int sampleRate;
+		unsigned int frames;
+		std::atomic<int> isPublished;
+		alignas(RING_CACHE_LINE) std::atomic<unsigned long long> write;
+		std::atomic<unsigned long long> writing;	// end of block which is being written
+		BusSlot slots[BUS_MAX_SUBSCRIBERS];
+		alignas(RING_CACHE_LINE) float data[1];	// channel, frames
+	};
+};
+
+/*******************************************
+* MakeName():
+* Name of mapping or event of bus
+*******************************************/
+static std::string MakeName(const char* lpName, int iSlot)
+{
+	char name[BUS_NAME_SIZE + 32] = {};
+	if (iSlot < 0) { sprintf_s(name, "Local\\AuBus_%s", lpName); }
+	else { sprintf_s(name, "Local\\AuBus_%s_%d", lpName, iSlot); }
+	return name;
+}
+
+/*******************************************
+* IsProcessAlive():
+* For slot of subscriber
+*******************************************/
+static bool IsProcessAlive(unsigned int processId)
+{
+	HANDLE hProcess = OpenProcess(SYNCHRONIZE, FALSE, processId);
+	if (!hProcess) { return false; }
+	bool isAlive = WaitForSingleObject(hProcess, 0) == WAIT_TIMEOUT;
+	CloseHandle(hProcess);
+	return isAlive;
+}
+
+/*******************************************
+* Create():
+* Make bus, name must be unique
+*******************************************/
+void AuEngine::BusPublisher::Create(const char* lpName, int iChannels, int iSampleRate, int iFrames)
+{
+	Destroy();
+	if (iChannels <= 0 || iChannels > BUS_MAX_CHANNELS || iFrames <= 0 || (iFrames & (iFrames - 1)) ||
+		strlen(lpName) >= BUS_NAME_SIZE)
+	{
+		THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR);
+	}
+
+	size_t size = offsetof(BusHeader, data) + (size_t)iChannels * iFrames * sizeof(float);
+	hMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, (DWORD)((unsigned long long)size >> 32), (DWORD)size,
+		MakeName(lpName, -1).c_str());
+	if (hMapping && GetLastError() == ERROR_ALREADY_EXISTS)
+	{
+		// other publisher has this name
+		CloseHandle(hMapping);
+		hMapping = NULL;
+		THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR);
+	}
+	if (hMapping) { pHeader = (BusHeader*)MapViewOfFile(hMapping, FILE_MAP_ALL_ACCESS, 0, 0, size); }
+	if (!pHeader)
+	{
+		Destroy();
+		THROW_EXCEPTION(AuEngine::OpSet::MEMORY_ERROR);
+	}
+
+	for (int i = 0; i < BUS_MAX_SUBSCRIBERS; i++)
+	{
+		hEvents[i] = CreateEventA(NULL, FALSE, FALSE, MakeName(lpName, i).c_str());
+		if (!hEvents[i])
+		{
+			Destroy();
+			THROW_EXCEPTION(AuEngine::OpSet::MEMORY_ERROR);
+		}
+	}
+
+	pHeader->channels = iChannels;
+	pHeader->sampleRate = iSampleRate;
+	pHeader->frames = iFrames;
+	pHeader->write = 0;
+	pHeader->writing = 0;
+	pHeader->isPublished = 1;
+	pHeader->magic = BUS_MAGIC;
+	pData = pHeader->data;
+	channels = iChannels;
+	frames = iFrames;
+	Msg("AuEngine: Bus created: " + std::string(lpName));
+}
+
+/*******************************************
+* Destroy():
+* Close bus, subscribers see it by
+* IsPublished() and are woken up
+*******************************************/
+void AuEngine::BusPublisher::Destroy()
+{
+	if (pHeader)
+	{
+		pHeader->isPublished = 0;
+		for (int i = 0; i < BUS_MAX_SUBSCRIBERS; i++)
+		{
+			if (hEvents[i]) { SetEvent(hEvents[i]); }
+		}
+		UnmapViewOfFile(pHeader);
+	}
+	for (int i = 0; i < BUS_MAX_SUBSCRIBERS; i++)
+	{
+		if (hEvents[i]) { CloseHandle(hEvents[i]); }
+		hEvents[i] = NULL;
+	}
+	if (hMapping) { CloseHandle(hMapping); }
+
+	hMapping = NULL;
+	pHeader = NULL;
+	pData = NULL;
+	channels = 0;
+	frames = 0;
+}
+
+/*******************************************
+* BeginWrite():
+* Mark frames up to end as being written,
+* before any of them is touched
+*******************************************/
+void AuEngine::BusPublisher::BeginWrite(unsigned long long end)
+{
+	pHeader->writing.store(end, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+}
+
+/*******************************************
+* Publish():
+* New write index and wakeup of sleeping
+* subscribers
+*******************************************/
+void AuEngine::BusPublisher::Publish(unsigned long long write)
+{
+	pHeader->write.store(write, std::memory_order_seq_cst);
+	for (int i = 0; i < BUS_MAX_SUBSCRIBERS; i++)
+	{
+		BusSlot& slot = pHeader->slots[i];
+		if (slot.waiting.load(std::memory_order_seq_cst) && slot.waiting.exchange(0)) { SetEvent(hEvents[i]); }
+	}
+}
+
+/*******************************************
+* Write():
+* Planar audio (audio thread)
+*******************************************/
+void AuEngine::BusPublisher::Write(const float* const* ppData, int iFrames)
+{
+	if (!pHeader || iFrames <= 0 || (unsigned int)iFrames > frames) { return; }
+
+	unsigned long long write = pHeader->write.load(std::memory_order_relaxed);
+	BeginWrite(write + iFrames);
+	size_t offset = (size_t)(write & (frames - 1));
+	size_t first = std::min((size_t)iFrames, frames - offset);
+	for (int c = 0; c < channels; c++)
+	{
+		float* pChannel = pData + (size_t)c * frames;
+		memcpy(pChannel + offset, ppData[c], first * sizeof(float));
+		memcpy(pChannel, ppData[c] + first, (iFrames - first) * sizeof(float));
+	}
+	Publish(write + iFrames);
+}
+
+/*******************************************
+* Write():
+* Interleaved audio (audio thread)
+*******************************************/
+void AuEngine::BusPublisher::Write(const float* pInput, int iFrames, int iChannels)
+{
+	if (!pHeader || iFrames <= 0 || (unsigned int)iFrames > frames) { return; }
+
+	unsigned long long write = pHeader->write.load(std::memory_order_relaxed);
+	BeginWrite(write + iFrames);
+	for (int c = 0; c < channels; c++)
+	{
+		float* pChannel = pData + (size_t)c * frames;
+		for (int f = 0; f < iFrames; f++)
+		{
+			pChannel[(write + f) & (frames - 1)] = c < iChannels ? pInput[f * iChannels + c] : 0.0f;
+		}
+	}
+	Publish(write + iFrames);
+}
+
+/*******************************************
+* GetSubscribersCount():
+* Slots in use
+*******************************************/
+int AuEngine::BusPublisher::GetSubscribersCount() const
+{
+	if (!pHeader) { return 0; }
+
+	int count = 0;
+	for (int i = 0; i < BUS_MAX_SUBSCRIBERS; i++)
+	{
+		if (pHeader->slots[i].processId.load()) { count++; }
+	}
+	return count;
+}
+
+/*******************************************
+* Open():
+* Take free slot of bus, reading starts
+* from current position of publisher
+*******************************************/
+void AuEngine::BusSubscriber::Open(const char* lpName)
+{
+	Close();
+	if (strlen(lpName) >= BUS_NAME_SIZE) { THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR); }
+
+	hMapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, MakeName(lpName, -1).c_str());
+	if (hMapping) { pHeader = (BusHeader*)MapViewOfFile(hMapping, FILE_MAP_ALL_ACCESS, 0, 0, 0); }
+	if (!pHeader || pHeader->magic != BUS_MAGIC)
+	{
+		Close();
+		THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR);
+	}
+
+	unsigned int processId = GetCurrentProcessId();
+	for (int i = 0; i < BUS_MAX_SUBSCRIBERS && slot < 0; i++)
+	{
+		unsigned int owner = 0;
+		std::atomic<unsigned int>& slotOwner = pHeader->slots[i].processId;
+		if (slotOwner.compare_exchange_strong(owner, processId)) { slot = i; }
+		else if (owner != processId && !IsProcessAlive(owner) && slotOwner.compare_exchange_strong(owner, processId)) { slot = i; }
+	}
+	if (slot >= 0) { hEvent = OpenEventA(SYNCHRONIZE | EVENT_MODIFY_STATE, FALSE, MakeName(lpName, slot).c_str()); }
+	if (!hEvent)
+	{
+		Close();
+		THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR);
+	}
+
+	pHeader->slots[slot].waiting = 0;
+	pData = pHeader->data;
+	channels = pHeader->channels;
+	sampleRate = pHeader->sampleRate;
+	frames = pHeader->frames;
+	position = pHeader->write.load(std::memory_order_acquire);
+	overruns = 0;
+}
+
+/*******************************************
+* Close():
+* Give slot back
+*******************************************/
+void AuEngine::BusSubscriber::Close()
+{
+	if (pHeader && slot >= 0) { pHeader->slots[slot].processId = 0; }
+	if (hEvent) { CloseHandle(hEvent); }
+	if (pHeader) { UnmapViewOfFile(pHeader); }
+	if (hMapping) { CloseHandle(hMapping); }
+
+	hEvent = NULL;
+	hMapping = NULL;
+	pHeader = NULL;
+	pData = NULL;
+	slot = -1;
+	channels = 0;
+	frames = 0;
+}
+
+/*******************************************
+* IsOverwritten():
+* Audio from frame is overwritten or is
+* being overwritten. Call it after audio
+* is read
+*******************************************/
+bool AuEngine::BusSubscriber::IsOverwritten(unsigned long long from) const
+{
+	std::atomic_thread_fence(std::memory_order_acquire);
+	return pHeader->writing.load(std::memory_order_relaxed) - from > frames;
+}
+
+/*******************************************
+* GetAvailable():
+* Frames to read. Subscriber that is more
+* than ring behind jumps to half of ring
+* before publisher
+*******************************************/
+size_t AuEngine::BusSubscriber::GetAvailable()
+{
+	if (!pHeader) { return 0; }
+
+	unsigned long long write = pHeader->write.load(std::memory_order_acquire);
+	if (write - position > frames)
+	{
+		unsigned long long next = write - frames / 2;
+		overruns += next - position;
+		position = next;
+	}
+	return (size_t)(write - position);
+}
+
+/*******************************************
+* Read():
+* Copy to planar buffers, returns frames
+*******************************************/
+size_t AuEngine::BusSubscriber::Read(float* const* ppData, size_t szFrames)
+{
+	size_t count = std::min(GetAvailable(), szFrames);
+	if (!count) { return 0; }
+
+	size_t offset = (size_t)(position & (frames - 1));
+	size_t first = std::min(count, frames - offset);
+	for (int c = 0; c < channels; c++)
+	{
+		const float* pChannel = pData + (size_t)c * frames;
+		memcpy(ppData[c], pChannel + offset, first * sizeof(float));
+		memcpy(ppData[c] + first, pChannel, (count - first) * sizeof(float));
+	}
+
+	return Release(count) ? count : 0;
+}
+
+/*******************************************
+* Read():
+* Copy to interleaved buffer
+*******************************************/
+size_t AuEngine::BusSubscriber::Read(float* pOutput, size_t szFrames, int iChannels)
+{
+	size_t count = std::min(GetAvailable(), szFrames);
+	if (!count) { return 0; }
+
+	for (int c = 0; c < iChannels; c++)
+	{
+		const float* pChannel = c < channels ? pData + (size_t)c * frames : NULL;
+		for (size_t f = 0; f < count; f++)
+		{
+			pOutput[f * iChannels + c] = pChannel ? pChannel[(position + f) & (frames - 1)] : 0.0f;
+		}
+	}
+
+	return Release(count) ? count : 0;
+}
+
+/*******************************************
+* Peek():
+* Pointers to ring at position (one for
+* every channel), returns contiguous
+* frames. Call Release() after use
+*******************************************/
+size_t AuEngine::BusSubscriber::Peek(const float** ppData, size_t szFrames)
+{
+	size_t count = std::min(GetAvailable(), szFrames);
+	size_t offset = (size_t)(position & (frames - 1));
+	count = std::min(count, frames - offset);
+	for (int c = 0; c < channels; c++) { ppData[c] = pData + (size_t)c * frames + offset; }
+	return count;
+}
+
+/*******************************************
+* Release():
+* Move position, false if audio was
+* overwritten while it was read
+*******************************************/
+bool AuEngine::BusSubscriber::Release(size_t szFrames)
+{
+	if (!pHeader) { return false; }
+
+	if (IsOverwritten(position))
+	{
+		GetAvailable();
+		return false;
+	}
+	position += szFrames;
+	return true;
+}
+
+/*******************************************
+* Wait():
+* Sleep until publisher writes or bus is
+* closed, true if there is audio
+*******************************************/
+bool AuEngine::BusSubscriber::Wait(DWORD dwTimeout)
+{
+	if (!pHeader) { return false; }
+	if (GetAvailable()) { return true; }
+
+	BusSlot& busSlot = pHeader->slots[slot];
+	busSlot.waiting.store(1, std::memory_order_seq_cst);
+	if (!GetAvailable() && IsPublished()) { WaitForSingleObject(hEvent, dwTimeout); }
+	busSlot.waiting.store(0, std::memory_order_relaxed);
+	return GetAvailable() > 0;
+}
+
+/*******************************************
+* IsPublished():
+* Publisher is still there
+*******************************************/
+bool AuEngine::BusSubscriber::IsPublished() const
+{
+	return pHeader && pHeader->isPublished.load();
+}
@@ -0,0 +1,144 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineBus.h:
+// header for shared memory audio bus
+/////////////////////////////////
+#pragma once
+#include "AuEngine.h"
+#include "AuEngineGraph.h"
+#include <atomic>
+#include <string.h>
+
+#define BUS_MAX_CHANNELS		8
+#define BUS_MAX_SUBSCRIBERS		16
+#define BUS_DEFAULT_FRAMES		65536			// ring of bus, power of two
+#define BUS_NAME_SIZE			64
+
+/***********************************************
+* class BusPublisher:
+* Makes named bus (file mapping "Local\
+* AuBus_<name>") and writes audio to it.
+* Ring is planar, publisher never waits
+* for subscribers: slow subscriber loses
+* old audio (overrun), not the publisher.
+* Write() is lock-free, system call is
+* made only for subscriber which sleeps
+* at Wait() (like futex wake). Block
+* longer than ring is not written
+***********************************
+* class BusSubscriber:
+* Reader of bus at any process, up to
+* BUS_MAX_SUBSCRIBERS at one time, every
+* one has own position. Read() copies,
+* Peek() gives pointers to ring itself
+* (zero-copy), Release() moves position
+* after it and returns false if that
+* audio was overwritten while it was
+* used. Wait() sleeps until new audio or
+* timeout
+***********************************
+* class BusSendNode:
+* Publishes its input and passes it on
+* (or ANALYSER_NODE at end of branch)
+***********************************
+* class BusReceiveNode:
+* Audio of bus as input of graph, gaps
+* are silence
+***********************************************/
+namespace AuEngine
+{
+	struct BusHeader;
+
+	class BusPublisher
+	{
+	public:
+		BusPublisher() {}
+		~BusPublisher() { Destroy(); }
+		DLL_API void Create(const char* lpName, int iChannels, int iSampleRate, int iFrames = BUS_DEFAULT_FRAMES);
+		DLL_API void Destroy();
+		DLL_API void Write(const float* const* ppData, int iFrames);
+		DLL_API void Write(const float* pData, int iFrames, int iChannels);
+		DLL_API int  GetSubscribersCount() const;
+
+		bool IsCreated() const { return pHeader != NULL; }
+		int  GetChannels() const { return channels; }
+
+	private:
+		void BeginWrite(unsigned long long end);
+		void Publish(unsigned long long write);
+
+		BusHeader* pHeader = NULL;
+		float* pData = NULL;
+		HANDLE hMapping = NULL;
+		HANDLE hEvents[BUS_MAX_SUBSCRIBERS] = {};
+		int channels = 0;
+		unsigned int frames = 0;
+	};
+
+	class BusSubscriber
+	{
+	public:
+		BusSubscriber() {}
+		~BusSubscriber() { Close(); }
+		DLL_API void Open(const char* lpName);
+		DLL_API void Close();
+
+		DLL_API size_t GetAvailable();
+		DLL_API size_t Read(float* const* ppData, size_t frames);
+		DLL_API size_t Read(float* pData, size_t frames, int iChannels);
+		DLL_API size_t Peek(const float** ppData, size_t frames);
+		DLL_API bool Release(size_t frames);
+		DLL_API bool Wait(DWORD dwTimeout);
+		DLL_API bool IsPublished() const;
+
+		bool IsOpen() const { return pHeader != NULL; }
+		int  GetChannels() const { return channels; }
+		int  GetSampleRate() const { return sampleRate; }
+		unsigned long long GetOverruns() const { return overruns; }
+
+	private:
+		bool IsOverwritten(unsigned long long from) const;
+
+		BusHeader* pHeader = NULL;
+		const float* pData = NULL;
+		HANDLE hMapping = NULL;
+		HANDLE hEvent = NULL;
+		int slot = -1;
+		int channels = 0;
+		int sampleRate = 0;
+		unsigned int frames = 0;
+		unsigned long long position = 0;
+		unsigned long long overruns = 0;			// frames lost
+	};
+
+	class BusSendNode : public Node
+	{
+	public:
+		BusSendNode(BusPublisher* pPublisher, NodeType nodeType = EFFECT_NODE) : Node(nodeType, pPublisher->GetChannels()), publisher(pPublisher) {}
+		void Process(float** ppIn, float** ppOut, int iFrames) override
+		{
+			publisher->Write(ppIn, iFrames);
+			for (int c = 0; c < channels; c++) { memcpy(ppOut[c], ppIn[c], iFrames * sizeof(float)); }
+		}
+
+	private:
+		BusPublisher* publisher;
+	};
+
+	class BusReceiveNode : public Node
+	{
+	public:
+		BusReceiveNode(BusSubscriber* pSubscriber, NodeType nodeType = EFFECT_NODE) : Node(nodeType, pSubscriber->GetChannels()), subscriber(pSubscriber) {}
+		void Process(float** ppIn, float** ppOut, int iFrames) override
+		{
+			size_t got = subscriber->Read(ppOut, iFrames);
+			for (int c = 0; c < channels; c++) { memset(ppOut[c] + got, 0, (iFrames - got) * sizeof(float)); }
+		}
+
+	private:
+		BusSubscriber* subscriber;
+	};
+};
@@ -0,0 +1,179 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineClap.h:
+// CLAP plugin ABI (host subset)
+/////////////////////////////////
+#pragma once
+#include <stdint.h>
+
+#ifdef _WIN32
+#define CLAP_ABI				__cdecl
+#else
+#define CLAP_ABI
+#endif
+
+#define CLAP_VERSION_MAJOR		1
+#define CLAP_NAME_SIZE			256
+#define CLAP_PLUGIN_FACTORY_ID	"clap.plugin-factory"
+#define CLAP_EXT_LATENCY		"clap.latency"
+#define CLAP_EXT_AUDIO_PORTS	"clap.audio-ports"
+#define CLAP_ENTRY_NAME			"clap_entry"
+
+/***********************************************
+* Declarations of CLAP 1.x (MIT) which
+* host needs: entry, factory, plugin,
+* process and latency / audio-ports
+* extensions. Layout is the same as at
+* clap/clap.h, only used parts are here,
+* so no SDK is needed to build engine.
+* Events are not used (no parameters,
+* no notes), lists are always empty
+***********************************************/
+extern "C"
+{
+	typedef uint32_t clap_id;
+
+	enum
+	{
+		CLAP_PROCESS_ERROR = 0,
+		CLAP_PROCESS_CONTINUE = 1,
+		CLAP_PROCESS_CONTINUE_IF_NOT_QUIET = 2,
+		CLAP_PROCESS_TAIL = 3,
+		CLAP_PROCESS_SLEEP = 4
+	};
+	typedef int32_t clap_process_status;
+
+	typedef struct clap_version
+	{
+		uint32_t major;
+		uint32_t minor;
+		uint32_t revision;
+	} clap_version_t;
+
+	typedef struct clap_plugin_descriptor
+	{
+		clap_version_t clap_version;
+		const char* id;
+		const char* name;
+		const char* vendor;
+		const char* url;
+		const char* manual_url;
+		const char* support_url;
+		const char* version;
+		const char* description;
+		const char* const* features;
+	} clap_plugin_descriptor_t;
+
+	typedef struct clap_host
+	{
+		clap_version_t clap_version;
+		void* host_data;
+		const char* name;
+		const char* vendor;
+		const char* url;
+		const char* version;
+		const void* (CLAP_ABI* get_extension)(const struct clap_host* host, const char* extension_id);
+		void (CLAP_ABI* request_restart)(const struct clap_host* host);
+		void (CLAP_ABI* request_process)(const struct clap_host* host);
+		void (CLAP_ABI* request_callback)(const struct clap_host* host);
+	} clap_host_t;
+
+	typedef struct clap_event_header
+	{
+		uint32_t size;
+		uint32_t time;
+		uint16_t space_id;
+		uint16_t type;
+		uint32_t flags;
+	} clap_event_header_t;
+
+	typedef struct clap_input_events
+	{
+		void* ctx;
+		uint32_t (CLAP_ABI* size)(const struct clap_input_events* list);
+		const clap_event_header_t* (CLAP_ABI* get)(const struct clap_input_events* list, uint32_t index);
+	} clap_input_events_t;
+
+	typedef struct clap_output_events
+	{
+		void* ctx;
+		bool (CLAP_ABI* try_push)(const struct clap_output_events* list, const clap_event_header_t* event);
+	} clap_output_events_t;
+
+	typedef struct clap_audio_buffer
+	{
+		float** data32;
+		double** data64;
+		uint32_t channel_count;
+		uint32_t latency;
+		uint64_t constant_mask;
+	} clap_audio_buffer_t;
+
+	typedef struct clap_process
+	{
+		int64_t steady_time;
+		uint32_t frames_count;
+		const void* transport;					// clap_event_transport_t, not used
+		const clap_audio_buffer_t* audio_inputs;
+		clap_audio_buffer_t* audio_outputs;
+		uint32_t audio_inputs_count;
+		uint32_t audio_outputs_count;
+		const clap_input_events_t* in_events;
+		const clap_output_events_t* out_events;
+	} clap_process_t;
+
+	typedef struct clap_plugin
+	{
+		const clap_plugin_descriptor_t* desc;
+		void* plugin_data;
+		bool (CLAP_ABI* init)(const struct clap_plugin* plugin);
+		void (CLAP_ABI* destroy)(const struct clap_plugin* plugin);
+		bool (CLAP_ABI* activate)(const struct clap_plugin* plugin, double sample_rate, uint32_t min_frames_count, uint32_t max_frames_count);
+		void (CLAP_ABI* deactivate)(const struct clap_plugin* plugin);
+		bool (CLAP_ABI* start_processing)(const struct clap_plugin* plugin);
+		void (CLAP_ABI* stop_processing)(const struct clap_plugin* plugin);
+		void (CLAP_ABI* reset)(const struct clap_plugin* plugin);
+		clap_process_status (CLAP_ABI* process)(const struct clap_plugin* plugin, const clap_process_t* process);
+		const void* (CLAP_ABI* get_extension)(const struct clap_plugin* plugin, const char* id);
+		void (CLAP_ABI* on_main_thread)(const struct clap_plugin* plugin);
+	} clap_plugin_t;
+
+	typedef struct clap_plugin_factory
+	{
+		uint32_t (CLAP_ABI* get_plugin_count)(const struct clap_plugin_factory* factory);
+		const clap_plugin_descriptor_t* (CLAP_ABI* get_plugin_descriptor)(const struct clap_plugin_factory* factory, uint32_t index);
+		const clap_plugin_t* (CLAP_ABI* create_plugin)(const struct clap_plugin_factory* factory, const clap_host_t* host, const char* plugin_id);
+	} clap_plugin_factory_t;
+
+	typedef struct clap_plugin_entry
+	{
+		clap_version_t clap_version;
+		bool (CLAP_ABI* init)(const char* plugin_path);
+		void (CLAP_ABI* deinit)(void);
+		const void* (CLAP_ABI* get_factory)(const char* factory_id);
+	} clap_plugin_entry_t;
+
+	typedef struct clap_plugin_latency
+	{
+		uint32_t (CLAP_ABI* get)(const clap_plugin_t* plugin);
+	} clap_plugin_latency_t;
+
+	typedef struct clap_audio_port_info
+	{
+		clap_id id;
+		char name[CLAP_NAME_SIZE];
+		uint32_t flags;
+		uint32_t channel_count;
+		const char* port_type;
+		clap_id in_place_pair;
+	} clap_audio_port_info_t;
+
+	typedef struct clap_plugin_audio_ports
+	{
+		uint32_t (CLAP_ABI* count)(const clap_plugin_t* plugin, bool is_input);
+		bool (CLAP_ABI* get)(const clap_plugin_t* plugin, uint32_t index, bool is_input, clap_audio_port_info_t* info);
+	} clap_plugin_audio_ports_t;
+}
@@ -0,0 +1,404 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineConstantQ.cpp:
+// constant-Q analyser
+/////////////////////////////////
+
+/*******************************************
+* Constant-Q transform:
+* Bin k has frequency minFreq * 2^(k / B)
+* and length Q * rate / f, where
+* Q = 1 / (2^(1 / B) - 1), so every bin
+* has the same number of periods.
+*
+* Direct transform is too slow, so we use
+* spectral kernels: correlation of signal
+* with temporal kernel is the same as sum
+* of X[j] * conj(K[j]) / N. Spectra of
+* kernels have energy near f only, so we
+* keep few values and one FFT of frame
+* gives all bins.
+*
+* Temporal kernel is window * 2 / sum(w),
+* so magnitude of bin is amplitude of sine.
+*
+* Kernels of low notes are very long, so
+* we don't make big FFT for them: every
+* octave down signal is filtered and
+* decimated by 2, and kernels of top
+* octave are used again (bins have the
+* same place relative to sample rate).
+* One hop costs one small FFT for every
+* octave.
+*******************************************/
+
+#include "AuEngineConstantQ.h"
+#include "AuEngineMath.h"
+#include <mutex>
+
+static const char* noteNameTable[12] = { "C", "C#", "D", "D#", "E", "F", "F#", "G", "G#", "A", "A#", "B" };
+
+/*******************************************
+* BuildKernel():
+* Build sparse kernels of top octave and
+* decimation filter for config
+*******************************************/
+static std::shared_ptr<const AuEngine::ConstantQKernel> BuildKernel(const AuEngine::ConstantQConfig& config)
+{
+	std::shared_ptr<AuEngine::ConstantQKernel> pKernel = std::make_shared<AuEngine::ConstantQKernel>();
+	pKernel->config = config;
+	int perOctave = config.binsPerOctave;
+
+	// top bin must be far from Nyquist, decimators need space for transition band
+	int bins = 0;
+	while (bins < config.bins && config.minFreq * pow(2.0, (double)bins / perOctave) < config.sampleRate * CQ_TOP_LIMIT)
+	{
+		pKernel->frequency.push_back(config.minFreq * pow(2.0, (double)bins / perOctave));
+		bins++;
+	}
+	int octaves = (bins + perOctave - 1) / perOctave;
+	if (!bins || octaves > CQ_MAX_OCTAVES)
+	{
+		Msg("AuEngine: Bad constant-Q config, octaves: ", octaves);
+		THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR);
+	}
+	pKernel->bins = bins;
+	pKernel->octaves = octaves;
+
+	double q = 1.0 / (pow(2.0, 1.0 / perOctave) - 1.0);
+	double topMin = config.minFreq * pow(2.0, octaves - 1);
+	int longest = (int)ceil(q * config.sampleRate / topMin);
+	int fftSize = 4;
+	while (fftSize < longest) { fftSize <<= 1; }
+	pKernel->plan.Create(fftSize);
+	pKernel->fftSize = fftSize;
+
+	AuMath math;
+	std::vector<float> window(longest);
+	std::vector<float> kr(fftSize), ki(fftSize);
+
+	for (int k = 0; k < perOctave; k++)
+	{
+		// lower octaves need all kernels, even if top octave isn't full
+		double freq = topMin * pow(2.0, (double)k / perOctave);
+		pKernel->binStart.push_back((int)pKernel->index.size());
+		if (freq >= config.sampleRate * 0.5) { continue; }
+
+		int length = (int)ceil(q * config.sampleRate / freq);
+		if (length > fftSize) { length = fftSize; }
+
+		switch (config.window)
+		{
+		case 2:		math.BuildHammingWindow(window.data(), length); break;
+		case 3:		math.BuildBlackmanWindow(window.data(), length); break;
+		case 4:		math.BuildBlackmanHarrisWindow(window.data(), length); break;
+		default:	math.BuildHannWindow(window.data(), length); break;
+		}
+
+		double windowSum = 0.0;
+		for (int n = 0; n < length; n++) { windowSum += window[n]; }
+
+		// kernel ends at last sample of frame
+		std::fill(kr.begin(), kr.end(), 0.0f);
+		std::fill(ki.begin(), ki.end(), 0.0f);
+		int start = fftSize - length;
+		for (int n = 0; n < length; n++)
+		{
+			double ang = 2.0 * M_PI * freq * n / config.sampleRate;
+			double value = 2.0 * window[n] / windowSum;
+			kr[start + n] = (float)(value * cos(ang));
+			ki[start + n] = (float)(value * sin(ang));
+		}
+		pKernel->plan.Forward(kr.data(), ki.data());
+
+		// signal is real, so only positive half of spectrum is used
+		float peak = 0.0f;
+		for (int j = 0; j <= fftSize / 2; j++)
+		{
+			float magnitude = sqrtf(kr[j] * kr[j] + ki[j] * ki[j]);
+			if (magnitude > peak) { peak = magnitude; }
+		}
+
+		for (int j = 0; j <= fftSize / 2; j++)
+		{
+			if (sqrtf(kr[j] * kr[j] + ki[j] * ki[j]) < peak * CQ_SPARSE_THRESHOLD) { continue; }
+			pKernel->index.push_back(j);
+			pKernel->re.push_back(kr[j] / fftSize);
+			pKernel->im.push_back(ki[j] / fftSize);
+		}
+	}
+	pKernel->binStart.push_back((int)pKernel->index.size());
+
+	// windowed sinc, cutoff below half of new Nyquist
+	pKernel->decimator.resize(CQ_DECIM_TAPS);
+	std::vector<float> decimWindow(CQ_DECIM_TAPS);
+	math.BuildBlackmanWindow(decimWindow.data(), CQ_DECIM_TAPS);
+	double decimSum = 0.0;
+	for (int i = 0; i < CQ_DECIM_TAPS; i++)
+	{
+		double x = i - (CQ_DECIM_TAPS - 1) / 2.0;
+		double sinc = x == 0.0 ? 2.0 * CQ_DECIM_CUTOFF : sin(2.0 * M_PI * CQ_DECIM_CUTOFF * x) / (M_PI * x);
+		pKernel->decimator[i] = (float)(sinc * decimWindow[i]);
+		decimSum += pKernel->decimator[i];
+	}
+	for (int i = 0; i < CQ_DECIM_TAPS; i++)
+	{
+		pKernel->decimator[i] = (float)(pKernel->decimator[i] / decimSum);
+	}
+
+	Msg("AuEngine: Constant-Q kernel, sparse values: ", (int)pKernel->index.size());
+	return pKernel;
+}
+
+/*******************************************
+* GetConstantQKernel():
+* Kernel from cache or new one
+*******************************************/
+std::shared_ptr<const AuEngine::ConstantQKernel> AuEngine::GetConstantQKernel(const ConstantQConfig& config)
+{
+	static std::mutex cacheMutex;
+	static std::vector<std::weak_ptr<const ConstantQKernel>> cache;
+
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	for (size_t i = 0; i < cache.size(); i++)
+	{
+		std::shared_ptr<const ConstantQKernel> pKernel = cache[i].lock();
+		if (!pKernel)
+		{
+			// nobody uses it, free slot
+			cache.erase(cache.begin() + i);
+			i--;
+			continue;
+		}
+		if (pKernel->config == config) { return pKernel; }
+	}
+
+	std::shared_ptr<const ConstantQKernel> pKernel = BuildKernel(config);
+	cache.push_back(pKernel);
+	return pKernel;
+}
+
+/*******************************************
+* Create():
+* Take kernel and allocate channel buffers
+*******************************************/
+void AuEngine::ConstantQ::Create(const ConstantQConfig& config, int iChannels, int iHop)
+{
+	if (config.binsPerOctave < 12 || config.binsPerOctave % 12 || config.minFreq <= 0.0 ||
+		iChannels < 1 || iChannels > CQ_MAX_CHANNELS || iHop < 1)
+	{
+		THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR);
+	}
+
+	kernel = GetConstantQKernel(config);
+	channels = iChannels;
+	bins = kernel->bins;
+	octaves = kernel->octaves;
+	fftSize = kernel->fftSize;
+
+	// all octaves are analysed at the same input frame
+	int step = 1 << (octaves - 1);
+	hop = (iHop + step - 1) / step * step;
+	inputFrames = 0;
+	for (int d = 0; d < CQ_MAX_OCTAVES; d++)
+	{
+		writePos[d] = 0;
+		delayPos[d] = 0;
+	}
+
+	history.assign((size_t)fftSize * octaves * channels, 0.0f);
+	delay.assign((size_t)2 * CQ_DECIM_TAPS * octaves * channels, 0.0f);
+	frame.assign(fftSize, 0.0f);
+	re.assign(fftSize / 2 + 1, 0.0f);
+	im.assign(fftSize / 2 + 1, 0.0f);
+	magnitudes.assign((size_t)bins * channels, 0.0f);
+
+	// name of nearest semitone for every bin
+	noteNames.clear();
+	for (int k = 0; k < bins; k++)
+	{
+		int midi = (int)floor(69.0 + 12.0 * log2(kernel->frequency[k] / CQ_REFERENCE_PITCH) + 0.5);
+		noteNames.push_back(std::string(noteNameTable[((midi % 12) + 12) % 12]) + std::to_string(midi / 12 - 1));
+	}
+}
+
+/*******************************************
+* Destroy():
+* Free buffers (kernel stays in cache
+* while other analysers use it)
+*******************************************/
+void AuEngine::ConstantQ::Destroy()
+{
+	kernel.reset();
+	history.clear();
+	delay.clear();
+	frame.clear();
+	re.clear();
+	im.clear();
+	magnitudes.clear();
+	noteNames.clear();
+	channels = bins = octaves = fftSize = 0;
+}
+
+/*******************************************
+* Process():
+* Push interleaved frames, returns count
+* of new spectra
+*******************************************/
+int AuEngine::ConstantQ::Process(const float* pInput, size_t frames)
+{
+	int spectra = 0;
+	for (size_t f = 0; f < frames; f++)
+	{
+		for (int c = 0; c < channels; c++)
+		{
+			Push(c, pInput[f * channels + c]);
+		}
+
+		// octave d gets sample every 2^d frames
+		inputFrames++;
+		for (int d = 0; d < octaves && !(inputFrames & ((1ULL << d) - 1)); d++)
+		{
+			writePos[d] = (writePos[d] + 1) & (fftSize - 1);
+			if (d + 1 < octaves) { delayPos[d + 1] = delayPos[d + 1] ? delayPos[d + 1] - 1 : CQ_DECIM_TAPS - 1; }
+		}
+
+		if (inputFrames % hop == 0)
+		{
+			for (int c = 0; c < channels; c++)
+			{
+				for (int d = 0; d < octaves; d++)
+				{
+					Analyse(c, d);
+				}
+			}
+			spectra++;
+		}
+	}
+	return spectra;
+}
+
+/*******************************************
+* Push():
+* Put sample to top octave and through
+* decimators to lower octaves
+*******************************************/
+void AuEngine::ConstantQ::Push(int iChannel, float fSample)
+{
+	unsigned long long frameIndex = inputFrames + 1;
+	const float* pTaps = kernel->decimator.data();
+	float x = fSample;
+
+	for (int d = 0; d < octaves; d++)
+	{
+		history[((size_t)iChannel * octaves + d) * fftSize + writePos[d]] = x;
+		if (d == octaves - 1) { break; }
+
+		// decimator of octave d + 1 takes every sample of octave d
+		float* pDelay = &delay[((size_t)iChannel * octaves + d + 1) * 2 * CQ_DECIM_TAPS];
+		int pos = delayPos[d + 1];
+		pDelay[pos] = x;
+		pDelay[pos + CQ_DECIM_TAPS] = x;
+
+		// and gives every second one
+		if (frameIndex & ((2ULL << d) - 1)) { break; }
+		float sum = 0.0f;
+		for (int i = 0; i < CQ_DECIM_TAPS; i++)
+		{
+			sum += pTaps[i] * pDelay[pos + i];
+		}
+		x = sum;
+	}
+}
+
+/*******************************************
+* Analyse():
+* FFT of octave frame and sparse kernels
+*******************************************/
+void AuEngine::ConstantQ::Analyse(int iChannel, int iOctave)
+{
+	// oldest sample first
+	const float* pRing = &history[((size_t)iChannel * octaves + iOctave) * fftSize];
+	int pos = writePos[iOctave];
+	int tail = fftSize - pos;
+	memcpy(frame.data(), pRing + pos, tail * sizeof(float));
+	memcpy(frame.data() + tail, pRing, pos * sizeof(float));
+
+	kernel->plan.ForwardReal(frame.data(), re.data(), im.data());
+
+	const int* pIndex = kernel->index.data();
+	const float* pKernelRe = kernel->re.data();
+	const float* pKernelIm = kernel->im.data();
+	int perOctave = kernel->config.binsPerOctave;
+	int firstBin = (octaves - 1 - iOctave) * perOctave;
+	float* pOut = &magnitudes[(size_t)iChannel * bins];
+
+	for (int k = 0; k < perOctave && firstBin + k < bins; k++)
+	{
+		// X * conj(K)
+		float sumRe = 0.0f;
+		float sumIm = 0.0f;
+		for (int i = kernel->binStart[k]; i < kernel->binStart[k + 1]; i++)
+		{
+			int j = pIndex[i];
+			sumRe += re[j] * pKernelRe[i] + im[j] * pKernelIm[i];
+			sumIm += im[j] * pKernelRe[i] - re[j] * pKernelIm[i];
+		}
+		pOut[firstBin + k] = sqrtf(sumRe * sumRe + sumIm * sumIm);
+	}
+}
+
+/*******************************************
+* GetPeakBin():
+* Loudest bin and distance from nearest
+* note in cents (for tuner)
+*******************************************/
+int AuEngine::ConstantQ::GetPeakBin(int iChannel, float* pCents) const
+{
+	const float* pMagnitudes = GetMagnitudes(iChannel);
+	int peak = 0;
+	for (int k = 1; k < bins; k++)
+	{
+		if (pMagnitudes[k] > pMagnitudes[peak]) { peak = k; }
+	}
+
+	if (pCents)
+	{
+		// Bin j answers to sine f as exp(-a * (Q * (f / fj - 1))^2), kernels
+		// of neighbours have other length, so simple parabola is biased.
+		// Ratio of log differences gives u = f / fpeak
+		double u = 1.0;
+		if (peak > 0 && peak < bins - 1 && pMagnitudes[peak - 1] > 0.0f && pMagnitudes[peak + 1] > 0.0f)
+		{
+			double r = pow(2.0, 1.0 / kernel->config.binsPerOctave);
+			double center = log(pMagnitudes[peak]);
+			double lower = log(pMagnitudes[peak - 1]) - center;
+			double upper = log(pMagnitudes[peak + 1]) - center;
+			if (upper < 0.0 && lower < 0.0)
+			{
+				double ratio = lower / upper;
+				double denom = ratio * (1.0 + 1.0 / r) + r * (r + 1.0);
+				if (denom > 0.0) { u = 2.0 * (ratio + r) / denom; }
+				if (u < 1.0 / r || u > r) { u = 1.0; }
+			}
+		}
+
+		double freq = kernel->frequency[peak] * u;
+		double note = 69.0 + 12.0 * log2(freq / CQ_REFERENCE_PITCH);
+		*pCents = (float)((note - floor(note + 0.5)) * 100.0);
+	}
+	return peak;
+}
+
+/*******************************************
+* GetNoteName():
+* Name of nearest semitone ("A4")
+*******************************************/
+const char* AuEngine::ConstantQ::GetNoteName(int iBin) const
+{
+	if (iBin < 0 || iBin >= bins) { return ""; }
+	return noteNames[iBin].c_str();
+}
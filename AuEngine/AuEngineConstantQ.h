@@ -0,0 +1,122 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineConstantQ.h:
+// header for constant-Q analyser
+/////////////////////////////////
+#pragma once
+#include "AuEngine.h"
+#include "AuEngineFFT.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+#define CQ_SPARSE_THRESHOLD		0.005f			// kernel values below this part of peak are dropped
+#define CQ_REFERENCE_PITCH		440.0			// A4
+#define CQ_MAX_CHANNELS			64
+#define CQ_DECIM_TAPS			63				// low-pass before every decimation by 2
+#define CQ_DECIM_CUTOFF			0.2				// of input rate
+#define CQ_MAX_OCTAVES			12
+#define CQ_TOP_LIMIT			0.4				// highest bin, part of sample rate
+
+/***********************************************
+* struct ConstantQConfig:
+* Bins start at minFreq, binsPerOctave
+* must be 12 * n (n bins for semitone).
+* Window is winmode of FFTProcess()
+* (1 - Hann, 2 - Hamming, 3 - Blackman,
+* 4 - Blackman-Harris)
+***********************************
+* struct ConstantQKernel:
+* Spectra of temporal kernels (window *
+* complex sine, length Q * rate / f) for
+* top octave, only values above
+* CQ_SPARSE_THRESHOLD are kept. Lower
+* octaves use the same kernels with signal
+* decimated by 2 for every octave. Kernels
+* are built once for config and shared by
+* all analysers
+***********************************
+* class ConstantQ:
+* Keeps last FFT frame of every octave
+* of every channel, every hop makes one
+* small real FFT for octave and multiplies
+* it by sparse kernels. Kernels end at
+* newest sample, so high notes have low
+* latency. Process() doesn't allocate,
+* call it from one thread
+***********************************************/
+namespace AuEngine
+{
+	struct ConstantQConfig
+	{
+		double sampleRate = 48000.0;
+		double minFreq = 27.5;					// A0
+		int binsPerOctave = 12;
+		int bins = 88;
+		int window = 1;
+
+		bool operator==(const ConstantQConfig& other) const
+		{
+			return sampleRate == other.sampleRate && minFreq == other.minFreq &&
+				binsPerOctave == other.binsPerOctave && bins == other.bins && window == other.window;
+		}
+	};
+
+	struct ConstantQKernel
+	{
+		ConstantQConfig config;
+		FFTPlan plan;
+		int fftSize = 0;
+		int bins = 0;							// can be less than config (Nyquist)
+		int octaves = 0;
+		std::vector<int> binStart;				// binsPerOctave + 1, offsets of sparse values
+		std::vector<int> index;					// FFT bin of value
+		std::vector<float> re;
+		std::vector<float> im;
+		std::vector<double> frequency;			// of all bins
+		std::vector<float> decimator;			// CQ_DECIM_TAPS
+	};
+
+	DLL_API std::shared_ptr<const ConstantQKernel> GetConstantQKernel(const ConstantQConfig& config);
+
+	class ConstantQ
+	{
+	public:
+		ConstantQ() {}
+		DLL_API void Create(const ConstantQConfig& config, int iChannels, int iHop);
+		DLL_API void Destroy();
+		DLL_API int  Process(const float* pInput, size_t frames);
+		DLL_API int  GetPeakBin(int iChannel, float* pCents) const;
+		DLL_API const char* GetNoteName(int iBin) const;
+
+		const float* GetMagnitudes(int iChannel) const { return &magnitudes[iChannel * bins]; }
+		double GetBinFrequency(int iBin) const { return kernel->frequency[iBin]; }
+		int GetBins() const { return bins; }
+		int GetFFTSize() const { return fftSize; }
+		int GetSparseSize() const { return kernel ? (int)kernel->index.size() : 0; }
+
+	private:
+		void Push(int iChannel, float fSample);
+		void Analyse(int iChannel, int iOctave);
+
+		std::shared_ptr<const ConstantQKernel> kernel;
+		std::vector<float> history;				// ring of fftSize samples for every octave of channel
+		std::vector<float> delay;				// 2 * CQ_DECIM_TAPS for every decimator of channel
+		std::vector<float> frame;
+		std::vector<float> re;
+		std::vector<float> im;
+		std::vector<float> magnitudes;			// bins for every channel
+		std::vector<std::string> noteNames;
+		int channels = 0;
+		int bins = 0;
+		int octaves = 0;
+		int fftSize = 0;
+		int hop = 0;
+		unsigned long long inputFrames = 0;
+		int writePos[CQ_MAX_OCTAVES];			// same for all channels
+		int delayPos[CQ_MAX_OCTAVES];
+	};
+};
@@ -0,0 +1,416 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineConvolver.cpp:
+// partitioned convolution
+/////////////////////////////////
+
+/*******************************************
+* Partitioned convolution:
+* IR is cut to partitions of P samples.
+* Every P input samples we make FFT of
+* last 2P samples and put spectrum to
+* frequency delay line (FDL). Output is
+* sum of FDL[i] * H[i] for all partitions,
+* last P samples of inverse FFT are
+* valid (overlap-save).
+*
+* Small partitions give low latency, but
+* long IR needs too many of them. So IR
+* is split to levels:
+*
+* level 0: P = block, [0, 8 blocks)
+* level 1: P = 4 blocks, [8, 32 blocks)
+* level 2: P = 16 blocks, [32, 128 blocks)
+* ...
+*
+* Level with partition P starts at 2P,
+* so its job (input up to time t) is
+* needed only at t + P. Job is made by
+* worker of level. If worker is late,
+* audio thread can't wait: partition of
+* level is silent and new input of level
+* is dropped (zero spectrum at FDL).
+* Offline render isn't real-time, so it
+* waits and render is the same every
+* time.
+*******************************************/
+
+#include "AuEngineConvolver.h"
+#include "AuEngineMemory.h"
+
+/*******************************************
+* Create():
+* Split IR to levels, build spectra of
+* partitions and start workers
+*******************************************/
+void AuEngine::Convolver::Create(const float* const* ppIR, size_t irFrames, int iInputs, int iOutputs,
+	ConvolverRouting convRouting, int iBlockSize)
+{
+	Destroy();
+
+	if (!ppIR || !irFrames || iInputs < 1 || iInputs > CONV_MAX_CHANNELS || iOutputs < 1 || iOutputs > CONV_MAX_CHANNELS ||
+		(convRouting == CONV_PARALLEL && iInputs != iOutputs) ||
+		iBlockSize < 16 || iBlockSize > CONV_MAX_PARTITION || (iBlockSize & (iBlockSize - 1)))
+	{
+		THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR);
+	}
+
+	inputs = iInputs;
+	outputs = iOutputs;
+	routing = convRouting;
+	blockSize = iBlockSize;
+	int routes = routing == CONV_PARALLEL ? inputs : inputs * outputs;
+
+	int partition = blockSize;
+	size_t offset = 0;
+	while (offset < irFrames)
+	{
+		int next = partition * CONV_LEVEL_FACTOR;
+		if (next > CONV_MAX_PARTITION) { next = CONV_MAX_PARTITION; }
+
+		// last level takes the rest of IR
+		size_t end = next > partition && levelsCount < CONV_MAX_LEVELS - 1 ? (size_t)next * 2 : irFrames;
+		if (end > irFrames) { end = irFrames; }
+
+		ConvolverLevel* pLevel = &levels[levelsCount++];
+		pLevel->partition = partition;
+		pLevel->offset = (int)offset;
+		pLevel->count = (int)((end - offset + partition - 1) / partition);
+		pLevel->bins = partition + 1;
+		pLevel->plan = GetFFTPlan(partition * 2);
+
+		size_t spectra = (size_t)pLevel->count * pLevel->bins;
+		pLevel->irRe.assign(routes * spectra, 0.0f);
+		pLevel->irIm.assign(routes * spectra, 0.0f);
+		pLevel->fdlRe.assign(inputs * spectra, 0.0f);
+		pLevel->fdlIm.assign(inputs * spectra, 0.0f);
+		pLevel->input.assign((size_t)inputs * partition * 2, 0.0f);
+		pLevel->output.assign((size_t)outputs * partition, 0.0f);
+		pLevel->playing.assign((size_t)outputs * partition, 0.0f);
+		pLevel->accRe.assign(pLevel->bins, 0.0f);
+		pLevel->accIm.assign(pLevel->bins, 0.0f);
+		pLevel->time.assign(partition * 2, 0.0f);
+		pLevel->fdlPos = 0;
+
+		// partition at first half, zeros at second one
+		for (int r = 0; r < routes; r++)
+		{
+			for (int p = 0; p < pLevel->count; p++)
+			{
+				std::fill(pLevel->time.begin(), pLevel->time.end(), 0.0f);
+				size_t start = offset + (size_t)p * partition;
+				size_t length = irFrames - start < (size_t)partition ? irFrames - start : partition;
+				memcpy(pLevel->time.data(), ppIR[r] + start, length * sizeof(float));
+
+				size_t index = (r * (size_t)pLevel->count + p) * pLevel->bins;
+				pLevel->plan->ForwardReal(pLevel->time.data(), &pLevel->irRe[index], &pLevel->irIm[index]);
+			}
+		}
+
+		offset = end;
+		partition = next;
+	}
+
+	historySize = blockSize * 2;
+	for (int i = 1; i < levelsCount; i++)
+	{
+		while (historySize < levels[i].partition * 2) { historySize <<= 1; }
+	}
+	history.assign((size_t)inputs * historySize, 0.0f);
+	inBlock.assign((size_t)inputs * blockSize, 0.0f);
+	outBlock.assign((size_t)outputs * blockSize, 0.0f);
+	historyPos = blockPos = 0;
+	blocks = 0;
+	lateCount = 0;
+
+	isRunning = true;
+	for (int i = 1; i < levelsCount; i++)
+	{
+		levels[i].hStartEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
+		levels[i].hDoneEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
+		if (!levels[i].hStartEvent || !levels[i].hDoneEvent) { THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR); }
+		levels[i].isBusy = false;
+		levels[i].worker = std::thread(&Convolver::WorkerThread, this, &levels[i]);
+	}
+
+	Msg("AuEngine: Convolver levels: ", levelsCount);
+}
+
+/*******************************************
+* Destroy():
+* Stop workers and free levels
+*******************************************/
+void AuEngine::Convolver::Destroy()
+{
+	isRunning = false;
+	for (int i = 0; i < levelsCount; i++)
+	{
+		ConvolverLevel* pLevel = &levels[i];
+		if (pLevel->worker.joinable())
+		{
+			SetEvent(pLevel->hStartEvent);
+			pLevel->worker.join();
+		}
+		if (pLevel->hStartEvent) { CloseHandle(pLevel->hStartEvent); }
+		if (pLevel->hDoneEvent) { CloseHandle(pLevel->hDoneEvent); }
+		pLevel->hStartEvent = pLevel->hDoneEvent = NULL;
+
+		pLevel->plan.reset();
+		pLevel->irRe.clear();
+		pLevel->irIm.clear();
+		pLevel->fdlRe.clear();
+		pLevel->fdlIm.clear();
+		pLevel->input.clear();
+		pLevel->output.clear();
+		pLevel->playing.clear();
+		pLevel->accRe.clear();
+		pLevel->accIm.clear();
+		pLevel->time.clear();
+		pLevel->isBusy = false;
+	}
+	levelsCount = 0;
+	history.clear();
+	inBlock.clear();
+	outBlock.clear();
+}
+
+/*******************************************
+* Reset():
+* Clear tail (new file or seek). Not for
+* audio thread, waits for workers
+*******************************************/
+void AuEngine::Convolver::Reset()
+{
+	for (int i = 0; i < levelsCount; i++)
+	{
+		ConvolverLevel* pLevel = &levels[i];
+		while (pLevel->isBusy.load(std::memory_order_acquire))
+		{
+			WaitForSingleObject(pLevel->hDoneEvent, CONV_WAIT_TIME);
+		}
+		std::fill(pLevel->fdlRe.begin(), pLevel->fdlRe.end(), 0.0f);
+		std::fill(pLevel->fdlIm.begin(), pLevel->fdlIm.end(), 0.0f);
+		std::fill(pLevel->output.begin(), pLevel->output.end(), 0.0f);
+		std::fill(pLevel->playing.begin(), pLevel->playing.end(), 0.0f);
+		pLevel->fdlPos = 0;
+		pLevel->dropped = 0;
+	}
+	std::fill(history.begin(), history.end(), 0.0f);
+	std::fill(outBlock.begin(), outBlock.end(), 0.0f);
+	historyPos = blockPos = 0;
+	blocks = 0;
+}
+
+/*******************************************
+* Process():
+* Planar input and output, any count of
+* frames. Output is one block late
+*******************************************/
+void AuEngine::Convolver::Process(const float* const* ppIn, float** ppOut, int iFrames)
+{
+	int done = 0;
+	while (done < iFrames)
+	{
+		int part = iFrames - done;
+		if (part > blockSize - blockPos) { part = blockSize - blockPos; }
+
+		for (int i = 0; i < inputs; i++)
+		{
+			memcpy(&inBlock[(size_t)i * blockSize + blockPos], ppIn[i] + done, part * sizeof(float));
+		}
+		for (int o = 0; o < outputs; o++)
+		{
+			memcpy(ppOut[o] + done, &outBlock[(size_t)o * blockSize + blockPos], part * sizeof(float));
+		}
+
+		blockPos += part;
+		done += part;
+		if (blockPos == blockSize)
+		{
+			ProcessBlock();
+			blockPos = 0;
+		}
+	}
+}
+
+/*******************************************
+* ProcessBlock():
+* Level 0 now, results and new jobs of
+* other levels
+*******************************************/
+void AuEngine::Convolver::ProcessBlock()
+{
+	int mask = historySize - 1;
+	for (int i = 0; i < inputs; i++)
+	{
+		memcpy(&history[(size_t)i * historySize + historyPos], &inBlock[(size_t)i * blockSize], blockSize * sizeof(float));
+	}
+	historyPos = (historyPos + blockSize) & mask;
+
+	// first sample of block at input
+	unsigned long long start = blocks * blockSize;
+	blocks++;
+
+	for (int l = 0; l < levelsCount; l++)
+	{
+		ConvolverLevel* pLevel = &levels[l];
+		int partition = pLevel->partition;
+
+		if (l)
+		{
+			// part of result for this block
+			int offset = (int)(start % partition);
+			for (int o = 0; o < outputs; o++)
+			{
+				float* pDst = &outBlock[(size_t)o * blockSize];
+				const float* pSrc = &pLevel->playing[(size_t)o * partition + offset];
+				for (int n = 0; n < blockSize; n++) { pDst[n] += pSrc[n]; }
+			}
+
+			// partition of input is full, previous job must be ready now
+			if ((start + blockSize) % partition) { continue; }
+			if (pLevel->isBusy.load(std::memory_order_acquire))
+			{
+				lateCount.fetch_add(1, std::memory_order_relaxed);
+				if (AuEngine::IsAudioThread())
+				{
+					memset(pLevel->playing.data(), 0, pLevel->playing.size() * sizeof(float));
+					pLevel->dropped++;
+					continue;
+				}
+				while (pLevel->isBusy.load(std::memory_order_acquire))
+				{
+					WaitForSingleObject(pLevel->hDoneEvent, CONV_WAIT_TIME);
+				}
+			}
+
+			if (pLevel->dropped)
+			{
+				// result of late job is old now, dropped inputs are silence
+				memset(pLevel->playing.data(), 0, pLevel->playing.size() * sizeof(float));
+				size_t spectra = (size_t)pLevel->count * pLevel->bins;
+				for (int d = 0; d < pLevel->dropped && d < pLevel->count; d++)
+				{
+					for (int i = 0; i < inputs; i++)
+					{
+						size_t index = i * spectra + (size_t)pLevel->fdlPos * pLevel->bins;
+						memset(&pLevel->fdlRe[index], 0, pLevel->bins * sizeof(float));
+						memset(&pLevel->fdlIm[index], 0, pLevel->bins * sizeof(float));
+					}
+					pLevel->fdlPos = pLevel->fdlPos + 1 == pLevel->count ? 0 : pLevel->fdlPos + 1;
+				}
+				pLevel->dropped = 0;
+			}
+			else { pLevel->output.swap(pLevel->playing); }
+		}
+
+		// last 2P input samples
+		int begin = (historyPos - partition * 2) & mask;
+		int tail = historySize - begin < partition * 2 ? historySize - begin : partition * 2;
+		for (int i = 0; i < inputs; i++)
+		{
+			const float* pRing = &history[(size_t)i * historySize];
+			float* pDst = &pLevel->input[(size_t)i * partition * 2];
+			memcpy(pDst, pRing + begin, tail * sizeof(float));
+			memcpy(pDst + tail, pRing, (partition * 2 - tail) * sizeof(float));
+		}
+
+		if (!l)
+		{
+			ProcessLevel(pLevel);
+			memcpy(outBlock.data(), pLevel->output.data(), (size_t)outputs * blockSize * sizeof(float));
+			continue;
+		}
+
+		pLevel->isBusy.store(true, std::memory_order_release);
+		SetEvent(pLevel->hStartEvent);
+	}
+}
+
+/*******************************************
+* ProcessLevel():
+* Spectra of new input partition, sum of
+* FDL * IR and inverse FFT
+*******************************************/
+void AuEngine::Convolver::ProcessLevel(ConvolverLevel* pLevel)
+{
+	int partition = pLevel->partition;
+	int count = pLevel->count;
+	int bins = pLevel->bins;
+	size_t spectra = (size_t)count * bins;
+	const FFTPlan* pPlan = pLevel->plan.get();
+
+	for (int i = 0; i < inputs; i++)
+	{
+		size_t index = i * spectra + (size_t)pLevel->fdlPos * bins;
+		pPlan->ForwardReal(&pLevel->input[(size_t)i * partition * 2], &pLevel->fdlRe[index], &pLevel->fdlIm[index]);
+	}
+
+	float* pAccRe = pLevel->accRe.data();
+	float* pAccIm = pLevel->accIm.data();
+	for (int o = 0; o < outputs; o++)
+	{
+		memset(pAccRe, 0, bins * sizeof(float));
+		memset(pAccIm, 0, bins * sizeof(float));
+
+		for (int i = 0; i < inputs; i++)
+		{
+			int route = GetRoute(i, o);
+			if (route < 0) { continue; }
+
+			// newest input spectrum with first partition of IR
+			for (int p = 0; p < count; p++)
+			{
+				int slot = pLevel->fdlPos - p;
+				if (slot < 0) { slot += count; }
+
+				const float* pXRe = &pLevel->fdlRe[i * spectra + (size_t)slot * bins];
+				const float* pXIm = &pLevel->fdlIm[i * spectra + (size_t)slot * bins];
+				const float* pHRe = &pLevel->irRe[route * spectra + (size_t)p * bins];
+				const float* pHIm = &pLevel->irIm[route * spectra + (size_t)p * bins];
+				for (int k = 0; k < bins; k++)
+				{
+					pAccRe[k] += pXRe[k] * pHRe[k] - pXIm[k] * pHIm[k];
+					pAccIm[k] += pXRe[k] * pHIm[k] + pXIm[k] * pHRe[k];
+				}
+			}
+		}
+
+		pPlan->InverseReal(pAccRe, pAccIm, pLevel->time.data());
+		memcpy(&pLevel->output[(size_t)o * partition], pLevel->time.data() + partition, partition * sizeof(float));
+	}
+
+	pLevel->fdlPos = pLevel->fdlPos + 1 == count ? 0 : pLevel->fdlPos + 1;
+}
+
+/*******************************************
+* WorkerThread():
+* Jobs of one level
+*******************************************/
+void AuEngine::Convolver::WorkerThread(ConvolverLevel* pLevel)
+{
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_HIGHEST);
+
+	while (true)
+	{
+		WaitForSingleObject(pLevel->hStartEvent, INFINITE);
+		if (!isRunning) { break; }
+
+		ProcessLevel(pLevel);
+		pLevel->isBusy.store(false, std::memory_order_release);
+		SetEvent(pLevel->hDoneEvent);
+	}
+}
+
+/*******************************************
+* GetRoute():
+* IR for input and output, -1 - none
+*******************************************/
+int AuEngine::Convolver::GetRoute(int iInput, int iOutput) const
+{
+	if (routing == CONV_PARALLEL) { return iInput == iOutput ? iInput : -1; }
+	return iInput * outputs + iOutput;
+}
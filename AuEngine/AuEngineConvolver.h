@@ -0,0 +1,151 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineConvolver.h:
+// header for partitioned convolution
+/////////////////////////////////
+#pragma once
+#include "AuEngine.h"
+#include "AuEngineFFT.h"
+#include "AuEngineGraph.h"
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#define CONV_MAX_CHANNELS		8
+#define CONV_MAX_LEVELS			8
+#define CONV_LEVEL_FACTOR		4				// partition of next level is 4 times bigger
+#define CONV_MAX_PARTITION		8192
+#define CONV_WAIT_TIME			100				// ms, offline render waits for late worker
+
+/***********************************************
+* enum ConvolverRouting:
+* CONV_PARALLEL - IR i for input i to
+* output i (inputs == outputs)
+* CONV_MATRIX   - IR (i * outputs + o)
+* for input i to output o, true stereo
+* is 2 x 2 matrix
+***********************************
+* struct ConvolverLevel:
+* Part of IR with one partition size.
+* Spectra of IR partitions and frequency
+* delay line of input spectra (uniformly
+* partitioned overlap-save)
+***********************************
+* class Convolver:
+* Non-uniformly partitioned convolution.
+* Level 0 has partition of audio block
+* and is processed at audio thread, other
+* levels are 4 times bigger every time
+* and start at 2 partitions, so their
+* worker thread has one partition of
+* time before result is needed. Latency
+* is one block. Audio thread never waits
+* for late worker: partition of level is
+* silent and counted by GetLateCount()
+* Create() allocates everything, Process()
+* takes any count of frames
+***********************************
+* class ConvolverNode:
+* Convolver for effect graph, node has
+* max(inputs, outputs) channels
+***********************************************/
+namespace AuEngine
+{
+	enum ConvolverRouting
+	{
+		CONV_PARALLEL,
+		CONV_MATRIX
+	};
+
+	struct ConvolverLevel
+	{
+		int partition = 0;
+		int offset = 0;							// at IR
+		int count = 0;							// of partitions
+		int bins = 0;							// partition + 1
+		std::shared_ptr<const FFTPlan> plan;	// 2 * partition
+
+		std::vector<float> irRe;				// route, partition, bin
+		std::vector<float> irIm;
+		std::vector<float> fdlRe;				// input, partition, bin
+		std::vector<float> fdlIm;
+		int fdlPos = 0;
+
+		std::vector<float> input;				// input, 2 * partition
+		std::vector<float> output;				// output, partition (worker writes)
+		std::vector<float> playing;				// output, partition (audio thread reads)
+		std::vector<float> accRe;
+		std::vector<float> accIm;
+		std::vector<float> time;
+
+		std::thread worker;
+		HANDLE hStartEvent = NULL;
+		HANDLE hDoneEvent = NULL;
+		std::atomic<bool> isBusy{ false };
+		int dropped = 0;						// jobs skipped while worker was late (audio thread)
+	};
+
+	class Convolver
+	{
+	public:
+		Convolver() {}
+		~Convolver() { Destroy(); }
+		DLL_API void Create(const float* const* ppIR, size_t irFrames, int iInputs, int iOutputs,
+			ConvolverRouting routing, int iBlockSize);
+		DLL_API void Destroy();
+		DLL_API void Reset();
+		DLL_API void Process(const float* const* ppIn, float** ppOut, int iFrames);
+
+		int GetLatency() const { return blockSize; }
+		int GetLevelsCount() const { return levelsCount; }
+		int GetInputs() const { return inputs; }
+		int GetOutputs() const { return outputs; }
+		size_t GetLateCount() const { return lateCount.load(std::memory_order_relaxed); }
+
+	private:
+		void ProcessBlock();
+		void ProcessLevel(ConvolverLevel* pLevel);
+		void WorkerThread(ConvolverLevel* pLevel);
+		int  GetRoute(int iInput, int iOutput) const;
+
+		ConvolverLevel levels[CONV_MAX_LEVELS];
+		int levelsCount = 0;
+		int inputs = 0;
+		int outputs = 0;
+		int blockSize = 0;
+		ConvolverRouting routing = CONV_PARALLEL;
+
+		std::vector<float> history;				// input, ring of historySize
+		int historySize = 0;
+		int historyPos = 0;
+		std::vector<float> inBlock;				// input, block
+		std::vector<float> outBlock;			// output, block
+		int blockPos = 0;
+		unsigned long long blocks = 0;
+
+		std::atomic<bool> isRunning{ false };
+		std::atomic<size_t> lateCount{ 0 };
+	};
+
+	class ConvolverNode : public Node
+	{
+	public:
+		ConvolverNode(Convolver* pConv) :
+			Node(EFFECT_NODE, pConv->GetInputs() > pConv->GetOutputs() ? pConv->GetInputs() : pConv->GetOutputs()), convolver(pConv) {}
+
+		void Process(float** ppIn, float** ppOut, int iFrames) override
+		{
+			convolver->Process(ppIn, ppOut, iFrames);
+			for (int c = convolver->GetOutputs(); c < channels; c++) { memset(ppOut[c], 0, iFrames * sizeof(float)); }
+		}
+
+		int GetLatency() const override { return convolver->GetLatency(); }
+
+	private:
+		Convolver* convolver;
+	};
+};
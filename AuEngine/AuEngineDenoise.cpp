@@ -0,0 +1,537 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineDenoise.cpp:
+// spectral noise reduction
+/////////////////////////////////
+
+/*******************************************
+* Noise reduction:
+* Power S of every bin is average of last
+* frames (and 3 bins around), noise N is
+* from profile. Gain is Wiener-like
+* 1 - a * N / S (or its square root for
+* power subtraction), not less than floor
+* of reduction. Phase is not changed.
+*
+* Parallel segments:
+* recursive smoothing (decision-directed
+* SNR and others) would make every sample
+* depend on all audio before it. Here
+* state is only last frames: input,
+* overlap-add tail and power history, and
+* sums are made in the same order from
+* any start. So worker starts Denoiser
+* GetWarmup() frames before its segment
+* and gets the same floats as one
+* Denoiser for whole file.
+*******************************************/
+
+#include "AuEngineDenoise.h"
+#include "AuEngineTrack.h"
+#include "AuEngineWav.h"
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <string.h>
+
+#define TWO_PI					6.28318530718
+#define WINDOW_NORM				(1.0f / 1.5f)	// Hann^2 at overlap 4
+
+/*******************************************
+* CreateHann():
+* Periodic Hann window
+*******************************************/
+static void CreateHann(std::vector<float>& window, int iSize)
+{
+	window.resize(iSize);
+	for (int i = 0; i < iSize; i++) { window[i] = (float)(0.5 - 0.5 * cos(TWO_PI * i / iSize)); }
+}
+
+/*******************************************
+* IsFrameSize():
+* Power of two in allowed range
+*******************************************/
+static bool IsFrameSize(int iSize)
+{
+	return iSize >= DENOISE_MIN_FRAME && iSize <= DENOISE_MAX_FRAME && !(iSize & (iSize - 1));
+}
+
+/*******************************************
+* NoiseProfile::Create():
+* Empty profile for frame size
+*******************************************/
+void AuEngine::NoiseProfile::Create(int iFrameSize, int iChannels)
+{
+	if (!IsFrameSize(iFrameSize) || iChannels < 1 || iChannels > DENOISE_MAX_CHANNELS)
+	{
+		THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR);
+	}
+
+	frameSize = iFrameSize;
+	bins = iFrameSize / 2 + 1;
+	channels = iChannels;
+	plan = GetFFTPlan(iFrameSize);
+	CreateHann(window, iFrameSize);
+
+	input.assign(channels * frameSize, 0.0f);
+	sum.assign(channels * bins, 0.0);
+	frame.assign(frameSize, 0.0f);
+	re.assign(bins, 0.0f);
+	im.assign(bins, 0.0f);
+	Reset();
+}
+
+/*******************************************
+* NoiseProfile::Reset():
+* Forget captured noise
+*******************************************/
+void AuEngine::NoiseProfile::Reset()
+{
+	std::fill(sum.begin(), sum.end(), 0.0);
+	inputFill = 0;
+	count = 0;
+}
+
+/*******************************************
+* NoiseProfile::Capture():
+* Add interleaved noise to profile
+*******************************************/
+void AuEngine::NoiseProfile::Capture(const float* pData, size_t frames)
+{
+	if (!plan) { THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR); }
+
+	while (frames)
+	{
+		size_t part = std::min(frames, (size_t)(frameSize - inputFill));
+		for (int c = 0; c < channels; c++)
+		{
+			float* pInput = &input[c * frameSize + inputFill];
+			for (size_t i = 0; i < part; i++) { pInput[i] = pData[i * channels + c]; }
+		}
+		inputFill += (int)part;
+		pData += part * channels;
+		frames -= part;
+
+		if (inputFill == frameSize)
+		{
+			AnalyseFrame();
+
+			// hop is half of frame
+			int half = frameSize / 2;
+			for (int c = 0; c < channels; c++)
+			{
+				memmove(&input[c * frameSize], &input[c * frameSize + half], half * sizeof(float));
+			}
+			inputFill = half;
+		}
+	}
+}
+
+/*******************************************
+* NoiseProfile::CaptureFile():
+* Add part of file to profile
+*******************************************/
+void AuEngine::NoiseProfile::CaptureFile(const char* lpPath, unsigned long long start, unsigned long long frames)
+{
+	TrackReader reader;
+	reader.Open(lpPath);
+	if (reader.GetChannels() != channels) { THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR); }
+
+	std::vector<float> block(DENOISE_EXPORT_FRAMES * channels);
+	reader.Seek(start);
+	while (frames)
+	{
+		size_t got = reader.Read(block.data(), (size_t)std::min(frames, (unsigned long long)DENOISE_EXPORT_FRAMES), channels);
+		if (!got) { break; }
+		Capture(block.data(), got);
+		frames -= got;
+	}
+}
+
+/*******************************************
+* NoiseProfile::AnalyseFrame():
+* Add power of full frame
+*******************************************/
+void AuEngine::NoiseProfile::AnalyseFrame()
+{
+	for (int c = 0; c < channels; c++)
+	{
+		const float* pInput = &input[c * frameSize];
+		for (int i = 0; i < frameSize; i++) { frame[i] = pInput[i] * window[i]; }
+		plan->ForwardReal(frame.data(), re.data(), im.data());
+
+		double* pSum = &sum[c * bins];
+		for (int k = 0; k < bins; k++) { pSum[k] += re[k] * re[k] + im[k] * im[k]; }
+	}
+	count++;
+}
+
+/*******************************************
+* Denoiser::Create():
+* Allocate everything, take noise of
+* profile (must have the same frame size)
+*******************************************/
+void AuEngine::Denoiser::Create(const DenoiseConfig& cfg, const NoiseProfile& profile, int iChannels)
+{
+	if (!IsFrameSize(cfg.frameSize) || iChannels < 1 || iChannels > DENOISE_MAX_CHANNELS ||
+		cfg.smoothing < 1 || cfg.smoothing > DENOISE_MAX_SMOOTH)
+	{
+		THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR);
+	}
+	if (!profile.IsReady() || profile.GetFrameSize() != cfg.frameSize || profile.GetChannels() != iChannels)
+	{
+		Msg("AuEngine: Noise profile doesn't fit denoiser");
+		THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR);
+	}
+
+	config = cfg;
+	frameSize = cfg.frameSize;
+	bins = frameSize / 2 + 1;
+	hop = frameSize / DENOISE_OVERLAP;
+	channels = iChannels;
+	smoothing = cfg.smoothing;
+	plan = GetFFTPlan(frameSize);
+	CreateHann(window, frameSize);
+
+	input.assign(channels * frameSize, 0.0f);
+	output.assign(channels * frameSize, 0.0f);
+	ready.assign(channels * hop, 0.0f);
+	history.assign(channels * smoothing * bins, 0.0f);
+	frame.assign(frameSize, 0.0f);
+	re.assign(bins, 0.0f);
+	im.assign(bins, 0.0f);
+	average.assign(bins, 0.0f);
+	planar.assign(channels * DENOISE_EXPORT_FRAMES, 0.0f);
+
+	noise.resize(channels * bins);
+	for (int c = 0; c < channels; c++)
+	{
+		for (int k = 0; k < bins; k++) { noise[c * bins + k] = profile.GetPower(c, k) * cfg.oversubtraction; }
+	}
+
+	SetReduction(cfg.reduction);
+	Reset();
+}
+
+/*******************************************
+* Denoiser::Destroy():
+* Free buffers
+*******************************************/
+void AuEngine::Denoiser::Destroy()
+{
+	plan.reset();
+	input.clear();
+	output.clear();
+	history.clear();
+	planar.clear();
+	channels = 0;
+}
+
+/*******************************************
+* Denoiser::Reset():
+* Drop all audio, input starts with zeros
+*******************************************/
+void AuEngine::Denoiser::Reset()
+{
+	std::fill(input.begin(), input.end(), 0.0f);
+	std::fill(output.begin(), output.end(), 0.0f);
+	std::fill(ready.begin(), ready.end(), 0.0f);
+	std::fill(history.begin(), history.end(), 0.0f);
+	fill = frameSize - hop;
+	historyPos = 0;
+}
+
+/*******************************************
+* Denoiser::SetReduction():
+* Max attenuation in dB
+*******************************************/
+void AuEngine::Denoiser::SetReduction(float fReduction)
+{
+	floorGain.store(powf(10.0f, -std::max(fReduction, 0.0f) / 20.0f), std::memory_order_relaxed);
+}
+
+/*******************************************
+* Denoiser::Process():
+* Interleaved data in place
+*******************************************/
+void AuEngine::Denoiser::Process(float* pData, int iFrames, int iChannels)
+{
+	if (iChannels != channels) { THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR); }
+
+	float* ppPlanar[DENOISE_MAX_CHANNELS];
+	for (int c = 0; c < channels; c++) { ppPlanar[c] = &planar[c * DENOISE_EXPORT_FRAMES]; }
+
+	while (iFrames > 0)
+	{
+		int part = std::min(iFrames, DENOISE_EXPORT_FRAMES);
+		for (int i = 0; i < part; i++)
+		{
+			for (int c = 0; c < channels; c++) { ppPlanar[c][i] = pData[i * channels + c]; }
+		}
+
+		Process(ppPlanar, ppPlanar, part);
+
+		for (int i = 0; i < part; i++)
+		{
+			for (int c = 0; c < channels; c++) { pData[i * channels + c] = ppPlanar[c][i]; }
+		}
+		pData += part * channels;
+		iFrames -= part;
+	}
+}
+
+/*******************************************
+* Denoiser::Process():
+* Planar data, in and out can be the same
+*******************************************/
+void AuEngine::Denoiser::Process(const float* const* ppIn, float** ppOut, int iFrames)
+{
+	int start = frameSize - hop;			// input is one hop, ready output is one hop old
+	int done = 0;
+	while (done < iFrames)
+	{
+		int part = std::min(iFrames - done, frameSize - fill);
+		for (int c = 0; c < channels; c++)
+		{
+			memcpy(&input[c * frameSize + fill], ppIn[c] + done, part * sizeof(float));
+			memcpy(ppOut[c] + done, &ready[c * hop + fill - start], part * sizeof(float));
+		}
+		fill += part;
+		done += part;
+
+		if (fill == frameSize)
+		{
+			ProcessFrame();
+			fill = start;
+		}
+	}
+}
+
+/*******************************************
+* Denoiser::ProcessFrame():
+* One STFT frame of every channel, first
+* hop of overlap-add is ready after it
+*******************************************/
+void AuEngine::Denoiser::ProcessFrame()
+{
+	float floor = floorGain.load(std::memory_order_relaxed);
+	float scale = 1.0f / (smoothing * 4.0f);
+	bool isWiener = config.method == DENOISE_WIENER;
+
+	for (int c = 0; c < channels; c++)
+	{
+		float* pInput = &input[c * frameSize];
+		for (int i = 0; i < frameSize; i++) { frame[i] = pInput[i] * window[i]; }
+		memmove(pInput, pInput + hop, (frameSize - hop) * sizeof(float));
+		plan->ForwardReal(frame.data(), re.data(), im.data());
+
+		float* pHistory = &history[c * smoothing * bins];
+		float* pPower = pHistory + historyPos * bins;
+		for (int k = 0; k < bins; k++) { pPower[k] = re[k] * re[k] + im[k] * im[k]; }
+
+		// from newest to oldest, so order doesn't depend on ring position
+		std::fill(average.begin(), average.end(), 0.0f);
+		for (int m = 0; m < smoothing; m++)
+		{
+			const float* pOld = pHistory + ((historyPos - m + smoothing) % smoothing) * bins;
+			for (int k = 0; k < bins; k++) { average[k] += pOld[k]; }
+		}
+
+		const float* pNoise = &noise[c * bins];
+		for (int k = 0; k < bins; k++)
+		{
+			float left = average[k > 0 ? k - 1 : k + 1];
+			float right = average[k < bins - 1 ? k + 1 : k - 1];
+			float power = (left + 2.0f * average[k] + right) * scale;
+
+			float gain = power > 0.0f ? 1.0f - pNoise[k] / power : 0.0f;
+			if (gain < 0.0f) { gain = 0.0f; }
+			if (!isWiener) { gain = sqrtf(gain); }
+			if (gain < floor) { gain = floor; }
+			re[k] *= gain;
+			im[k] *= gain;
+		}
+
+		plan->InverseReal(re.data(), im.data(), frame.data());
+
+		float* pOutput = &output[c * frameSize];
+		for (int i = 0; i < frameSize; i++) { pOutput[i] += frame[i] * window[i] * WINDOW_NORM; }
+
+		memcpy(&ready[c * hop], pOutput, hop * sizeof(float));
+		memmove(pOutput, pOutput + hop, (frameSize - hop) * sizeof(float));
+		memset(pOutput + frameSize - hop, 0, hop * sizeof(float));
+	}
+
+	historyPos = (historyPos + 1) % smoothing;
+}
+
+/*******************************************
+* DenoiseFile():
+* Workers process segments, this thread
+* writes them in order
+*******************************************/
+void AuEngine::DenoiseFile(const char* lpSource, const char* lpPath, const DenoiseConfig& config,
+	const NoiseProfile& profile, int iWorkers, PaSampleFormat format, std::atomic<int>* pPercent)
+{
+	TrackReader reader;
+	reader.Open(lpSource);
+	if (!format) { format = reader.GetFormat(); }
+
+	int channels = reader.GetChannels();
+	size_t frameSize = channels * Pa_GetSampleSize(format);
+	int sampleRate = reader.GetSampleRate();
+	unsigned long long frames = reader.GetFrames();
+	reader.Close();
+
+	// checks config and profile before any thread
+	Denoiser check;
+	check.Create(config, profile, channels);
+	check.Destroy();
+
+	if (iWorkers <= 0) { iWorkers = (int)std::thread::hardware_concurrency(); }
+	iWorkers = std::max(1, std::min(iWorkers, DENOISE_MAX_WORKERS));
+
+	// every worker can be one segment ahead of writer
+	struct Segment
+	{
+		std::vector<float> data;
+		size_t frames = 0;
+		bool isReady = false;
+	};
+	int segments = (int)((frames + DENOISE_SEGMENT_FRAMES - 1) / DENOISE_SEGMENT_FRAMES);
+	int slotsCount = 2 * iWorkers;
+	std::vector<Segment> slots(slotsCount);
+
+	std::mutex mutex;
+	std::condition_variable condition;
+	std::atomic<int> nextSegment{ 0 };
+	int written = 0;
+	bool isFailed = false;
+
+	auto worker = [&]()
+	{
+		try
+		{
+			TrackReader source;
+			source.Open(lpSource);
+			Denoiser denoiser;
+			denoiser.Create(config, profile, channels);
+			size_t latency = denoiser.GetLatency();
+			size_t warmup = denoiser.GetWarmup();
+			std::vector<float> block(DENOISE_EXPORT_FRAMES * channels);
+			unsigned long long fed = 0;			// end of input which denoiser has
+			int last = -2;
+
+			int index;
+			while ((index = nextSegment.fetch_add(1)) < segments)
+			{
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					condition.wait(lock, [&]() { return isFailed || index < written + slotsCount; });
+					if (isFailed) { return; }
+				}
+
+				unsigned long long start = (unsigned long long)index * DENOISE_SEGMENT_FRAMES;
+				unsigned long long end = std::min(start + DENOISE_SEGMENT_FRAMES, frames);
+
+				// next segment goes on, else start again before segment
+				if (index != last + 1)
+				{
+					fed = start > warmup ? start - warmup : 0;
+					denoiser.Reset();
+					source.Seek(fed);
+				}
+				last = index;
+
+				Segment& slot = slots[index % slotsCount];
+				slot.data.resize((size_t)(end - start) * channels);
+				slot.frames = 0;
+
+				// output of denoiser is input - latency
+				unsigned long long skip = start + latency - fed;
+				while (slot.frames < end - start)
+				{
+					size_t part = (size_t)std::min((unsigned long long)DENOISE_EXPORT_FRAMES, end + latency - fed);
+					size_t got = fed < frames ? source.Read(block.data(), part, channels) : 0;
+					memset(block.data() + got * channels, 0, (part - got) * channels * sizeof(float));
+					denoiser.Process(block.data(), (int)part, channels);
+					fed += part;
+
+					size_t drop = (size_t)std::min(skip, (unsigned long long)part);
+					skip -= drop;
+					memcpy(slot.data.data() + slot.frames * channels, block.data() + drop * channels, (part - drop) * channels * sizeof(float));
+					slot.frames += part - drop;
+				}
+
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					slot.isReady = true;
+				}
+				condition.notify_all();
+			}
+		}
+		catch (AuEngine::Exception&)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			isFailed = true;
+		}
+		condition.notify_all();
+	};
+
+	std::string partPath = std::string(lpPath) + ".part";
+	std::vector<uint8_t> converted;
+	WavStreamWriter writer;
+	writer.Open(partPath.c_str(), channels, sampleRate, format, (long long)(frames * frameSize));
+
+	std::vector<std::thread> workers;
+	for (int i = 0; i < iWorkers; i++) { workers.push_back(std::thread(worker)); }
+
+	for (int index = 0; index < segments; index++)
+	{
+		Segment& slot = slots[index % slotsCount];
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [&]() { return isFailed || slot.isReady; });
+			if (isFailed) { break; }
+		}
+
+		// workers must be stopped and joined before error goes out
+		converted.resize(slot.frames * frameSize);
+		ConvertFromFloat(slot.data.data(), converted.data(), slot.frames * channels, format);
+		try
+		{
+			writer.WriteBlocking(converted.data(), converted.size());
+		}
+		catch (AuEngine::Exception&)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				isFailed = true;
+			}
+			condition.notify_all();
+			break;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			slot.isReady = false;
+			written++;
+		}
+		condition.notify_all();
+		if (pPercent) { *pPercent = (int)((index + 1) * 100LL / segments); }
+	}
+
+	for (size_t i = 0; i < workers.size(); i++) { workers[i].join(); }
+	writer.Close();
+
+	if (isFailed || writer.IsFailed() || !MoveFileExA(partPath.c_str(), lpPath, MOVEFILE_REPLACE_EXISTING))
+	{
+		DeleteFileA(partPath.c_str());
+		THROW_EXCEPTION(AuEngine::OpSet::FILESYSYEM_ERROR);
+	}
+	if (pPercent) { *pPercent = 100; }
+}
@@ -0,0 +1,178 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineDenoise.h:
+// header for spectral noise reduction
+/////////////////////////////////
+#pragma once
+#include "AuEngine.h"
+#include "AuEngineFFT.h"
+#include "AuEngineGraph.h"
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#define DENOISE_MAX_CHANNELS	8
+#define DENOISE_MIN_FRAME		256
+#define DENOISE_MAX_FRAME		16384
+#define DENOISE_OVERLAP			4				// hop is frame / 4
+#define DENOISE_MAX_SMOOTH		16				// frames of power average
+#define DENOISE_SEGMENT_FRAMES	131072			// offline segment of one worker
+#define DENOISE_EXPORT_FRAMES	8192
+#define DENOISE_MAX_WORKERS		16
+
+/***********************************************
+* class NoiseProfile:
+* Mean power spectrum of noise for every
+* channel (Hann frames, hop frame / 2).
+* Capture() takes interleaved audio of
+* noise only part (any block size, can be
+* called many times), CaptureFile() reads
+* part of file
+***********************************
+* enum DenoiseMethod:
+* DENOISE_SUBTRACT - power subtraction,
+*   gain sqrt(1 - a * N / S)
+* DENOISE_WIENER   - gain 1 - a * N / S,
+*   stronger at low SNR
+***********************************
+* struct DenoiseConfig:
+* reduction is max attenuation (dB),
+* oversubtraction is a (noise is taken
+* a times louder), smoothing is count of
+* frames for average of signal power S
+* (less musical noise)
+***********************************
+* class Denoiser:
+* STFT noise reduction (Hann, overlap 4).
+* Gain of frame depends only on last
+* smoothing frames of input, there is no
+* recursive state. So audio processed
+* from any point after warm-up
+* (GetWarmup()) is bit-exact the same as
+* from the start, offline segments are
+* processed at the same time without any
+* seam. Latency is one frame.
+* Nothing is allocated after Create(),
+* SetReduction() can be called from any
+* thread
+***********************************
+* class DenoiseNode:
+* Denoiser for effect graph (preview)
+***********************************
+* DenoiseFile():
+* Offline noise reduction of file by
+* workers (0 - all cores), segments are
+* written in order. Output is aligned
+* and equal to output of one Denoiser
+* for whole file
+***********************************************/
+namespace AuEngine
+{
+	class NoiseProfile
+	{
+	public:
+		NoiseProfile() {}
+		DLL_API void Create(int iFrameSize, int iChannels);
+		DLL_API void Reset();
+		DLL_API void Capture(const float* pData, size_t frames);
+		DLL_API void CaptureFile(const char* lpPath, unsigned long long start, unsigned long long frames);
+
+		bool  IsReady() const { return count > 0; }
+		int   GetFrameSize() const { return frameSize; }
+		int   GetChannels() const { return channels; }
+		unsigned long long GetFramesCount() const { return count; }
+		float GetPower(int iChannel, int iBin) const { return count ? (float)(sum[iChannel * bins + iBin] / count) : 0.0f; }
+
+	private:
+		void AnalyseFrame();
+
+		std::shared_ptr<const FFTPlan> plan;
+		int frameSize = 0;
+		int bins = 0;
+		int channels = 0;
+		std::vector<float> window;
+		std::vector<float> input;				// channel, frameSize
+		int inputFill = 0;
+		std::vector<double> sum;				// channel, bins
+		unsigned long long count = 0;			// analysed frames
+		std::vector<float> frame;
+		std::vector<float> re;
+		std::vector<float> im;
+	};
+
+	enum DenoiseMethod
+	{
+		DENOISE_SUBTRACT,
+		DENOISE_WIENER
+	};
+
+	struct DenoiseConfig
+	{
+		DenoiseMethod method = DENOISE_WIENER;
+		int frameSize = 2048;
+		float reduction = 12.0f;
+		float oversubtraction = 1.5f;
+		int smoothing = 4;
+	};
+
+	class Denoiser
+	{
+	public:
+		Denoiser() {}
+		DLL_API void Create(const DenoiseConfig& config, const NoiseProfile& profile, int iChannels);
+		DLL_API void Destroy();
+		DLL_API void Reset();
+		DLL_API void SetReduction(float fReduction);
+		DLL_API void Process(float* pData, int iFrames, int iChannels);
+		DLL_API void Process(const float* const* ppIn, float** ppOut, int iFrames);
+
+		int GetLatency() const { return frameSize; }
+		int GetWarmup() const { return 2 * frameSize + smoothing * hop; }
+		int GetHop() const { return hop; }
+		int GetChannels() const { return channels; }
+		const DenoiseConfig& GetConfig() const { return config; }
+
+	private:
+		void ProcessFrame();
+
+		DenoiseConfig config;
+		std::shared_ptr<const FFTPlan> plan;
+		std::atomic<float> floorGain{ 0.0f };
+		int frameSize = 0;
+		int bins = 0;
+		int hop = 0;
+		int channels = 0;
+		int smoothing = 0;
+		int fill = 0;							// position at input (first hop is old input)
+		int historyPos = 0;
+
+		std::vector<float> window;
+		std::vector<float> input;				// channel, frameSize
+		std::vector<float> output;				// channel, frameSize (overlap-add)
+		std::vector<float> ready;				// channel, hop (done samples)
+		std::vector<float> noise;				// channel, bins (profile * oversubtraction)
+		std::vector<float> history;				// channel, smoothing, bins (power)
+		std::vector<float> frame;
+		std::vector<float> re;
+		std::vector<float> im;
+		std::vector<float> average;				// bins
+		std::vector<float> planar;				// channel, DENOISE_EXPORT_FRAMES (interleaved input)
+	};
+
+	class DenoiseNode : public Node
+	{
+	public:
+		DenoiseNode(Denoiser* pDenoiser, NodeType nodeType = EFFECT_NODE) : Node(nodeType, pDenoiser->GetChannels()), denoiser(pDenoiser) {}
+		void Process(float** ppIn, float** ppOut, int iFrames) override { denoiser->Process(ppIn, ppOut, iFrames); }
+		int  GetLatency() const override { return denoiser->GetLatency(); }
+
+	private:
+		Denoiser* denoiser;
+	};
+
+	DLL_API void DenoiseFile(const char* lpSource, const char* lpPath, const DenoiseConfig& config,
+		const NoiseProfile& profile, int iWorkers = 0, PaSampleFormat format = 0, std::atomic<int>* pPercent = NULL);
+};
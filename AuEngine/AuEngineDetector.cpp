@@ -0,0 +1,389 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineDetector.cpp:
+// pitch and onset detector
+/////////////////////////////////
+
+/*******************************************
+* Onset:
+* Spectral flux is sum of positive
+* differences of log magnitudes between
+* two frames. Onset is local maximum of
+* flux above adaptive threshold (median
+* of previous values), so it's reported
+* one hop later.
+*
+* Pitch (McLeod):
+* NSDF n(t) = 2 r(t) / m(t), r is
+* autocorrelation (by FFT of frame with
+* zeros, |X|^2 and inverse FFT), m is sum
+* of squares of both parts. Period is
+* first key maximum (between zero
+* crossings) above 0.9 of highest one,
+* it's more stable than highest peak
+* (no octave errors). NSDF peak is
+* clarity of sound.
+*******************************************/
+
+#include "AuEngineDetector.h"
+#include "AuEngineTrack.h"
+#include "AuEngineMath.h"
+#include <algorithm>
+
+/*******************************************
+* Create():
+* Allocate all buffers for config
+*******************************************/
+void AuEngine::Detector::Create(const DetectorConfig& cfg)
+{
+	if (cfg.frameSize < 64 || (cfg.frameSize & (cfg.frameSize - 1)) || cfg.hop < 1 ||
+		cfg.minPitch <= 0.0f || cfg.maxPitch <= cfg.minPitch || cfg.sampleRate <= 0.0)
+	{
+		THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR);
+	}
+	config = cfg;
+
+	// pitch doesn't need high rate, 4 samples for period of highest pitch is enough
+	decimation = 1;
+	while (decimation < DETECT_MAX_DECIMATION && config.sampleRate / (decimation * 2) >= 4.0 * config.maxPitch)
+	{
+		decimation <<= 1;
+	}
+	hop = (config.hop + decimation - 1) / decimation * decimation;
+
+	// two periods of lowest pitch
+	double pitchRate = config.sampleRate / decimation;
+	pitchSize = 64;
+	while (pitchSize < 2.0 * pitchRate / config.minPitch) { pitchSize <<= 1; }
+
+	onsetPlan.Create(config.frameSize);
+	pitchPlan.Create(pitchSize * 2);
+
+	int frameMax = std::max(config.frameSize, pitchSize * 2);
+	history.assign(config.frameSize, 0.0f);
+	pitchHistory.assign(pitchSize, 0.0f);
+	window.resize(config.frameSize);
+	frame.assign(frameMax, 0.0f);
+	re.assign(frameMax / 2 + 1, 0.0f);
+	im.assign(frameMax / 2 + 1, 0.0f);
+	magnitudes.assign(config.frameSize / 2 + 1, 0.0f);
+	nsdf.assign(pitchSize * 2, 0.0f);
+
+	AuMath math;
+	math.BuildHannWindow(window.data(), config.frameSize);
+
+	events.Create(DETECT_QUEUE_EVENTS * sizeof(DetectorEvent));
+	Reset();
+}
+
+/*******************************************
+* Destroy():
+* Free buffers
+*******************************************/
+void AuEngine::Detector::Destroy()
+{
+	history.clear();
+	pitchHistory.clear();
+	window.clear();
+	frame.clear();
+	re.clear();
+	im.clear();
+	magnitudes.clear();
+	nsdf.clear();
+	events.Destroy();
+	hop = pitchSize = 0;
+}
+
+/*******************************************
+* Reset():
+* Forget signal (new file or seek),
+* don't call it with PopEvent() together
+*******************************************/
+void AuEngine::Detector::Reset()
+{
+	std::fill(history.begin(), history.end(), 0.0f);
+	std::fill(pitchHistory.begin(), pitchHistory.end(), 0.0f);
+	std::fill(magnitudes.begin(), magnitudes.end(), 0.0f);
+	memset(fluxValues, 0, sizeof(fluxValues));
+	memset(fluxHistory, 0, sizeof(fluxHistory));
+	fluxCount = 0;
+	hasOnset = false;
+	lastOnset = 0;
+	historyPos = pitchPos = 0;
+	decimCount = 0;
+	decimSum = 0.0f;
+	inputFrames = 0;
+	pitch = clarity = lastPitch = 0.0f;
+	dropped = 0;
+	events.Flush();
+}
+
+/*******************************************
+* Process():
+* Push interleaved frames, analyse every
+* hop. No allocations and no locks
+*******************************************/
+void AuEngine::Detector::Process(const float* pInput, size_t frames, int iChannels)
+{
+	int mask = config.frameSize - 1;
+	int pitchMask = pitchSize - 1;
+	float scale = 1.0f / iChannels;
+
+	for (size_t f = 0; f < frames; f++)
+	{
+		float mono = 0.0f;
+		for (int c = 0; c < iChannels; c++) { mono += pInput[f * iChannels + c]; }
+		mono *= scale;
+
+		history[historyPos] = mono;
+		historyPos = (historyPos + 1) & mask;
+
+		// box filter before decimation, period of signal is still the same
+		decimSum += mono;
+		if (++decimCount == decimation)
+		{
+			pitchHistory[pitchPos] = decimSum / decimation;
+			pitchPos = (pitchPos + 1) & pitchMask;
+			decimCount = 0;
+			decimSum = 0.0f;
+		}
+
+		inputFrames++;
+		if (inputFrames % hop == 0)
+		{
+			AnalyseOnset();
+			AnalysePitch();
+		}
+	}
+}
+
+/*******************************************
+* AnalyseOnset():
+* Flux of new frame, peak picking of
+* previous one
+*******************************************/
+void AuEngine::Detector::AnalyseOnset()
+{
+	int size = config.frameSize;
+	int tail = size - historyPos;
+	memcpy(frame.data(), history.data() + historyPos, tail * sizeof(float));
+	memcpy(frame.data() + tail, history.data(), historyPos * sizeof(float));
+	for (int i = 0; i < size; i++) { frame[i] *= window[i]; }
+
+	onsetPlan.ForwardReal(frame.data(), re.data(), im.data());
+
+	int bins = size / 2 + 1;
+	float norm = 4.0f / size;				// sine with amplitude 1 gives 1 for Hann
+	float flux = 0.0f;
+	for (int j = 0; j < bins; j++)
+	{
+		float magnitude = log1pf(DETECT_COMPRESSION * norm * sqrtf(re[j] * re[j] + im[j] * im[j]));
+		float diff = magnitude - magnitudes[j];
+		if (diff > 0.0f) { flux += diff; }
+		magnitudes[j] = magnitude;
+	}
+	flux /= bins;
+
+	fluxValues[2] = fluxValues[1];
+	fluxValues[1] = fluxValues[0];
+	fluxValues[0] = flux;
+
+	// threshold from values before candidate
+	float sorted[DETECT_MEDIAN_SIZE];
+	int count = std::min(fluxCount, DETECT_MEDIAN_SIZE);
+	memcpy(sorted, fluxHistory, count * sizeof(float));
+	float median = 0.0f;
+	if (count)
+	{
+		std::nth_element(sorted, sorted + count / 2, sorted + count);
+		median = sorted[count / 2];
+	}
+
+	float candidate = fluxValues[1];
+	if (fluxCount && candidate > fluxValues[0] && candidate >= fluxValues[2] &&
+		candidate > config.onsetDelta + config.onsetLambda * median)
+	{
+		// middle of new part of candidate frame
+		unsigned long long position = inputFrames - hop - hop / 2;
+		unsigned long long gap = (unsigned long long)(config.onsetGap * config.sampleRate);
+		if (!hasOnset || position - lastOnset >= gap)
+		{
+			PushEvent(DETECT_ONSET, candidate, 0.0f, position);
+			lastOnset = position;
+			hasOnset = true;
+		}
+	}
+
+	if (inputFrames > (unsigned long long)hop)
+	{
+		fluxHistory[fluxCount % DETECT_MEDIAN_SIZE] = candidate;
+		fluxCount++;
+	}
+}
+
+/*******************************************
+* AnalysePitch():
+* NSDF of decimated frame and key maxima
+*******************************************/
+void AuEngine::Detector::AnalysePitch()
+{
+	int size = pitchSize;
+	int tail = size - pitchPos;
+	memcpy(frame.data(), pitchHistory.data() + pitchPos, tail * sizeof(float));
+	memcpy(frame.data() + tail, pitchHistory.data(), pitchPos * sizeof(float));
+	memset(frame.data() + size, 0, size * sizeof(float));
+
+	float energy = 0.0f;
+	for (int i = 0; i < size; i++) { energy += frame[i] * frame[i]; }
+
+	float newPitch = 0.0f;
+	float newClarity = 0.0f;
+	if (energy > size * DETECT_SILENCE_RMS * DETECT_SILENCE_RMS)
+	{
+		// autocorrelation without wrap (zeros at second half)
+		pitchPlan.ForwardReal(frame.data(), re.data(), im.data());
+		for (int j = 0; j <= size; j++)
+		{
+			re[j] = re[j] * re[j] + im[j] * im[j];
+			im[j] = 0.0f;
+		}
+		pitchPlan.InverseReal(re.data(), im.data(), nsdf.data());
+
+		double pitchRate = config.sampleRate / decimation;
+		int minLag = std::max(2, (int)(pitchRate / config.maxPitch));
+		int maxLag = std::min(size / 2, (int)(pitchRate / config.minPitch) + 1);
+
+		float m = 2.0f * nsdf[0];
+		for (int t = 0; t <= maxLag; t++)
+		{
+			float r = nsdf[t];
+			nsdf[t] = m > 0.0f ? 2.0f * r / m : 0.0f;
+			m -= frame[t] * frame[t] + frame[size - 1 - t] * frame[size - 1 - t];
+		}
+
+		// key maxima: highest point of every positive part after first negative one
+		int keyLag[64];
+		float keyValue[64];
+		int keys = 0;
+		float highest = 0.0f;
+		bool wasNegative = false;
+		int best = 0;
+		for (int t = 1; t < maxLag; t++)
+		{
+			if (nsdf[t] < 0.0f)
+			{
+				if (best && keys < 64)
+				{
+					keyLag[keys] = best;
+					keyValue[keys++] = nsdf[best];
+					highest = std::max(highest, nsdf[best]);
+				}
+				wasNegative = true;
+				best = 0;
+				continue;
+			}
+			if (wasNegative && t >= minLag && (!best || nsdf[t] > nsdf[best])) { best = t; }
+		}
+		if (best && keys < 64 && best < maxLag - 1)
+		{
+			keyLag[keys] = best;
+			keyValue[keys++] = nsdf[best];
+			highest = std::max(highest, nsdf[best]);
+		}
+
+		for (int i = 0; i < keys; i++)
+		{
+			if (keyValue[i] < DETECT_KEY_THRESHOLD * highest) { continue; }
+
+			int t = keyLag[i];
+			float a = nsdf[t - 1];
+			float b = nsdf[t];
+			float c = nsdf[t + 1];
+			float denom = a - 2.0f * b + c;
+			float offset = denom < 0.0f ? 0.5f * (a - c) / denom : 0.0f;
+			newClarity = b - 0.25f * (a - c) * offset;
+			if (newClarity >= config.clarity) { newPitch = (float)(pitchRate / (t + offset)); }
+			break;
+		}
+	}
+
+	pitch = newPitch;
+	clarity = newClarity;
+
+	// event only for new note or lost pitch
+	unsigned long long center = (unsigned long long)size * decimation / 2;
+	unsigned long long position = inputFrames > center ? inputFrames - center : 0;
+	if (pitch > 0.0f)
+	{
+		if (lastPitch <= 0.0f || fabsf(1200.0f * log2f(pitch / lastPitch)) > DETECT_PITCH_CHANGE)
+		{
+			PushEvent(DETECT_PITCH, pitch, clarity, position);
+			lastPitch = pitch;
+		}
+	}
+	else if (lastPitch > 0.0f)
+	{
+		PushEvent(DETECT_PITCH, 0.0f, clarity, position);
+		lastPitch = 0.0f;
+	}
+}
+
+/*******************************************
+* PushEvent():
+* Whole event or nothing
+*******************************************/
+void AuEngine::Detector::PushEvent(int iType, float fValue, float fClarity, unsigned long long frame)
+{
+	if (events.GetWriteAvailable() < sizeof(DetectorEvent))
+	{
+		dropped++;
+		return;
+	}
+
+	DetectorEvent event = { iType, fValue, fClarity, frame };
+	events.Write(&event, sizeof(DetectorEvent));
+}
+
+/*******************************************
+* PopEvent():
+* Take next event (consumer thread)
+*******************************************/
+bool AuEngine::Detector::PopEvent(DetectorEvent* pEvent)
+{
+	if (events.GetReadAvailable() < sizeof(DetectorEvent)) { return false; }
+	events.Read(pEvent, sizeof(DetectorEvent));
+	return true;
+}
+
+/*******************************************
+* DetectFile():
+* Analyse whole file, sample rate of
+* config is taken from file
+*******************************************/
+void AuEngine::DetectFile(const char* lpPath, const DetectorConfig& config, std::vector<DetectorEvent>* pEvents)
+{
+	TrackReader reader;
+	reader.Open(lpPath);
+
+	DetectorConfig fileConfig = config;
+	fileConfig.sampleRate = reader.GetSampleRate();
+
+	Detector detector;
+	detector.Create(fileConfig);
+
+	int channels = reader.GetChannels();
+	std::vector<float> buffer((size_t)TRACK_READ_FRAMES * channels);
+	DetectorEvent event;
+
+	size_t read;
+	while ((read = reader.Read(buffer.data(), TRACK_READ_FRAMES, channels)) > 0)
+	{
+		detector.Process(buffer.data(), read, channels);
+		while (detector.PopEvent(&event)) { pEvents->push_back(event); }
+	}
+
+	Msg("AuEngine: Detector events: ", (int)pEvents->size());
+}
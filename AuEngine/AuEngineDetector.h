@@ -0,0 +1,140 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineDetector.h:
+// header for pitch and onset detector
+/////////////////////////////////
+#pragma once
+#include "AuEngine.h"
+#include "AuEngineFFT.h"
+#include "AuEngineRing.h"
+#include <vector>
+
+#define DETECT_QUEUE_EVENTS		1024			// events before consumer reads them
+#define DETECT_MEDIAN_SIZE		9				// flux values for adaptive threshold
+#define DETECT_MAX_DECIMATION	4				// for pitch analysis
+#define DETECT_KEY_THRESHOLD	0.9f			// part of highest NSDF maximum (McLeod)
+#define DETECT_SILENCE_RMS		1e-4f			// quieter frames have no pitch
+#define DETECT_PITCH_CHANGE		50.0f			// cents, smaller changes give no event
+#define DETECT_COMPRESSION		10.0f			// log(1 + C * |X|) before flux
+
+/***********************************************
+* struct DetectorConfig:
+* frameSize - onset FFT, power of two
+* hop       - frames between analyses
+* clarity   - NSDF peak for voiced frame
+* threshold of onset is
+* onsetDelta + onsetLambda * median(flux)
+***********************************
+* struct DetectorEvent:
+* DETECT_ONSET - value is flux
+* DETECT_PITCH - value is frequency (0 if
+* sound lost pitch), clarity from NSDF
+* frame is input frame of event
+***********************************
+* class Detector:
+* Spectral flux onset detector and McLeod
+* pitch tracker (NSDF, autocorrelation by
+* FFT). Pitch is analysed at decimated
+* signal, period of sound is the same and
+* FFT is 4 times smaller.
+* All memory is taken at Create(), so
+* Process() can be called from audio
+* thread. Events go to lock-free queue,
+* PopEvent() is for other thread (one
+* consumer). If queue is full, events are
+* dropped and counted
+***********************************
+* DetectFile():
+* Offline analysis of WAV file, for
+* slicing of sample libraries
+***********************************************/
+namespace AuEngine
+{
+	enum DetectorEventType
+	{
+		DETECT_ONSET,
+		DETECT_PITCH
+	};
+
+	struct DetectorConfig
+	{
+		double sampleRate = 48000.0;
+		int frameSize = 2048;
+		int hop = 512;
+		float minPitch = 50.0f;
+		float maxPitch = 2000.0f;
+		float clarity = 0.8f;
+		float onsetDelta = 0.003f;				// flux is mean over bins
+		float onsetLambda = 1.5f;
+		float onsetGap = 0.05f;					// seconds between onsets
+	};
+
+	struct DetectorEvent
+	{
+		int type;
+		float value;
+		float clarity;
+		unsigned long long frame;
+	};
+
+	class Detector
+	{
+	public:
+		Detector() {}
+		DLL_API void Create(const DetectorConfig& config);
+		DLL_API void Destroy();
+		DLL_API void Reset();
+		DLL_API void Process(const float* pInput, size_t frames, int iChannels);
+		DLL_API bool PopEvent(DetectorEvent* pEvent);
+
+		float GetPitch() const { return pitch; }
+		float GetClarity() const { return clarity; }
+		float GetFlux() const { return fluxValues[0]; }
+		size_t GetDropped() const { return dropped; }
+		int GetHop() const { return hop; }
+
+	private:
+		void AnalyseOnset();
+		void AnalysePitch();
+		void PushEvent(int iType, float fValue, float fClarity, unsigned long long frame);
+
+		DetectorConfig config;
+		FFTPlan onsetPlan;
+		FFTPlan pitchPlan;
+		RingBuffer events;
+
+		std::vector<float> history;				// mono input, ring of frameSize
+		std::vector<float> pitchHistory;		// decimated input, ring of pitchSize
+		std::vector<float> window;
+		std::vector<float> frame;
+		std::vector<float> re;
+		std::vector<float> im;
+		std::vector<float> magnitudes;			// of last frame, for flux
+		std::vector<float> nsdf;
+
+		float fluxValues[3];					// current and two previous
+		float fluxHistory[DETECT_MEDIAN_SIZE];
+		int fluxCount = 0;
+		unsigned long long lastOnset = 0;
+		bool hasOnset = false;
+
+		int hop = 0;
+		int historyPos = 0;
+		int pitchSize = 0;						// NSDF window
+		int pitchPos = 0;
+		int decimation = 1;
+		int decimCount = 0;
+		float decimSum = 0.0f;
+		unsigned long long inputFrames = 0;
+
+		float pitch = 0.0f;
+		float clarity = 0.0f;
+		float lastPitch = 0.0f;					// last sent to queue
+		size_t dropped = 0;
+	};
+
+	DLL_API void DetectFile(const char* lpPath, const DetectorConfig& config, std::vector<DetectorEvent>* pEvents);
+};
@@ -0,0 +1,335 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineDevices.cpp:
+// device cache
+/////////////////////////////////
+
+/*******************************************
+* Device cache:
+* Pa_IsFormatSupported() opens driver for
+* every call, so sweep of all devices and
+* rates can take seconds. We make it once
+* in background thread at startup and keep
+* result at DEVICE_CACHE_FILE. At next start
+* devices with the same signature (host API,
+* name, channels, default rate) take rates
+* from file and only new devices are probed.
+*
+* On hot-plug (WM_DEVICECHANGE) UI calls
+* Invalidate(). PortAudio isn't thread
+* safe and enumerates devices only at
+* Pa_Initialize(), so cache can't be
+* rebuilt at UI or background thread while
+* stream lives. Stale cache is rebuilt by
+* WaitReady(), which every stream opener
+* calls before Pa_Initialize(), and by
+* playlist between streams. If PortAudio
+* is still held by other stream, old list
+* is kept and cache stays stale.
+*******************************************/
+
+#include "AuEngineDevices.h"
+#include <fstream>
+#include <sstream>
+#include <map>
+
+const double AuEngine::standardSampleRates[DEVICE_RATES_COUNT] = { 8000.0, 9600.0, 11025.0, 12000.0, 16000.0,
+	22050.0, 24000.0, 32000.0, 44100.0, 48000.0, 88200.0, 96000.0, 192000.0 };
+
+static AuEngine::DeviceCache deviceCache;
+
+/*******************************************
+* GetDeviceCache():
+* Global cache of devices
+*******************************************/
+AuEngine::DeviceCache& AuEngine::GetDeviceCache()
+{
+	return deviceCache;
+}
+
+/*******************************************
+* BuildAsync():
+* Start building in background thread
+*******************************************/
+void AuEngine::DeviceCache::BuildAsync()
+{
+	std::lock_guard<std::mutex> lock(buildMutex);
+	if (buildThread.joinable()) { buildThread.join(); }
+
+	isReady.store(false, std::memory_order_release);
+	buildThread = std::thread(&DeviceCache::Build, this);
+}
+
+/*******************************************
+* WaitReady():
+* Wait for build (or build now, if it was
+* never started or devices were changed).
+* Call it before stream is opened
+*******************************************/
+void AuEngine::DeviceCache::WaitReady()
+{
+	std::lock_guard<std::mutex> lock(buildMutex);
+	if (buildThread.joinable()) { buildThread.join(); }
+	if (!IsReady() || IsStale()) { Build(); }
+}
+
+/*******************************************
+* Invalidate():
+* Devices were changed: rebuild list at
+* next WaitReady(). Any thread
+*******************************************/
+void AuEngine::DeviceCache::Invalidate()
+{
+	Msg("AuEngine: Devices changed, cache will be rebuilt");
+	isStale.store(true, std::memory_order_release);
+}
+
+/*******************************************
+* Shutdown():
+* Stop build and release PortAudio
+*******************************************/
+void AuEngine::DeviceCache::Shutdown()
+{
+	std::lock_guard<std::mutex> lock(buildMutex);
+	if (buildThread.joinable()) { buildThread.join(); }
+	if (isInitialized)
+	{
+		Pa_Terminate();
+		isInitialized = false;
+	}
+	isReady.store(false, std::memory_order_release);
+	retired.clear();
+}
+
+/*******************************************
+* Build():
+* Enumerate and probe all devices
+*******************************************/
+void AuEngine::DeviceCache::Build()
+{
+	// re-init, so PortAudio enumerates devices again. If other stream
+	// still holds it, enumeration would be the old one: wait for next call
+	isStale.store(false, std::memory_order_release);
+	if (isInitialized) { Pa_Terminate(); }
+	bool isHeld = Pa_GetDeviceCount() != paNotInitialized;
+	isInitialized = Pa_Initialize() == paNoError;
+	if (isHeld && IsReady())
+	{
+		Msg("AuEngine: PortAudio is in use, device cache is kept");
+		isStale.store(true, std::memory_order_release);
+		return;
+	}
+	if (!isInitialized)
+	{
+		Msg("AuEngine: Can't init PortAudio for device cache");
+		Publish(std::vector<DeviceCaps>());
+		return;
+	}
+
+	std::vector<DeviceCaps> cached;
+	LoadFile(&cached);
+
+	int count = Pa_GetDeviceCount();
+	std::vector<DeviceCaps> list(count > 0 ? count : 0);
+	int probed = 0;
+	for (int i = 0; i < count; i++)
+	{
+		const PaDeviceInfo* pInfo = Pa_GetDeviceInfo(i);
+		DeviceCaps& caps = list[i];
+		caps.name = pInfo->name;
+		caps.hostApi = Pa_GetHostApiInfo(pInfo->hostApi)->name;
+		caps.maxInputChannels = pInfo->maxInputChannels;
+		caps.maxOutputChannels = pInfo->maxOutputChannels;
+		caps.defaultSampleRate = pInfo->defaultSampleRate;
+		caps.defaultLowInputLatency = pInfo->defaultLowInputLatency;
+		caps.defaultLowOutputLatency = pInfo->defaultLowOutputLatency;
+		caps.defaultHighInputLatency = pInfo->defaultHighInputLatency;
+		caps.defaultHighOutputLatency = pInfo->defaultHighOutputLatency;
+
+		std::string signature = Signature(caps);
+		bool isCached = false;
+		for (size_t u = 0; u < cached.size(); u++)
+		{
+			if (cached[u].name == signature)
+			{
+				caps.inputRates = cached[u].inputRates;
+				caps.outputRates = cached[u].outputRates;
+				isCached = true;
+				break;
+			}
+		}
+
+		if (!isCached)
+		{
+			Probe(i, &caps);
+			probed++;
+		}
+	}
+
+	if (probed) { SaveFile(list); }
+	Publish(std::move(list));
+	Msg("AuEngine: Device cache is ready, probed devices: ", probed);
+}
+
+/*******************************************
+* Publish():
+* Swap list for readers, old one is kept
+* for pointers which readers may hold
+*******************************************/
+void AuEngine::DeviceCache::Publish(std::vector<DeviceCaps>&& list)
+{
+	std::shared_ptr<const std::vector<DeviceCaps>> fresh = std::make_shared<const std::vector<DeviceCaps>>(std::move(list));
+	std::shared_ptr<const std::vector<DeviceCaps>> old = std::atomic_exchange(&devices, fresh);
+	if (old) { retired.push_back(old); }
+	isReady.store(true, std::memory_order_release);
+}
+
+/*******************************************
+* Probe():
+* Check all standard rates of device
+* (input and output separately)
+*******************************************/
+void AuEngine::DeviceCache::Probe(PaDeviceIndex index, DeviceCaps* pCaps)
+{
+	PaStreamParameters parameters;
+	parameters.device = index;
+	parameters.sampleFormat = paInt16;
+	parameters.suggestedLatency = 0;			// ignored by Pa_IsFormatSupported()
+	parameters.hostApiSpecificStreamInfo = NULL;
+
+	pCaps->inputRates = 0;
+	pCaps->outputRates = 0;
+	for (int u = 0; u < DEVICE_RATES_COUNT; u++)
+	{
+		if (pCaps->maxInputChannels > 0)
+		{
+			parameters.channelCount = pCaps->maxInputChannels;
+			if (Pa_IsFormatSupported(&parameters, NULL, standardSampleRates[u]) == paFormatIsSupported)
+			{
+				pCaps->inputRates |= 1u << u;
+			}
+		}
+		if (pCaps->maxOutputChannels > 0)
+		{
+			parameters.channelCount = pCaps->maxOutputChannels;
+			if (Pa_IsFormatSupported(NULL, &parameters, standardSampleRates[u]) == paFormatIsSupported)
+			{
+				pCaps->outputRates |= 1u << u;
+			}
+		}
+	}
+}
+
+/*******************************************
+* Signature():
+* Key of device at cache file
+*******************************************/
+std::string AuEngine::DeviceCache::Signature(const DeviceCaps& caps)
+{
+	std::ostringstream stream;
+	stream << caps.hostApi << '|' << caps.name << '|' << caps.maxInputChannels << '|'
+		<< caps.maxOutputChannels << '|' << (int)caps.defaultSampleRate;
+	return stream.str();
+}
+
+/*******************************************
+* LoadFile():
+* Read cache file. Only signature and
+* rates are used ('name' keeps signature)
+*******************************************/
+void AuEngine::DeviceCache::LoadFile(std::vector<DeviceCaps>* pCached)
+{
+	std::ifstream file(DEVICE_CACHE_FILE);
+	if (!file) { return; }
+
+	int version = 0;
+	std::string line;
+	if (!std::getline(file, line) || sscanf(line.c_str(), "AuDevices %d", &version) != 1 || version != DEVICE_CACHE_VERSION)
+	{
+		Msg("AuEngine: Device cache file is old, ignored");
+		return;
+	}
+
+	// "inputRates outputRates signature"
+	while (std::getline(file, line))
+	{
+		DeviceCaps caps = {};
+		int offset = 0;
+		if (sscanf(line.c_str(), "%x %x %n", &caps.inputRates, &caps.outputRates, &offset) < 2 || !offset) { continue; }
+		caps.name = line.substr(offset);
+		pCached->push_back(caps);
+	}
+}
+
+/*******************************************
+* SaveFile():
+* Write cache file
+*******************************************/
+void AuEngine::DeviceCache::SaveFile(const std::vector<DeviceCaps>& list)
+{
+	std::ofstream file(DEVICE_CACHE_FILE, std::ios::trunc);
+	if (!file)
+	{
+		Msg("AuEngine: Can't write device cache file");
+		return;
+	}
+
+	file << "AuDevices " << DEVICE_CACHE_VERSION << '\n' << std::hex;
+	for (size_t i = 0; i < list.size(); i++)
+	{
+		file << list[i].inputRates << ' ' << list[i].outputRates << ' ' << Signature(list[i]) << '\n';
+	}
+}
+
+/*******************************************
+* GetDevice():
+* Caps by PortAudio index (NULL if cache
+* isn't ready or index is bad)
+*******************************************/
+const AuEngine::DeviceCaps* AuEngine::DeviceCache::GetDevice(PaDeviceIndex index)
+{
+	std::shared_ptr<const std::vector<DeviceCaps>> list = std::atomic_load(&devices);
+	if (!IsReady() || !list || index < 0 || index >= (int)list->size()) { return NULL; }
+	return &(*list)[index];
+}
+
+/*******************************************
+* IsRateSupported():
+* Check rate from cache. Rate which isn't
+* standard is checked by driver
+*******************************************/
+bool AuEngine::DeviceCache::IsRateSupported(PaDeviceIndex index, double dSampleRate, bool isInput)
+{
+	const DeviceCaps* pCaps = GetDevice(index);
+	if (!pCaps) { return false; }
+
+	for (int u = 0; u < DEVICE_RATES_COUNT; u++)
+	{
+		if (standardSampleRates[u] == dSampleRate)
+		{
+			return ((isInput ? pCaps->inputRates : pCaps->outputRates) >> u) & 1;
+		}
+	}
+
+	PaStreamParameters parameters;
+	parameters.device = index;
+	parameters.channelCount = isInput ? pCaps->maxInputChannels : pCaps->maxOutputChannels;
+	parameters.sampleFormat = paInt16;
+	parameters.suggestedLatency = 0;
+	parameters.hostApiSpecificStreamInfo = NULL;
+	if (parameters.channelCount <= 0) { return false; }
+	return Pa_IsFormatSupported(isInput ? &parameters : NULL, isInput ? NULL : &parameters, dSampleRate) == paFormatIsSupported;
+}
+
+/*******************************************
+* GetDevicesCount():
+* Count of devices at cache
+*******************************************/
+int AuEngine::DeviceCache::GetDevicesCount()
+{
+	std::shared_ptr<const std::vector<DeviceCaps>> list = std::atomic_load(&devices);
+	return IsReady() && list ? (int)list->size() : 0;
+}
@@ -0,0 +1,90 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineDevices.h:
+// header for device cache
+/////////////////////////////////
+#pragma once
+#include "AuEngine.h"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define DEVICE_CACHE_FILE		"AuDevices.cache"
+#define DEVICE_RATES_COUNT		13
+#define DEVICE_CACHE_VERSION	1
+
+/***********************************************
+* struct DeviceCaps:
+* Capabilities of one device. Rates are
+* bit masks of standardSampleRates
+***********************************
+* class DeviceCache:
+* Probes all devices once (in background),
+* keeps result at disk and gives it by
+* device index in O(1). Devices with the
+* same signature are not probed again.
+* Invalidate() only marks cache as stale,
+* it's rebuilt by WaitReady() at thread
+* which opens streams, before it opens
+* one. List is published by atomic swap,
+* old lists live until Shutdown(), so
+* pointer from GetDevice() stays valid
+***********************************************/
+namespace AuEngine
+{
+	extern const double standardSampleRates[DEVICE_RATES_COUNT];
+
+	struct DeviceCaps
+	{
+		std::string name;
+		std::string hostApi;
+		int maxInputChannels;
+		int maxOutputChannels;
+		double defaultSampleRate;
+		double defaultLowInputLatency;
+		double defaultLowOutputLatency;
+		double defaultHighInputLatency;
+		double defaultHighOutputLatency;
+		unsigned int inputRates;			// bit i - standardSampleRates[i] is supported
+		unsigned int outputRates;
+	};
+
+	class DeviceCache
+	{
+	public:
+		DeviceCache() {}
+		~DeviceCache() { Shutdown(); }
+		DLL_API void BuildAsync();
+		DLL_API void WaitReady();
+		DLL_API void Invalidate();			// hot-plug: call on WM_DEVICECHANGE
+		DLL_API void Shutdown();
+		DLL_API const DeviceCaps* GetDevice(PaDeviceIndex index);
+		DLL_API bool IsRateSupported(PaDeviceIndex index, double dSampleRate, bool isInput);
+		DLL_API int GetDevicesCount();
+		bool IsReady() const { return isReady.load(std::memory_order_acquire); }
+		bool IsStale() const { return isStale.load(std::memory_order_acquire); }
+
+	private:
+		void Build();
+		void Probe(PaDeviceIndex index, DeviceCaps* pCaps);
+		void LoadFile(std::vector<DeviceCaps>* pCached);
+		void SaveFile(const std::vector<DeviceCaps>& list);
+		void Publish(std::vector<DeviceCaps>&& list);
+		static std::string Signature(const DeviceCaps& caps);
+
+		std::shared_ptr<const std::vector<DeviceCaps>> devices;	// std::atomic_load/atomic_store only
+		std::vector<std::shared_ptr<const std::vector<DeviceCaps>>> retired;
+		std::thread buildThread;
+		std::mutex buildMutex;				// never taken by audio thread
+		std::atomic<bool> isReady{ false };
+		std::atomic<bool> isStale{ false };	// devices were changed after build
+		bool isInitialized = false;
+	};
+
+	DLL_API DeviceCache& GetDeviceCache();
+};
@@ -0,0 +1,388 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineDirectReader.cpp:
+// batch file reader
+/////////////////////////////////
+
+/*******************************************
+* Direct reader:
+* For batch analysis disk is the limit, and
+* fread() copies every byte from system
+* cache. Files are opened with
+* FILE_FLAG_NO_BUFFERING, so data goes
+* from disk to our aligned buffer and sink
+* reads it from there.
+*
+* Every block has whole frames: read is
+* made from sector before first frame to
+* sector after last one (at most two extra
+* sectors), sink gets pointer to first
+* frame. So blocks don't depend on each
+* other and can come in any order.
+*
+* IOCP backend keeps READER_QUEUE_DEPTH
+* reads for each of READER_MAX_FILES
+* files. Worker which takes completion
+* gives block to sink and sends the same
+* buffer to next read. If system can't
+* make port, THREADS backend is used:
+* every worker makes positioned reads.
+*******************************************/
+
+#include "AuEngineDirectReader.h"
+#include "AuEngineTrack.h"
+
+/*******************************************
+* AddFile():
+* Add file to batch (before Start())
+*******************************************/
+void AuEngine::DirectReader::AddFile(const char* lpPath)
+{
+	files.push_back(lpPath);
+}
+
+/*******************************************
+* Start():
+* Open first files and start workers
+*******************************************/
+void AuEngine::DirectReader::Start(BlockSink* pBlockSink, int iWorkers, ReaderBackend backend)
+{
+	Wait();
+	if (iWorkers <= 0) { iWorkers = 1; }
+
+	pSink = pBlockSink;
+	nextFile = 0;
+	filesDone = 0;
+	slotCursor = 0;
+	bytesRead = 0;
+
+	activeBackend = READER_THREADS;
+	if (backend != READER_THREADS)
+	{
+		hPort = CreateIoCompletionPort(INVALID_HANDLE_VALUE, NULL, 0, iWorkers);
+		if (hPort) { activeBackend = READER_IOCP; }
+		else { Msg("AuEngine: No completion port, reader uses threads"); }
+	}
+
+	// IOCP: buffers for all reads in flight, THREADS: buffer for every worker
+	size_t count = activeBackend == READER_IOCP ? READER_MAX_FILES * READER_QUEUE_DEPTH : iWorkers;
+	requests = std::vector<Request>(count);
+	for (size_t i = 0; i < count; i++)
+	{
+		requests[i].pBuffer = (uint8_t*)_aligned_malloc(READER_BUFFER_SIZE, READER_SECTOR_SIZE);
+		if (!requests[i].pBuffer)
+		{
+			// no event yet, so Wait() doesn't wait for workers which never started
+			for (size_t u = 0; u < i; u++) { _aligned_free(requests[u].pBuffer); }
+			requests.clear();
+			if (hPort) { CloseHandle(hPort); }
+			hPort = NULL;
+			THROW_EXCEPTION(AuEngine::OpSet::MEMORY_ERROR);
+		}
+	}
+	hDoneEvent = CreateEventA(NULL, TRUE, FALSE, NULL);
+
+	// workers first: FinishIfDone() must know them
+	slots = std::vector<FileSlot>(READER_MAX_FILES);
+	{
+		std::lock_guard<std::mutex> lock(scheduleMutex);
+		for (int i = 0; i < iWorkers; i++)
+		{
+			if (activeBackend == READER_IOCP) { workers.push_back(std::thread(&DirectReader::CompletionWorker, this)); }
+			else { workers.push_back(std::thread(&DirectReader::ThreadWorker, this, &requests[i])); }
+		}
+		for (size_t i = 0; i < slots.size(); i++) { OpenSlot(slots[i]); }
+		FinishIfDone();
+	}
+
+	if (activeBackend == READER_IOCP)
+	{
+		for (size_t i = 0; i < requests.size(); i++) { Submit(&requests[i]); }
+	}
+}
+
+/*******************************************
+* Wait():
+* Wait for all files and free buffers
+*******************************************/
+void AuEngine::DirectReader::Wait()
+{
+	if (!hDoneEvent) { return; }
+
+	WaitForSingleObject(hDoneEvent, INFINITE);
+	for (size_t i = 0; i < workers.size(); i++) { workers[i].join(); }
+	workers.clear();
+
+	for (size_t i = 0; i < requests.size(); i++) { _aligned_free(requests[i].pBuffer); }
+	requests.clear();
+	idleRequests.clear();
+	slots.clear();
+
+	if (hPort) { CloseHandle(hPort); }
+	CloseHandle(hDoneEvent);
+	hPort = NULL;
+	hDoneEvent = NULL;
+}
+
+/*******************************************
+* OpenSlot():
+* Open next file of batch at slot (lock
+* must be taken)
+*******************************************/
+bool AuEngine::DirectReader::OpenSlot(FileSlot& slot)
+{
+	while (nextFile < files.size())
+	{
+		int file = (int)nextFile++;
+		const char* lpPath = files[file].c_str();
+
+		// header is small: parse it with usual reader
+		AuEngine::TrackReader header;
+		long long dataOffset = -1;
+		try
+		{
+			header.Open(lpPath);
+			const std::vector<AuEngine::TrackChunk>& chunks = header.GetChunks();
+			for (size_t i = 0; i < chunks.size(); i++)
+			{
+				if (!memcmp(chunks[i].tag, "data", 4)) { dataOffset = chunks[i].offset; }
+			}
+		}
+		catch (AuEngine::Exception&)
+		{
+			Msg("AuEngine: Reader can't parse file: " + files[file]);
+		}
+
+		DWORD flags = FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN | (activeBackend == READER_IOCP ? FILE_FLAG_OVERLAPPED : 0);
+		HANDLE hFile = INVALID_HANDLE_VALUE;
+		if (dataOffset >= 0)
+		{
+			hFile = CreateFileA(lpPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, flags, NULL);
+
+			// some file systems don't support unbuffered reads
+			if (hFile == INVALID_HANDLE_VALUE)
+			{
+				hFile = CreateFileA(lpPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, flags & ~FILE_FLAG_NO_BUFFERING, NULL);
+			}
+			if (hFile != INVALID_HANDLE_VALUE && hPort && !CreateIoCompletionPort(hFile, hPort, 0, 0))
+			{
+				CloseHandle(hFile);
+				hFile = INVALID_HANDLE_VALUE;
+			}
+		}
+
+		if (hFile == INVALID_HANDLE_VALUE || !header.GetFrames())
+		{
+			if (hFile != INVALID_HANDLE_VALUE) { CloseHandle(hFile); }
+			pSink->OnFileDone(file, dataOffset >= 0);
+			filesDone++;
+			continue;
+		}
+
+		slot.hFile = hFile;
+		slot.dataOffset = dataOffset;
+		slot.frames = header.GetFrames();
+		slot.info.file = file;
+		slot.info.channels = header.GetChannels();
+		slot.info.sampleRate = header.GetSampleRate();
+		slot.info.format = header.GetFormat();
+		slot.info.frameSize = header.GetChannels() * Pa_GetSampleSize(header.GetFormat());
+		slot.framesPerBlock = READER_BLOCK_SIZE / slot.info.frameSize;
+		slot.blocks = (slot.frames + slot.framesPerBlock - 1) / slot.framesPerBlock;
+		slot.nextBlock = 0;
+		slot.blocksDone = 0;
+		slot.inFlight = 0;
+		slot.isOk = true;
+		return true;
+	}
+	return false;
+}
+
+/*******************************************
+* FinishIfDone():
+* Wake Wait() and stop workers after last
+* file (lock must be taken)
+*******************************************/
+void AuEngine::DirectReader::FinishIfDone()
+{
+	if (filesDone != files.size()) { return; }
+
+	SetEvent(hDoneEvent);
+	if (activeBackend == READER_IOCP)
+	{
+		for (size_t i = 0; i < workers.size(); i++) { PostQueuedCompletionStatus(hPort, 0, 0, NULL); }
+	}
+}
+
+/*******************************************
+* Pick():
+* Take next block of some file (files
+* by turn, lock must be taken)
+*******************************************/
+AuEngine::DirectReader::PickResult AuEngine::DirectReader::Pick(Request* pRequest, bool isLimited)
+{
+	bool isWork = false;
+	for (size_t n = 0; n < slots.size(); n++)
+	{
+		int index = (int)((slotCursor + n) % slots.size());
+		FileSlot& slot = slots[index];
+		if (slot.hFile == INVALID_HANDLE_VALUE || slot.nextBlock >= slot.blocks) { continue; }
+
+		isWork = true;
+		if (isLimited && slot.inFlight >= READER_QUEUE_DEPTH) { continue; }
+
+		unsigned long long firstFrame = slot.nextBlock * slot.framesPerBlock;
+		unsigned long long frames = slot.frames - firstFrame < slot.framesPerBlock ? slot.frames - firstFrame : slot.framesPerBlock;
+		long long start = slot.dataOffset + (long long)(firstFrame * slot.info.frameSize);
+		long long end = start + (long long)(frames * slot.info.frameSize);
+		long long alignedStart = start & ~(long long)(READER_SECTOR_SIZE - 1);
+		long long alignedEnd = (end + READER_SECTOR_SIZE - 1) & ~(long long)(READER_SECTOR_SIZE - 1);
+
+		memset(&pRequest->overlapped, 0, sizeof(pRequest->overlapped));
+		pRequest->overlapped.Offset = (DWORD)alignedStart;
+		pRequest->overlapped.OffsetHigh = (DWORD)(alignedStart >> 32);
+		pRequest->slot = index;
+		pRequest->block = slot.nextBlock;
+		pRequest->skip = (size_t)(start - alignedStart);
+		pRequest->bytes = (DWORD)(alignedEnd - alignedStart);
+
+		slot.nextBlock++;
+		slot.inFlight++;
+		slotCursor = index + 1;
+		return PICK_OK;
+	}
+	return isWork ? PICK_WAIT : PICK_NONE;
+}
+
+/*******************************************
+* Submit():
+* Send overlapped read (IOCP backend)
+*******************************************/
+void AuEngine::DirectReader::Submit(Request* pRequest)
+{
+	{
+		std::lock_guard<std::mutex> lock(scheduleMutex);
+		if (Pick(pRequest, true) != PICK_OK)
+		{
+			idleRequests.push_back(pRequest);
+			return;
+		}
+	}
+
+	// completion comes to port even if read was done at once
+	if (!ReadFile(slots[pRequest->slot].hFile, pRequest->pBuffer, pRequest->bytes, NULL, &pRequest->overlapped) &&
+		GetLastError() != ERROR_IO_PENDING)
+	{
+		Complete(pRequest, 0, false);
+	}
+}
+
+/*******************************************
+* Complete():
+* Give block to sink, close finished file
+* and reuse buffer
+*******************************************/
+void AuEngine::DirectReader::Complete(Request* pRequest, DWORD bytes, bool isOk)
+{
+	FileSlot& slot = slots[pRequest->slot];
+	unsigned long long firstFrame = pRequest->block * slot.framesPerBlock;
+	size_t frames = (size_t)(slot.frames - firstFrame < slot.framesPerBlock ? slot.frames - firstFrame : slot.framesPerBlock);
+
+	// short read: file is shorter than header says
+	size_t available = isOk && bytes > pRequest->skip ? (bytes - pRequest->skip) / slot.info.frameSize : 0;
+	if (available < frames)
+	{
+		frames = available;
+		isOk = false;
+	}
+
+	if (frames)
+	{
+		ReadBlock block = slot.info;
+		block.firstFrame = firstFrame;
+		block.frames = frames;
+		block.pFrames = pRequest->pBuffer + pRequest->skip;
+		pSink->OnBlock(block);
+	}
+	bytesRead.fetch_add(bytes, std::memory_order_relaxed);
+
+	std::vector<Request*> wake;
+	{
+		std::lock_guard<std::mutex> lock(scheduleMutex);
+		slot.blocksDone++;
+		slot.inFlight--;
+		if (!isOk)
+		{
+			// rest of file is skipped
+			Msg("AuEngine: Reader can't read file: " + files[slot.info.file]);
+			slot.isOk = false;
+			slot.blocksDone += slot.blocks - slot.nextBlock;
+			slot.nextBlock = slot.blocks;
+		}
+
+		if (slot.blocksDone == slot.blocks && !slot.inFlight)
+		{
+			CloseHandle(slot.hFile);
+			slot.hFile = INVALID_HANDLE_VALUE;
+			pSink->OnFileDone(slot.info.file, slot.isOk);
+			filesDone++;
+			if (OpenSlot(slot)) { wake.swap(idleRequests); }
+			FinishIfDone();
+		}
+	}
+
+	if (activeBackend == READER_IOCP)
+	{
+		Submit(pRequest);
+		for (size_t i = 0; i < wake.size(); i++) { Submit(wake[i]); }
+	}
+}
+
+/*******************************************
+* CompletionWorker():
+* Take finished reads from port
+*******************************************/
+void AuEngine::DirectReader::CompletionWorker()
+{
+	while (true)
+	{
+		DWORD bytes = 0;
+		ULONG_PTR key = 0;
+		OVERLAPPED* pOverlapped = NULL;
+		BOOL isOk = GetQueuedCompletionStatus(hPort, &bytes, &key, &pOverlapped, INFINITE);
+		if (!pOverlapped) { break; }			// quit packet
+
+		Complete((Request*)pOverlapped, bytes, isOk != FALSE);
+	}
+}
+
+/*******************************************
+* ThreadWorker():
+* Positioned synchronous reads (fallback)
+*******************************************/
+void AuEngine::DirectReader::ThreadWorker(Request* pRequest)
+{
+	while (true)
+	{
+		PickResult result;
+		{
+			std::lock_guard<std::mutex> lock(scheduleMutex);
+			result = Pick(pRequest, false);
+			if (result != PICK_OK && filesDone == files.size()) { break; }
+		}
+
+		// other workers finish last blocks, next file comes after
+		if (result != PICK_OK)
+		{
+			WaitForSingleObject(hDoneEvent, 1);
+			continue;
+		}
+
+		DWORD bytes = 0;
+		BOOL isOk = ReadFile(slots[pRequest->slot].hFile, pRequest->pBuffer, pRequest->bytes, &bytes, &pRequest->overlapped);
+		Complete(pRequest, bytes, isOk != FALSE);
+	}
+}
@@ -0,0 +1,135 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineDirectReader.h:
+// header for batch file reader
+/////////////////////////////////
+#pragma once
+#include "AuEngine.h"
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define READER_SECTOR_SIZE		4096				// alignment for unbuffered I/O
+#define READER_BLOCK_SIZE		(1 << 20)			// audio bytes of one read
+#define READER_QUEUE_DEPTH		4					// reads in flight for one file
+#define READER_MAX_FILES		8					// files in flight
+#define READER_BUFFER_SIZE		(READER_BLOCK_SIZE + 2 * READER_SECTOR_SIZE)
+
+/***********************************************
+* struct ReadBlock:
+* Whole frames of one read. pFrames
+* points to I/O buffer (no copy) and is
+* valid only inside OnBlock()
+***********************************
+* class BlockSink:
+* Gets blocks from worker threads, in
+* any order and at the same time.
+* OnFileDone() is called under reader
+* lock: don't call reader from it
+***********************************
+* class DirectReader:
+* Reads list of WAV/RF64 files without
+* system cache. Backends:
+* IOCP - overlapped reads, READER_QUEUE_DEPTH
+*        for file and READER_MAX_FILES files
+*        in flight, workers take completions
+* THREADS - workers make positioned
+*        synchronous reads (fallback)
+***********************************************/
+namespace AuEngine
+{
+	enum ReaderBackend
+	{
+		READER_AUTO = 0,
+		READER_IOCP,
+		READER_THREADS
+	};
+
+	struct ReadBlock
+	{
+		int file;								// index by AddFile() order
+		unsigned long long firstFrame;
+		size_t frames;
+		const uint8_t* pFrames;
+		int channels;
+		int sampleRate;
+		int frameSize;
+		PaSampleFormat format;
+	};
+
+	class BlockSink
+	{
+	public:
+		virtual ~BlockSink() {}
+		virtual void OnBlock(const ReadBlock& block) = 0;
+		virtual void OnFileDone(int file, bool isOk) {}
+	};
+
+	class DirectReader
+	{
+	public:
+		DirectReader() {}
+		~DirectReader() { Wait(); }
+		DLL_API void AddFile(const char* lpPath);
+		DLL_API void Start(BlockSink* pSink, int iWorkers, ReaderBackend backend = READER_AUTO);
+		DLL_API void Wait();
+		ReaderBackend GetBackend() const { return activeBackend; }
+		unsigned long long GetBytesRead() const { return bytesRead.load(std::memory_order_relaxed); }
+
+	private:
+		struct FileSlot
+		{
+			HANDLE hFile = INVALID_HANDLE_VALUE;
+			int file = -1;
+			long long dataOffset = 0;
+			unsigned long long frames = 0;
+			size_t framesPerBlock = 0;
+			unsigned long long blocks = 0;
+			unsigned long long nextBlock = 0;
+			unsigned long long blocksDone = 0;
+			int inFlight = 0;
+			bool isOk = true;
+			ReadBlock info;
+		};
+
+		struct Request
+		{
+			OVERLAPPED overlapped;				// first: completion gives us Request*
+			uint8_t* pBuffer = NULL;
+			int slot = -1;
+			unsigned long long block = 0;
+			size_t skip = 0;					// bytes before first frame
+			DWORD bytes = 0;					// bytes to read
+		};
+
+		enum PickResult { PICK_OK, PICK_WAIT, PICK_NONE };
+
+		bool OpenSlot(FileSlot& slot);
+		void FinishIfDone();
+		PickResult Pick(Request* pRequest, bool isLimited);
+		void Submit(Request* pRequest);
+		void Complete(Request* pRequest, DWORD bytes, bool isOk);
+		void CompletionWorker();
+		void ThreadWorker(Request* pRequest);
+
+		std::vector<std::string> files;
+		std::vector<FileSlot> slots;
+		std::vector<Request> requests;
+		std::vector<Request*> idleRequests;
+		std::vector<std::thread> workers;
+		std::mutex scheduleMutex;				// never taken by audio thread
+		size_t nextFile = 0;
+		size_t filesDone = 0;
+		int slotCursor = 0;
+
+		BlockSink* pSink = NULL;
+		HANDLE hPort = NULL;
+		HANDLE hDoneEvent = NULL;
+		ReaderBackend activeBackend = READER_AUTO;
+		std::atomic<unsigned long long> bytesRead{ 0 };
+	};
+};
@@ -0,0 +1,525 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineDynamics.cpp:
+// dynamics processors
+/////////////////////////////////
+
+/*******************************************
+* Gain computer:
+* Works in dB, L is level, T threshold,
+* R ratio, W knee. Compressor:
+*   L - T < -W/2  : 0
+*   |L - T| <= W/2: (1/R - 1)(L - T + W/2)^2 / 2W
+*   L - T > W/2   : (1/R - 1)(L - T)
+* expander is the same below threshold
+* with (R - 1).
+*
+* Follower:
+* One-pole in dB with attack coefficient
+* when gain goes to more reduction (or
+* gate opens) and release coefficient
+* otherwise.
+*
+* Limiter:
+* Needed gain g[n] goes through moving
+* minimum of lookahead + 1 frames, release
+* follower (down at once, up slowly) and
+* moving average of the same length. Every
+* average around peak is made only from
+* values not bigger than gain of peak, and
+* the peak comes out of delay line exactly
+* when the window is over it. Gain reaches
+* its value with linear ramp, no clicks.
+*
+* True peak:
+* Detector at frame n is for time between
+* samples n - 6 and n - 5, so minimum is
+* one frame longer to cover both.
+* 4x polyphase interpolation (48 taps,
+* 12 for one phase, like BS.1770). One
+* input sample gives 4 phases, so 4 phases
+* are one SSE register. Even filter has no
+* phase at input sample, so the sample of
+* the same delay is checked too.
+*******************************************/
+
+#include "AuEngineDynamics.h"
+#include "AuEngineFIR.h"
+#include <algorithm>
+#include <string.h>
+#include <emmintrin.h>
+
+#define DB_TO_LOG2				0.16609640474f	// log2(10) / 20
+#define LOG2_TO_DB				6.02059991328f
+
+/*******************************************
+* FastLog2():
+* log2 for 4 positive values,
+* error < 2e-5
+*******************************************/
+static inline __m128 FastLog2(__m128 x)
+{
+	__m128i bits = _mm_castps_si128(x);
+	__m128 e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+	__m128 m = _mm_or_ps(_mm_castsi128_ps(_mm_and_si128(bits, _mm_set1_epi32(0x007FFFFF))), _mm_set1_ps(1.0f));
+
+	// log(m) = 2 atanh((m - 1) / (m + 1)), m at [1, 2)
+	__m128 y = _mm_div_ps(_mm_sub_ps(m, _mm_set1_ps(1.0f)), _mm_add_ps(m, _mm_set1_ps(1.0f)));
+	__m128 y2 = _mm_mul_ps(y, y);
+	__m128 p = _mm_add_ps(_mm_set1_ps(1.0f / 7.0f), _mm_mul_ps(y2, _mm_set1_ps(1.0f / 9.0f)));
+	p = _mm_add_ps(_mm_set1_ps(1.0f / 5.0f), _mm_mul_ps(y2, p));
+	p = _mm_add_ps(_mm_set1_ps(1.0f / 3.0f), _mm_mul_ps(y2, p));
+	p = _mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(y2, p));
+	p = _mm_mul_ps(_mm_mul_ps(y, p), _mm_set1_ps(2.88539008178f));		// 2 / ln(2)
+
+	return _mm_add_ps(e, p);
+}
+
+/*******************************************
+* FastExp2():
+* 2^x for 4 values at [-126, 126],
+* error < 2e-7
+*******************************************/
+static inline __m128 FastExp2(__m128 x)
+{
+	x = _mm_max_ps(_mm_min_ps(x, _mm_set1_ps(126.0f)), _mm_set1_ps(-126.0f));
+	__m128i i = _mm_cvtps_epi32(x);
+	__m128 z = _mm_mul_ps(_mm_sub_ps(x, _mm_cvtepi32_ps(i)), _mm_set1_ps(0.69314718056f));
+
+	// e^z, |z| <= ln(2) / 2
+	__m128 p = _mm_add_ps(_mm_set1_ps(1.0f / 120.0f), _mm_mul_ps(z, _mm_set1_ps(1.0f / 720.0f)));
+	p = _mm_add_ps(_mm_set1_ps(1.0f / 24.0f), _mm_mul_ps(z, p));
+	p = _mm_add_ps(_mm_set1_ps(1.0f / 6.0f), _mm_mul_ps(z, p));
+	p = _mm_add_ps(_mm_set1_ps(0.5f), _mm_mul_ps(z, p));
+	p = _mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(z, p));
+	p = _mm_add_ps(_mm_set1_ps(1.0f), _mm_mul_ps(z, p));
+
+	__m128 scale = _mm_castsi128_ps(_mm_slli_epi32(_mm_add_epi32(i, _mm_set1_epi32(127)), 23));
+	return _mm_mul_ps(p, scale);
+}
+
+/*******************************************
+* Create():
+* Check config and allocate buffers for
+* the biggest rate
+*******************************************/
+void AuEngine::Dynamics::Create(const DynamicsConfig& cfg, int iChannels)
+{
+	if (iChannels < 1 || iChannels > DYN_MAX_CHANNELS || cfg.sampleRate <= 0.0 || cfg.sampleRate > DYN_MAX_RATE ||
+		cfg.lookahead < 0.0f || cfg.lookahead > DYN_MAX_LOOKAHEAD || cfg.ratio < 1.0f || cfg.knee < 0.0f ||
+		cfg.attack < 0.0f || cfg.release < 0.0f || cfg.hold < 0.0f || cfg.range < 0.0f)
+	{
+		THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR);
+	}
+
+	config = cfg;
+	channels = iChannels;
+	threshold = cfg.threshold;
+
+	int maxLookahead = (int)ceil(cfg.lookahead * DYN_MAX_RATE);
+	lineSize = maxLookahead + DYN_TP_DELAY + DYN_BLOCK;
+	line.assign(channels * lineSize, 0.0f);
+	tpLine.assign(channels * (DYN_TP_TAPS - 1 + DYN_BLOCK), 0.0f);
+	planar.assign(channels * DYN_BLOCK, 0.0f);
+	minValues.assign(maxLookahead + 2, 0.0f);
+	minIndices.assign(maxLookahead + 2, 0);
+	avgRing.assign(maxLookahead + 1, 0.0f);
+
+	// prototype at 4x rate, every phase is normalized to 1 at DC
+	const int taps = DYN_TP_TAPS * DYN_TP_OVERSAMPLE;
+	std::vector<float> proto(taps);
+	DesignWindowedSinc(proto.data(), taps, FIR_LOWPASS, 0.5 * cfg.sampleRate, 0.0,
+		DYN_TP_OVERSAMPLE * cfg.sampleRate, FIR_KAISER_WINDOW, 80.0f);
+
+	tpCoefs.assign(taps, 0.0f);
+	for (int p = 0; p < DYN_TP_OVERSAMPLE; p++)
+	{
+		double sum = 0.0;
+		for (int j = 0; j < DYN_TP_TAPS; j++) { sum += proto[j * DYN_TP_OVERSAMPLE + p]; }
+		for (int j = 0; j < DYN_TP_TAPS; j++)
+		{
+			tpCoefs[j * DYN_TP_OVERSAMPLE + p] = (float)(proto[j * DYN_TP_OVERSAMPLE + p] / sum);
+		}
+	}
+
+	sampleRate = 0.0;
+	SetSampleRate(cfg.sampleRate);
+}
+
+/*******************************************
+* Destroy():
+* Free buffers
+*******************************************/
+void AuEngine::Dynamics::Destroy()
+{
+	line.clear();
+	tpLine.clear();
+	tpCoefs.clear();
+	planar.clear();
+	minValues.clear();
+	minIndices.clear();
+	avgRing.clear();
+	channels = 0;
+	delay = 0;
+}
+
+/*******************************************
+* Reset():
+* Clear delay lines and followers
+*******************************************/
+void AuEngine::Dynamics::Reset()
+{
+	std::fill(line.begin(), line.end(), 0.0f);
+	std::fill(tpLine.begin(), tpLine.end(), 0.0f);
+	std::fill(avgRing.begin(), avgRing.end(), 0.0f);
+
+	envelope = 0.0;
+	holdLeft = 0;
+	isOpen = false;
+	minHead = 0;
+	minCount = 0;
+	avgSum = 0.0;
+	avgPos = 0;
+	counter = 0;
+	reduction.store(0.0f, std::memory_order_relaxed);
+}
+
+/*******************************************
+* SetSampleRate():
+* Coefficients and delay for new rate
+*******************************************/
+void AuEngine::Dynamics::SetSampleRate(double dSampleRate)
+{
+	if (dSampleRate <= 0.0 || dSampleRate > DYN_MAX_RATE || dSampleRate == sampleRate || !channels) { return; }
+	sampleRate = dSampleRate;
+
+	lookahead = (int)(config.lookahead * sampleRate + 0.5);
+	delay = lookahead + (config.isTruePeak ? DYN_TP_DELAY : 0);
+	minWindow = lookahead + (config.isTruePeak ? 2 : 1);
+	attackCoef = config.attack > 0.0f ? exp(-1.0 / (config.attack * sampleRate)) : 0.0;
+	releaseCoef = config.release > 0.0f ? exp(-1.0 / (config.release * sampleRate)) : 0.0;
+	holdFrames = (int)(config.hold * sampleRate);
+	Reset();
+}
+
+/*******************************************
+* SetThreshold():
+* Taken at next block
+*******************************************/
+void AuEngine::Dynamics::SetThreshold(float fThreshold)
+{
+	threshold.store(fThreshold, std::memory_order_relaxed);
+}
+
+/*******************************************
+* DetectPeak():
+* Max of absolute values of all channels
+*******************************************/
+void AuEngine::Dynamics::DetectPeak(float** ppData, int iFrames)
+{
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	int i = 0;
+	for (; i + 4 <= iFrames; i += 4)
+	{
+		__m128 peak = _mm_setzero_ps();
+		for (int c = 0; c < channels; c++)
+		{
+			peak = _mm_max_ps(peak, _mm_and_ps(_mm_loadu_ps(ppData[c] + i), absMask));
+		}
+		_mm_storeu_ps(level + i, peak);
+	}
+
+	for (; i < iFrames; i++)
+	{
+		float peak = 0.0f;
+		for (int c = 0; c < channels; c++) { peak = std::max(peak, fabsf(ppData[c][i])); }
+		level[i] = peak;
+	}
+}
+
+/*******************************************
+* DetectTruePeak():
+* Max of 4 interpolated phases of all
+* channels
+*******************************************/
+void AuEngine::Dynamics::DetectTruePeak(float** ppData, int iFrames)
+{
+	const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+	const int tpSize = DYN_TP_TAPS - 1 + DYN_BLOCK;
+
+	for (int i = 0; i < iFrames; i++) { level[i] = 0.0f; }
+
+	for (int c = 0; c < channels; c++)
+	{
+		float* pLine = &tpLine[c * tpSize];
+		memcpy(pLine + DYN_TP_TAPS - 1, ppData[c], iFrames * sizeof(float));
+
+		for (int i = 0; i < iFrames; i++)
+		{
+			// phases of output 4 i + p, newest sample goes with tap 0
+			const float* pNewest = pLine + i + DYN_TP_TAPS - 1;
+			__m128 acc = _mm_setzero_ps();
+			for (int j = 0; j < DYN_TP_TAPS; j++)
+			{
+				acc = _mm_add_ps(acc, _mm_mul_ps(_mm_set1_ps(pNewest[-j]), _mm_loadu_ps(&tpCoefs[j * DYN_TP_OVERSAMPLE])));
+			}
+
+			acc = _mm_and_ps(acc, absMask);
+			acc = _mm_max_ps(acc, _mm_shuffle_ps(acc, acc, _MM_SHUFFLE(1, 0, 3, 2)));
+			acc = _mm_max_ps(acc, _mm_shuffle_ps(acc, acc, _MM_SHUFFLE(2, 3, 0, 1)));
+			// phases are between samples, sample itself is max too
+			float peak = std::max(_mm_cvtss_f32(acc), fabsf(pNewest[-DYN_TP_DELAY]));
+			if (peak > level[i]) { level[i] = peak; }
+		}
+
+		memmove(pLine, pLine + iFrames, (DYN_TP_TAPS - 1) * sizeof(float));
+	}
+}
+
+/*******************************************
+* ComputeGain():
+* Level to dB, then needed gain in dB
+*******************************************/
+void AuEngine::Dynamics::ComputeGain(int iFrames)
+{
+	const __m128 floor = _mm_set1_ps(1e-6f);				// -120 dB
+	const __m128 toDb = _mm_set1_ps(LOG2_TO_DB);
+	int i = 0;
+	for (; i + 4 <= iFrames; i += 4)
+	{
+		__m128 x = _mm_max_ps(_mm_loadu_ps(level + i), floor);
+		_mm_storeu_ps(level + i, _mm_mul_ps(FastLog2(x), toDb));
+	}
+	for (; i < iFrames; i++)
+	{
+		level[i] = level[i] > 1e-6f ? 20.0f * log10f(level[i]) : DYN_FLOOR;
+	}
+
+	float thr = threshold.load(std::memory_order_relaxed);
+	float knee = config.knee;
+	float halfKnee = knee * 0.5f;
+
+	switch (config.mode)
+	{
+	case DYN_COMPRESSOR:
+	{
+		float slope = 1.0f / config.ratio - 1.0f;
+		for (i = 0; i < iFrames; i++)
+		{
+			float over = level[i] - thr;
+			if (over <= -halfKnee)		{ gain[i] = 0.0f; }
+			else if (over < halfKnee)	{ gain[i] = slope * (over + halfKnee) * (over + halfKnee) / (2.0f * knee); }
+			else						{ gain[i] = slope * over; }
+		}
+		break;
+	}
+	case DYN_LIMITER:
+		for (i = 0; i < iFrames; i++) { gain[i] = level[i] > thr ? thr - level[i] : 0.0f; }
+		break;
+	case DYN_EXPANDER:
+	{
+		float slope = config.ratio - 1.0f;
+		for (i = 0; i < iFrames; i++)
+		{
+			float over = level[i] - thr;
+			float g;
+			if (over >= halfKnee)		{ g = 0.0f; }
+			else if (over > -halfKnee)	{ g = -slope * (over - halfKnee) * (over - halfKnee) / (2.0f * knee); }
+			else						{ g = slope * over; }
+			gain[i] = g > -config.range ? g : -config.range;
+		}
+		break;
+	}
+	case DYN_GATE:
+		for (i = 0; i < iFrames; i++)
+		{
+			if (level[i] > thr)
+			{
+				isOpen = true;
+				holdLeft = holdFrames;
+			}
+			else if (isOpen && level[i] < thr - DYN_GATE_HYSTERESIS)
+			{
+				if (holdLeft > 0)	{ holdLeft--; }
+				else				{ isOpen = false; }
+			}
+			gain[i] = isOpen ? 0.0f : -config.range;
+		}
+		break;
+	}
+}
+
+/*******************************************
+* FollowEnvelope():
+* Attack and release of gain
+*******************************************/
+void AuEngine::Dynamics::FollowEnvelope(int iFrames)
+{
+	// compressor attacks down, expander and gate attack up
+	bool isDownAttack = config.mode == DYN_COMPRESSOR;
+	double env = envelope;
+
+	for (int i = 0; i < iFrames; i++)
+	{
+		double target = gain[i];
+		double coef = (target < env) == isDownAttack ? attackCoef : releaseCoef;
+		env = target + (env - target) * coef;
+		gain[i] = (float)env;
+	}
+
+	envelope = env;
+}
+
+/*******************************************
+* FollowLimiter():
+* Moving minimum, release and moving
+* average over lookahead + 1 frames
+*******************************************/
+void AuEngine::Dynamics::FollowLimiter(int iFrames)
+{
+	int window = lookahead + 1;
+	double env = envelope;
+
+	for (int i = 0; i < iFrames; i++, counter++)
+	{
+		// monotonic queue, front is minimum of window. Old front is
+		// dropped before push, else full ring would overwrite it
+		float value = gain[i];
+		if (minCount && counter - minIndices[minHead] >= (unsigned int)minWindow)
+		{
+			minHead = (minHead + 1) % minWindow;
+			minCount--;
+		}
+		while (minCount && minValues[(minHead + minCount - 1) % minWindow] >= value) { minCount--; }
+		int back = (minHead + minCount) % minWindow;
+		minValues[back] = value;
+		minIndices[back] = counter;
+		minCount++;
+
+		double minimum = minValues[minHead];
+		env = minimum < env ? minimum : minimum + (env - minimum) * releaseCoef;
+
+		avgSum += env - avgRing[avgPos];
+		avgRing[avgPos] = (float)env;
+		if (++avgPos == window) { avgPos = 0; }
+		gain[i] = (float)(avgSum / window);
+	}
+
+	envelope = env;
+}
+
+/*******************************************
+* ApplyGain():
+* Delayed audio * gain
+*******************************************/
+void AuEngine::Dynamics::ApplyGain(float** ppData, int iFrames)
+{
+	const __m128 toLog2 = _mm_set1_ps(DB_TO_LOG2);
+	const __m128 makeup = _mm_set1_ps(config.makeup);
+
+	int i = 0;
+	for (; i + 4 <= iFrames; i += 4)
+	{
+		__m128 g = _mm_loadu_ps(gain + i);
+		_mm_storeu_ps(gain + i, FastExp2(_mm_mul_ps(_mm_add_ps(g, makeup), toLog2)));
+	}
+	for (; i < iFrames; i++)
+	{
+		gain[i] = powf(10.0f, (gain[i] + config.makeup) / 20.0f);
+	}
+
+	for (int c = 0; c < channels; c++)
+	{
+		float* pLine = &line[c * lineSize];
+		float* pOut = ppData[c];
+		memcpy(pLine + delay, pOut, iFrames * sizeof(float));
+
+		for (i = 0; i + 4 <= iFrames; i += 4)
+		{
+			_mm_storeu_ps(pOut + i, _mm_mul_ps(_mm_loadu_ps(pLine + i), _mm_loadu_ps(gain + i)));
+		}
+		for (; i < iFrames; i++) { pOut[i] = pLine[i] * gain[i]; }
+
+		memmove(pLine, pLine + iFrames, delay * sizeof(float));
+	}
+}
+
+/*******************************************
+* ProcessBlock():
+* Up to DYN_BLOCK frames, planar, in place
+*******************************************/
+void AuEngine::Dynamics::ProcessBlock(float** ppData, int iFrames)
+{
+	if (config.isTruePeak)	{ DetectTruePeak(ppData, iFrames); }
+	else					{ DetectPeak(ppData, iFrames); }
+
+	ComputeGain(iFrames);
+	if (config.mode == DYN_LIMITER)	{ FollowLimiter(iFrames); }
+	else							{ FollowEnvelope(iFrames); }
+
+	float minGain = 0.0f;
+	for (int i = 0; i < iFrames; i++) { if (gain[i] < minGain) { minGain = gain[i]; } }
+	reduction.store(minGain, std::memory_order_relaxed);
+
+	ApplyGain(ppData, iFrames);
+}
+
+/*******************************************
+* Process():
+* Interleaved data, in place. Channels
+* after GetChannels() are not changed
+*******************************************/
+void AuEngine::Dynamics::Process(float* pData, int iFrames, int iChannels)
+{
+	if (!channels) { return; }
+
+	float* pChannels[DYN_MAX_CHANNELS];
+	for (int c = 0; c < channels; c++) { pChannels[c] = &planar[c * DYN_BLOCK]; }
+
+	if (iChannels < channels)
+	{
+		for (int c = iChannels; c < channels; c++) { memset(pChannels[c], 0, DYN_BLOCK * sizeof(float)); }
+	}
+	int count = iChannels < channels ? iChannels : channels;
+
+	for (int pos = 0; pos < iFrames; pos += DYN_BLOCK)
+	{
+		int frames = iFrames - pos < DYN_BLOCK ? iFrames - pos : DYN_BLOCK;
+		float* pBlock = pData + (size_t)pos * iChannels;
+
+		for (int i = 0; i < frames; i++)
+		{
+			for (int c = 0; c < count; c++) { pChannels[c][i] = pBlock[i * iChannels + c]; }
+		}
+
+		ProcessBlock(pChannels, frames);
+
+		for (int i = 0; i < frames; i++)
+		{
+			for (int c = 0; c < count; c++) { pBlock[i * iChannels + c] = pChannels[c][i]; }
+		}
+	}
+}
+
+/*******************************************
+* Process():
+* Planar data, input may be output
+*******************************************/
+void AuEngine::Dynamics::Process(const float* const* ppIn, float** ppOut, int iFrames)
+{
+	for (int c = 0; c < channels; c++)
+	{
+		if (ppIn[c] != ppOut[c]) { memcpy(ppOut[c], ppIn[c], iFrames * sizeof(float)); }
+	}
+
+	float* pChannels[DYN_MAX_CHANNELS];
+	for (int pos = 0; pos < iFrames; pos += DYN_BLOCK)
+	{
+		int frames = iFrames - pos < DYN_BLOCK ? iFrames - pos : DYN_BLOCK;
+		for (int c = 0; c < channels; c++) { pChannels[c] = ppOut[c] + pos; }
+		ProcessBlock(pChannels, frames);
+	}
+}
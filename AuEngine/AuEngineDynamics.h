@@ -0,0 +1,159 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineDynamics.h:
+// header for dynamics processors
+/////////////////////////////////
+#pragma once
+#include "AuEngine.h"
+#include "AuEngineGraph.h"
+#include <atomic>
+#include <vector>
+
+#define DYN_MAX_CHANNELS		8
+#define DYN_BLOCK				64				// frames of one pass of detector
+#define DYN_MAX_RATE			192000.0		// for size of delay line
+#define DYN_MAX_LOOKAHEAD		0.02			// seconds
+#define DYN_TP_OVERSAMPLE		4				// true-peak detector (ITU-R BS.1770)
+#define DYN_TP_TAPS				12				// taps for one phase
+#define DYN_TP_DELAY			6				// frames, group delay of true-peak filter
+#define DYN_GATE_HYSTERESIS		3.0f			// dB, gate closes below threshold - hysteresis
+#define DYN_FLOOR				-120.0f			// dB, level of silence
+
+/***********************************************
+* enum DynamicsMode:
+* DYN_COMPRESSOR - ratio above threshold
+* DYN_LIMITER    - brickwall, threshold is
+* ceiling, attack is lookahead
+* DYN_EXPANDER   - ratio below threshold
+* (downward), not more than range
+* DYN_GATE       - range below threshold
+***********************************
+* struct DynamicsConfig:
+* Levels in dB, times in seconds. Knee
+* is width of soft knee (0 - hard knee)
+***********************************
+* class Dynamics:
+* Peak detector (or 4x oversampled true
+* peak), gain computer and attack/release
+* follower, all channels are linked. Audio
+* goes through delay line of lookahead
+* (and true-peak filter delay), so gain is
+* down before peak comes. Limiter uses
+* moving minimum of gain over lookahead
+* and moving average of same length, so
+* no sample is over ceiling.
+* Work is done by blocks of DYN_BLOCK
+* frames, detector, dB conversion and
+* gain use SSE.
+* Create() allocates everything for any
+* rate up to DYN_MAX_RATE. SetSampleRate()
+* is for audio thread and does nothing if
+* rate is the same. SetThreshold() can be
+* called from any thread
+***********************************
+* class DynamicsNode:
+* Dynamics for effect graph
+***********************************************/
+namespace AuEngine
+{
+	enum DynamicsMode
+	{
+		DYN_COMPRESSOR,
+		DYN_LIMITER,
+		DYN_EXPANDER,
+		DYN_GATE
+	};
+
+	struct DynamicsConfig
+	{
+		DynamicsMode mode = DYN_COMPRESSOR;
+		double sampleRate = 48000.0;
+		float threshold = -18.0f;
+		float ratio = 4.0f;
+		float knee = 6.0f;
+		float attack = 0.005f;
+		float release = 0.1f;
+		float hold = 0.05f;						// gate
+		float range = 80.0f;					// expander and gate
+		float lookahead = 0.0f;
+		float makeup = 0.0f;
+		bool isTruePeak = false;
+	};
+
+	class Dynamics
+	{
+	public:
+		Dynamics() {}
+		DLL_API void Create(const DynamicsConfig& config, int iChannels);
+		DLL_API void Destroy();
+		DLL_API void Reset();
+		DLL_API void SetSampleRate(double dSampleRate);
+		DLL_API void SetThreshold(float fThreshold);
+		DLL_API void Process(float* pData, int iFrames, int iChannels);
+		DLL_API void Process(const float* const* ppIn, float** ppOut, int iFrames);
+
+		int   GetLatency() const { return delay; }
+		int   GetChannels() const { return channels; }
+		float GetReduction() const { return reduction.load(std::memory_order_relaxed); }
+		const DynamicsConfig& GetConfig() const { return config; }
+
+	private:
+		void ProcessBlock(float** ppData, int iFrames);
+		void DetectPeak(float** ppData, int iFrames);
+		void DetectTruePeak(float** ppData, int iFrames);
+		void ComputeGain(int iFrames);
+		void FollowEnvelope(int iFrames);
+		void FollowLimiter(int iFrames);
+		void ApplyGain(float** ppData, int iFrames);
+
+		DynamicsConfig config;
+		std::atomic<float> threshold{ 0.0f };
+		std::atomic<float> reduction{ 0.0f };	// dB of last block
+		int channels = 0;
+		int delay = 0;							// frames of delay line
+		int lookahead = 0;
+		int lineSize = 0;
+
+		std::vector<float> line;				// channel, delay old + DYN_BLOCK new frames
+		std::vector<float> tpLine;				// channel, DYN_TP_TAPS - 1 old + DYN_BLOCK new
+		std::vector<float> tpCoefs;				// tap, phase
+		std::vector<float> planar;				// channel, DYN_BLOCK (interleaved input)
+		float level[DYN_BLOCK];					// detector, then dB
+		float gain[DYN_BLOCK];					// dB, then linear
+
+		double attackCoef = 0.0;
+		double releaseCoef = 0.0;
+		double envelope = 0.0;					// dB of gain
+		int holdFrames = 0;
+		int holdLeft = 0;
+		bool isOpen = false;					// gate
+
+		// limiter: moving minimum (monotonic queue) and moving average
+		std::vector<float> minValues;
+		std::vector<unsigned int> minIndices;
+		int minWindow = 0;
+		int minHead = 0;
+		int minCount = 0;
+		std::vector<float> avgRing;
+		double avgSum = 0.0;
+		int avgPos = 0;
+		unsigned int counter = 0;				// frames, for age of minimum
+
+		double sampleRate = 0.0;
+	};
+
+	class DynamicsNode : public Node
+	{
+	public:
+		DynamicsNode(Dynamics* pDynamics, NodeType nodeType = EFFECT_NODE) : Node(nodeType, pDynamics->GetChannels()), dynamics(pDynamics) {}
+		void Prepare(double dSampleRate, int iMaxFrames) override { dynamics->SetSampleRate(dSampleRate); }
+		void Process(float** ppIn, float** ppOut, int iFrames) override { dynamics->Process(ppIn, ppOut, iFrames); }
+		int  GetLatency() const override { return dynamics->GetLatency(); }
+
+	private:
+		Dynamics* dynamics;
+	};
+};
@@ -0,0 +1,389 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineEQ.cpp:
+// parametric EQ
+/////////////////////////////////
+
+/*******************************************
+* Smoothing:
+* Coefficients of biquad can't be
+* interpolated (filter between two stable
+* filters may be unstable), so parameters
+* are ramped and coefficients are computed
+* from them. Frequency is ramped in
+* octaves and gain in dB, so the ramp
+* sounds even. Every EQ_SUBBLOCK frames is
+* enough against zipper noise, and band
+* which reached its target costs nothing.
+*
+* Peak and shelf bands fade in from 0 dB
+* when enabled and fade out when disabled.
+* Other types have no neutral value and
+* are switched at once.
+*******************************************/
+
+#include "AuEngineEQ.h"
+#include <string.h>
+
+#define EQ_SETTLE_FREQ			1e-4			// octaves
+#define EQ_SETTLE_GAIN			1e-3			// dB
+#define EQ_SETTLE_Q				1e-4
+#define EQ_DENORMAL				1e-25
+
+static bool
+HasGain(AuEngine::EQBandType type)
+{
+	return type == AuEngine::EQ_PEAK || type == AuEngine::EQ_LOWSHELF || type == AuEngine::EQ_HIGHSHELF;
+}
+
+/*******************************************
+* Create():
+* Queue and bands, every band is disabled
+*******************************************/
+void AuEngine::ParametricEQ::Create(double dSampleRate, int iChannels)
+{
+	if (iChannels < 1 || iChannels > EQ_MAX_CHANNELS || dSampleRate <= 0.0)
+	{
+		THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR);
+	}
+
+	channels = iChannels;
+	messages.Create(EQ_QUEUE_SIZE * sizeof(EQMessage));
+	for (int i = 0; i < EQ_MAX_BANDS; i++) { controlBands[i] = EQBandParams(); }
+
+	sampleRate = 0.0;
+	SetSampleRate(dSampleRate);
+	isCreated = true;
+	Reset();
+}
+
+/*******************************************
+* Destroy():
+* Free queue
+*******************************************/
+void AuEngine::ParametricEQ::Destroy()
+{
+	isCreated = false;
+	messages.Destroy();
+	channels = 0;
+	activeCount = 0;
+}
+
+/*******************************************
+* Reset():
+* Bands go to targets at once, state
+* of filters is cleared
+*******************************************/
+void AuEngine::ParametricEQ::Reset()
+{
+	TakeMessages();
+	activeCount = 0;
+
+	for (int i = 0; i < EQ_MAX_BANDS; i++)
+	{
+		EQBand* pBand = &bands[i];
+		pBand->freq = log2((double)pBand->target.frequency);
+		pBand->gain = pBand->target.isEnabled ? pBand->target.gain : 0.0;
+		pBand->q = pBand->target.q;
+		pBand->isMoving = false;
+		pBand->isActive = false;
+		memset(pBand->z1, 0, sizeof(pBand->z1));
+		memset(pBand->z2, 0, sizeof(pBand->z2));
+
+		ComputeCoefficients(pBand);
+		UpdateActive(pBand);
+	}
+}
+
+/*******************************************
+* SetSampleRate():
+* Recompute coefficients for new rate
+*******************************************/
+void AuEngine::ParametricEQ::SetSampleRate(double dSampleRate)
+{
+	if (dSampleRate <= 0.0 || dSampleRate == sampleRate) { return; }
+
+	sampleRate = dSampleRate;
+	smoothCoef = 1.0 - exp(-EQ_SUBBLOCK / (EQ_SMOOTH_TIME * sampleRate));
+	for (int i = 0; i < EQ_MAX_BANDS; i++) { ComputeCoefficients(&bands[i]); }
+}
+
+/*******************************************
+* SetBand():
+* Post new parameters to audio thread.
+* Returns false if queue is full
+*******************************************/
+bool AuEngine::ParametricEQ::SetBand(int iBand, const EQBandParams& params)
+{
+	if (iBand < 0 || iBand >= EQ_MAX_BANDS || !isCreated) { return false; }
+	if (messages.GetWriteAvailable() < sizeof(EQMessage)) { return false; }
+
+	EQMessage message;
+	message.band = iBand;
+	message.params = params;
+	if (message.params.frequency < EQ_MIN_FREQUENCY) { message.params.frequency = (float)EQ_MIN_FREQUENCY; }
+	if (message.params.q < 0.05f) { message.params.q = 0.05f; }
+
+	messages.Write(&message, sizeof(EQMessage));
+	controlBands[iBand] = message.params;
+	return true;
+}
+
+/*******************************************
+* TakeMessages():
+* Read all updates from control thread
+*******************************************/
+void AuEngine::ParametricEQ::TakeMessages()
+{
+	EQMessage message;
+	while (messages.GetReadAvailable() >= sizeof(EQMessage))
+	{
+		messages.Read(&message, sizeof(EQMessage));
+		EQBand* pBand = &bands[message.band];
+		EQBandParams old = pBand->target;
+		pBand->target = message.params;
+
+		if (!message.params.isEnabled && !pBand->isActive)
+		{
+			// silent band has nothing to ramp
+			pBand->freq = log2((double)message.params.frequency);
+			pBand->gain = 0.0;
+			pBand->q = message.params.q;
+			pBand->isMoving = false;
+			ComputeCoefficients(pBand);
+			continue;
+		}
+
+		if (old.type != message.params.type || (!old.isEnabled && message.params.isEnabled))
+		{
+			// no ramp between types, enabled band starts from its target (and 0 dB)
+			if (!pBand->isActive)
+			{
+				memset(pBand->z1, 0, sizeof(pBand->z1));
+				memset(pBand->z2, 0, sizeof(pBand->z2));
+			}
+			pBand->freq = log2((double)message.params.frequency);
+			pBand->q = message.params.q;
+			pBand->gain = HasGain(message.params.type) && !old.isEnabled ? 0.0 : message.params.gain;
+			ComputeCoefficients(pBand);
+		}
+
+		pBand->isMoving = true;
+		UpdateActive(pBand);
+	}
+}
+
+/*******************************************
+* SmoothBands():
+* One step of ramp for moving bands
+*******************************************/
+void AuEngine::ParametricEQ::SmoothBands(int iFrames)
+{
+	double coef = iFrames == EQ_SUBBLOCK ? smoothCoef : 1.0 - exp(-iFrames / (EQ_SMOOTH_TIME * sampleRate));
+
+	for (int i = 0; i < EQ_MAX_BANDS; i++)
+	{
+		EQBand* pBand = &bands[i];
+		if (!pBand->isMoving) { continue; }
+
+		double freq = log2((double)pBand->target.frequency);
+		double gain = pBand->target.isEnabled ? pBand->target.gain : 0.0;
+		double q = pBand->target.q;
+
+		pBand->freq += (freq - pBand->freq) * coef;
+		pBand->gain += (gain - pBand->gain) * coef;
+		pBand->q += (q - pBand->q) * coef;
+
+		if (fabs(freq - pBand->freq) < EQ_SETTLE_FREQ &&
+			fabs(gain - pBand->gain) < EQ_SETTLE_GAIN &&
+			fabs(q - pBand->q) < EQ_SETTLE_Q * q)
+		{
+			pBand->freq = freq;
+			pBand->gain = gain;
+			pBand->q = q;
+			pBand->isMoving = false;
+		}
+
+		ComputeCoefficients(pBand);
+		UpdateActive(pBand);
+	}
+}
+
+/*******************************************
+* UpdateActive():
+* Band is skipped if it's disabled or
+* settled at 0 dB
+*******************************************/
+void AuEngine::ParametricEQ::UpdateActive(EQBand* pBand)
+{
+	bool isActive = pBand->isMoving ? (pBand->target.isEnabled || HasGain(pBand->target.type)) : pBand->target.isEnabled;
+	if (isActive && !pBand->isMoving && HasGain(pBand->target.type) && pBand->gain == 0.0) { isActive = false; }
+
+	if (isActive != pBand->isActive)
+	{
+		activeCount += isActive ? 1 : -1;
+		if (!isActive)
+		{
+			memset(pBand->z1, 0, sizeof(pBand->z1));
+			memset(pBand->z2, 0, sizeof(pBand->z2));
+		}
+		pBand->isActive = isActive;
+	}
+}
+
+/*******************************************
+* ComputeCoefficients():
+* RBJ Audio EQ Cookbook
+*******************************************/
+void AuEngine::ParametricEQ::ComputeCoefficients(EQBand* pBand)
+{
+	if (sampleRate <= 0.0) { return; }
+
+	double freq = exp2(pBand->freq);
+	if (freq < EQ_MIN_FREQUENCY) { freq = EQ_MIN_FREQUENCY; }
+	if (freq > EQ_MAX_FREQUENCY * sampleRate) { freq = EQ_MAX_FREQUENCY * sampleRate; }
+
+	double w0 = 2.0 * M_PI * freq / sampleRate;
+	double cosW = cos(w0);
+	double alpha = sin(w0) / (2.0 * pBand->q);
+	double A = pow(10.0, pBand->gain / 40.0);
+	double sqrtA2 = 2.0 * sqrt(A) * alpha;
+	double b0, b1, b2, a0, a1, a2;
+
+	switch (pBand->target.type)
+	{
+	case EQ_PEAK:
+		b0 = 1.0 + alpha * A;		b1 = -2.0 * cosW;	b2 = 1.0 - alpha * A;
+		a0 = 1.0 + alpha / A;		a1 = -2.0 * cosW;	a2 = 1.0 - alpha / A;
+		break;
+	case EQ_LOWSHELF:
+		b0 = A * ((A + 1.0) - (A - 1.0) * cosW + sqrtA2);
+		b1 = 2.0 * A * ((A - 1.0) - (A + 1.0) * cosW);
+		b2 = A * ((A + 1.0) - (A - 1.0) * cosW - sqrtA2);
+		a0 = (A + 1.0) + (A - 1.0) * cosW + sqrtA2;
+		a1 = -2.0 * ((A - 1.0) + (A + 1.0) * cosW);
+		a2 = (A + 1.0) + (A - 1.0) * cosW - sqrtA2;
+		break;
+	case EQ_HIGHSHELF:
+		b0 = A * ((A + 1.0) + (A - 1.0) * cosW + sqrtA2);
+		b1 = -2.0 * A * ((A - 1.0) + (A + 1.0) * cosW);
+		b2 = A * ((A + 1.0) + (A - 1.0) * cosW - sqrtA2);
+		a0 = (A + 1.0) - (A - 1.0) * cosW + sqrtA2;
+		a1 = 2.0 * ((A - 1.0) - (A + 1.0) * cosW);
+		a2 = (A + 1.0) - (A - 1.0) * cosW - sqrtA2;
+		break;
+	case EQ_LOWPASS:
+		b0 = (1.0 - cosW) * 0.5;	b1 = 1.0 - cosW;	b2 = (1.0 - cosW) * 0.5;
+		a0 = 1.0 + alpha;			a1 = -2.0 * cosW;	a2 = 1.0 - alpha;
+		break;
+	case EQ_HIGHPASS:
+		b0 = (1.0 + cosW) * 0.5;	b1 = -(1.0 + cosW);	b2 = (1.0 + cosW) * 0.5;
+		a0 = 1.0 + alpha;			a1 = -2.0 * cosW;	a2 = 1.0 - alpha;
+		break;
+	case EQ_NOTCH:
+		b0 = 1.0;					b1 = -2.0 * cosW;	b2 = 1.0;
+		a0 = 1.0 + alpha;			a1 = -2.0 * cosW;	a2 = 1.0 - alpha;
+		break;
+	case EQ_BANDPASS:
+	default:
+		b0 = alpha;					b1 = 0.0;			b2 = -alpha;
+		a0 = 1.0 + alpha;			a1 = -2.0 * cosW;	a2 = 1.0 - alpha;
+		break;
+	}
+
+	pBand->b0 = b0 / a0;
+	pBand->b1 = b1 / a0;
+	pBand->b2 = b2 / a0;
+	pBand->a1 = a1 / a0;
+	pBand->a2 = a2 / a0;
+}
+
+/*******************************************
+* ProcessBlock():
+* All active bands for one sub-block.
+* Sample n of channel c is
+* ppData[c][n * iStride]
+*******************************************/
+void AuEngine::ParametricEQ::ProcessBlock(float** ppData, int iStride, int iFrames, int iChannels)
+{
+	for (int i = 0; i < EQ_MAX_BANDS; i++)
+	{
+		EQBand* pBand = &bands[i];
+		if (!pBand->isActive) { continue; }
+
+		double b0 = pBand->b0, b1 = pBand->b1, b2 = pBand->b2;
+		double a1 = pBand->a1, a2 = pBand->a2;
+
+		for (int c = 0; c < iChannels; c++)
+		{
+			float* pData = ppData[c];
+			double z1 = pBand->z1[c];
+			double z2 = pBand->z2[c];
+
+			for (int n = 0; n < iFrames; n++)
+			{
+				double x = pData[n * iStride];
+				double y = b0 * x + z1;
+				z1 = b1 * x - a1 * y + z2;
+				z2 = b2 * x - a2 * y;
+				pData[n * iStride] = (float)y;
+			}
+
+			pBand->z1[c] = fabs(z1) < EQ_DENORMAL ? 0.0 : z1;
+			pBand->z2[c] = fabs(z2) < EQ_DENORMAL ? 0.0 : z2;
+		}
+	}
+}
+
+/*******************************************
+* Process():
+* Interleaved data, in place. Channels
+* after EQ_MAX_CHANNELS are not changed
+*******************************************/
+void AuEngine::ParametricEQ::Process(float* pData, int iFrames, int iChannels)
+{
+	if (!isCreated) { return; }
+	TakeMessages();
+	if (!activeCount) { return; }
+
+	int count = iChannels < channels ? iChannels : channels;
+	float* pChannels[EQ_MAX_CHANNELS];
+
+	for (int pos = 0; pos < iFrames; pos += EQ_SUBBLOCK)
+	{
+		int frames = iFrames - pos < EQ_SUBBLOCK ? iFrames - pos : EQ_SUBBLOCK;
+		for (int c = 0; c < count; c++) { pChannels[c] = pData + (size_t)pos * iChannels + c; }
+
+		SmoothBands(frames);
+		ProcessBlock(pChannels, iChannels, frames, count);
+	}
+}
+
+/*******************************************
+* Process():
+* Planar data, input may be output
+*******************************************/
+void AuEngine::ParametricEQ::Process(const float* const* ppIn, float** ppOut, int iFrames)
+{
+	for (int c = 0; c < channels; c++)
+	{
+		if (ppIn[c] != ppOut[c]) { memcpy(ppOut[c], ppIn[c], iFrames * sizeof(float)); }
+	}
+
+	if (!isCreated) { return; }
+	TakeMessages();
+	if (!activeCount) { return; }
+
+	float* pChannels[EQ_MAX_CHANNELS];
+	for (int pos = 0; pos < iFrames; pos += EQ_SUBBLOCK)
+	{
+		int frames = iFrames - pos < EQ_SUBBLOCK ? iFrames - pos : EQ_SUBBLOCK;
+		for (int c = 0; c < channels; c++) { pChannels[c] = ppOut[c] + pos; }
+
+		SmoothBands(frames);
+		ProcessBlock(pChannels, 1, frames, channels);
+	}
+}
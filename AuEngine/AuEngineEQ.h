@@ -0,0 +1,137 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineEQ.h:
+// header for parametric EQ
+/////////////////////////////////
+#pragma once
+#include "AuEngine.h"
+#include "AuEngineGraph.h"
+#include "AuEngineRing.h"
+
+#define EQ_MAX_BANDS			32
+#define EQ_MAX_CHANNELS			8
+#define EQ_QUEUE_SIZE			256				// band updates before audio thread takes them
+#define EQ_SUBBLOCK				32				// frames with the same coefficients
+#define EQ_SMOOTH_TIME			0.02			// seconds, time constant of parameter ramp
+#define EQ_MIN_FREQUENCY		10.0
+#define EQ_MAX_FREQUENCY		0.49			// part of sample rate
+
+/***********************************************
+* enum EQBandType:
+* RBJ cookbook biquads. Gain is used by
+* peak and shelf bands only, Q is slope
+* of shelf or bandwidth of other bands
+***********************************
+* struct EQBandParams:
+* Parameters of one band, set by control
+* thread
+***********************************
+* class ParametricEQ:
+* Multi-band EQ for audio thread.
+* SetBand() is for one control thread
+* (UI) and posts update to lock-free
+* queue, Process() takes updates at start
+* of buffer. Frequency (in log scale),
+* gain (in dB) and Q go to new value
+* with one-pole ramp, coefficients are
+* recomputed every EQ_SUBBLOCK frames
+* while band is moving and never when it
+* is settled. Disabled bands and peak or
+* shelf bands with 0 dB are skipped.
+* SetSampleRate() is for audio thread
+* too, it does nothing if rate is the same
+***********************************
+* class EQNode:
+* ParametricEQ for effect graph
+***********************************************/
+namespace AuEngine
+{
+	enum EQBandType
+	{
+		EQ_PEAK,
+		EQ_LOWSHELF,
+		EQ_HIGHSHELF,
+		EQ_LOWPASS,
+		EQ_HIGHPASS,
+		EQ_NOTCH,
+		EQ_BANDPASS
+	};
+
+	struct EQBandParams
+	{
+		EQBandType type = EQ_PEAK;
+		float frequency = 1000.0f;
+		float gain = 0.0f;						// dB
+		float q = 0.707f;
+		bool isEnabled = false;
+	};
+
+	struct EQBand
+	{
+		EQBandParams target;
+		double freq = 0.0;						// log2 of Hz, current value of ramp
+		double gain = 0.0;
+		double q = 0.0;
+		bool isMoving = false;
+		bool isActive = false;					// not skipped at processing
+
+		double b0 = 1.0, b1 = 0.0, b2 = 0.0;	// normalized by a0
+		double a1 = 0.0, a2 = 0.0;
+		double z1[EQ_MAX_CHANNELS];				// transposed direct form II
+		double z2[EQ_MAX_CHANNELS];
+	};
+
+	class ParametricEQ
+	{
+	public:
+		ParametricEQ() {}
+		DLL_API void Create(double dSampleRate, int iChannels);
+		DLL_API void Destroy();
+		DLL_API void Reset();
+		DLL_API void SetSampleRate(double dSampleRate);
+
+		DLL_API bool SetBand(int iBand, const EQBandParams& params);
+		DLL_API void Process(float* pData, int iFrames, int iChannels);
+		DLL_API void Process(const float* const* ppIn, float** ppOut, int iFrames);
+
+		const EQBandParams& GetBand(int iBand) const { return controlBands[iBand]; }
+		int GetChannels() const { return channels; }
+		bool IsCreated() const { return isCreated; }
+
+	private:
+		struct EQMessage
+		{
+			int band;
+			EQBandParams params;
+		};
+
+		void TakeMessages();
+		void ProcessBlock(float** ppData, int iStride, int iFrames, int iChannels);
+		void SmoothBands(int iFrames);
+		void ComputeCoefficients(EQBand* pBand);
+		void UpdateActive(EQBand* pBand);
+
+		EQBand bands[EQ_MAX_BANDS];
+		EQBandParams controlBands[EQ_MAX_BANDS];	// last values from SetBand()
+		RingBuffer messages;
+		double sampleRate = 0.0;
+		double smoothCoef = 0.0;				// for one sub-block
+		int channels = 0;
+		int activeCount = 0;
+		bool isCreated = false;
+	};
+
+	class EQNode : public Node
+	{
+	public:
+		EQNode(ParametricEQ* pEQ, NodeType nodeType = EFFECT_NODE) : Node(nodeType, pEQ->GetChannels()), eq(pEQ) {}
+		void Prepare(double dSampleRate, int iMaxFrames) override { eq->SetSampleRate(dSampleRate); }
+		void Process(float** ppIn, float** ppOut, int iFrames) override { eq->Process(ppIn, ppOut, iFrames); }
+
+	private:
+		ParametricEQ* eq;
+	};
+};
@@ -24,10 +24,18 @@
 * Hann and Kaiser. It's needy to 
 * delete clipping and show real 
 * spectre.
+*
+* FFTPlan is FFT for other modules: tables
+* are built once, transforms don't touch
+* globals. Real FFT of N points is made by
+* complex FFT of N/2 points and split of
+* spectrum.
 *******************************************/
 
 #include "AuEngineMath.h"
+#include "AuEngineFFT.h"
 #include <corecrt_math_defines.h>
+#include <mutex>
 
 DLL_API bool OpenCL_FFT = false;
 
@@ -51,12 +59,11 @@ enum WinMods
 *******************************************/
 void AuMath::FFTProcess(void* FFT, float mem1[4], float mem2[4], int winmode)
 {
-	float window[FFT_SIZE];
-	float freqTable[FFT_SIZE];
 	//char * noteNameTable[FFT_SIZE];
 	//float notePitchTable[FFT_SIZE];
 
-	switch (winmode)
+	// rebuild window only if mode was changed
+	switch (windowMode == winmode ? 0 : winmode)
 	{
 	case WinMods::HANN_WINDOW:
 		BuildHannWindow(window, FFT_SIZE);
@@ -73,6 +80,7 @@ void AuMath::FFTProcess(void* FFT, float mem1[4], float mem2[4], int winmode)
 	default:
 		break;
 	}
+	windowMode = winmode;
 
 	FFT = FFTInit(FFT_EXP_SIZE);
 }
@@ -87,11 +95,10 @@ void* AuMath::FFTInit(int bit)
 {
 	int i, j, value;
 
-	fft = (struct fft_s *) malloc(sizeof(struct FFTStruct));
-	//#NOTE: fft pointer must to be free
-
-	if (!fft) 
-		Msg("Could not allocate for FFT.");
+	// table is static, so we don't need malloc here
+	fft = &fftstruct;
+	if (fftstruct.bits == bit)
+		return fft;
 
 	fftstruct.bits = bit;
 
@@ -117,7 +124,7 @@ void* AuMath::FFTInit(int bit)
 
 void AuMath::FFTClose()
 {
-	free(fft);
+	fft = NULL;
 }
 
 /*******************************************
@@ -253,10 +260,10 @@ void AuMath::BuildBlackmanHarrisWindow(float* window, int size)
 *******************************************/
 void AuMath::BuildKaiserWindow(float* window, float shape, int size)
 {	
-	//#TODO: Must to be refactored.
 	const float oneOverDenom = 1.0f / ZeroEthOrderBessel(shape);
 
-	const UINT N = sizeof(window) - 1;
+	// sizeof(window) was size of pointer, not of window
+	const UINT N = size > 1 ? size - 1 : 1;
 	const float oneOverN = 1.0f / N;
 
 	for (UINT n = 0; n < size; ++n)
@@ -289,6 +296,16 @@ static float ComputeShape(float atten)
 	return alpha;
 }
 
+/*******************************************
+* ComputeKaiserShape():
+* Shape for BuildKaiserWindow() by
+* stopband attenuation (dB)
+*******************************************/
+float AuMath::ComputeKaiserShape(float atten)
+{
+	return ComputeShape(atten);
+}
+
 /*******************************************
 * ApplyWindow():
 * Apply window type
@@ -367,3 +384,263 @@ float AuMath::ZeroEthOrderBessel(float x)
 * turn off FFT-analyse
 *******************************************/
 void AuMath::SignalHandler(int signum) { /*running = false;*/ }
+
+/*******************************************
+* FFTPlan::Create():
+* Build tables for N points (power of 2)
+*******************************************/
+void AuEngine::FFTPlan::Create(int iSize)
+{
+	int iBits = 0;
+	while ((1 << iBits) < iSize) { iBits++; }
+	if (iSize < 4 || (1 << iBits) != iSize || iBits > FFT_PLAN_MAX_BITS)
+	{
+		Msg("AuEngine: Bad FFT size: ", iSize);
+		THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR);
+	}
+
+	size = iSize;
+	bits = iBits;
+	cosTable.resize(size / 2);
+	sinTable.resize(size / 2);
+	for (int k = 0; k < size / 2; k++)
+	{
+		// double, so big plans keep precision
+		double ang = 2.0 * M_PI * k / size;
+		cosTable[k] = (float)cos(ang);
+		sinTable[k] = (float)sin(ang);
+	}
+
+	// stage of len points uses [len / 2, len)
+	stageCos.resize(size);
+	stageSin.resize(size);
+	for (int half = 1; half < size; half <<= 1)
+	{
+		for (int k = 0; k < half; k++)
+		{
+			stageCos[half + k] = cosTable[k * (size / 2 / half)];
+			stageSin[half + k] = sinTable[k * (size / 2 / half)];
+		}
+	}
+
+	bitReverse.resize(size);
+	for (int i = 0; i < size; i++)
+	{
+		int value = 0;
+		for (int j = 0; j < bits; j++)
+		{
+			value = (value << 1) | ((i >> j) & 1);
+		}
+		bitReverse[i] = value;
+	}
+}
+
+/*******************************************
+* FFTPlan::Transform():
+* Complex FFT of N or N/2 points in place
+*******************************************/
+void AuEngine::FFTPlan::Transform(float* pRe, float* pIm, int iSize, bool isInverse) const
+{
+	int shift = iSize == size ? 0 : 1;
+	for (int i = 0; i < iSize; i++)
+	{
+		int j = bitReverse[i] >> shift;
+		if (j <= i) { continue; }
+		float tr = pRe[i];
+		float ti = pIm[i];
+		pRe[i] = pRe[j];
+		pIm[i] = pIm[j];
+		pRe[j] = tr;
+		pIm[j] = ti;
+	}
+
+	// first stage: twiddle is 1
+	for (int i = 0; i < iSize; i += 2)
+	{
+		float tr = pRe[i + 1];
+		float ti = pIm[i + 1];
+		pRe[i + 1] = pRe[i] - tr;
+		pIm[i + 1] = pIm[i] - ti;
+		pRe[i] += tr;
+		pIm[i] += ti;
+	}
+
+	float sign = isInverse ? 1.0f : -1.0f;
+	for (int len = 4; len <= iSize; len <<= 1)
+	{
+		// twiddles of stage are stored one after another
+		int half = len / 2;
+		const float* pCos = &stageCos[half];
+		const float* pSin = &stageSin[half];
+		for (int i = 0; i < iSize; i += len)
+		{
+			float* pRe0 = pRe + i;
+			float* pIm0 = pIm + i;
+			float* pRe1 = pRe0 + half;
+			float* pIm1 = pIm0 + half;
+			for (int k = 0; k < half; k++)
+			{
+				float wr = pCos[k];
+				float wi = sign * pSin[k];
+				float tr = pRe1[k] * wr - pIm1[k] * wi;
+				float ti = pRe1[k] * wi + pIm1[k] * wr;
+				pRe1[k] = pRe0[k] - tr;
+				pIm1[k] = pIm0[k] - ti;
+				pRe0[k] += tr;
+				pIm0[k] += ti;
+			}
+		}
+	}
+}
+
+/*******************************************
+* FFTPlan::Forward():
+* Complex FFT, not scaled
+*******************************************/
+void AuEngine::FFTPlan::Forward(float* pRe, float* pIm) const
+{
+	Transform(pRe, pIm, size, false);
+}
+
+/*******************************************
+* FFTPlan::Inverse():
+* Complex inverse FFT, scaled by 1/N
+*******************************************/
+void AuEngine::FFTPlan::Inverse(float* pRe, float* pIm) const
+{
+	Transform(pRe, pIm, size, true);
+
+	float scale = 1.0f / size;
+	for (int i = 0; i < size; i++)
+	{
+		pRe[i] *= scale;
+		pIm[i] *= scale;
+	}
+}
+
+/*******************************************
+* FFTPlan::ForwardReal():
+* N real samples to N/2 + 1 bins
+*******************************************/
+void AuEngine::FFTPlan::ForwardReal(const float* pIn, float* pRe, float* pIm) const
+{
+	int half = size / 2;
+
+	// even samples to re, odd to im
+	for (int n = 0; n < half; n++)
+	{
+		pRe[n] = pIn[2 * n];
+		pIm[n] = pIn[2 * n + 1];
+	}
+	Transform(pRe, pIm, half, false);
+
+	// split spectrum of packed signal, bins k and N/2 - k together
+	float re0 = pRe[0];
+	float im0 = pIm[0];
+	pRe[0] = re0 + im0;
+	pIm[0] = 0.0f;
+	pRe[half] = re0 - im0;
+	pIm[half] = 0.0f;
+
+	for (int k = 1; k <= half / 2; k++)
+	{
+		int m = half - k;
+		float ar = pRe[k], ai = pIm[k];
+		float br = pRe[m], bi = pIm[m];
+
+		// even part (a + conj b) / 2, odd part (a - conj b) / 2i
+		float er = 0.5f * (ar + br);
+		float ei = 0.5f * (ai - bi);
+		float orr = 0.5f * (ai + bi);
+		float oi = -0.5f * (ar - br);
+
+		// X[k] = E + W^k * O, X[m] = conj(E) + W^m * conj(O), W = e^(-2*pi*i/N)
+		float wr = cosTable[k], wi = -sinTable[k];
+		pRe[k] = er + orr * wr - oi * wi;
+		pIm[k] = ei + orr * wi + oi * wr;
+
+		wr = cosTable[m];
+		wi = -sinTable[m];
+		pRe[m] = er + orr * wr + oi * wi;
+		pIm[m] = -ei + orr * wi - oi * wr;
+	}
+}
+
+/*******************************************
+* FFTPlan::InverseReal():
+* N/2 + 1 bins to N real samples
+*******************************************/
+void AuEngine::FFTPlan::InverseReal(float* pRe, float* pIm, float* pOut) const
+{
+	int half = size / 2;
+
+	// pack spectrum back: Z = E + i * O
+	float x0 = pRe[0];
+	float xh = pRe[half];
+	pRe[0] = 0.5f * (x0 + xh);
+	pIm[0] = 0.5f * (x0 - xh);
+
+	for (int k = 1; k <= half / 2; k++)
+	{
+		int m = half - k;
+		float ar = pRe[k], ai = pIm[k];
+		float br = pRe[m], bi = pIm[m];
+
+		// E = (a + conj b) / 2, O = (a - conj b) * W^-k / 2
+		float er = 0.5f * (ar + br);
+		float ei = 0.5f * (ai - bi);
+		float dr = 0.5f * (ar - br);
+		float di = 0.5f * (ai + bi);
+		float wr = cosTable[k], wi = sinTable[k];
+		float orr = dr * wr - di * wi;
+		float oi = dr * wi + di * wr;
+		pRe[k] = er - oi;
+		pIm[k] = ei + orr;
+
+		// same for bin m: E' = conj(E), O' = (b - conj a) * W^-m / 2
+		dr = -dr;
+		wr = cosTable[m];
+		wi = sinTable[m];
+		orr = dr * wr - di * wi;
+		oi = dr * wi + di * wr;
+		pRe[m] = er - oi;
+		pIm[m] = -ei + orr;
+	}
+
+	Transform(pRe, pIm, half, true);
+
+	float scale = 1.0f / half;
+	for (int n = 0; n < half; n++)
+	{
+		pOut[2 * n] = pRe[n] * scale;
+		pOut[2 * n + 1] = pIm[n] * scale;
+	}
+}
+
+/*******************************************
+* GetFFTPlan():
+* Plan from cache or new one
+*******************************************/
+std::shared_ptr<const AuEngine::FFTPlan> AuEngine::GetFFTPlan(int iSize)
+{
+	static std::mutex cacheMutex;
+	static std::vector<std::weak_ptr<const FFTPlan>> cache;
+
+	std::lock_guard<std::mutex> lock(cacheMutex);
+	for (size_t i = 0; i < cache.size(); i++)
+	{
+		std::shared_ptr<const FFTPlan> pPlan = cache[i].lock();
+		if (!pPlan)
+		{
+			cache.erase(cache.begin() + i);
+			i--;
+			continue;
+		}
+		if (pPlan->GetSize() == iSize) { return pPlan; }
+	}
+
+	std::shared_ptr<FFTPlan> pPlan = std::make_shared<FFTPlan>();
+	pPlan->Create(iSize);
+	cache.push_back(pPlan);
+	return pPlan;
+}
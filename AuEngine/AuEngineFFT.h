@@ -0,0 +1,65 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineFFT.h:
+// header for FFT plans
+/////////////////////////////////
+#pragma once
+#include "AuEngine.h"
+#include <memory>
+#include <vector>
+
+#define FFT_PLAN_MAX_BITS		20				// 1M points
+
+/***********************************************
+* class FFTPlan:
+* Radix-2 FFT with tables built once by
+* Create(). Unlike AuMath::ConvertToFFT(),
+* plan has no global state and transforms
+* are const, so one plan can be used by
+* many channels and threads at the same
+* time.
+* Forward() isn't scaled, Inverse() is
+* scaled by 1/N, so Inverse(Forward(x))
+* is x.
+* ForwardReal() takes N real samples and
+* gives N/2 + 1 bins (re and im arrays
+* must have N/2 + 1 elements), it's made
+* by complex FFT of N/2 points.
+* InverseReal() uses re and im as scratch
+*
+* GetFFTPlan():
+* Shared plan for size, tables are built
+* once for all users. Don't call it from
+* audio thread (lock and allocation)
+***********************************************/
+namespace AuEngine
+{
+	class FFTPlan
+	{
+	public:
+		FFTPlan() {}
+		DLL_API void Create(int iSize);
+		DLL_API void Forward(float* pRe, float* pIm) const;
+		DLL_API void Inverse(float* pRe, float* pIm) const;
+		DLL_API void ForwardReal(const float* pIn, float* pRe, float* pIm) const;
+		DLL_API void InverseReal(float* pRe, float* pIm, float* pOut) const;
+		int GetSize() const { return size; }
+		int GetBins() const { return size / 2 + 1; }
+
+	private:
+		void Transform(float* pRe, float* pIm, int iSize, bool isInverse) const;
+
+		std::vector<float> cosTable;			// cos(2 * pi * k / N), k < N / 2
+		std::vector<float> sinTable;
+		std::vector<float> stageCos;			// contiguous twiddles of every stage
+		std::vector<float> stageSin;
+		std::vector<int> bitReverse;			// for N points (N / 2 points: >> 1)
+		int size = 0;
+		int bits = 0;
+	};
+
+	DLL_API std::shared_ptr<const FFTPlan> GetFFTPlan(int iSize);
+};
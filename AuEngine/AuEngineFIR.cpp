@@ -0,0 +1,470 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineFIR.cpp:
+// FIR design and filter
+/////////////////////////////////
+
+/*******************************************
+* FIR design:
+* Windowed sinc - ideal response is cut
+* to N taps and multiplied by window,
+* Kaiser window gives needy stopband by
+* its shape.
+*
+* Parks-McClellan - linear phase filter
+* with smallest max error (equiripple).
+* Amplitude of symmetric filter is sum of
+* cos(k * w), so we search it by Remez
+* exchange: solve for r + 1 extremal
+* points with alternating error, find
+* real extrema of error at dense grid,
+* take them and repeat. Even count of
+* taps has zero at Nyquist, so it's
+* cos(w / 2) * sum and desired response
+* and weight are changed by cos(w / 2).
+*
+* FIR filter:
+* Direct form keeps taps - 1 old samples
+* before new block, so every output is
+* one dot product of contiguous memory
+* (SSE, 4 outputs for one pass of taps).
+* Cost is taps per sample, FFT convolution
+* is ~log(N) per sample, so long filters
+* go to Convolver. With 8 channels and
+* FIR_FFT_BLOCK, direct form is faster
+* up to ~350 taps, Convolver is faster
+* from 384 (FIR_FFT_THRESHOLD).
+*******************************************/
+
+#include "AuEngineFIR.h"
+#include "AuEngineMath.h"
+#include <xmmintrin.h>
+
+/*******************************************
+* Sinc():
+* sin(pi x) / (pi x)
+*******************************************/
+static double Sinc(double x)
+{
+	if (fabs(x) < 1e-12) { return 1.0; }
+	return sin(M_PI * x) / (M_PI * x);
+}
+
+/*******************************************
+* DesignWindowedSinc():
+* Build taps of linear phase filter
+*******************************************/
+void AuEngine::DesignWindowedSinc(float* pTaps, int iTaps, FIRBandType bandType, double f1, double f2,
+	double dSampleRate, int window, float fAtten)
+{
+	bool needOdd = bandType == FIR_HIGHPASS || bandType == FIR_BANDSTOP;
+	if (!pTaps || iTaps < 1 || iTaps > FIR_MAX_TAPS || (needOdd && !(iTaps & 1)) ||
+		f1 <= 0.0 || f1 >= dSampleRate * 0.5 ||
+		((bandType == FIR_BANDPASS || bandType == FIR_BANDSTOP) && (f2 <= f1 || f2 >= dSampleRate * 0.5)))
+	{
+		THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR);
+	}
+
+	std::vector<float> win(iTaps);
+	AuMath math;
+	switch (window)
+	{
+	case 1:					math.BuildHannWindow(win.data(), iTaps); break;
+	case 2:					math.BuildHammingWindow(win.data(), iTaps); break;
+	case 3:					math.BuildBlackmanWindow(win.data(), iTaps); break;
+	case 4:					math.BuildBlackmanHarrisWindow(win.data(), iTaps); break;
+	case FIR_KAISER_WINDOW:	math.BuildKaiserWindow(win.data(), math.ComputeKaiserShape(fAtten), iTaps); break;
+	default:				std::fill(win.begin(), win.end(), 1.0f); break;
+	}
+
+	// Hann window is 0 at edges, 1 tap filter has only edge
+	if (iTaps == 1) { win[0] = 1.0f; }
+
+	double center = (iTaps - 1) * 0.5;
+	double c1 = f1 / dSampleRate;
+	double c2 = f2 / dSampleRate;
+	std::vector<double> h(iTaps);
+	for (int n = 0; n < iTaps; n++)
+	{
+		double t = n - center;
+		double lowPass = 2.0 * c1 * Sinc(2.0 * c1 * t);
+		double value = lowPass;
+		switch (bandType)
+		{
+		case FIR_HIGHPASS:	value = (t == 0.0 ? 1.0 : 0.0) - lowPass; break;
+		case FIR_BANDPASS:	value = 2.0 * c2 * Sinc(2.0 * c2 * t) - lowPass; break;
+		case FIR_BANDSTOP:	value = (t == 0.0 ? 1.0 : 0.0) - (2.0 * c2 * Sinc(2.0 * c2 * t) - lowPass); break;
+		default:			break;
+		}
+		h[n] = value * win[n];
+	}
+
+	// unity gain at middle of passband
+	double freq = 0.0;
+	if (bandType == FIR_HIGHPASS) { freq = 0.5; }
+	if (bandType == FIR_BANDPASS) { freq = (c1 + c2) * 0.5; }
+	double gain = 0.0;
+	for (int n = 0; n < iTaps; n++)
+	{
+		gain += h[n] * cos(2.0 * M_PI * freq * (n - center));
+	}
+	if (fabs(gain) < 1e-12) { gain = 1.0; }
+
+	for (int n = 0; n < iTaps; n++)
+	{
+		pTaps[n] = (float)(h[n] / gain);
+	}
+}
+
+/*******************************************
+* GetKaiserTapsCount():
+* Kaiser estimation of filter length
+*******************************************/
+int AuEngine::GetKaiserTapsCount(double dTransition, double dSampleRate, float fAtten)
+{
+	double width = dTransition / dSampleRate;
+	if (width <= 0.0) { THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR); }
+
+	double count = fAtten > 21.0f ? (fAtten - 7.95) / (14.36 * width) + 1.0 : 0.9222 / width + 1.0;
+	int taps = (int)ceil(count);
+	if (!(taps & 1)) { taps++; }
+	return taps < FIR_MAX_TAPS ? taps : FIR_MAX_TAPS - 1;
+}
+
+/*******************************************
+* DesignEquiripple():
+* Parks-McClellan design by Remez exchange
+*******************************************/
+bool AuEngine::DesignEquiripple(float* pTaps, int iTaps, const double* pBands, const double* pDesired,
+	const double* pWeights, int iBands, double dSampleRate)
+{
+	if (!pTaps || iTaps < 3 || iTaps > FIR_MAX_REMEZ_TAPS || iBands < 1 || iBands > FIR_MAX_BANDS)
+	{
+		THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR);
+	}
+	for (int b = 0; b < iBands * 2; b++)
+	{
+		if (pBands[b] < 0.0 || pBands[b] > dSampleRate * 0.5 || (b && pBands[b] < pBands[b - 1]))
+		{
+			THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR);
+		}
+	}
+
+	bool isOdd = (iTaps & 1) != 0;
+	int functions = isOdd ? (iTaps - 1) / 2 + 1 : iTaps / 2;
+	int extremals = functions + 1;
+
+	// dense grid at bands (frequency is part of sample rate)
+	double step = 0.5 / (FIR_REMEZ_DENSITY * functions);
+	std::vector<double> gridFreq, gridDesired, gridWeight;
+	std::vector<int> gridBand;
+	for (int b = 0; b < iBands; b++)
+	{
+		double low = pBands[b * 2] / dSampleRate;
+		double high = pBands[b * 2 + 1] / dSampleRate;
+		if (!isOdd && high > 0.5 - step) { high = 0.5 - step; }
+		if (high < low) { continue; }
+
+		int points = (int)((high - low) / step + 0.5);
+		if (points < 1) { points = 1; }
+		for (int i = 0; i <= points; i++)
+		{
+			double f = low + (high - low) * i / points;
+			double desired = pDesired[b];
+			double weight = pWeights ? pWeights[b] : 1.0;
+
+			// even taps: A(f) = cos(pi f) * P(f), search P
+			if (!isOdd)
+			{
+				double c = cos(M_PI * f);
+				desired /= c;
+				weight *= c;
+			}
+			gridFreq.push_back(f);
+			gridDesired.push_back(desired);
+			gridWeight.push_back(weight);
+			gridBand.push_back(b);
+		}
+	}
+
+	int gridSize = (int)gridFreq.size();
+	if (gridSize < extremals * 2) { THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR); }
+
+	std::vector<double> x(gridSize);
+	for (int k = 0; k < gridSize; k++) { x[k] = cos(2.0 * M_PI * gridFreq[k]); }
+
+	std::vector<int> ext(extremals);
+	for (int i = 0; i < extremals; i++) { ext[i] = (int)((long long)i * (gridSize - 1) / (extremals - 1)); }
+
+	std::vector<double> ad(extremals), values(extremals), error(gridSize);
+	std::vector<int> found;
+	found.reserve(gridSize);
+	bool isConverged = false;
+	int jet = (extremals - 1) / 15 + 1;
+
+	auto evaluate = [&](double xValue) -> double
+	{
+		double num = 0.0;
+		double den = 0.0;
+		for (int i = 0; i < extremals; i++)
+		{
+			double diff = xValue - x[ext[i]];
+			if (fabs(diff) < 1e-14) { return values[i]; }
+			double t = ad[i] / diff;
+			num += t * values[i];
+			den += t;
+		}
+		return num / den;
+	};
+
+	// alternating error at extremals: barycentric weights, delta and values
+	auto solve = [&]() -> double
+	{
+		for (int i = 0; i < extremals; i++)
+		{
+			// products in strided order, so they don't overflow
+			double denom = 1.0;
+			double xi = x[ext[i]];
+			for (int j = 0; j < jet; j++)
+			{
+				for (int k = j; k < extremals; k += jet)
+				{
+					if (k != i) { denom *= 2.0 * (xi - x[ext[k]]); }
+				}
+			}
+			if (fabs(denom) < 1e-300) { denom = 1e-300; }
+			ad[i] = 1.0 / denom;
+		}
+
+		double num = 0.0;
+		double den = 0.0;
+		double sign = 1.0;
+		for (int i = 0; i < extremals; i++)
+		{
+			num += ad[i] * gridDesired[ext[i]];
+			den += sign * ad[i] / gridWeight[ext[i]];
+			sign = -sign;
+		}
+		double delta = num / den;
+
+		sign = 1.0;
+		for (int i = 0; i < extremals; i++)
+		{
+			values[i] = gridDesired[ext[i]] - sign * delta / gridWeight[ext[i]];
+			sign = -sign;
+		}
+		return delta;
+	};
+
+	for (int iter = 0; iter < FIR_REMEZ_ITERATIONS; iter++)
+	{
+		double delta = solve();
+		if (delta == 0.0 || !std::isfinite(delta)) { break; }		// spec is beyond precision
+
+		double maxError = 0.0;
+		for (int k = 0; k < gridSize; k++)
+		{
+			error[k] = gridWeight[k] * (gridDesired[k] - evaluate(x[k]));
+			maxError = fmax(maxError, fabs(error[k]));
+		}
+
+		// local extrema inside bands
+		found.clear();
+		for (int k = 0; k < gridSize; k++)
+		{
+			double e = error[k];
+			bool hasLeft = k > 0 && gridBand[k - 1] == gridBand[k];
+			bool hasRight = k < gridSize - 1 && gridBand[k + 1] == gridBand[k];
+			bool isLeft = !hasLeft || (e > 0.0 ? e >= error[k - 1] : e <= error[k - 1]);
+			bool isRight = !hasRight || (e > 0.0 ? e > error[k + 1] : e < error[k + 1]);
+			if (!isLeft || !isRight || e == 0.0) { continue; }
+
+			// same sign as previous - keep bigger one
+			if (!found.empty() && (error[found.back()] > 0.0) == (e > 0.0))
+			{
+				if (fabs(e) > fabs(error[found.back()])) { found.back() = k; }
+				continue;
+			}
+			found.push_back(k);
+		}
+
+		// too many - drop smaller one from ends, alternation stays
+		while ((int)found.size() > extremals)
+		{
+			if (fabs(error[found.front()]) < fabs(error[found.back()])) { found.erase(found.begin()); }
+			else { found.pop_back(); }
+		}
+		if ((int)found.size() < extremals) { break; }
+
+		bool isSame = found == ext;
+		ext = found;
+		if (isSame || maxError - fabs(delta) <= 1e-6 * maxError)
+		{
+			isConverged = true;
+			break;
+		}
+	}
+
+	// interpolation at last extremals
+	solve();
+
+	// taps from amplitude at N equally spaced frequencies
+	int half = isOdd ? (iTaps - 1) / 2 : iTaps / 2 - 1;
+	std::vector<double> amplitude(half + 1);
+	for (int k = 0; k <= half; k++)
+	{
+		double f = (double)k / iTaps;
+		amplitude[k] = evaluate(cos(2.0 * M_PI * f));
+		if (!isOdd) { amplitude[k] *= cos(M_PI * f); }
+	}
+
+	double center = (iTaps - 1) * 0.5;
+	for (int n = 0; n < iTaps; n++)
+	{
+		double sum = amplitude[0];
+		for (int k = 1; k <= half; k++)
+		{
+			sum += 2.0 * amplitude[k] * cos(2.0 * M_PI * k * (n - center) / iTaps);
+		}
+		pTaps[n] = (float)(sum / iTaps);
+	}
+
+	if (!isConverged)
+	{
+		// taps aren't usable, fewer taps or other bands are needed
+		Msg("AuEngine: Remez exchange doesn't converge, taps: ", iTaps);
+		memset(pTaps, 0, iTaps * sizeof(float));
+	}
+	return isConverged;
+}
+
+/*******************************************
+* FIRFilter::Create():
+* Choose direct or FFT form and allocate
+*******************************************/
+void AuEngine::FIRFilter::Create(const float* pTaps, int iTaps, int iChannels, bool allowFFT)
+{
+	Destroy();
+	if (!pTaps || iTaps < 1 || iTaps > FIR_MAX_TAPS || iChannels < 1 || iChannels > CONV_MAX_CHANNELS)
+	{
+		THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR);
+	}
+
+	taps = iTaps;
+	channels = iChannels;
+	isFFT = allowFFT && iTaps >= FIR_FFT_THRESHOLD;
+
+	if (isFFT)
+	{
+		// same IR for every channel
+		const float* ppIR[CONV_MAX_CHANNELS];
+		for (int c = 0; c < channels; c++) { ppIR[c] = pTaps; }
+		convolver.Create(ppIR, iTaps, channels, channels, CONV_PARALLEL, FIR_FFT_BLOCK);
+		return;
+	}
+
+	padded = (iTaps + 3) & ~3;
+	reversed.assign(padded, 0.0f);
+	for (int i = 0; i < iTaps; i++) { reversed[i] = pTaps[iTaps - 1 - i]; }
+
+	// padded taps read up to padded - taps samples after last new one
+	lineSize = padded - 1 + FIR_DIRECT_BLOCK;
+	line.assign((size_t)lineSize * channels, 0.0f);
+}
+
+/*******************************************
+* FIRFilter::Destroy():
+* Free buffers
+*******************************************/
+void AuEngine::FIRFilter::Destroy()
+{
+	convolver.Destroy();
+	reversed.clear();
+	line.clear();
+	taps = padded = lineSize = channels = 0;
+	isFFT = false;
+}
+
+/*******************************************
+* FIRFilter::Reset():
+* Clear old samples
+*******************************************/
+void AuEngine::FIRFilter::Reset()
+{
+	if (isFFT) { convolver.Reset(); }
+	std::fill(line.begin(), line.end(), 0.0f);
+}
+
+/*******************************************
+* FIRFilter::Process():
+* Planar input and output
+*******************************************/
+void AuEngine::FIRFilter::Process(const float* const* ppIn, float** ppOut, int iFrames)
+{
+	if (isFFT)
+	{
+		convolver.Process(ppIn, ppOut, iFrames);
+		return;
+	}
+
+	for (int c = 0; c < channels; c++)
+	{
+		for (int done = 0; done < iFrames; done += FIR_DIRECT_BLOCK)
+		{
+			int part = iFrames - done < FIR_DIRECT_BLOCK ? iFrames - done : FIR_DIRECT_BLOCK;
+			ProcessDirect(ppIn[c] + done, ppOut[c] + done, part, c);
+		}
+	}
+}
+
+/*******************************************
+* FIRFilter::ProcessDirect():
+* Dot products for one part of channel
+*******************************************/
+void AuEngine::FIRFilter::ProcessDirect(const float* pIn, float* pOut, int iFrames, int iChannel)
+{
+	float* pLine = &line[(size_t)iChannel * lineSize];
+	const float* pRev = reversed.data();
+	int history = taps - 1;
+	memcpy(pLine + history, pIn, iFrames * sizeof(float));
+
+	int n = 0;
+	for (; n + 4 <= iFrames; n += 4)
+	{
+		// one load of taps for 4 outputs
+		__m128 acc0 = _mm_setzero_ps();
+		__m128 acc1 = _mm_setzero_ps();
+		__m128 acc2 = _mm_setzero_ps();
+		__m128 acc3 = _mm_setzero_ps();
+		const float* pSrc = pLine + n;
+		for (int m = 0; m < padded; m += 4)
+		{
+			__m128 h = _mm_loadu_ps(pRev + m);
+			acc0 = _mm_add_ps(acc0, _mm_mul_ps(h, _mm_loadu_ps(pSrc + m)));
+			acc1 = _mm_add_ps(acc1, _mm_mul_ps(h, _mm_loadu_ps(pSrc + m + 1)));
+			acc2 = _mm_add_ps(acc2, _mm_mul_ps(h, _mm_loadu_ps(pSrc + m + 2)));
+			acc3 = _mm_add_ps(acc3, _mm_mul_ps(h, _mm_loadu_ps(pSrc + m + 3)));
+		}
+
+		// transpose, so sum of every accumulator is one lane
+		_MM_TRANSPOSE4_PS(acc0, acc1, acc2, acc3);
+		_mm_storeu_ps(pOut + n, _mm_add_ps(_mm_add_ps(acc0, acc1), _mm_add_ps(acc2, acc3)));
+	}
+
+	for (; n < iFrames; n++)
+	{
+		__m128 acc = _mm_setzero_ps();
+		for (int m = 0; m < padded; m += 4)
+		{
+			acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(pRev + m), _mm_loadu_ps(pLine + n + m)));
+		}
+		float sum[4];
+		_mm_storeu_ps(sum, acc);
+		pOut[n] = sum[0] + sum[1] + sum[2] + sum[3];
+	}
+
+	memmove(pLine, pLine + iFrames, history * sizeof(float));
+}
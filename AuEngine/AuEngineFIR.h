@@ -0,0 +1,108 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineFIR.h:
+// header for FIR design and filter
+/////////////////////////////////
+#pragma once
+#include "AuEngine.h"
+#include "AuEngineConvolver.h"
+#include "AuEngineGraph.h"
+#include <vector>
+
+#define FIR_MAX_TAPS			65536
+#define FIR_MAX_REMEZ_TAPS		511				// bigger filters lose precision at exchange
+#define FIR_REMEZ_DENSITY		16				// grid points for every extremal
+#define FIR_REMEZ_ITERATIONS	64
+#define FIR_MAX_BANDS			16
+#define FIR_FFT_THRESHOLD		384				// taps, measured crossover: from this count FFT is faster
+#define FIR_FFT_BLOCK			256				// block of FFT mode (and its latency)
+#define FIR_DIRECT_BLOCK		256				// frames for one pass of direct mode
+#define FIR_KAISER_WINDOW		5				// after winmodes 1 - 4
+
+/***********************************************
+* enum FIRBandType:
+* Type of windowed-sinc filter, f1 is
+* cutoff, f2 is upper edge for band
+* filters. Highpass and bandstop need
+* odd count of taps
+***********************************
+* DesignWindowedSinc():
+* Ideal response * window. Window is
+* winmode of FFTProcess() or
+* FIR_KAISER_WINDOW (shape by fAtten)
+*
+* GetKaiserTapsCount():
+* Odd count of taps for Kaiser window
+* with transition width and attenuation
+*
+* DesignEquiripple():
+* Parks-McClellan (Remez exchange).
+* Bands are pairs of edges in Hz, desired
+* gain and weight for every band. Returns
+* false if exchange doesn't converge
+***********************************
+* class FIRFilter:
+* Linear FIR for many channels. Short
+* filters use direct form with SSE dot
+* products (no latency), long ones go to
+* partitioned FFT convolution (one block
+* of latency, see GetLatency()). Group
+* delay of linear phase filter is extra
+***********************************************/
+namespace AuEngine
+{
+	enum FIRBandType
+	{
+		FIR_LOWPASS,
+		FIR_HIGHPASS,
+		FIR_BANDPASS,
+		FIR_BANDSTOP
+	};
+
+	DLL_API void DesignWindowedSinc(float* pTaps, int iTaps, FIRBandType bandType, double f1, double f2,
+		double dSampleRate, int window, float fAtten = 80.0f);
+	DLL_API int  GetKaiserTapsCount(double dTransition, double dSampleRate, float fAtten);
+	DLL_API bool DesignEquiripple(float* pTaps, int iTaps, const double* pBands, const double* pDesired,
+		const double* pWeights, int iBands, double dSampleRate);
+
+	class FIRFilter
+	{
+	public:
+		FIRFilter() {}
+		DLL_API void Create(const float* pTaps, int iTaps, int iChannels, bool allowFFT = true);
+		DLL_API void Destroy();
+		DLL_API void Reset();
+		DLL_API void Process(const float* const* ppIn, float** ppOut, int iFrames);
+
+		bool IsFFT() const { return isFFT; }
+		int  GetLatency() const { return isFFT ? convolver.GetLatency() : 0; }
+		int  GetTapsCount() const { return taps; }
+		int  GetChannels() const { return channels; }
+
+	private:
+		void ProcessDirect(const float* pIn, float* pOut, int iFrames, int iChannel);
+
+		Convolver convolver;
+		std::vector<float> reversed;			// taps from last to first, padded to 4
+		std::vector<float> line;				// channel, taps - 1 old + FIR_DIRECT_BLOCK new
+		int taps = 0;
+		int padded = 0;
+		int lineSize = 0;
+		int channels = 0;
+		bool isFFT = false;
+	};
+
+	class FIRNode : public Node
+	{
+	public:
+		FIRNode(FIRFilter* pFilter) : Node(EFFECT_NODE, pFilter->GetChannels()), filter(pFilter) {}
+		void Process(float** ppIn, float** ppOut, int iFrames) override { filter->Process(ppIn, ppOut, iFrames); }
+		int  GetLatency() const override { return filter->GetLatency(); }
+
+	private:
+		FIRFilter* filter;
+	};
+};
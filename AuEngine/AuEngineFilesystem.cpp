@@ -1,10 +1,66 @@
 #include "AuEngine.h"
+#include "AuEngineTrack.h"
+#include "AuEngineWav.h"
+#include <vector>
 FILE* lFile;
 int iFileType;
 
-void AuEngine::FileSystem::CreateFileInBuffer(FILE* oFile, size_t szBuffer)
+void AuEngine::FileSystem::CreateFileInBuffer(const char* lpPath, const void* pData, size_t szBuffer,
+	int iChannels, int iSampleRate, PaSampleFormat format)
 {
+	// buffer is in memory already, so write it at once
+	WavFileWriter writer;
+	writer.Open(lpPath, iChannels, iSampleRate, format, (long long)szBuffer);
+	writer.Write(pData, szBuffer);
+	if (!writer.Close()) { THROW_EXCEPTION(AuEngine::OpSet::FILESYSYEM_ERROR); }
+}
+
+void AuEngine::FileSystem::ExportFile(const char* lpSource, const char* lpPath, PaSampleFormat format,
+	std::atomic<int>* pPercent)
+{
+	TrackReader reader;
+	reader.Open(lpSource);
+	if (!format) { format = reader.GetFormat(); }
+
+	int channels = reader.GetChannels();
+	size_t frameSize = channels * Pa_GetSampleSize(format);
+	unsigned long long frames = reader.GetFrames();
+
+	// write near target and replace it at the end: source can be the same file
+	std::string partPath = std::string(lpPath) + ".part";
+	std::vector<float> block(WAV_EXPORT_FRAMES * channels);
+	std::vector<uint8_t> converted(WAV_EXPORT_FRAMES * frameSize);
+	WavStreamWriter writer;
+	writer.Open(partPath.c_str(), channels, reader.GetSampleRate(), format, (long long)(frames * frameSize));
+
+	try
+	{
+		unsigned long long done = 0;
+		size_t read = 0;
+		while ((read = reader.Read(block.data(), WAV_EXPORT_FRAMES, channels)) > 0)
+		{
+			ConvertFromFloat(block.data(), converted.data(), read * channels, format);
+			writer.WriteBlocking(converted.data(), read * frameSize);
 
+			done += read;
+			if (pPercent && frames) { *pPercent = (int)(done * 100 / frames); }
+		}
+	}
+	catch (AuEngine::Exception&)
+	{
+		writer.Close();
+		DeleteFileA(partPath.c_str());
+		throw;
+	}
+
+	writer.Close();
+	reader.Close();
+	if (writer.IsFailed() || !MoveFileExA(partPath.c_str(), lpPath, MOVEFILE_REPLACE_EXISTING))
+	{
+		DeleteFileA(partPath.c_str());
+		THROW_EXCEPTION(AuEngine::OpSet::FILESYSYEM_ERROR);
+	}
+	if (pPercent) { *pPercent = 100; }
 }
 
 void AuEngine::FileSystem::OpenFileByPart(const char* lpPath)
@@ -21,31 +77,31 @@ void AuEngine::FileSystem::OpenFileByPart(const char* lpPath)
 	//void* buffer = malloc(fileSize);
 	//fseek(lFile, 0, SEEK_SET);
 
-	if (freadStr(lFile, 4) == "RIFF")
+	if (freadTag(lFile, "RIFF", 4))
 	{
 		uint32_t wavechunksize = freadNum<uint32_t>(lFile);
-		CHECK(freadStr(lFile, 4) == "WAVE");
+		CHECK(freadTag(lFile, "WAVE", 4));
 		iFileType = 1;				// WAV_FILE
 	}
-	else if (freadStr(lFile, 4) == "FORM")
+	else if (freadTag(lFile, "FORM", 4))
 	{
 		uint32_t wavechunksize = freadNum<uint32_t>(lFile);
-		CHECK(freadStr(lFile, 4) == "AIFF");
+		CHECK(freadTag(lFile, "AIFF", 4));
 		iFileType = 2;				// AIF_FILE
 	}
-	else if (freadStr(lFile, 3) == "ID3")
+	else if (freadTag(lFile, "ID3", 3))
 	{
 		iFileType = 3;				// MP3_FILE
 	}
-	else if (freadStr(lFile, 12) == "   ftypmp42")
+	else if (freadTag(lFile, "   ftypmp42", 12))
 	{
 		iFileType = 4;				// MP3C_FILE
 	}
-	else if (freadStr(lFile, 11) == "    ftypM4A")
+	else if (freadTag(lFile, "    ftypM4A", 11))
 	{
 		iFileType = 6;				// AAC_FILE (M4A)
 	}
-	else if (freadStr(lFile, 4) == "fLaC")
+	else if (freadTag(lFile, "fLaC", 4))
 	{
 		iFileType = 5;				// FLAC_FILE
 	}
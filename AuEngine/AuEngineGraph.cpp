@@ -0,0 +1,474 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineGraph.cpp:
+// effect graph and scheduler
+/////////////////////////////////
+
+/*******************************************
+* Effect graph:
+* Every node is a vertex of DAG. Before
+* playing we need to compile graph: sort
+* nodes and allocate all buffers, so
+* Process() doesn't allocate anything.
+*
+* Scheduling: every node has counter of
+* not finished inputs. When counter is 0,
+* node goes to ready list and any thread
+* (audio thread or worker) can take it.
+* Audio thread takes nodes too, so it
+* never waits for sleeping worker.
+*******************************************/
+
+#include "AuEngineGraph.h"
+#include "AuEngineMemory.h"
+
+/*******************************************
+* WorkerPool::Start():
+* Create time-critical worker threads
+*******************************************/
+void AuEngine::WorkerPool::Start(int iWorkers)
+{
+	if (isRunning) { Stop(); }
+	if (iWorkers > GRAPH_MAX_WORKERS) { iWorkers = GRAPH_MAX_WORKERS; }
+	if (iWorkers <= 0) { return; }
+
+	hSemaphore = CreateSemaphoreA(NULL, 0, GRAPH_MAX_WORKERS, NULL);
+	if (!hSemaphore) { THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR); }
+
+	isRunning = true;
+	for (int i = 0; i < iWorkers; i++)
+	{
+		workers.push_back(std::thread(&WorkerPool::WorkerThread, this));
+	}
+	Msg("AuEngine: Graph workers: ", iWorkers);
+}
+
+/*******************************************
+* WorkerPool::Stop():
+* Stop and join all workers
+*******************************************/
+void AuEngine::WorkerPool::Stop()
+{
+	if (!isRunning) { return; }
+
+	isRunning = false;
+	ReleaseSemaphore(hSemaphore, (LONG)workers.size(), NULL);
+	for (size_t i = 0; i < workers.size(); i++)
+	{
+		workers[i].join();
+	}
+	workers.clear();
+	CloseHandle(hSemaphore);
+	hSemaphore = NULL;
+}
+
+/*******************************************
+* WorkerPool::Wake():
+* Wake workers for current buffer period.
+* Doesn't block audio thread.
+*******************************************/
+void AuEngine::WorkerPool::Wake(Graph* pGraph, int iCount)
+{
+	if (iCount > (int)workers.size()) { iCount = (int)workers.size(); }
+	if (iCount <= 0) { return; }
+
+	currentGraph.store(pGraph, std::memory_order_release);
+	ReleaseSemaphore(hSemaphore, iCount, NULL);
+}
+
+/*******************************************
+* WorkerPool::WaitIdle():
+* Wait until no worker touches any graph.
+* Not for audio thread.
+*******************************************/
+void AuEngine::WorkerPool::WaitIdle()
+{
+	// store then load of other flag (worker does the opposite), so both
+	// sides must be seq_cst: release/acquire lets the load pass the store
+	currentGraph.store(nullptr, std::memory_order_seq_cst);
+	while (activeWorkers.load(std::memory_order_seq_cst) > 0)
+	{
+		Sleep(0);
+	}
+}
+
+/*******************************************
+* WorkerPool::WorkerThread():
+* Worker loop: sleep at semaphore, after
+* waking run nodes until cycle is done
+*******************************************/
+void AuEngine::WorkerPool::WorkerThread()
+{
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+	AuEngine::AudioThreadScope audioScope;		// nodes run for audio callback
+
+	while (isRunning)
+	{
+		WaitForSingleObject(hSemaphore, INFINITE);
+		if (!isRunning) { break; }
+
+		activeWorkers.fetch_add(1, std::memory_order_seq_cst);
+		Graph* pGraph = currentGraph.load(std::memory_order_seq_cst);
+		if (pGraph)
+		{
+			int iIdle = 0;
+			while (!pGraph->IsDone())
+			{
+				if (pGraph->RunReadyNodes()) { iIdle = 0; continue; }
+
+				// don't burn core of audio thread if machine is overloaded
+				if (++iIdle < 64) { YieldProcessor(); }
+				else { Sleep(0); }
+			}
+		}
+		activeWorkers.fetch_sub(1, std::memory_order_acq_rel);
+	}
+}
+
+/*******************************************
+* Graph::~Graph():
+* Destructor. Nodes are owned by caller
+*******************************************/
+AuEngine::Graph::~Graph()
+{
+	if (pool) { pool->WaitIdle(); }
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		delete nodes[i];
+	}
+}
+
+/*******************************************
+* Graph::AddNode():
+* Add node to graph, returns node index
+*******************************************/
+int AuEngine::Graph::AddNode(Node* pNode)
+{
+	if (!pNode || nodes.size() >= GRAPH_MAX_NODES) { THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR); }
+	if (pNode->channels <= 0 || pNode->channels > GRAPH_MAX_CHANNELS) { THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR); }
+
+	NodeState* pState = new NodeState();
+	pState->pNode = pNode;
+	nodes.push_back(pState);
+	return (int)nodes.size() - 1;
+}
+
+/*******************************************
+* Graph::Connect():
+* Connect output of node to input of node
+*******************************************/
+void AuEngine::Graph::Connect(int iFrom, int iTo)
+{
+	CHECK(iFrom >= 0 && iFrom < (int)nodes.size());
+	CHECK(iTo >= 0 && iTo < (int)nodes.size());
+	if (iFrom == iTo) { THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR); }
+
+	nodes[iFrom]->outputs.push_back(iTo);
+	nodes[iTo]->inputs.push_back(iFrom);
+}
+
+/*******************************************
+* Graph::Compile():
+* Topological sort, count max width of
+* graph and allocate all buffers
+*******************************************/
+void AuEngine::Graph::Compile(double dSampleRate, int iMaxFrames, WorkerPool* pWorkers)
+{
+	if (pool) { pool->WaitIdle(); }
+
+	size_t count = nodes.size();
+	std::vector<int> inCount(count), level(count, 0), sorted;
+	roots.clear();
+
+	// Kahn's algorithm, level is the longest path from root
+	for (size_t i = 0; i < count; i++)
+	{
+		inCount[i] = (int)nodes[i]->inputs.size();
+		if (!inCount[i]) { sorted.push_back((int)i); roots.push_back((int)i); }
+	}
+	for (size_t i = 0; i < sorted.size(); i++)
+	{
+		NodeState* pState = nodes[sorted[i]];
+		for (size_t j = 0; j < pState->outputs.size(); j++)
+		{
+			int iOut = pState->outputs[j];
+			if (level[iOut] < level[sorted[i]] + 1) { level[iOut] = level[sorted[i]] + 1; }
+			if (!--inCount[iOut]) { sorted.push_back(iOut); }
+		}
+	}
+
+	if (sorted.size() != count)
+	{
+		Msg("AuEngine: Graph has a cycle");
+		THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR);
+	}
+
+	std::vector<int> width(count + 1, 0);
+	maxWidth = 1;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (++width[level[i]] > maxWidth) { maxWidth = width[level[i]]; }
+	}
+
+	maxFrames = iMaxFrames;
+	for (size_t i = 0; i < count; i++)
+	{
+		NodeState* pState = nodes[i];
+		int iChannels = pState->pNode->channels;
+
+		pState->inBuffer.assign(iChannels * iMaxFrames, 0.0f);
+		pState->outBuffer.assign(iChannels * iMaxFrames, 0.0f);
+		for (int c = 0; c < iChannels; c++)
+		{
+			pState->inPtr[c] = &pState->inBuffer[c * iMaxFrames];
+			pState->outPtr[c] = &pState->outBuffer[c * iMaxFrames];
+		}
+		pState->pNode->Prepare(dSampleRate, iMaxFrames);
+	}
+
+	// branches are not aligned, latency is for the slowest one
+	std::vector<int> pathLatency(count, 0);
+	latency = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		NodeState* pState = nodes[sorted[i]];
+		int path = 0;
+		for (size_t j = 0; j < pState->inputs.size(); j++)
+		{
+			if (pathLatency[pState->inputs[j]] > path) { path = pathLatency[pState->inputs[j]]; }
+		}
+		path += pState->pNode->GetLatency();
+		pathLatency[sorted[i]] = path;
+		if (pState->pNode->type == OUTPUT_NODE && path > latency) { latency = path; }
+	}
+
+	readyList.assign(count, 0);
+	for (size_t i = 0; i < GRAPH_MAX_NODES; i++)
+	{
+		readySlot[i].store(0);
+	}
+	nodesLeft = 0;
+
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+	tickToSec = 1.0 / (double)freq.QuadPart;
+
+	pool = pWorkers;
+	Msg("AuEngine: Graph compiled, max width: ", maxWidth);
+}
+
+/*******************************************
+* Graph::PushReady():
+* Publish node to ready list
+*******************************************/
+void AuEngine::Graph::PushReady(int iNode)
+{
+	int idx = readyWrite.fetch_add(1, std::memory_order_acq_rel);
+	readyList[idx] = iNode;
+	readySlot[idx].store(cycle, std::memory_order_release);
+}
+
+/*******************************************
+* Graph::RunReadyNodes():
+* Take and run nodes from ready list.
+* Returns count of processed nodes
+*******************************************/
+int AuEngine::Graph::RunReadyNodes()
+{
+	int iDone = 0;
+	int count = (int)nodes.size();
+
+	while (true)
+	{
+		unsigned long long take = readyTake.load(std::memory_order_acquire);
+		unsigned int takeCycle = (unsigned int)(take >> 32);
+		int idx = (int)(take & 0xFFFFFFFF);
+
+		if (idx >= count) { break; }
+		if (readySlot[idx].load(std::memory_order_acquire) != takeCycle) { break; }	// not published yet
+
+		// cycle in the high bits makes stale workers fail here
+		if (!readyTake.compare_exchange_weak(take, take + 1, std::memory_order_acq_rel)) { continue; }
+
+		RunNode(readyList[idx]);
+		iDone++;
+	}
+	return iDone;
+}
+
+/*******************************************
+* Graph::RunNode():
+* Mix inputs, process node, release
+* dependent nodes
+*******************************************/
+void AuEngine::Graph::RunNode(int iNode)
+{
+	NodeState* pState = nodes[iNode];
+	Node* pNode = pState->pNode;
+	int iChannels = pNode->channels;
+
+	for (int c = 0; c < iChannels; c++)
+	{
+		memset(pState->inPtr[c], 0, frames * sizeof(float));
+	}
+
+	if (pNode->type == SOURCE_NODE && extInput)
+	{
+		for (int c = 0; c < iChannels && c < extChannels; c++)
+		{
+			float* pIn = pState->inPtr[c];
+			for (int i = 0; i < frames; i++)
+			{
+				pIn[i] = extInput[i * extChannels + c];
+			}
+		}
+	}
+
+	for (size_t j = 0; j < pState->inputs.size(); j++)
+	{
+		NodeState* pFrom = nodes[pState->inputs[j]];
+		int iFromChannels = pFrom->pNode->channels;
+		for (int c = 0; c < iChannels; c++)
+		{
+			const float* pSrc = pFrom->outPtr[c % iFromChannels];
+			float* pDst = pState->inPtr[c];
+			for (int i = 0; i < frames; i++)
+			{
+				pDst[i] += pSrc[i];
+			}
+		}
+	}
+
+	LARGE_INTEGER start, end;
+	QueryPerformanceCounter(&start);
+	pNode->Process(pState->inPtr, pState->outPtr, frames);
+	QueryPerformanceCounter(&end);
+
+	long long ticks = end.QuadPart - start.QuadPart;
+	pState->lastTicks.store(ticks, std::memory_order_relaxed);
+	if (ticks > pState->peakTicks.load(std::memory_order_relaxed))
+	{
+		pState->peakTicks.store(ticks, std::memory_order_relaxed);
+	}
+
+	for (size_t j = 0; j < pState->outputs.size(); j++)
+	{
+		int iOut = pState->outputs[j];
+		if (nodes[iOut]->pending.fetch_sub(1, std::memory_order_acq_rel) == 1)
+		{
+			PushReady(iOut);
+		}
+	}
+	nodesLeft.fetch_sub(1, std::memory_order_acq_rel);
+}
+
+/*******************************************
+* Graph::Process():
+* Process one buffer period. Input and
+* output are interleaved, can be the
+* same buffer
+*******************************************/
+void AuEngine::Graph::Process(const float* pInput, float* pOutput, int iChannels, int iFrames)
+{
+	int count = (int)nodes.size();
+	if (!count || iFrames > maxFrames)
+	{
+		if (pInput != pOutput) { memcpy(pOutput, pInput, iFrames * iChannels * sizeof(float)); }
+		return;
+	}
+
+	frames = iFrames;
+	extInput = pInput;
+	extChannels = iChannels;
+
+	// new cycle: reset take index before anything can be published
+	cycle = (cycle + 1) ? cycle + 1 : 1;
+	readyTake.store((unsigned long long)cycle << 32, std::memory_order_release);
+	readyWrite.store(0, std::memory_order_relaxed);
+	for (int i = 0; i < count; i++)
+	{
+		nodes[i]->pending.store((int)nodes[i]->inputs.size(), std::memory_order_relaxed);
+	}
+	nodesLeft.store(count, std::memory_order_release);
+
+	for (size_t i = 0; i < roots.size(); i++)
+	{
+		PushReady(roots[i]);
+	}
+
+	if (pool && maxWidth > 1) { pool->Wake(this, maxWidth - 1); }
+
+	// audio thread is a worker too
+	while (!IsDone())
+	{
+		if (!RunReadyNodes()) { YieldProcessor(); }
+	}
+
+	bool isOutput = false;
+	for (int i = 0; i < count; i++)
+	{
+		NodeState* pState = nodes[i];
+		if (pState->pNode->type != OUTPUT_NODE) { continue; }
+
+		if (!isOutput)
+		{
+			memset(pOutput, 0, iFrames * iChannels * sizeof(float));
+			isOutput = true;
+		}
+		int iNodeChannels = pState->pNode->channels;
+		for (int c = 0; c < iChannels; c++)
+		{
+			const float* pSrc = pState->outPtr[c % iNodeChannels];
+			for (int f = 0; f < iFrames; f++)
+			{
+				pOutput[f * iChannels + c] += pSrc[f];
+			}
+		}
+	}
+
+	if (!isOutput && pInput != pOutput)
+	{
+		memcpy(pOutput, pInput, iFrames * iChannels * sizeof(float));
+	}
+	extInput = nullptr;
+}
+
+/*******************************************
+* Graph::GetNodeTime():
+* Return time of last Process() (seconds)
+*******************************************/
+double AuEngine::Graph::GetNodeTime(int iNode)
+{
+	if (iNode < 0 || iNode >= (int)nodes.size()) { return 0.0; }
+	return nodes[iNode]->lastTicks.load(std::memory_order_relaxed) * tickToSec;
+}
+
+/*******************************************
+* Graph::GetNodePeakTime():
+* Return peak time of Process() (seconds)
+*******************************************/
+double AuEngine::Graph::GetNodePeakTime(int iNode)
+{
+	if (iNode < 0 || iNode >= (int)nodes.size()) { return 0.0; }
+	return nodes[iNode]->peakTicks.load(std::memory_order_relaxed) * tickToSec;
+}
+
+/*******************************************
+* Graph::GetMemorySize():
+* Bytes of node states and buffers which
+* Compile() allocates for iMaxFrames
+*******************************************/
+size_t AuEngine::Graph::GetMemorySize(int iMaxFrames) const
+{
+	size_t bytes = nodes.size() * (sizeof(NodeState) + sizeof(int));		// state and ready list
+	for (size_t i = 0; i < nodes.size(); i++)
+	{
+		const NodeState* pState = nodes[i];
+		bytes += 2 * (size_t)pState->pNode->channels * iMaxFrames * sizeof(float);
+		bytes += (pState->inputs.size() + pState->outputs.size()) * sizeof(int);
+	}
+	return bytes;
+}
@@ -0,0 +1,155 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineGraph.h:
+// header for effect graph
+/////////////////////////////////
+#pragma once
+#include "AuEngine.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#define GRAPH_MAX_NODES			256
+#define GRAPH_MAX_CHANNELS		8
+#define GRAPH_MAX_WORKERS		32
+
+/***********************************************
+* class Node:
+* Base class for every processing node.
+* Node gets planar input (sum of all
+* connected nodes) and writes planar output
+***********************************
+* class Graph:
+* DAG of nodes. Compile() sorts nodes
+* by dependencies, Process() runs one
+* buffer period. Independent branches are
+* executed at the same time by workers.
+* GetLatency() is delay of longest path
+* to output node, offline renders skip it
+*
+* class MixerNode:
+* Passes sum of its inputs (graph mixes
+* them), e.g. as output node of chain
+*
+* class WorkerPool:
+* Time-critical threads for Graph. Audio
+* thread works with pool and never waits
+* on locks (no priority inversion)
+***********************************************/
+namespace AuEngine
+{
+	enum NodeType
+	{
+		SOURCE_NODE		= 1,			// gets external input of graph
+		EFFECT_NODE		= 2,
+		MIXER_NODE		= 3,
+		ANALYSER_NODE	= 4,			// output is not used by graph
+		OUTPUT_NODE		= 5				// output goes to external output of graph
+	};
+
+	class Node
+	{
+	public:
+		Node(NodeType nodeType, int iChannels) : type(nodeType), channels(iChannels) {}
+		virtual ~Node() {}
+
+		// called from Graph::Compile(), not at audio thread
+		virtual void Prepare(double dSampleRate, int iMaxFrames) {}
+		virtual void Process(float** ppIn, float** ppOut, int iFrames) = 0;
+		// frames of delay, valid after Prepare()
+		virtual int GetLatency() const { return 0; }
+
+		NodeType type;
+		int channels;
+	};
+
+	class MixerNode : public Node
+	{
+	public:
+		MixerNode(int iChannels, NodeType nodeType = MIXER_NODE) : Node(nodeType, iChannels) {}
+		void Process(float** ppIn, float** ppOut, int iFrames) override
+		{
+			for (int c = 0; c < channels; c++) { memcpy(ppOut[c], ppIn[c], iFrames * sizeof(float)); }
+		}
+	};
+
+	class Graph;
+
+	class WorkerPool
+	{
+	public:
+		WorkerPool() {}
+		~WorkerPool() { Stop(); }
+		DLL_API void Start(int iWorkers);
+		DLL_API void Stop();
+		int  GetWorkersCount() const { return (int)workers.size(); }
+		void Wake(Graph* pGraph, int iCount);
+		void WaitIdle();
+
+	private:
+		void WorkerThread();
+
+		std::vector<std::thread> workers;
+		std::atomic<Graph*> currentGraph{ nullptr };
+		std::atomic<bool> isRunning{ false };
+		std::atomic<int> activeWorkers{ 0 };
+		HANDLE hSemaphore = NULL;
+	};
+
+	class Graph
+	{
+	public:
+		Graph() {}
+		DLL_API ~Graph();
+		DLL_API int  AddNode(Node* pNode);
+		DLL_API void Connect(int iFrom, int iTo);
+		DLL_API void Compile(double dSampleRate, int iMaxFrames, WorkerPool* pWorkers);
+		DLL_API void Process(const float* pInput, float* pOutput, int iChannels, int iFrames);
+		DLL_API double GetNodeTime(int iNode);
+		DLL_API double GetNodePeakTime(int iNode);
+		DLL_API size_t GetMemorySize(int iMaxFrames) const;
+		int  GetNodesCount() const { return (int)nodes.size(); }
+		int  GetLatency() const { return latency; }
+		bool IsDone() const { return nodesLeft.load(std::memory_order_acquire) <= 0; }
+		int  RunReadyNodes();
+
+	private:
+		struct NodeState
+		{
+			Node* pNode;
+			std::vector<int> inputs;
+			std::vector<int> outputs;
+			std::vector<float> inBuffer;
+			std::vector<float> outBuffer;
+			float* inPtr[GRAPH_MAX_CHANNELS];
+			float* outPtr[GRAPH_MAX_CHANNELS];
+			std::atomic<int> pending{ 0 };
+			std::atomic<long long> lastTicks{ 0 };
+			std::atomic<long long> peakTicks{ 0 };
+		};
+
+		void RunNode(int iNode);
+		void PushReady(int iNode);
+
+		std::vector<NodeState*> nodes;
+		std::vector<int> roots;					// nodes without inputs
+		std::vector<int> readyList;
+		std::atomic<unsigned int> readySlot[GRAPH_MAX_NODES];
+		std::atomic<unsigned long long> readyTake{ 0 };	// cycle << 32 | index
+		std::atomic<int> readyWrite{ 0 };
+		std::atomic<int> nodesLeft{ 0 };
+		unsigned int cycle = 0;
+
+		WorkerPool* pool = nullptr;
+		int maxWidth = 1;						// max count of nodes which can run at the same time
+		int latency = 0;						// longest path to output node
+		int maxFrames = 0;
+		int frames = 0;
+		int extChannels = 0;
+		const float* extInput = nullptr;
+		double tickToSec = 0.0;
+	};
+};
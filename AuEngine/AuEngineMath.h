@@ -37,6 +37,7 @@ public:
 	void BuildHammingWindow(float* window, int size);
 	void BuildHannWindow(float* window, int size);
 	void BuildKaiserWindow(float* window, float shape, int size);
+	float ComputeKaiserShape(float atten);
 	void BuildBlackmanWindow(float* window, int size);
 	void BuildBlackmanHarrisWindow(float* window, int size);
 
@@ -49,5 +50,6 @@ public:
 	void SignalHandler(int signum);
 
 private:
-
+	float window[FFT_SIZE];			// built once for winmode, not at every call
+	int windowMode = 0;
 };
\ No newline at end of file
@@ -0,0 +1,194 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineMemory.cpp:
+// real-time memory
+/////////////////////////////////
+
+/*******************************************
+* Real-time memory:
+* Audio thread can't call malloc/free,
+* because heap takes a lock and can wait
+* for page faults. All memory for stream
+* is allocated before Pa_StartStream():
+* arena for temporary buffers (reset at
+* every callback) and pools for blocks
+* with equal size (frames, messages).
+*******************************************/
+
+#include "AuEngineMemory.h"
+#ifdef RT_ALLOC_TRAP
+#include <crtdbg.h>
+#endif
+
+static thread_local int audioThreadDepth = 0;
+
+/*******************************************
+* Arena::Create():
+* Allocate block for arena
+*******************************************/
+void AuEngine::Arena::Create(size_t szSize)
+{
+	Destroy();
+	pData = (uint8_t*)_aligned_malloc(szSize, ARENA_ALIGN);
+	if (!pData) { THROW_EXCEPTION(AuEngine::OpSet::MEMORY_ERROR); }
+
+	// touch all pages now, not at audio thread
+	memset(pData, 0, szSize);
+	size = szSize;
+	used = 0;
+	peak = 0;
+}
+
+/*******************************************
+* Arena::Destroy():
+* Free arena block
+*******************************************/
+void AuEngine::Arena::Destroy()
+{
+	if (pData) { _aligned_free(pData); }
+	pData = NULL;
+	size = used = 0;
+}
+
+/*******************************************
+* BlockPool::Create():
+* Allocate all blocks and build free list
+*******************************************/
+void AuEngine::BlockPool::Create(size_t szBlock, int iCount)
+{
+	Destroy();
+	blockSize = (szBlock + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+	count = iCount;
+
+	pData = (uint8_t*)_aligned_malloc(blockSize * iCount, ARENA_ALIGN);
+	pNext = (int*)malloc(iCount * sizeof(int));
+	if (!pData || !pNext) { THROW_EXCEPTION(AuEngine::OpSet::MEMORY_ERROR); }
+	memset(pData, 0, blockSize * iCount);
+
+	for (int i = 0; i < iCount; i++)
+	{
+		pNext[i] = (i + 1 < iCount) ? i + 2 : 0;		// index + 1, 0 - end of list
+	}
+	head.store(iCount ? 1 : 0);
+	freeCount.store(iCount);
+}
+
+/*******************************************
+* BlockPool::Destroy():
+* Free all blocks
+*******************************************/
+void AuEngine::BlockPool::Destroy()
+{
+	if (pData) { _aligned_free(pData); }
+	if (pNext) { free(pNext); }
+	pData = NULL;
+	pNext = NULL;
+	count = 0;
+	head.store(0);
+	freeCount.store(0);
+}
+
+/*******************************************
+* BlockPool::Alloc():
+* Take block from free list (lock-free),
+* returns NULL if pool is empty
+*******************************************/
+void* AuEngine::BlockPool::Alloc()
+{
+	unsigned long long oldHead = head.load(std::memory_order_acquire);
+	while (true)
+	{
+		unsigned int idx = (unsigned int)(oldHead & 0xFFFFFFFF);
+		if (!idx) { return NULL; }
+
+		// tag in the high bits protects us from ABA
+		unsigned long long newHead = ((oldHead >> 32) + 1) << 32 | (unsigned int)pNext[idx - 1];
+		if (head.compare_exchange_weak(oldHead, newHead, std::memory_order_acq_rel))
+		{
+			freeCount.fetch_sub(1, std::memory_order_relaxed);
+			return pData + (idx - 1) * blockSize;
+		}
+	}
+}
+
+/*******************************************
+* BlockPool::Free():
+* Return block to free list (lock-free)
+*******************************************/
+void AuEngine::BlockPool::Free(void* pBlock)
+{
+	if (!pBlock) { return; }
+
+	size_t offset = (uint8_t*)pBlock - pData;
+	CHECK(offset < blockSize * count && !(offset % blockSize));
+	unsigned int idx = (unsigned int)(offset / blockSize) + 1;
+
+	unsigned long long oldHead = head.load(std::memory_order_acquire);
+	while (true)
+	{
+		pNext[idx - 1] = (int)(oldHead & 0xFFFFFFFF);
+		unsigned long long newHead = ((oldHead >> 32) + 1) << 32 | idx;
+		if (head.compare_exchange_weak(oldHead, newHead, std::memory_order_acq_rel))
+		{
+			freeCount.fetch_add(1, std::memory_order_relaxed);
+			return;
+		}
+	}
+}
+
+/*******************************************
+* AudioThreadScope():
+* Mark thread as audio thread
+*******************************************/
+AuEngine::AudioThreadScope::AudioThreadScope()
+{
+	audioThreadDepth++;
+}
+
+AuEngine::AudioThreadScope::~AudioThreadScope()
+{
+	audioThreadDepth--;
+}
+
+/*******************************************
+* IsAudioThread():
+* Return true inside AudioThreadScope
+*******************************************/
+bool AuEngine::IsAudioThread()
+{
+	return audioThreadDepth > 0;
+}
+
+#ifdef RT_ALLOC_TRAP
+/*******************************************
+* AllocHook():
+* CRT hook, breaks on heap call from
+* audio thread
+*******************************************/
+static int AllocHook(int allocType, void* userData, size_t size, int blockType,
+	long requestNumber, const unsigned char* filename, int lineNumber)
+{
+	// CRT blocks are allocated by CRT itself (e.g. for printf)
+	if (blockType == _CRT_BLOCK || !audioThreadDepth) { return TRUE; }
+
+	// Msg() allocates too, so use raw output
+	OutputDebugStringA(allocType == _HOOK_FREE ? "AuEngine: free() at audio thread\n" : "AuEngine: malloc() at audio thread\n");
+	DEBUG_BREAK;
+	return TRUE;
+}
+#endif
+
+/*******************************************
+* InstallAllocTrap():
+* Install heap hook for debug builds
+*******************************************/
+void AuEngine::InstallAllocTrap()
+{
+#ifdef RT_ALLOC_TRAP
+	_CrtSetAllocHook(AllocHook);
+	Msg("AuEngine: Real-time allocation trap installed");
+#endif
+}
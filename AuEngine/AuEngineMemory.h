@@ -0,0 +1,98 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineMemory.h:
+// header for real-time memory
+/////////////////////////////////
+#pragma once
+#include "AuEngine.h"
+#include <atomic>
+
+#define ARENA_ALIGN				64				// cache line
+#define STREAM_ARENA_SIZE		(1 << 20)		// 1 MB for every stream
+
+// Trap for malloc/free at audio thread (debug CRT only)
+#ifdef _DEBUG
+#define RT_ALLOC_TRAP
+#endif
+
+/***********************************************
+* class Arena:
+* Bump allocator. Memory is taken from
+* one block and all of it is released by
+* Reset() at the start of every buffer
+***********************************
+* class BlockPool:
+* Fixed-size blocks with lock-free free
+* list. Alloc() and Free() can be called
+* from any thread
+*
+* class AudioThreadScope:
+* Marks current thread as audio thread.
+* With RT_ALLOC_TRAP every malloc/free
+* inside scope breaks to debugger
+***********************************************/
+namespace AuEngine
+{
+	class Arena
+	{
+	public:
+		Arena() {}
+		~Arena() { Destroy(); }
+		DLL_API void Create(size_t szSize);
+		DLL_API void Destroy();
+
+		// Alloc() returns NULL if arena is full, never calls malloc
+		void* Alloc(size_t szSize, size_t szAlign = 16)
+		{
+			size_t offset = (used + szAlign - 1) & ~(szAlign - 1);
+			if (offset + szSize > size) { return NULL; }
+			used = offset + szSize;
+			if (used > peak) { peak = used; }
+			return pData + offset;
+		}
+		template<typename T> T* AllocArray(size_t count) { return (T*)Alloc(count * sizeof(T), alignof(T) > 16 ? alignof(T) : 16); }
+		void Reset() { used = 0; }
+		size_t GetUsed() const { return used; }
+		size_t GetPeak() const { return peak; }
+
+	private:
+		uint8_t* pData = NULL;
+		size_t size = 0;
+		size_t used = 0;
+		size_t peak = 0;
+	};
+
+	class BlockPool
+	{
+	public:
+		BlockPool() {}
+		~BlockPool() { Destroy(); }
+		DLL_API void Create(size_t szBlock, int iCount);
+		DLL_API void Destroy();
+		DLL_API void* Alloc();
+		DLL_API void Free(void* pBlock);
+		size_t GetBlockSize() const { return blockSize; }
+		int GetFreeCount() const { return freeCount.load(std::memory_order_relaxed); }
+
+	private:
+		uint8_t* pData = NULL;
+		int* pNext = NULL;							// next free block for every block
+		size_t blockSize = 0;
+		int count = 0;
+		std::atomic<unsigned long long> head{ 0 };	// tag << 32 | (index + 1), 0 - empty
+		std::atomic<int> freeCount{ 0 };
+	};
+
+	class AudioThreadScope
+	{
+	public:
+		DLL_API AudioThreadScope();
+		DLL_API ~AudioThreadScope();
+	};
+
+	DLL_API bool IsAudioThread();
+	DLL_API void InstallAllocTrap();
+};
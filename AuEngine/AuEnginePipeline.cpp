@@ -0,0 +1,151 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEnginePipeline.cpp:
+// sample pipelines
+/////////////////////////////////
+
+/*******************************************
+* Sample pipelines:
+* Callback used to count
+* bytesPerSample * numChannels and switch
+* by format for every sample. Now every
+* common pair of format and channels has
+* own instance of Pipeline<S, C>, table
+* below is built by compiler (only function
+* addresses, no code at startup). Stream
+* takes functions once at open and callback
+* calls them by pointer.
+*******************************************/
+
+#include "AuEnginePipeline.h"
+#include <string>
+
+#define PIPELINE_BENCH_PASSES	5
+
+#define PIPELINE_ROW(S)														\
+	{																		\
+		{ &Pipeline<S, 1>::Decode, &Pipeline<S, 1>::Apply, &Pipeline<S, 1>::Encode, 1 },	\
+		{ &Pipeline<S, 2>::Decode, &Pipeline<S, 2>::Apply, &Pipeline<S, 2>::Encode, 2 },	\
+		{ &Pipeline<S, 6>::Decode, &Pipeline<S, 6>::Apply, &Pipeline<S, 6>::Encode, 6 },	\
+		{ &Pipeline<S, 8>::Decode, &Pipeline<S, 8>::Apply, &Pipeline<S, 8>::Encode, 8 }	\
+	}
+
+namespace AuEngine
+{
+	static const PipelineFuncs pipelineTable[PIPELINE_FORMATS][PIPELINE_LAYOUTS] =
+	{
+		PIPELINE_ROW(SampleUInt8),
+		PIPELINE_ROW(SampleInt16),
+		PIPELINE_ROW(SampleInt24),
+		PIPELINE_ROW(SampleInt32),
+		PIPELINE_ROW(SampleFloat32)
+	};
+
+	static const PipelineFuncs genericTable[PIPELINE_FORMATS] =
+	{
+		{ &PipelineGeneric<SampleUInt8>::Decode, &PipelineGeneric<SampleUInt8>::Apply, &PipelineGeneric<SampleUInt8>::Encode, 0 },
+		{ &PipelineGeneric<SampleInt16>::Decode, &PipelineGeneric<SampleInt16>::Apply, &PipelineGeneric<SampleInt16>::Encode, 0 },
+		{ &PipelineGeneric<SampleInt24>::Decode, &PipelineGeneric<SampleInt24>::Apply, &PipelineGeneric<SampleInt24>::Encode, 0 },
+		{ &PipelineGeneric<SampleInt32>::Decode, &PipelineGeneric<SampleInt32>::Apply, &PipelineGeneric<SampleInt32>::Encode, 0 },
+		{ &PipelineGeneric<SampleFloat32>::Decode, &PipelineGeneric<SampleFloat32>::Apply, &PipelineGeneric<SampleFloat32>::Encode, 0 }
+	};
+
+	static const PaSampleFormat pipelineFormats[PIPELINE_FORMATS] = { paUInt8, paInt16, paInt24, paInt32, paFloat32 };
+	static const int pipelineLayouts[PIPELINE_LAYOUTS] = { 1, 2, 6, 8 };
+};
+
+/*******************************************
+* GetPipeline():
+* Take functions for format and channels
+*******************************************/
+const AuEngine::PipelineFuncs* AuEngine::GetPipeline(PaSampleFormat format, int iChannels)
+{
+	for (int f = 0; f < PIPELINE_FORMATS; f++)
+	{
+		if (pipelineFormats[f] != format) { continue; }
+
+		for (int l = 0; l < PIPELINE_LAYOUTS; l++)
+		{
+			if (pipelineLayouts[l] == iChannels) { return &pipelineTable[f][l]; }
+		}
+		return iChannels > 0 ? &genericTable[f] : NULL;
+	}
+	return NULL;
+}
+
+/*******************************************
+* BenchmarkPipelines():
+* Time of every specialization (ns/frame)
+* and of generic loops, to debug output
+*******************************************/
+void AuEngine::BenchmarkPipelines(size_t frames)
+{
+	static const char* formatNames[PIPELINE_FORMATS] = { "uint8", "int16", "int24", "int32", "float32" };
+
+	uint8_t* pData = (uint8_t*)malloc(frames * PIPELINE_MAX_CHANNELS * 4);
+	float* pFloat = (float*)malloc(frames * PIPELINE_MAX_CHANNELS * sizeof(float));
+	if (!pData || !pFloat)
+	{
+		free(pData);
+		free(pFloat);
+		THROW_EXCEPTION(AuEngine::OpSet::MEMORY_ERROR);
+	}
+
+	// noise-like data, so nothing is constant
+	unsigned int seed = 1;
+	for (size_t i = 0; i < frames * PIPELINE_MAX_CHANNELS * 4; i++)
+	{
+		seed = seed * 1664525 + 1013904223;
+		pData[i] = (uint8_t)(seed >> 24);
+	}
+	for (size_t i = 0; i < frames * PIPELINE_MAX_CHANNELS; i++)
+	{
+		pFloat[i] = (float)(int8_t)pData[i] * (1.0f / 128.0f);
+	}
+
+	LARGE_INTEGER freq, start, end;
+	QueryPerformanceFrequency(&freq);
+	MeterState meter;
+
+	for (int f = 0; f < PIPELINE_FORMATS; f++)
+	{
+		// float data must be valid floats, not random bytes
+		if (pipelineFormats[f] == paFloat32) { memcpy(pData, pFloat, frames * PIPELINE_MAX_CHANNELS * sizeof(float)); }
+
+		for (int l = 0; l < PIPELINE_LAYOUTS + 1; l++)
+		{
+			const PipelineFuncs* pFuncs = l < PIPELINE_LAYOUTS ? &pipelineTable[f][l] : &genericTable[f];
+			int channels = l < PIPELINE_LAYOUTS ? pipelineLayouts[l] : 2;
+			std::string name = std::string("AuEngine: Pipeline ") + formatNames[f] + " x" + std::to_string(channels)
+				+ (l < PIPELINE_LAYOUTS ? "" : " (generic)");
+
+			// best of several passes, first one warms caches
+			double decodeNs = 1e30;
+			double applyNs = 1e30;
+			for (int pass = 0; pass < PIPELINE_BENCH_PASSES; pass++)
+			{
+				ResetMeter(&meter);
+				QueryPerformanceCounter(&start);
+				pFuncs->decode(pData, pFloat, frames, channels, 0.5f, &meter);
+				QueryPerformanceCounter(&end);
+				double ns = (double)(end.QuadPart - start.QuadPart) * 1e9 / (double)freq.QuadPart / (double)frames;
+				if (ns < decodeNs) { decodeNs = ns; }
+
+				QueryPerformanceCounter(&start);
+				pFuncs->apply(pData, frames, channels, 1.0f, &meter);
+				QueryPerformanceCounter(&end);
+				ns = (double)(end.QuadPart - start.QuadPart) * 1e9 / (double)freq.QuadPart / (double)frames;
+				if (ns < applyNs) { applyNs = ns; }
+			}
+
+			Msg(name + ": decode (ps/frame): ", (int)(decodeNs * 1000.0));
+			Msg(name + ": apply (ps/frame): ", (int)(applyNs * 1000.0));
+		}
+	}
+
+	free(pData);
+	free(pFloat);
+}
@@ -0,0 +1,275 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEnginePipeline.h:
+// header for sample pipelines
+/////////////////////////////////
+#pragma once
+#include "AuEngine.h"
+
+#define PIPELINE_MAX_CHANNELS	8
+#define PIPELINE_FORMATS		5				// uint8, int16, int24, int32, float32
+#define PIPELINE_LAYOUTS		4				// 1, 2, 6, 8 channels
+
+/***********************************************
+* struct MeterState:
+* Peak and sum of squares for every
+* channel. Pipeline adds block to it,
+* owner resets it after reading
+***********************************
+* Sample types:
+* Load() gives float, Store() clips and
+* rounds, Gain() scales sample in place
+* and gives float. Size is compile-time,
+* so frame stride is constant too
+***********************************
+* struct Pipeline<S, C>:
+* Inner loops for sample type S and C
+* channels. Channel loop has constant
+* count and is fully unrolled, there is
+* no branch per sample.
+* Decode() - file data to float with gain
+*            (meter can be NULL)
+* Apply()  - gain at native data (in place)
+* Encode() - float to file data with clip
+*
+* GetPipeline():
+* Functions from dispatch table, call it
+* once when stream (or file) is opened.
+* Plain conversion of any interleaved
+* data can take mono functions. Other
+* channel counts take generic loops,
+* NULL - format isn't supported
+***********************************************/
+namespace AuEngine
+{
+	struct MeterState
+	{
+		float peak[PIPELINE_MAX_CHANNELS];
+		double sum[PIPELINE_MAX_CHANNELS];
+		unsigned long long frames;
+	};
+
+	inline void ResetMeter(MeterState* pMeter) { memset(pMeter, 0, sizeof(MeterState)); }
+
+	typedef void(*DecodeFunc)(const void* pIn, float* pOut, size_t frames, int iChannels, float fGain, MeterState* pMeter);
+	typedef void(*ApplyFunc)(void* pBuffer, size_t frames, int iChannels, float fGain, MeterState* pMeter);
+	typedef void(*EncodeFunc)(const float* pIn, void* pOut, size_t frames, int iChannels);
+
+	struct PipelineFuncs
+	{
+		DecodeFunc decode;
+		ApplyFunc apply;
+		EncodeFunc encode;
+		int channels;							// 0 - generic loops
+	};
+
+	struct SampleUInt8
+	{
+		static const int size = 1;
+		static float Load(const uint8_t* p) { return (p[0] - 128) * (1.0f / 128.0f); }
+		static void Store(uint8_t* p, float x)
+		{
+			// 8-bit WAV is unsigned
+			int32_t s = (int32_t)lrintf(fminf(fmaxf(x * 128.0f, -128.0f), 127.0f));
+			p[0] = (uint8_t)(s + 128);
+		}
+		static float Gain(uint8_t* p, float fGain) { float x = Load(p) * fGain; Store(p, x); return x; }
+	};
+
+	struct SampleInt16
+	{
+		static const int size = 2;
+		static float Load(const uint8_t* p) { int16_t s; memcpy(&s, p, 2); return s * (1.0f / 32768.0f); }
+		static void Store(uint8_t* p, float x)
+		{
+			int32_t s = (int32_t)lrintf(fminf(fmaxf(x * 32768.0f, -32768.0f), 32767.0f));
+			int16_t s16 = (int16_t)s;
+			memcpy(p, &s16, 2);
+		}
+		static float Gain(uint8_t* p, float fGain) { float x = Load(p) * fGain; Store(p, x); return x; }
+	};
+
+	struct SampleInt24
+	{
+		static const int size = 3;
+		static float Load(const uint8_t* p)
+		{
+			return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) * (1.0f / 2147483648.0f);
+		}
+		static void Store(uint8_t* p, float x)
+		{
+			int32_t s = (int32_t)lrintf(fminf(fmaxf(x * 8388608.0f, -8388608.0f), 8388607.0f));
+			p[0] = (uint8_t)s;
+			p[1] = (uint8_t)(s >> 8);
+			p[2] = (uint8_t)(s >> 16);
+		}
+		static float Gain(uint8_t* p, float fGain) { float x = Load(p) * fGain; Store(p, x); return x; }
+	};
+
+	struct SampleInt32
+	{
+		static const int size = 4;
+		static float Load(const uint8_t* p) { int32_t s; memcpy(&s, p, 4); return s * (1.0f / 2147483648.0f); }
+		static void Store(uint8_t* p, float x)
+		{
+			// +1.0 * 2^31 does not fit to int32, clip in double
+			int32_t s = (int32_t)lrint(fmin(fmax(x * 2147483648.0, -2147483648.0), 2147483647.0));
+			memcpy(p, &s, 4);
+		}
+		static float Gain(uint8_t* p, float fGain)
+		{
+			// float keeps only 24 bits, so scale in double (unity gain is lossless)
+			int32_t s;
+			memcpy(&s, p, 4);
+			double x = fmin(fmax(s * (double)fGain, -2147483648.0), 2147483647.0);
+			s = (int32_t)lrint(x);
+			memcpy(p, &s, 4);
+			return (float)(x * (1.0 / 2147483648.0));
+		}
+	};
+
+	struct SampleFloat32
+	{
+		static const int size = 4;
+		static float Load(const uint8_t* p) { float s; memcpy(&s, p, 4); return s; }
+		static void Store(uint8_t* p, float x) { memcpy(p, &x, 4); }
+		static float Gain(uint8_t* p, float fGain) { float x = Load(p) * fGain; Store(p, x); return x; }
+	};
+
+	template<typename S, int C>
+	struct Pipeline
+	{
+		static void Decode(const void* pIn, float* pOut, size_t frames, int iChannels, float fGain, MeterState* pMeter)
+		{
+			const uint8_t* pSrc = (const uint8_t*)pIn;
+			if (!pMeter)
+			{
+				for (size_t i = 0; i < frames * C; i++) { pOut[i] = S::Load(pSrc + i * S::size) * fGain; }
+				return;
+			}
+
+			float peak[C];
+			float sum[C];
+			for (int c = 0; c < C; c++) { peak[c] = 0.0f; sum[c] = 0.0f; }
+
+			for (size_t f = 0; f < frames; f++)
+			{
+				for (int c = 0; c < C; c++)
+				{
+					float x = S::Load(pSrc + (f * C + c) * S::size) * fGain;
+					pOut[f * C + c] = x;
+					peak[c] = fmaxf(peak[c], fabsf(x));
+					sum[c] += x * x;
+				}
+			}
+			Accumulate(pMeter, peak, sum, frames);
+		}
+
+		static void Apply(void* pBuffer, size_t frames, int iChannels, float fGain, MeterState* pMeter)
+		{
+			uint8_t* pData = (uint8_t*)pBuffer;
+			float peak[C];
+			float sum[C];
+			for (int c = 0; c < C; c++) { peak[c] = 0.0f; sum[c] = 0.0f; }
+
+			for (size_t f = 0; f < frames; f++)
+			{
+				for (int c = 0; c < C; c++)
+				{
+					float x = S::Gain(pData + (f * C + c) * S::size, fGain);
+					peak[c] = fmaxf(peak[c], fabsf(x));
+					sum[c] += x * x;
+				}
+			}
+			Accumulate(pMeter, peak, sum, frames);
+		}
+
+		static void Encode(const float* pIn, void* pOut, size_t frames, int iChannels)
+		{
+			uint8_t* pDst = (uint8_t*)pOut;
+			for (size_t f = 0; f < frames; f++)
+			{
+				for (int c = 0; c < C; c++)
+				{
+					S::Store(pDst + (f * C + c) * S::size, pIn[f * C + c]);
+				}
+			}
+		}
+
+		static void Accumulate(MeterState* pMeter, const float* peak, const float* sum, size_t frames)
+		{
+			if (!pMeter) { return; }
+			for (int c = 0; c < C; c++)
+			{
+				pMeter->peak[c] = fmaxf(pMeter->peak[c], peak[c]);
+				pMeter->sum[c] += sum[c];
+			}
+			pMeter->frames += frames;
+		}
+	};
+
+	// generic loops for any count of channels (slower)
+	template<typename S>
+	struct PipelineGeneric
+	{
+		static void Decode(const void* pIn, float* pOut, size_t frames, int iChannels, float fGain, MeterState* pMeter)
+		{
+			const uint8_t* pSrc = (const uint8_t*)pIn;
+			size_t samples = frames * iChannels;
+			for (size_t i = 0; i < samples; i++)
+			{
+				pOut[i] = S::Load(pSrc + i * S::size) * fGain;
+			}
+			Measure(pOut, frames, iChannels, pMeter);
+		}
+
+		static void Apply(void* pBuffer, size_t frames, int iChannels, float fGain, MeterState* pMeter)
+		{
+			uint8_t* pData = (uint8_t*)pBuffer;
+			size_t samples = frames * iChannels;
+			for (size_t i = 0; i < samples; i++)
+			{
+				float x = S::Gain(pData + i * S::size, fGain);
+				if (pMeter && i % iChannels < PIPELINE_MAX_CHANNELS)
+				{
+					int c = (int)(i % iChannels);
+					pMeter->peak[c] = fmaxf(pMeter->peak[c], fabsf(x));
+					pMeter->sum[c] += x * x;
+				}
+			}
+			if (pMeter) { pMeter->frames += frames; }
+		}
+
+		static void Encode(const float* pIn, void* pOut, size_t frames, int iChannels)
+		{
+			uint8_t* pDst = (uint8_t*)pOut;
+			size_t samples = frames * iChannels;
+			for (size_t i = 0; i < samples; i++)
+			{
+				S::Store(pDst + i * S::size, pIn[i]);
+			}
+		}
+
+		static void Measure(const float* pData, size_t frames, int iChannels, MeterState* pMeter)
+		{
+			if (!pMeter) { return; }
+			int channels = iChannels < PIPELINE_MAX_CHANNELS ? iChannels : PIPELINE_MAX_CHANNELS;
+			for (int c = 0; c < channels; c++)
+			{
+				for (size_t f = 0; f < frames; f++)
+				{
+					float x = pData[f * iChannels + c];
+					pMeter->peak[c] = fmaxf(pMeter->peak[c], fabsf(x));
+					pMeter->sum[c] += x * x;
+				}
+			}
+			pMeter->frames += frames;
+		}
+	};
+
+	DLL_API const PipelineFuncs* GetPipeline(PaSampleFormat format, int iChannels);
+	DLL_API void BenchmarkPipelines(size_t frames);
+};
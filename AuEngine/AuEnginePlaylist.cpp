@@ -0,0 +1,1024 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEnginePlaylist.cpp:
+// gapless playlist
+/////////////////////////////////
+
+/*******************************************
+* Gapless playback:
+* Stream is opened once and never closed
+* between tracks with the same sample rate.
+* Loader thread opens next track while
+* current one plays and fills its ring, so
+* at the end of track callback takes the
+* rest of buffer from next deck (sample
+* accurate switch, no gap).
+*
+* Owner of deck is defined by its state:
+* loader changes EMPTY deck only, callback
+* reads READY deck only and gives it back
+* as DONE. Track with other sample rate
+* needs new stream: it waits as REOPEN
+* until current one ends (only this case
+* has a gap).
+*
+* Seek never stops stream: loader reads
+* first block from new position (one
+* fread() for cached file), callback takes
+* it at next buffer. So seek-to-audio
+* time is less than one buffer period,
+* we keep it at GetSeekLatency().
+*******************************************/
+
+#include "AuEnginePlaylist.h"
+#include "AuEngineDevices.h"
+#include "AuEngineMemory.h"
+#include <algorithm>
+
+#define FRAME_BYTES			(PLAYLIST_CHANNELS * sizeof(float))
+
+/*******************************************
+* Add():
+* Add file to end of playlist
+*******************************************/
+void AuEngine::Playlist::Add(const char* lpPath)
+{
+	{
+		std::lock_guard<std::mutex> lock(queueMutex);
+		queue.push_back(lpPath);
+	}
+	if (hWakeEvent) { SetEvent(hWakeEvent); }
+}
+
+/*******************************************
+* Clear():
+* Remove tracks which are not loaded yet
+*******************************************/
+void AuEngine::Playlist::Clear()
+{
+	std::lock_guard<std::mutex> lock(queueMutex);
+	queue.clear();
+}
+
+/*******************************************
+* SetCrossfade():
+* Length of crossfade (0 - gapless only)
+*******************************************/
+void AuEngine::Playlist::SetCrossfade(double dSeconds)
+{
+	crossfadeMs = dSeconds > 0.0 ? (int)(dSeconds * 1000.0) : 0;
+}
+
+/*******************************************
+* SetEqualizer():
+* EQ for output (NULL - no EQ)
+*******************************************/
+void AuEngine::Playlist::SetEqualizer(ParametricEQ* pEQ)
+{
+	equalizer.store(pEQ, std::memory_order_release);
+}
+
+/*******************************************
+* SetDynamics():
+* Dynamics for output (NULL - none)
+*******************************************/
+void AuEngine::Playlist::SetDynamics(Dynamics* pDynamics)
+{
+	dynamics.store(pDynamics, std::memory_order_release);
+}
+
+/*******************************************
+* SetEffectGraph():
+* Graph for output (NULL - none). Waits
+* until loader swaps it
+*******************************************/
+void AuEngine::Playlist::SetEffectGraph(Graph* pGraph)
+{
+	requestGraph.store(pGraph, std::memory_order_release);
+	unsigned int request = graphRequests.fetch_add(1, std::memory_order_acq_rel) + 1;
+	if (!isRunning)
+	{
+		// no stream, graph is compiled when it's opened
+		graphDone.store(request, std::memory_order_release);
+		return;
+	}
+
+	SetEvent(hWakeEvent);
+	while (graphDone.load(std::memory_order_acquire) != request) { Sleep(1); }
+}
+
+/*******************************************
+* SetSpeed():
+* Playback speed (1 - normal) and pitch
+* shift in semitones
+*******************************************/
+void AuEngine::Playlist::SetSpeed(double dSpeed, double dSemitones)
+{
+	if (dSpeed <= 0.0) { dSpeed = 1.0; }
+	speed.store(dSpeed, std::memory_order_relaxed);
+	semitones.store(dSemitones, std::memory_order_relaxed);
+}
+
+/*******************************************
+* SetLatencyProfile():
+* Latency profile for next stream
+*******************************************/
+void AuEngine::Playlist::SetLatencyProfile(LatencyProfile profile)
+{
+	latencyProfile.store(profile, std::memory_order_release);
+}
+
+/*******************************************
+* SetLatency():
+* Explicit frames per buffer and device
+* latency (seconds) for next stream
+*******************************************/
+void AuEngine::Playlist::SetLatency(unsigned long frames, double dSeconds)
+{
+	customFrames.store(frames, std::memory_order_relaxed);
+	customLatency.store(dSeconds, std::memory_order_relaxed);
+	latencyProfile.store(LatencyProfile::LATENCY_CUSTOM, std::memory_order_release);
+}
+
+/*******************************************
+* Next():
+* Skip current track
+*******************************************/
+void AuEngine::Playlist::Next()
+{
+	isSkip = true;
+}
+
+/*******************************************
+* Pause():
+* Pause or resume (with short fade)
+*******************************************/
+void AuEngine::Playlist::Pause(bool isPause)
+{
+	isPaused = isPause;
+}
+
+/*******************************************
+* PostTransport():
+* Write request for loader (seqlock)
+*******************************************/
+void AuEngine::Playlist::PostTransport(unsigned long long frame, unsigned long long start, unsigned long long end)
+{
+	LARGE_INTEGER ticks;
+	QueryPerformanceCounter(&ticks);
+
+	// odd sequence: request is written now
+	transportSeq.fetch_add(1, std::memory_order_acq_rel);
+	requestFrame.store(frame, std::memory_order_relaxed);
+	requestLoopStart.store(start, std::memory_order_relaxed);
+	requestLoopEnd.store(end, std::memory_order_relaxed);
+	requestTicks.store(ticks.QuadPart, std::memory_order_relaxed);
+	transportSeq.fetch_add(1, std::memory_order_release);
+
+	if (hWakeEvent) { SetEvent(hWakeEvent); }
+}
+
+/*******************************************
+* Seek():
+* Go to frame of current track
+*******************************************/
+void AuEngine::Playlist::Seek(unsigned long long frame)
+{
+	PostTransport(frame, loopStart, loopEnd);
+}
+
+/*******************************************
+* SetLoop():
+* Loop region of current track (playing
+* goes to start of region)
+*******************************************/
+void AuEngine::Playlist::SetLoop(unsigned long long start, unsigned long long end)
+{
+	if (end <= start) { return; }
+	loopStart = start;
+	loopEnd = end;
+	PostTransport(start, start, end);
+}
+
+/*******************************************
+* ClearLoop():
+* Continue from current position
+*******************************************/
+void AuEngine::Playlist::ClearLoop()
+{
+	loopStart = loopEnd = 0;
+	PostTransport(GetPosition(), 0, 0);
+}
+
+/*******************************************
+* GetPosition():
+* Played frame of current track
+*******************************************/
+unsigned long long AuEngine::Playlist::GetPosition()
+{
+	return decks[current.load(std::memory_order_relaxed)].position.load(std::memory_order_relaxed);
+}
+
+/*******************************************
+* GetTrackSampleRate():
+* Sample rate of current track (for
+* conversion of positions to seconds)
+*******************************************/
+int AuEngine::Playlist::GetTrackSampleRate()
+{
+	Deck& deck = decks[current.load(std::memory_order_relaxed)];
+	return deck.state.load(std::memory_order_acquire) == DECK_READY ? deck.sampleRate : 0;
+}
+
+/*******************************************
+* GetSeekLatency():
+* Time (us) from Seek() to buffer with new
+* audio: last, max and count of seeks
+* longer than buffer period
+*******************************************/
+double AuEngine::Playlist::GetSeekLatency(double* pMaxLatency, unsigned long long* pLateSeeks)
+{
+	if (pMaxLatency) { *pMaxLatency = maxSeekLatencyNs.load(std::memory_order_relaxed) / 1000.0; }
+	if (pLateSeeks) { *pLateSeeks = lateSeeks.load(std::memory_order_relaxed); }
+	return seekLatencyNs.load(std::memory_order_relaxed) / 1000.0;
+}
+
+/*******************************************
+* Play():
+* Start loader thread. Stream is opened
+* by loader with rate of first track
+*******************************************/
+void AuEngine::Playlist::Play()
+{
+	if (isRunning) { return; }
+
+	AuEngine::GetDeviceCache().WaitReady();
+	PaError err = Pa_Initialize();
+	PA_CHECK(err, AuEngine::OpSet::INIT_ERROR);
+	isPaHeld = true;
+	AuEngine::InstallAllocTrap();
+
+	// blocks for one buffer are taken from arena by callback
+	arena.Create(STREAM_ARENA_SIZE);
+	pSeekTail = (float*)_aligned_malloc(PLAYLIST_FADE_FRAMES * FRAME_BYTES, 64);
+	if (!pSeekTail) { THROW_EXCEPTION(AuEngine::OpSet::MEMORY_ERROR); }
+	pStretchIn = (float*)_aligned_malloc(PLAYLIST_MAX_FRAMES * FRAME_BYTES, 64);
+	if (!pStretchIn) { THROW_EXCEPTION(AuEngine::OpSet::MEMORY_ERROR); }
+	stretchPending = 0;
+	// seek blocks of both decks
+	framePool.Create(PLAYLIST_SEEK_FRAMES * FRAME_BYTES, PLAYLIST_POOL_BLOCKS);
+	for (int i = 0; i < 2; i++)
+	{
+		for (int u = 0; u < 2; u++)
+		{
+			decks[i].pSeekBlock[u] = (float*)framePool.Alloc();
+			if (!decks[i].pSeekBlock[u]) { THROW_EXCEPTION(AuEngine::OpSet::MEMORY_ERROR); }
+		}
+	}
+
+	LARGE_INTEGER frequency;
+	QueryPerformanceFrequency(&frequency);
+	ticksPerSecond = (double)frequency.QuadPart;
+	seekLatencyNs = 0;
+	maxSeekLatencyNs = 0;
+	lateSeeks = 0;
+	transportGain = isPaused ? 0.0f : 1.0f;
+	hWakeEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
+	timing.Reset();
+	lastBusyTime = lastBufferTime = 0.0;
+
+	// ratios don't depend on rate, so it's created once
+	AuEngine::StretchConfig stretchConfig;
+	stretch.Create(stretchConfig, PLAYLIST_CHANNELS);
+	isStretch = false;
+
+	isRunning = true;
+	loaderThread = std::thread(&Playlist::LoaderThread, this);
+	Msg("AuEngine: Playlist started");
+}
+
+/*******************************************
+* Stop():
+* Stop stream and loader, free decks
+*******************************************/
+void AuEngine::Playlist::Stop()
+{
+	if (!isRunning) { return; }
+
+	isRunning = false;
+	SetEvent(hWakeEvent);
+	loaderThread.join();
+	CloseStream();
+	effectGraph.store(NULL, std::memory_order_release);
+	graphDone.store(graphRequests.load(std::memory_order_acquire), std::memory_order_release);
+
+	for (int i = 0; i < 2; i++)
+	{
+		decks[i].reader.Close();
+		decks[i].ring.Destroy();
+		decks[i].state = DECK_EMPTY;
+		for (int u = 0; u < 2; u++)
+		{
+			framePool.Free(decks[i].pSeekBlock[u]);
+			decks[i].pSeekBlock[u] = NULL;
+		}
+	}
+	current = 0;
+	seekTailFrames = seekTailRead = 0;
+	transportHandled = transportSeq.load();
+
+	CloseHandle(hWakeEvent);
+	hWakeEvent = NULL;
+	_aligned_free(pSeekTail);
+	pSeekTail = NULL;
+	_aligned_free(pStretchIn);
+	pStretchIn = NULL;
+	stretchPending = 0;
+	pFade = NULL;
+	arena.Destroy();
+	framePool.Destroy();
+	stretch.Destroy();
+	if (isPaHeld)
+	{
+		Pa_Terminate();
+		isPaHeld = false;
+	}
+}
+
+/*******************************************
+* PlaylistCallback():
+* Stream callback (userData is Playlist)
+*******************************************/
+int AuEngine::Playlist::PlaylistCallback(const void* inputBuffer, void* outputBuffer, unsigned long framesPerBuffer,
+	const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags, void* userData)
+{
+	Playlist* pThis = (Playlist*)userData;
+	AuEngine::CallbackTimer callbackTimer(pThis->timing, framesPerBuffer, pThis->streamRate, statusFlags);
+	AuEngine::AudioThreadScope audioScope;
+	pThis->arena.Reset();
+	pThis->pFade = NULL;
+
+	float* pOut = (float*)outputBuffer;
+	float target = pThis->isPaused.load(std::memory_order_relaxed) ? 0.0f : 1.0f;
+	float gain = pThis->transportGain;
+	if (gain == target && target == 1.0f)
+	{
+		pThis->RenderOutput(pOut, framesPerBuffer);
+		pThis->ApplyEffects(pOut, framesPerBuffer);
+		pThis->PublishTelemetry(pOut, framesPerBuffer);
+		return paContinue;
+	}
+
+	// on pause render only frames of fade, rest is silent
+	unsigned long frames = framesPerBuffer;
+	if (target == 0.0f)
+	{
+		unsigned long fadeLeft = (unsigned long)ceilf(gain * PLAYLIST_FADE_FRAMES);
+		if (frames > fadeLeft) { frames = fadeLeft; }
+	}
+	if (frames)
+	{
+		pThis->RenderOutput(pOut, frames);
+		pThis->ApplyEffects(pOut, frames);
+	}
+	memset(pOut + frames * PLAYLIST_CHANNELS, 0, (framesPerBuffer - frames) * FRAME_BYTES);
+
+	const float step = 1.0f / PLAYLIST_FADE_FRAMES;
+	for (unsigned long i = 0; i < frames; i++)
+	{
+		gain = gain < target ? (gain + step < target ? gain + step : target) : (gain - step > target ? gain - step : target);
+		for (int c = 0; c < PLAYLIST_CHANNELS; c++) { pOut[i * PLAYLIST_CHANNELS + c] *= gain; }
+	}
+	pThis->transportGain = frames < framesPerBuffer ? target : gain;
+	pThis->PublishTelemetry(pOut, framesPerBuffer);
+	return paContinue;
+}
+
+/*******************************************
+* PublishTelemetry():
+* Meter output of callback, publish
+* snapshot once per telemetry period
+*******************************************/
+void AuEngine::Playlist::PublishTelemetry(const float* pOut, unsigned long frames)
+{
+	if (!meter.Process(pOut, frames)) { return; }
+
+	TelemetrySnapshot* pSnapshot = telemetry.BeginWrite();
+	meter.Fill(pSnapshot);
+	pSnapshot->position = GetPosition();
+	pSnapshot->sampleRate = GetTrackSampleRate();
+	pSnapshot->isPaused = isPaused.load(std::memory_order_relaxed);
+	timing.GetSnapshot(&pSnapshot->timing);
+
+	// mean of all time hides spikes, so load is of this period only
+	double busy = pSnapshot->timing.busyTime - lastBusyTime;
+	double period = pSnapshot->timing.bufferTime - lastBufferTime;
+	pSnapshot->load = (period > 0.0 && busy >= 0.0) ? busy / period : 0.0;
+	lastBusyTime = pSnapshot->timing.busyTime;
+	lastBufferTime = pSnapshot->timing.bufferTime;
+	telemetry.Publish();
+}
+
+/*******************************************
+* RenderOutput():
+* Render tracks, through time-stretch if
+* speed or pitch is changed
+*******************************************/
+void AuEngine::Playlist::RenderOutput(float* pOut, unsigned long frames)
+{
+	double time = 1.0 / speed.load(std::memory_order_relaxed);
+	double shift = semitones.load(std::memory_order_relaxed);
+	if (time == 1.0 && shift == 0.0)
+	{
+		isStretch = false;
+		Render(pOut, frames);
+		return;
+	}
+
+	// old audio of vocoder is dropped, new one starts after latency
+	if (!isStretch)
+	{
+		stretch.Reset();
+		stretchPending = 0;
+		isStretch = true;
+	}
+	stretch.SetTime(time);
+	stretch.SetPitch(shift);
+
+	// frames which vocoder didn't take stay at front of input for next write
+	while (pStretchIn && stretch.GetAvailable() < frames)
+	{
+		size_t feed = std::min((size_t)PLAYLIST_MAX_FRAMES, stretch.GetWriteSpace());
+		if (!feed) { break; }
+		if (stretchPending < feed)
+		{
+			Render(pStretchIn + stretchPending * PLAYLIST_CHANNELS, (unsigned long)(feed - stretchPending));
+			stretchPending = feed;
+		}
+
+		size_t taken = stretch.Write(pStretchIn, stretchPending);
+		stretchPending -= taken;
+		if (stretchPending) { memmove(pStretchIn, pStretchIn + taken * PLAYLIST_CHANNELS, stretchPending * FRAME_BYTES); }
+		if (!taken) { break; }
+	}
+
+	size_t got = stretch.Read(pOut, frames);
+	memset(pOut + got * PLAYLIST_CHANNELS, 0, (frames - got) * FRAME_BYTES);
+}
+
+/*******************************************
+* ApplyEffects():
+* Effects work with rate of stream, rate
+* is set at audio thread, so effect is
+* never changed by two threads
+*******************************************/
+void AuEngine::Playlist::ApplyEffects(float* pOut, unsigned long frames)
+{
+	// graph is compiled for blocks of PLAYLIST_MAX_FRAMES
+	Graph* pGraph = effectGraph.load(std::memory_order_acquire);
+	for (unsigned long done = 0; pGraph && done < frames; done += PLAYLIST_MAX_FRAMES)
+	{
+		float* pBlock = pOut + done * PLAYLIST_CHANNELS;
+		pGraph->Process(pBlock, pBlock, PLAYLIST_CHANNELS, (int)std::min(frames - done, (unsigned long)PLAYLIST_MAX_FRAMES));
+	}
+
+	ParametricEQ* pEQ = equalizer.load(std::memory_order_acquire);
+	if (pEQ)
+	{
+		pEQ->SetSampleRate(streamRate);
+		pEQ->Process(pOut, (int)frames, PLAYLIST_CHANNELS);
+	}
+
+	Dynamics* pDynamics = dynamics.load(std::memory_order_acquire);
+	if (pDynamics)
+	{
+		pDynamics->SetSampleRate(streamRate);
+		pDynamics->Process(pOut, (int)frames, PLAYLIST_CHANNELS);
+	}
+}
+
+/*******************************************
+* Render():
+* Take frames from current deck, switch
+* to next deck at the end of track
+*******************************************/
+void AuEngine::Playlist::Render(float* pOut, unsigned long frames)
+{
+	if (isSkip.exchange(false, std::memory_order_relaxed))
+	{
+		Deck& deck = decks[current.load(std::memory_order_relaxed)];
+		if (deck.state.load(std::memory_order_acquire) == DECK_READY)
+		{
+			deck.state.store(DECK_DONE, std::memory_order_release);
+			current.store(current.load(std::memory_order_relaxed) ^ 1, std::memory_order_relaxed);
+			seekTailFrames = 0;
+			SetEvent(hWakeEvent);
+		}
+	}
+
+	unsigned long long fadeFrames = (unsigned long long)crossfadeMs.load(std::memory_order_relaxed) * streamRate / 1000;
+	unsigned long framesPerBuffer = frames;
+
+	while (frames)
+	{
+		int index = current.load(std::memory_order_relaxed);
+		Deck& deck = decks[index];
+		Deck& next = decks[index ^ 1];
+
+		if (deck.state.load(std::memory_order_acquire) != DECK_READY)
+		{
+			if (next.state.load(std::memory_order_acquire) == DECK_READY)
+			{
+				current.store(index ^ 1, std::memory_order_relaxed);
+				seekTailFrames = 0;
+				continue;
+			}
+			memset(pOut, 0, frames * FRAME_BYTES);		// nothing to play
+			return;
+		}
+
+		AdoptSeek(deck, framesPerBuffer);
+
+		unsigned long part = frames < PLAYLIST_MAX_FRAMES ? frames : PLAYLIST_MAX_FRAMES;
+		unsigned long long position = deck.position.load(std::memory_order_relaxed);
+		unsigned long long remaining = deck.frames > position ? deck.frames - position : 0;
+
+		// block must not cross start of crossfade (track never ends while looping)
+		bool isTrackFade = fadeFrames && !deck.playLoopEnd;
+		bool isFade = isTrackFade && remaining <= fadeFrames && next.state.load(std::memory_order_acquire) == DECK_READY;
+		if (isTrackFade && remaining > fadeFrames && part > remaining - fadeFrames)
+		{
+			part = (unsigned long)(remaining - fadeFrames);
+		}
+
+		size_t got = ReadDeck(deck, pOut, part);
+
+		// old audio after seek fades out
+		if (seekTailRead < seekTailFrames)
+		{
+			for (size_t i = 0; i < got && seekTailRead < seekTailFrames; i++, seekTailRead++)
+			{
+				float t = (float)seekTailRead / (float)PLAYLIST_FADE_FRAMES;
+				for (int c = 0; c < PLAYLIST_CHANNELS; c++)
+				{
+					size_t sample = i * PLAYLIST_CHANNELS + c;
+					pOut[sample] = pOut[sample] * t + pSeekTail[seekTailRead * PLAYLIST_CHANNELS + c] * (1.0f - t);
+				}
+			}
+		}
+
+		if (isFade && got && !pFade) { pFade = arena.AllocArray<float>(PLAYLIST_MAX_FRAMES * PLAYLIST_CHANNELS); }
+		if (isFade && got && pFade)
+		{
+			size_t gotNext = ReadDeck(next, pFade, got);
+			memset(pFade + gotNext * PLAYLIST_CHANNELS, 0, (got - gotNext) * FRAME_BYTES);
+
+			// equal power
+			for (size_t i = 0; i < got; i++)
+			{
+				float t = (float)(fadeFrames - (remaining - i)) / (float)fadeFrames;
+				float gainOut = cosf(t * (float)M_PI * 0.5f);
+				float gainIn = sinf(t * (float)M_PI * 0.5f);
+				for (int c = 0; c < PLAYLIST_CHANNELS; c++)
+				{
+					size_t sample = i * PLAYLIST_CHANNELS + c;
+					pOut[sample] = pOut[sample] * gainOut + pFade[sample] * gainIn;
+				}
+			}
+		}
+
+		pOut += got * PLAYLIST_CHANNELS;
+		frames -= (unsigned long)got;
+		if (got == part) { continue; }
+
+		// eof flag first: it's stored after last Write()
+		if (deck.isEof.load(std::memory_order_acquire) && !deck.ring.GetReadAvailable() &&
+			deck.seekPlaying < 0 && deck.seekPending.load(std::memory_order_acquire) < 0)
+		{
+			deck.state.store(DECK_DONE, std::memory_order_release);
+			current.store(index ^ 1, std::memory_order_relaxed);
+			seekTailFrames = 0;
+			SetEvent(hWakeEvent);
+			continue;
+		}
+
+		// loader is late: play silence for this block
+		memset(pOut, 0, (part - got) * FRAME_BYTES);
+		pOut += (part - got) * PLAYLIST_CHANNELS;
+		frames -= (unsigned long)(part - got);
+	}
+}
+
+/*******************************************
+* ReadDeck():
+* Take frames from seek block and ring,
+* move position (with loop)
+*******************************************/
+size_t AuEngine::Playlist::ReadDeck(Deck& deck, float* pOut, size_t frames)
+{
+	size_t done = 0;
+	if (deck.seekPlaying >= 0)
+	{
+		int block = deck.seekPlaying;
+		done = deck.seekFrames[block] - deck.seekRead;
+		if (done > frames) { done = frames; }
+		memcpy(pOut, deck.pSeekBlock[block] + deck.seekRead * PLAYLIST_CHANNELS, done * FRAME_BYTES);
+		deck.seekRead += done;
+		if (deck.seekRead == deck.seekFrames[block]) { deck.seekPlaying = -1; }
+	}
+	if (done < frames)
+	{
+		done += deck.ring.Read(pOut + done * PLAYLIST_CHANNELS, (frames - done) * FRAME_BYTES) / FRAME_BYTES;
+	}
+
+	unsigned long long position = deck.position.load(std::memory_order_relaxed) + done;
+	if (deck.playLoopEnd > deck.playLoopStart)
+	{
+		while (position >= deck.playLoopEnd) { position -= deck.playLoopEnd - deck.playLoopStart; }
+	}
+	deck.position.store(position, std::memory_order_relaxed);
+	return done;
+}
+
+/*******************************************
+* AdoptSeek():
+* Take published seek block: keep a bit
+* of old audio for fade, drop ring
+*******************************************/
+void AuEngine::Playlist::AdoptSeek(Deck& deck, unsigned long framesPerBuffer)
+{
+	int block = deck.seekPending.load(std::memory_order_acquire);
+	if (block < 0) { return; }
+
+	seekTailFrames = ReadDeck(deck, pSeekTail, PLAYLIST_FADE_FRAMES);
+	seekTailRead = 0;
+	deck.ring.Flush();
+
+	deck.seekPlaying = block;
+	deck.seekRead = 0;
+	deck.playLoopStart = deck.seekLoopStart[block];
+	deck.playLoopEnd = deck.seekLoopEnd[block];
+	deck.position.store(deck.seekTarget[block], std::memory_order_relaxed);
+	deck.isEof.store(deck.seekEof[block], std::memory_order_relaxed);
+
+	// seek-to-audio time (not counted if it waited for resume)
+	if (transportGain == 1.0f)
+	{
+		LARGE_INTEGER now;
+		QueryPerformanceCounter(&now);
+		unsigned long long ns = (unsigned long long)((now.QuadPart - deck.seekTicks[block]) * 1000000000.0 / ticksPerSecond);
+		seekLatencyNs.store(ns, std::memory_order_relaxed);
+		if (ns > maxSeekLatencyNs.load(std::memory_order_relaxed)) { maxSeekLatencyNs.store(ns, std::memory_order_relaxed); }
+		if (streamRate && ns > framesPerBuffer * 1000000000ULL / streamRate) { lateSeeks.fetch_add(1, std::memory_order_relaxed); }
+	}
+
+	// loader may write ring again
+	deck.seekPending.store(-1, std::memory_order_release);
+	SetEvent(hWakeEvent);
+}
+
+/*******************************************
+* LoaderThread():
+* Open next tracks, fill rings, reopen
+* stream for other sample rate
+*******************************************/
+void AuEngine::Playlist::LoaderThread()
+{
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_ABOVE_NORMAL);
+	float* pScratch = new float[TRACK_READ_FRAMES * PLAYLIST_CHANNELS];
+
+	while (isRunning)
+	{
+		WaitForSingleObject(hWakeEvent, PLAYLIST_LOADER_WAIT);
+		int index = current.load(std::memory_order_relaxed);
+
+		for (int i = 0; i < 2; i++)
+		{
+			if (decks[i].state.load(std::memory_order_acquire) == DECK_DONE)
+			{
+				decks[i].reader.Close();
+				decks[i].seekPending.store(-1, std::memory_order_relaxed);
+				decks[i].state.store(DECK_EMPTY, std::memory_order_release);
+			}
+		}
+
+		// current deck first (cold start), after that next one
+		for (int i = 0; i < 2; i++)
+		{
+			Deck& deck = decks[index ^ i];
+			if (deck.state.load(std::memory_order_acquire) == DECK_EMPTY) { LoadDeck(deck); }
+		}
+
+		// seek is before fill: new position must be at ring first
+		HandleTransport();
+
+		for (int i = 0; i < 2; i++)
+		{
+			int state = decks[i].state.load(std::memory_order_acquire);
+			if (state == DECK_READY || state == DECK_REOPEN) { FillDeck(decks[i], pScratch); }
+		}
+
+		// other rate: only when nothing is played
+		for (int i = 0; i < 2; i++)
+		{
+			if (decks[i].state.load(std::memory_order_acquire) != DECK_REOPEN) { continue; }
+			if (stream && decks[i].sampleRate == streamRate)
+			{
+				decks[i].state.store(DECK_READY, std::memory_order_release);
+			}
+			else if (decks[i ^ 1].state.load(std::memory_order_acquire) != DECK_READY)
+			{
+				try
+				{
+					ReopenStream(decks[i].sampleRate);
+					decks[i].state.store(DECK_READY, std::memory_order_release);
+				}
+				catch (AuEngine::Exception&)
+				{
+					Msg("AuEngine: Can't open stream for track, rate: ", decks[i].sampleRate);
+					decks[i].reader.Close();
+					decks[i].state.store(DECK_EMPTY, std::memory_order_release);
+				}
+			}
+		}
+
+		UpdateGraph();
+	}
+
+	delete[] pScratch;
+}
+
+/*******************************************
+* LoadDeck():
+* Open next file of playlist at deck
+*******************************************/
+bool AuEngine::Playlist::LoadDeck(Deck& deck)
+{
+	while (true)
+	{
+		std::string path;
+		{
+			std::lock_guard<std::mutex> lock(queueMutex);
+			if (queue.empty()) { return false; }
+			path = queue.front();
+			queue.pop_front();
+		}
+
+		try
+		{
+			deck.reader.Open(path.c_str());
+		}
+		catch (AuEngine::Exception&)
+		{
+			Msg("AuEngine: Playlist skips file: " + path);
+			continue;
+		}
+
+		deck.sampleRate = deck.reader.GetSampleRate();
+		deck.frames = deck.reader.GetFrames();
+		deck.position.store(0, std::memory_order_relaxed);
+		deck.isEof.store(false, std::memory_order_relaxed);
+		deck.seekPending.store(-1, std::memory_order_relaxed);
+		deck.seekPlaying = -1;
+		deck.loopStart = deck.loopEnd = 0;
+		deck.playLoopStart = deck.playLoopEnd = 0;
+		deck.ring.Create((size_t)deck.sampleRate * PLAYLIST_RING_SECONDS * FRAME_BYTES);
+
+		// ready for switch only if stream has the same rate
+		deck.state.store(stream && deck.sampleRate == streamRate ? DECK_READY : DECK_REOPEN, std::memory_order_release);
+		return true;
+	}
+}
+
+/*******************************************
+* FillDeck():
+* Read file to ring while there is space
+*******************************************/
+void AuEngine::Playlist::FillDeck(Deck& deck, float* pScratch)
+{
+	// ring will be dropped by callback, wait for it
+	if (deck.seekPending.load(std::memory_order_acquire) >= 0) { return; }
+
+	while (!deck.isEof.load(std::memory_order_relaxed) && deck.ring.GetWriteAvailable() >= TRACK_READ_FRAMES * FRAME_BYTES)
+	{
+		size_t got = ReadLooped(deck, pScratch, TRACK_READ_FRAMES);
+		deck.ring.Write(pScratch, got * FRAME_BYTES);
+		if (got < TRACK_READ_FRAMES) { deck.isEof.store(true, std::memory_order_release); }
+	}
+}
+
+/*******************************************
+* ReadLooped():
+* Read frames of track, go back to loop
+* start at loop end
+*******************************************/
+size_t AuEngine::Playlist::ReadLooped(Deck& deck, float* pOut, size_t frames)
+{
+	size_t done = 0;
+	try
+	{
+		while (done < frames)
+		{
+			size_t part = frames - done;
+			if (deck.loopEnd)
+			{
+				unsigned long long position = deck.reader.GetPosition();
+				if (position >= deck.loopEnd)
+				{
+					deck.reader.Seek(deck.loopStart);
+					continue;
+				}
+				if (part > deck.loopEnd - position) { part = (size_t)(deck.loopEnd - position); }
+			}
+
+			size_t got = deck.reader.Read(pOut + done * PLAYLIST_CHANNELS, part, PLAYLIST_CHANNELS);
+			done += got;
+			if (got < part) { break; }
+		}
+	}
+	catch (AuEngine::Exception&)
+	{
+		Msg("AuEngine: Playlist can't read file");
+	}
+	return done;
+}
+
+/*******************************************
+* HandleTransport():
+* Read last request and publish seek
+* block for current deck
+*******************************************/
+void AuEngine::Playlist::HandleTransport()
+{
+	unsigned int sequence = transportSeq.load(std::memory_order_acquire);
+	if (sequence == transportHandled || (sequence & 1)) { return; }
+
+	unsigned long long frame = requestFrame.load(std::memory_order_relaxed);
+	unsigned long long start = requestLoopStart.load(std::memory_order_relaxed);
+	unsigned long long end = requestLoopEnd.load(std::memory_order_relaxed);
+	long long ticks = requestTicks.load(std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (transportSeq.load(std::memory_order_relaxed) != sequence) { return; }		// written now, take it later
+
+	Deck& deck = decks[current.load(std::memory_order_relaxed)];
+	int state = deck.state.load(std::memory_order_acquire);
+	if (state != DECK_READY && state != DECK_REOPEN)
+	{
+		transportHandled = sequence;
+		return;
+	}
+
+	// previous seek isn't taken yet: last request wins later
+	if (deck.seekPending.load(std::memory_order_acquire) >= 0) { return; }
+	transportHandled = sequence;
+
+	if (end > deck.frames) { end = deck.frames; }
+	deck.loopStart = end > start ? start : 0;
+	deck.loopEnd = end > start ? end : 0;
+	if (frame > deck.frames) { frame = deck.frames; }
+
+	// callback can play only last published block
+	int block = deck.seekPublished ^ 1;
+	size_t got = 0;
+	try
+	{
+		deck.reader.Seek(frame);
+		got = ReadLooped(deck, deck.pSeekBlock[block], PLAYLIST_SEEK_FRAMES);
+	}
+	catch (AuEngine::Exception&)
+	{
+		Msg("AuEngine: Playlist can't seek file");
+	}
+
+	deck.seekFrames[block] = got;
+	deck.seekTarget[block] = frame;
+	deck.seekLoopStart[block] = deck.loopStart;
+	deck.seekLoopEnd[block] = deck.loopEnd;
+	deck.seekTicks[block] = ticks;
+	deck.seekEof[block] = got < PLAYLIST_SEEK_FRAMES;
+	deck.seekPublished = block;
+	deck.seekPending.store(block, std::memory_order_release);
+}
+
+/*******************************************
+* UpdateGraph():
+* Swap effect graph requested by UI, old
+* graph is free after callback which
+* could take it
+*******************************************/
+void AuEngine::Playlist::UpdateGraph()
+{
+	unsigned int request = graphRequests.load(std::memory_order_acquire);
+	if (request == graphDone.load(std::memory_order_relaxed)) { return; }
+
+	Graph* pGraph = requestGraph.load(std::memory_order_acquire);
+	if (pGraph != effectGraph.load(std::memory_order_relaxed))
+	{
+		if (stream) { CompileGraph(pGraph, streamRate); }
+		else { effectGraph.store(pGraph, std::memory_order_release); }
+
+		// count is changed at end of callback
+		unsigned long long callbacks = timing.GetCallbacks();
+		for (int ms = 0; ms < PLAYLIST_GRAPH_WAIT && stream && timing.GetCallbacks() == callbacks; ms++) { Sleep(1); }
+	}
+	graphDone.store(request, std::memory_order_release);
+}
+
+/*******************************************
+* CompileGraph():
+* Prepare graph for rate and publish it
+* (NULL if it can't be prepared). Graph
+* isn't used by callback here
+*******************************************/
+void AuEngine::Playlist::CompileGraph(Graph* pGraph, int iSampleRate)
+{
+	try
+	{
+		if (pGraph) { pGraph->Compile(iSampleRate, PLAYLIST_MAX_FRAMES, NULL); }
+	}
+	catch (AuEngine::Exception&)
+	{
+		Msg("AuEngine: Can't prepare effect graph, rate: ", iSampleRate);
+		pGraph = NULL;
+	}
+	effectGraph.store(pGraph, std::memory_order_release);
+}
+
+/*******************************************
+* ReopenStream():
+* Open stream with other sample rate
+*******************************************/
+void AuEngine::Playlist::ReopenStream(int iSampleRate)
+{
+	CloseStream();
+
+	// devices were changed: rebuild cache while playlist holds no stream
+	// (or init failed last time). Only our own init is released
+	AuEngine::DeviceCache& cache = AuEngine::GetDeviceCache();
+	if (cache.IsStale() || !isPaHeld)
+	{
+		if (isPaHeld)
+		{
+			Pa_Terminate();
+			isPaHeld = false;
+		}
+		cache.WaitReady();
+		PaError err = Pa_Initialize();
+		PA_CHECK(err, AuEngine::OpSet::INIT_ERROR);
+		isPaHeld = true;
+	}
+
+	PaDeviceIndex device = Pa_GetDefaultOutputDevice();
+	const PaDeviceInfo* pInfo = device != paNoDevice ? Pa_GetDeviceInfo(device) : NULL;
+	if (!pInfo) { THROW_EXCEPTION(AuEngine::OpSet::NO_AUDIO_DEVICE); }
+	if (!AuEngine::GetDeviceCache().IsRateSupported(device, iSampleRate, false))
+	{
+		Msg("AuEngine: Device doesn't report support of rate: ", iSampleRate);
+	}
+
+	PaStreamParameters outputParameters;
+	outputParameters.device = device;
+	outputParameters.channelCount = PLAYLIST_CHANNELS;
+	outputParameters.sampleFormat = paFloat32;
+	LatencyProfile profile = latencyProfile.load(std::memory_order_acquire);
+	unsigned long frames = AuEngine::ChooseFramesPerBuffer(profile, customFrames.load(std::memory_order_relaxed), iSampleRate);
+	outputParameters.suggestedLatency = AuEngine::ChooseSuggestedLatency(profile, customLatency.load(std::memory_order_relaxed),
+		pInfo, frames, iSampleRate, false);
+	outputParameters.hostApiSpecificStreamInfo = NULL;
+
+	streamRate = iSampleRate;
+	meter.Prepare(iSampleRate, PLAYLIST_CHANNELS);
+	CompileGraph(requestGraph.load(std::memory_order_acquire), iSampleRate);
+	PaError err = Pa_OpenStream(&stream, NULL, &outputParameters, iSampleRate,
+		frames, paClipOff, &PlaylistCallback, this);
+	if (err != paNoError)
+	{
+		stream = NULL;
+		THROW_EXCEPTION(AuEngine::OpSet::STREAM_ERROR);
+	}
+
+	err = Pa_StartStream(stream);
+	if (err != paNoError)
+	{
+		CloseStream();
+		THROW_EXCEPTION(AuEngine::OpSet::STREAM_ERROR);
+	}
+	Msg("AuEngine: Playlist stream opened, rate: ", iSampleRate);
+}
+
+/*******************************************
+* CloseStream():
+* Stop and close stream
+*******************************************/
+void AuEngine::Playlist::CloseStream()
+{
+	if (!stream) { return; }
+
+	Pa_StopStream(stream);
+	Pa_CloseStream(stream);
+	stream = NULL;
+	streamRate = 0;
+}
@@ -0,0 +1,244 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEnginePlaylist.h:
+// header for gapless playlist
+/////////////////////////////////
+#pragma once
+#include "AuEngine.h"
+#include "AuEngineDynamics.h"
+#include "AuEngineEQ.h"
+#include "AuEngineGraph.h"
+#include "AuEngineMemory.h"
+#include "AuEngineRing.h"
+#include "AuEngineStretch.h"
+#include "AuEngineTelemetry.h"
+#include "AuEngineTrack.h"
+#include "AuEngineTiming.h"
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+#define PLAYLIST_CHANNELS		2
+#define PLAYLIST_RING_SECONDS	2				// pre-buffered audio of every deck
+#define PLAYLIST_MAX_FRAMES		2048			// callback works by blocks of this size
+#define PLAYLIST_LOADER_WAIT	10				// ms between loader checks
+#define PLAYLIST_SEEK_FRAMES	4096			// first block after seek, read at once
+#define PLAYLIST_FADE_FRAMES	256				// crossfade for seek and pause
+#define PLAYLIST_POOL_BLOCKS	4				// seek blocks, 2 for every deck
+#define PLAYLIST_GRAPH_WAIT		1000			// ms for callback to leave old effect graph
+
+/***********************************************
+* enum DeckState:
+* EMPTY - deck is owned by loader
+* READY - callback plays it, loader fills it
+* REOPEN - loaded, but needs stream with
+*          other sample rate
+* DONE - played, loader must free it
+***********************************
+* class Playlist:
+* Keeps one float stream for all tracks.
+* Two decks: current one plays, next one
+* is opened and pre-buffered by loader
+* thread. Callback switches decks inside
+* one buffer, so there is no gap. With
+* crossfade tail of current track is mixed
+* with head of next one
+***********************************
+* Transport:
+* Seek() and SetLoop() post request by
+* seqlock (UI is only writer). Loader reads
+* PLAYLIST_SEEK_FRAMES from new position to
+* free seek block of deck and publishes it,
+* callback takes it at next buffer, drops
+* ring and fades from old audio to new.
+* Loop is made by loader (reader goes back
+* to loop start), so loop is sample accurate
+***********************************
+* Effects:
+* SetEqualizer() and SetDynamics() set
+* EQ and dynamics (after EQ) for output
+* of playlist (NULL - none). Callback
+* takes them at next buffer, so they must
+* live until they're replaced or stream
+* is stopped.
+* SetEffectGraph() sets graph before EQ
+* (NULL - none). Loader compiles it for
+* rate of stream (and again when rate is
+* changed), callback processes it by
+* blocks of PLAYLIST_MAX_FRAMES, latency
+* of graph isn't compensated. It returns
+* when callback doesn't use old graph,
+* so old graph can be deleted after it
+***********************************
+* Speed:
+* SetSpeed() sets playback speed and
+* pitch shift. If any of them isn't 1:1,
+* output goes through phase vocoder
+* (callback renders as much input as
+* needed), else it's skipped
+***********************************
+* Latency:
+* Stream takes buffer size and device
+* latency from latency profile, like
+* streams of Output. New profile is used
+* from next opened stream
+***********************************
+* Telemetry:
+* Callback publishes levels, spectrum,
+* position and timing of output, UI
+* takes last snapshot by GetTelemetry()
+* from its timer (one reader only). No
+* side waits for the other one
+***********************************************/
+namespace AuEngine
+{
+	enum DeckState
+	{
+		DECK_EMPTY = 0,
+		DECK_READY,
+		DECK_REOPEN,
+		DECK_DONE
+	};
+
+	struct Deck
+	{
+		TrackReader reader;
+		RingBuffer ring;						// float frames, PLAYLIST_CHANNELS
+		std::atomic<int> state{ DECK_EMPTY };
+		std::atomic<bool> isEof{ false };		// all file is at ring
+		std::atomic<unsigned long long> position{ 0 };	// frame of track which is played
+		unsigned long long frames = 0;
+		int sampleRate = 0;
+
+		// seek blocks: loader writes one which isn't played
+		float* pSeekBlock[2] = { NULL, NULL };
+		size_t seekFrames[2] = { 0, 0 };
+		unsigned long long seekTarget[2] = { 0, 0 };
+		unsigned long long seekLoopStart[2] = { 0, 0 };
+		unsigned long long seekLoopEnd[2] = { 0, 0 };
+		long long seekTicks[2] = { 0, 0 };
+		bool seekEof[2] = { false, false };
+		std::atomic<int> seekPending{ -1 };	// published block, callback sets -1
+		int seekPublished = 1;
+
+		// loader only
+		unsigned long long loopStart = 0;
+		unsigned long long loopEnd = 0;			// 0 - no loop
+
+		// callback only
+		int seekPlaying = -1;
+		size_t seekRead = 0;
+		unsigned long long playLoopStart = 0;
+		unsigned long long playLoopEnd = 0;
+	};
+
+	class Playlist
+	{
+	public:
+		Playlist() {}
+		~Playlist() { Stop(); }
+		DLL_API void Add(const char* lpPath);
+		DLL_API void Clear();
+		DLL_API void Play();
+		DLL_API void Stop();
+		DLL_API void Next();
+		DLL_API void SetCrossfade(double dSeconds);
+		DLL_API void SetEqualizer(ParametricEQ* pEQ);
+		DLL_API void SetDynamics(Dynamics* pDynamics);
+		DLL_API void SetEffectGraph(Graph* pGraph);
+		DLL_API void SetSpeed(double dSpeed, double dSemitones = 0.0);
+		DLL_API void SetLatencyProfile(LatencyProfile profile);
+		DLL_API void SetLatency(unsigned long frames, double dSeconds);
+		DLL_API void Pause(bool isPause);
+		DLL_API void Seek(unsigned long long frame);
+		DLL_API void SetLoop(unsigned long long start, unsigned long long end);
+		DLL_API void ClearLoop();
+		DLL_API unsigned long long GetPosition();
+		DLL_API int GetTrackSampleRate();
+		DLL_API double GetSeekLatency(double* pMaxLatency, unsigned long long* pLateSeeks);
+		DLL_API void GetCallbackTiming(TimingSnapshot* pSnapshot) { timing.GetSnapshot(pSnapshot); }
+		DLL_API bool GetTelemetry(TelemetrySnapshot* pSnapshot) { return telemetry.Read(pSnapshot); }
+		bool IsPlaying() const { return isRunning; }
+
+	private:
+		static int PlaylistCallback(const void* inputBuffer, void* outputBuffer, unsigned long framesPerBuffer,
+			const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags, void* userData);
+		void RenderOutput(float* pOut, unsigned long frames);
+		void Render(float* pOut, unsigned long frames);
+		void ApplyEffects(float* pOut, unsigned long frames);
+		void PublishTelemetry(const float* pOut, unsigned long frames);
+		size_t ReadDeck(Deck& deck, float* pOut, size_t frames);
+		void AdoptSeek(Deck& deck, unsigned long framesPerBuffer);
+		void PostTransport(unsigned long long frame, unsigned long long start, unsigned long long end);
+		void HandleTransport();
+		size_t ReadLooped(Deck& deck, float* pOut, size_t frames);
+		void LoaderThread();
+		bool LoadDeck(Deck& deck);
+		void FillDeck(Deck& deck, float* pScratch);
+		void UpdateGraph();
+		void CompileGraph(Graph* pGraph, int iSampleRate);
+		void ReopenStream(int iSampleRate);
+		void CloseStream();
+
+		Deck decks[2];
+		std::atomic<int> current{ 0 };
+		std::deque<std::string> queue;
+		std::mutex queueMutex;					// UI and loader only
+		std::thread loaderThread;
+		HANDLE hWakeEvent = NULL;
+
+		PaStream* stream = NULL;
+		int streamRate = 0;
+		bool isPaHeld = false;					// Pa_Initialize() of playlist (loader owns it while running)
+		std::atomic<LatencyProfile> latencyProfile{ LatencyProfile::LATENCY_SAFE };	// UI writes, loader reads
+		std::atomic<unsigned long> customFrames{ 0 };
+		std::atomic<double> customLatency{ 0.0 };
+		AuEngine::Arena arena;					// scratch of callback, reset every buffer
+		AuEngine::BlockPool framePool;			// seek blocks of decks
+		float* pFade = NULL;					// next track for crossfade (from arena)
+		float* pSeekTail = NULL;				// old audio for seek crossfade
+		size_t seekTailFrames = 0;
+		size_t seekTailRead = 0;
+		float transportGain = 1.0f;				// pause ramp (callback only)
+		std::atomic<bool> isPaused{ false };
+
+		// transport request (seqlock, UI thread writes)
+		std::atomic<unsigned int> transportSeq{ 0 };
+		std::atomic<unsigned long long> requestFrame{ 0 };
+		std::atomic<unsigned long long> requestLoopStart{ 0 };
+		std::atomic<unsigned long long> requestLoopEnd{ 0 };
+		std::atomic<long long> requestTicks{ 0 };
+		unsigned int transportHandled = 0;		// loader only
+		unsigned long long loopStart = 0;		// last posted loop (UI)
+		unsigned long long loopEnd = 0;
+
+		double ticksPerSecond = 1.0;
+		std::atomic<unsigned long long> seekLatencyNs{ 0 };
+		std::atomic<unsigned long long> maxSeekLatencyNs{ 0 };
+		std::atomic<unsigned long long> lateSeeks{ 0 };	// longer than buffer period
+		std::atomic<bool> isRunning{ false };
+		std::atomic<bool> isSkip{ false };
+		std::atomic<int> crossfadeMs{ 0 };
+		std::atomic<ParametricEQ*> equalizer{ NULL };
+		std::atomic<Dynamics*> dynamics{ NULL };
+		std::atomic<Graph*> requestGraph{ NULL };	// UI writes, loader compiles
+		std::atomic<unsigned int> graphRequests{ 0 };
+		std::atomic<unsigned int> graphDone{ 0 };	// last request swapped by loader
+		std::atomic<Graph*> effectGraph{ NULL };	// compiled for stream, callback reads
+		std::atomic<double> speed{ 1.0 };
+		std::atomic<double> semitones{ 0.0 };
+		TimeStretch stretch;					// callback only (after Play())
+		bool isStretch = false;
+		float* pStretchIn = NULL;				// rendered frames which vocoder didn't take yet
+		size_t stretchPending = 0;
+		TimingHistogram timing;
+		double lastBusyTime = 0.0;				// timing at last snapshot (callback only)
+		double lastBufferTime = 0.0;
+		TelemetryMeter meter;					// callback only (after stream is opened)
+		TelemetryChannel telemetry;
+	};
+};
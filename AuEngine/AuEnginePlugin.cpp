@@ -0,0 +1,660 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEnginePlugin.cpp:
+// CLAP plugin host
+/////////////////////////////////
+
+/*******************************************
+* Sandbox:
+* Host makes named file mapping and two
+* auto-reset events, then starts
+* "rundll32 AuEngine.dll,PluginSandboxMain"
+* with name of mapping and its own pid.
+* Sandbox loads plugin by ClapPlugin and
+* waits for work event or exit of host.
+*
+* Audio goes by two SPSC rings of frames
+* at the mapping (indexes at own cache
+* lines, never wrapped). Output ring gets
+* max frames of silence at activation,
+* so sandbox has one block of time. If
+* output isn't there, host plays silence
+* and remembers frames it owes, sandbox
+* output for them is dropped later.
+* Full input ring means that sandbox
+* hangs, plugin is bypassed then.
+*
+* Commands (activate, quit) go through
+* the same work event, host waits for
+* done event or exit of sandbox with
+* timeout, never at audio thread.
+*******************************************/
+
+#include "AuEnginePlugin.h"
+#include "AuEngineRing.h"
+#include <algorithm>
+#include <new>
+#include <stdio.h>
+#include <string.h>
+
+#define SANDBOX_MAGIC			0x58424441		// "ADBX"
+#define SANDBOX_PATH			1024
+#define RING_MASK				(PLUGIN_RING_FRAMES - 1)
+
+namespace AuEngine
+{
+	enum SandboxCommand
+	{
+		SANDBOX_NONE,
+		SANDBOX_ACTIVATE,
+		SANDBOX_QUIT
+	};
+
+	enum SandboxState
+	{
+		SANDBOX_STARTING,
+		SANDBOX_LOADED,
+		SANDBOX_ACTIVE,
+		SANDBOX_FAILED
+	};
+
+	struct SandboxRing
+	{
+		alignas(RING_CACHE_LINE) std::atomic<unsigned int> write;
+		alignas(RING_CACHE_LINE) std::atomic<unsigned int> read;
+	};
+
+	struct SandboxShared
+	{
+		unsigned int magic;
+		char path[SANDBOX_PATH];
+		int index;
+		int channels;
+		double sampleRate;
+		int maxFrames;
+		int latency;							// of plugin, set at activation
+		std::atomic<int> command;
+		std::atomic<int> state;
+
+		long long frequency;
+		std::atomic<long long> lastTicks;
+		std::atomic<long long> peakTicks;
+		std::atomic<long long> totalTicks;
+		std::atomic<long long> totalFrames;
+
+		SandboxRing input;
+		SandboxRing output;
+		alignas(RING_CACHE_LINE) float inData[PLUGIN_RING_FRAMES * PLUGIN_MAX_CHANNELS];
+		alignas(RING_CACHE_LINE) float outData[PLUGIN_RING_FRAMES * PLUGIN_MAX_CHANNELS];
+	};
+};
+
+/*******************************************
+* Host callbacks:
+* Engine doesn't take requests of plugin
+* (restart, process, main thread)
+*******************************************/
+static const void* CLAP_ABI HostGetExtension(const clap_host_t* pHost, const char* lpId) { return NULL; }
+static void CLAP_ABI HostRequest(const clap_host_t* pHost) {}
+static uint32_t CLAP_ABI EventsSize(const clap_input_events_t* pList) { return 0; }
+static const clap_event_header_t* CLAP_ABI EventsGet(const clap_input_events_t* pList, uint32_t index) { return NULL; }
+static bool CLAP_ABI EventsPush(const clap_output_events_t* pList, const clap_event_header_t* pEvent) { return true; }
+
+static const clap_input_events_t inEvents = { NULL, EventsSize, EventsGet };
+static const clap_output_events_t outEvents = { NULL, EventsPush };
+
+/*******************************************
+* Load():
+* Load plugin iIndex of .clap file
+*******************************************/
+void AuEngine::ClapPlugin::Load(const char* lpPath, int iIndex, int iChannels)
+{
+	Unload();
+	if (iChannels <= 0 || iChannels > PLUGIN_MAX_CHANNELS) { THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR); }
+
+	hModule = LoadLibraryA(lpPath);
+	if (!hModule) { THROW_EXCEPTION(AuEngine::OpSet::FILESYSYEM_ERROR); }
+
+	pEntry = (const clap_plugin_entry_t*)GetProcAddress(hModule, CLAP_ENTRY_NAME);
+	if (!pEntry || pEntry->clap_version.major < CLAP_VERSION_MAJOR || !pEntry->init(lpPath))
+	{
+		FreeLibrary(hModule);
+		hModule = NULL;
+		pEntry = NULL;
+		THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR);
+	}
+
+	host.clap_version = { CLAP_VERSION_MAJOR, 0, 0 };
+	host.host_data = this;
+	host.name = "OpenAu";
+	host.vendor = "VERTVER";
+	host.url = "";
+	host.version = "1.0";
+	host.get_extension = HostGetExtension;
+	host.request_restart = HostRequest;
+	host.request_process = HostRequest;
+	host.request_callback = HostRequest;
+
+	const clap_plugin_factory_t* pFactory = (const clap_plugin_factory_t*)pEntry->get_factory(CLAP_PLUGIN_FACTORY_ID);
+	const clap_plugin_descriptor_t* pDesc = NULL;
+	if (pFactory && iIndex >= 0 && (uint32_t)iIndex < pFactory->get_plugin_count(pFactory))
+	{
+		pDesc = pFactory->get_plugin_descriptor(pFactory, iIndex);
+	}
+	if (pDesc) { pPlugin = pFactory->create_plugin(pFactory, &host, pDesc->id); }
+	if (pPlugin && !pPlugin->init(pPlugin))
+	{
+		pPlugin->destroy(pPlugin);
+		pPlugin = NULL;
+	}
+	if (!pPlugin)
+	{
+		Unload();
+		THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR);
+	}
+
+	channels = iChannels;
+	try
+	{
+		CheckPorts(true);
+		CheckPorts(false);
+	}
+	catch (AuEngine::Exception&)
+	{
+		Unload();
+		throw;
+	}
+
+	LARGE_INTEGER freq = {};
+	QueryPerformanceFrequency(&freq);
+	frequency = freq.QuadPart;
+	Msg("AuEngine: CLAP plugin loaded: " + std::string(GetName()));
+}
+
+/*******************************************
+* CheckPorts():
+* Main port must have our channels (no
+* audio-ports extension - plugin takes
+* what host gives)
+*******************************************/
+void AuEngine::ClapPlugin::CheckPorts(bool isInput)
+{
+	const clap_plugin_audio_ports_t* pPorts = (const clap_plugin_audio_ports_t*)pPlugin->get_extension(pPlugin, CLAP_EXT_AUDIO_PORTS);
+	if (!pPorts) { return; }
+
+	clap_audio_port_info_t info = {};
+	if (!pPorts->count(pPlugin, isInput) || !pPorts->get(pPlugin, 0, isInput, &info) || (int)info.channel_count != channels)
+	{
+		THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR);
+	}
+}
+
+/*******************************************
+* Unload():
+* Destroy plugin and free library
+*******************************************/
+void AuEngine::ClapPlugin::Unload()
+{
+	if (pPlugin)
+	{
+		if (isProcessing) { pPlugin->stop_processing(pPlugin); }
+		if (isActive) { pPlugin->deactivate(pPlugin); }
+		pPlugin->destroy(pPlugin);
+	}
+	if (pEntry) { pEntry->deinit(); }
+	if (hModule) { FreeLibrary(hModule); }
+
+	pPlugin = NULL;
+	pEntry = NULL;
+	hModule = NULL;
+	isProcessing = false;
+	isActive = false;
+	latency = 0;
+	channels = 0;
+}
+
+/*******************************************
+* Activate():
+* Restart plugin with new rate and block
+*******************************************/
+void AuEngine::ClapPlugin::Activate(double dSampleRate, int iMaxFrames)
+{
+	if (!pPlugin || iMaxFrames <= 0 || iMaxFrames > PLUGIN_MAX_FRAMES) { THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR); }
+
+	if (isProcessing) { pPlugin->stop_processing(pPlugin); }
+	if (isActive) { pPlugin->deactivate(pPlugin); }
+	isProcessing = false;
+	isActive = pPlugin->activate(pPlugin, dSampleRate, 1, iMaxFrames);
+	if (!isActive) { THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR); }
+
+	const clap_plugin_latency_t* pLatency = (const clap_plugin_latency_t*)pPlugin->get_extension(pPlugin, CLAP_EXT_LATENCY);
+	latency = pLatency ? (int)pLatency->get(pPlugin) : 0;
+	sampleRate = dSampleRate;
+	steadyTime = 0;
+	lastTicks = 0;
+	peakTicks = 0;
+	totalTicks = 0;
+	totalFrames = 0;
+}
+
+/*******************************************
+* Process():
+* Audio thread, planar buffers
+*******************************************/
+void AuEngine::ClapPlugin::Process(float** ppIn, float** ppOut, int iFrames)
+{
+	if (!isActive)
+	{
+		for (int c = 0; c < channels; c++) { memcpy(ppOut[c], ppIn[c], iFrames * sizeof(float)); }
+		return;
+	}
+
+	// processing is started at audio thread
+	if (!isProcessing) { isProcessing = pPlugin->start_processing(pPlugin); }
+
+	clap_audio_buffer_t input = { ppIn, NULL, (uint32_t)channels, 0, 0 };
+	clap_audio_buffer_t output = { ppOut, NULL, (uint32_t)channels, 0, 0 };
+	clap_process_t process = {};
+	process.steady_time = steadyTime;
+	process.frames_count = iFrames;
+	process.audio_inputs = &input;
+	process.audio_outputs = &output;
+	process.audio_inputs_count = 1;
+	process.audio_outputs_count = 1;
+	process.in_events = &inEvents;
+	process.out_events = &outEvents;
+
+	LARGE_INTEGER start = {};
+	LARGE_INTEGER end = {};
+	QueryPerformanceCounter(&start);
+	clap_process_status status = isProcessing ? pPlugin->process(pPlugin, &process) : CLAP_PROCESS_ERROR;
+	QueryPerformanceCounter(&end);
+
+	if (status == CLAP_PROCESS_ERROR)
+	{
+		for (int c = 0; c < channels; c++) { memset(ppOut[c], 0, iFrames * sizeof(float)); }
+	}
+
+	long long ticks = end.QuadPart - start.QuadPart;
+	lastTicks.store(ticks, std::memory_order_relaxed);
+	if (ticks > peakTicks.load(std::memory_order_relaxed)) { peakTicks.store(ticks, std::memory_order_relaxed); }
+	totalTicks.fetch_add(ticks, std::memory_order_relaxed);
+	totalFrames.fetch_add(iFrames, std::memory_order_relaxed);
+	steadyTime += iFrames;
+}
+
+/*******************************************
+* MakeStats():
+* Stats from counters of process() time
+*******************************************/
+static AuEngine::PluginStats MakeStats(long long lastTicks, long long peakTicks, long long totalTicks,
+	long long totalFrames, long long frequency, double dSampleRate)
+{
+	AuEngine::PluginStats stats;
+	if (frequency <= 0) { return stats; }
+
+	stats.lastTime = (double)lastTicks / frequency;
+	stats.peakTime = (double)peakTicks / frequency;
+	if (totalFrames && dSampleRate > 0.0) { stats.load = ((double)totalTicks / frequency) / (totalFrames / dSampleRate); }
+	return stats;
+}
+
+/*******************************************
+* GetStats():
+* Can be called from any thread
+*******************************************/
+AuEngine::PluginStats AuEngine::ClapPlugin::GetStats() const
+{
+	PluginStats stats = MakeStats(lastTicks.load(), peakTicks.load(), totalTicks.load(), totalFrames.load(), frequency, sampleRate);
+	stats.latency = latency;
+	return stats;
+}
+
+/*******************************************
+* Load():
+* Start sandbox and load plugin there
+*******************************************/
+void AuEngine::SandboxPlugin::Load(const char* lpPath, int iIndex, int iChannels)
+{
+	static std::atomic<int> counter{ 0 };
+
+	Unload();
+	if (iChannels <= 0 || iChannels > PLUGIN_MAX_CHANNELS || strlen(lpPath) >= SANDBOX_PATH) { THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR); }
+
+	char name[64] = {};
+	sprintf_s(name, "Local\\AuSandbox_%lu_%d", GetCurrentProcessId(), counter.fetch_add(1));
+	std::string workName = std::string(name) + "_work";
+	std::string doneName = std::string(name) + "_done";
+
+	hMapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, sizeof(SandboxShared), name);
+	if (hMapping) { pShared = (SandboxShared*)MapViewOfFile(hMapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(SandboxShared)); }
+	hWork = CreateEventA(NULL, FALSE, FALSE, workName.c_str());
+	hDone = CreateEventA(NULL, FALSE, FALSE, doneName.c_str());
+	if (!pShared || !hWork || !hDone)
+	{
+		Unload();
+		THROW_EXCEPTION(AuEngine::OpSet::MEMORY_ERROR);
+	}
+
+	new (pShared) SandboxShared();
+	pShared->magic = SANDBOX_MAGIC;
+	strcpy_s(pShared->path, lpPath);
+	pShared->index = iIndex;
+	pShared->channels = iChannels;
+	pShared->command = SANDBOX_NONE;
+	pShared->state = SANDBOX_STARTING;
+
+	// sandbox is this DLL at rundll32 of system
+	HMODULE hSelf = NULL;
+	char dllPath[MAX_PATH] = {};
+	char exePath[MAX_PATH] = {};
+	GetModuleHandleExA(GET_MODULE_HANDLE_EX_FLAG_FROM_ADDRESS | GET_MODULE_HANDLE_EX_FLAG_UNCHANGED_REFCOUNT,
+		(LPCSTR)&PluginSandboxMain, &hSelf);
+	GetModuleFileNameA(hSelf, dllPath, MAX_PATH);
+	GetSystemDirectoryA(exePath, MAX_PATH);
+	strcat_s(exePath, "\\rundll32.exe");
+
+	char cmdLine[MAX_PATH * 2 + 128] = {};
+	sprintf_s(cmdLine, "rundll32.exe \"%s\",PluginSandboxMain %s %lu", dllPath, name, GetCurrentProcessId());
+
+	STARTUPINFOA startup = {};
+	PROCESS_INFORMATION info = {};
+	startup.cb = sizeof(startup);
+	if (!CreateProcessA(exePath, cmdLine, NULL, NULL, FALSE, CREATE_NO_WINDOW, NULL, NULL, &startup, &info))
+	{
+		Unload();
+		THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR);
+	}
+	CloseHandle(info.hThread);
+	hProcess = info.hProcess;
+
+	if (!WaitSandbox() || pShared->state != SANDBOX_LOADED)
+	{
+		Unload();
+		THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR);
+	}
+
+	channels = iChannels;
+	isCrashed = false;
+	Msg("AuEngine: Sandbox started for plugin: " + std::string(lpPath));
+}
+
+/*******************************************
+* WaitSandbox():
+* Wait for done event, false if sandbox
+* exits or doesn't answer
+*******************************************/
+bool AuEngine::SandboxPlugin::WaitSandbox()
+{
+	HANDLE handles[2] = { hDone, hProcess };
+	return WaitForMultipleObjects(2, handles, FALSE, PLUGIN_TIMEOUT) == WAIT_OBJECT_0;
+}
+
+/*******************************************
+* Unload():
+* Stop sandbox (kill it if it hangs)
+*******************************************/
+void AuEngine::SandboxPlugin::Unload()
+{
+	if (hProcess)
+	{
+		pShared->command = SANDBOX_QUIT;
+		SetEvent(hWork);
+		if (WaitForSingleObject(hProcess, PLUGIN_TIMEOUT) != WAIT_OBJECT_0) { TerminateProcess(hProcess, 1); }
+		CloseHandle(hProcess);
+	}
+	if (pShared) { UnmapViewOfFile(pShared); }
+	if (hMapping) { CloseHandle(hMapping); }
+	if (hWork) { CloseHandle(hWork); }
+	if (hDone) { CloseHandle(hDone); }
+
+	hProcess = hMapping = hWork = hDone = NULL;
+	pShared = NULL;
+	latency = sandboxLatency = 0;
+	owed = 0;
+	channels = 0;
+}
+
+/*******************************************
+* Activate():
+* Activate plugin at sandbox. If sandbox
+* is dead plugin stays bypassed
+*******************************************/
+void AuEngine::SandboxPlugin::Activate(double dSampleRate, int iMaxFrames)
+{
+	if (!pShared || iMaxFrames <= 0 || iMaxFrames > PLUGIN_MAX_FRAMES) { THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR); }
+
+	sampleRate = dSampleRate;
+	latency = sandboxLatency = 0;
+	owed = 0;
+	underruns = 0;
+	if (isCrashed) { return; }
+
+	pShared->sampleRate = dSampleRate;
+	pShared->maxFrames = iMaxFrames;
+	pShared->command = SANDBOX_ACTIVATE;
+	SetEvent(hWork);
+
+	if (!WaitSandbox() || pShared->state != SANDBOX_ACTIVE)
+	{
+		isCrashed = true;
+		Msg("AuEngine: Sandbox plugin can't be activated, bypassed");
+		return;
+	}
+
+	sandboxLatency = iMaxFrames;
+	latency = pShared->latency + sandboxLatency;
+}
+
+/*******************************************
+* Process():
+* Audio thread. Never waits for sandbox
+*******************************************/
+void AuEngine::SandboxPlugin::Process(float** ppIn, float** ppOut, int iFrames)
+{
+	if (!isCrashed.load(std::memory_order_relaxed) && WaitForSingleObject(hProcess, 0) == WAIT_OBJECT_0)
+	{
+		isCrashed = true;
+	}
+
+	SandboxRing& input = pShared->input;
+	unsigned int write = input.write.load(std::memory_order_relaxed);
+	if (!isCrashed.load(std::memory_order_relaxed) &&
+		PLUGIN_RING_FRAMES - (write - input.read.load(std::memory_order_acquire)) < (unsigned int)iFrames)
+	{
+		// sandbox doesn't take input any more
+		isCrashed = true;
+	}
+
+	if (isCrashed.load(std::memory_order_relaxed))
+	{
+		for (int c = 0; c < channels; c++) { memcpy(ppOut[c], ppIn[c], iFrames * sizeof(float)); }
+		return;
+	}
+
+	for (int f = 0; f < iFrames; f++)
+	{
+		float* pDst = pShared->inData + ((write + f) & RING_MASK) * channels;
+		for (int c = 0; c < channels; c++) { pDst[c] = ppIn[c][f]; }
+	}
+	input.write.store(write + iFrames, std::memory_order_release);
+	SetEvent(hWork);
+
+	// drop late output which was played as silence
+	SandboxRing& output = pShared->output;
+	unsigned int read = output.read.load(std::memory_order_relaxed);
+	unsigned int avail = output.write.load(std::memory_order_acquire) - read;
+	unsigned int drop = std::min(owed, avail);
+	read += drop;
+	avail -= drop;
+	owed -= drop;
+
+	int got = (int)std::min(avail, (unsigned int)iFrames);
+	for (int f = 0; f < got; f++)
+	{
+		const float* pSrc = pShared->outData + ((read + f) & RING_MASK) * channels;
+		for (int c = 0; c < channels; c++) { ppOut[c][f] = pSrc[c]; }
+	}
+	output.read.store(read + got, std::memory_order_release);
+
+	if (got < iFrames)
+	{
+		for (int c = 0; c < channels; c++) { memset(ppOut[c] + got, 0, (iFrames - got) * sizeof(float)); }
+		owed += iFrames - got;
+		underruns.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+/*******************************************
+* GetStats():
+* Time is measured at sandbox
+*******************************************/
+AuEngine::PluginStats AuEngine::SandboxPlugin::GetStats() const
+{
+	PluginStats stats;
+	if (pShared)
+	{
+		stats = MakeStats(pShared->lastTicks.load(), pShared->peakTicks.load(), pShared->totalTicks.load(),
+			pShared->totalFrames.load(), pShared->frequency, sampleRate);
+	}
+	stats.latency = latency;
+	stats.sandboxLatency = sandboxLatency;
+	stats.underruns = underruns.load();
+	stats.isCrashed = isCrashed.load();
+	return stats;
+}
+
+/*******************************************
+* SandboxProcess():
+* Process all input of ring by blocks
+*******************************************/
+static void SandboxProcess(AuEngine::SandboxShared* pShared, AuEngine::ClapPlugin& plugin,
+	float** ppIn, float** ppOut)
+{
+	int channels = pShared->channels;
+	int maxFrames = pShared->maxFrames;
+	AuEngine::SandboxRing& input = pShared->input;
+	AuEngine::SandboxRing& output = pShared->output;
+
+	for (;;)
+	{
+		unsigned int read = input.read.load(std::memory_order_relaxed);
+		unsigned int avail = input.write.load(std::memory_order_acquire) - read;
+		if (!avail) { break; }
+
+		int frames = (int)std::min(avail, (unsigned int)maxFrames);
+		for (int f = 0; f < frames; f++)
+		{
+			const float* pSrc = pShared->inData + ((read + f) & RING_MASK) * channels;
+			for (int c = 0; c < channels; c++) { ppIn[c][f] = pSrc[c]; }
+		}
+		input.read.store(read + frames, std::memory_order_release);
+
+		plugin.Process(ppIn, ppOut, frames);
+
+		// host is gone too far if there is no space, output is lost
+		unsigned int write = output.write.load(std::memory_order_relaxed);
+		if (PLUGIN_RING_FRAMES - (write - output.read.load(std::memory_order_acquire)) < (unsigned int)frames) { continue; }
+		for (int f = 0; f < frames; f++)
+		{
+			float* pDst = pShared->outData + ((write + f) & RING_MASK) * channels;
+			for (int c = 0; c < channels; c++) { pDst[c] = ppOut[c][f]; }
+		}
+		output.write.store(write + frames, std::memory_order_release);
+
+		pShared->lastTicks.store(plugin.GetLastTicks(), std::memory_order_relaxed);
+		pShared->peakTicks.store(plugin.GetPeakTicks(), std::memory_order_relaxed);
+		pShared->totalTicks.store(plugin.GetTotalTicks(), std::memory_order_relaxed);
+		pShared->totalFrames.store(plugin.GetTotalFrames(), std::memory_order_relaxed);
+	}
+}
+
+/*******************************************
+* PluginSandboxMain():
+* rundll32 entry, lpCmdLine is name of
+* mapping and pid of host
+*******************************************/
+void CALLBACK PluginSandboxMain(HWND hWnd, HINSTANCE hInstance, LPSTR lpCmdLine, int iShow)
+{
+	char name[64] = {};
+	unsigned long parentId = 0;
+	if (sscanf_s(lpCmdLine, "%63s %lu", name, (unsigned)sizeof(name), &parentId) != 2) { return; }
+
+	HANDLE hMapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name);
+	AuEngine::SandboxShared* pShared = hMapping ?
+		(AuEngine::SandboxShared*)MapViewOfFile(hMapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(AuEngine::SandboxShared)) : NULL;
+	HANDLE hWork = OpenEventA(SYNCHRONIZE | EVENT_MODIFY_STATE, FALSE, (std::string(name) + "_work").c_str());
+	HANDLE hDone = OpenEventA(SYNCHRONIZE | EVENT_MODIFY_STATE, FALSE, (std::string(name) + "_done").c_str());
+	HANDLE hParent = OpenProcess(SYNCHRONIZE, FALSE, parentId);
+
+	if (pShared && pShared->magic == SANDBOX_MAGIC && hWork && hDone && hParent)
+	{
+		SetPriorityClass(GetCurrentProcess(), HIGH_PRIORITY_CLASS);
+		SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_TIME_CRITICAL);
+
+		AuEngine::ClapPlugin plugin;
+		int channels = pShared->channels;
+		std::vector<float> planar(2 * PLUGIN_MAX_FRAMES * channels);
+		float* ppIn[PLUGIN_MAX_CHANNELS] = {};
+		float* ppOut[PLUGIN_MAX_CHANNELS] = {};
+		for (int c = 0; c < channels; c++)
+		{
+			ppIn[c] = planar.data() + c * PLUGIN_MAX_FRAMES;
+			ppOut[c] = planar.data() + (channels + c) * PLUGIN_MAX_FRAMES;
+		}
+
+		try
+		{
+			plugin.Load(pShared->path, pShared->index, channels);
+			pShared->frequency = plugin.GetFrequency();
+			pShared->state = AuEngine::SANDBOX_LOADED;
+		}
+		catch (AuEngine::Exception&)
+		{
+			pShared->state = AuEngine::SANDBOX_FAILED;
+		}
+		SetEvent(hDone);
+
+		HANDLE handles[2] = { hWork, hParent };
+		while (pShared->state != AuEngine::SANDBOX_FAILED &&
+			WaitForMultipleObjects(2, handles, FALSE, INFINITE) == WAIT_OBJECT_0)
+		{
+			int command = pShared->command.exchange(AuEngine::SANDBOX_NONE);
+			if (command == AuEngine::SANDBOX_QUIT) { break; }
+
+			if (command == AuEngine::SANDBOX_ACTIVATE)
+			{
+				try
+				{
+					plugin.Activate(pShared->sampleRate, pShared->maxFrames);
+					pShared->latency = plugin.GetLatency();
+
+					// host writes nothing while it waits for activation
+					pShared->input.read = pShared->input.write.load();
+					memset(pShared->outData, 0, pShared->maxFrames * channels * sizeof(float));
+					pShared->output.read = 0;
+					pShared->output.write = (unsigned int)pShared->maxFrames;
+					pShared->state = AuEngine::SANDBOX_ACTIVE;
+				}
+				catch (AuEngine::Exception&)
+				{
+					pShared->state = AuEngine::SANDBOX_FAILED;
+				}
+				SetEvent(hDone);
+				continue;
+			}
+
+			if (pShared->state == AuEngine::SANDBOX_ACTIVE) { SandboxProcess(pShared, plugin, ppIn, ppOut); }
+		}
+		plugin.Unload();
+	}
+
+	if (hParent) { CloseHandle(hParent); }
+	if (hDone) { CloseHandle(hDone); }
+	if (hWork) { CloseHandle(hWork); }
+	if (pShared) { UnmapViewOfFile(pShared); }
+	if (hMapping) { CloseHandle(hMapping); }
+}
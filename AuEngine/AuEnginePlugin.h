@@ -0,0 +1,174 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEnginePlugin.h:
+// header for CLAP plugin host
+/////////////////////////////////
+#pragma once
+#include "AuEngine.h"
+#include "AuEngineClap.h"
+#include "AuEngineGraph.h"
+#include <atomic>
+#include <vector>
+
+#define PLUGIN_MAX_CHANNELS		8
+#define PLUGIN_MAX_FRAMES		8192			// max block of Process()
+#define PLUGIN_RING_FRAMES		32768			// sandbox ring, power of two, 4 blocks at least
+#define PLUGIN_TIMEOUT			5000			// ms for start, activation and exit of sandbox
+
+/***********************************************
+* struct PluginStats:
+* latency is frames of plugin and sandbox
+* (sandboxLatency is only sandbox part),
+* time is of plugin process() call (s),
+* load is time / length of audio.
+* underruns are blocks which had no
+* output of sandbox in time (silence was
+* played instead), isCrashed - sandbox
+* is dead or stalled, plugin is bypassed
+***********************************
+* class Plugin:
+* Base class for hosted plugins,
+* Activate() is called from Compile() of
+* graph, Process() at audio thread
+***********************************
+* class ClapPlugin:
+* CLAP plugin at engine process. Load()
+* takes plugin iIndex of .clap file.
+* Main audio ports of plugin must have
+* iChannels. Parameters, notes and GUI
+* are not hosted
+***********************************
+* class SandboxPlugin:
+* The same plugin at own process (engine
+* DLL started by rundll32), connected by
+* shared memory rings and events. Audio
+* thread writes block to input ring,
+* wakes sandbox and takes output of
+* earlier blocks from output ring, it
+* never waits for sandbox. Sandbox is one
+* block (max frames) behind, if it's
+* later, silence is played and late
+* output is dropped when it comes, so
+* delay stays the same. Crash or hang of
+* plugin only bypasses it
+***********************************
+* class PluginNode:
+* Plugin for effect graph
+***********************************
+* PluginSandboxMain():
+* Entry of sandbox process
+***********************************************/
+namespace AuEngine
+{
+	struct PluginStats
+	{
+		int latency = 0;
+		int sandboxLatency = 0;
+		double lastTime = 0.0;
+		double peakTime = 0.0;
+		double load = 0.0;
+		unsigned int underruns = 0;
+		bool isCrashed = false;
+	};
+
+	class Plugin
+	{
+	public:
+		virtual ~Plugin() {}
+		virtual void Activate(double dSampleRate, int iMaxFrames) = 0;
+		virtual void Process(float** ppIn, float** ppOut, int iFrames) = 0;
+		virtual int  GetLatency() const = 0;
+		virtual PluginStats GetStats() const = 0;
+		int GetChannels() const { return channels; }
+
+	protected:
+		int channels = 0;
+	};
+
+	class ClapPlugin : public Plugin
+	{
+	public:
+		ClapPlugin() {}
+		~ClapPlugin() { Unload(); }
+		DLL_API void Load(const char* lpPath, int iIndex, int iChannels);
+		DLL_API void Unload();
+		DLL_API void Activate(double dSampleRate, int iMaxFrames) override;
+		DLL_API void Process(float** ppIn, float** ppOut, int iFrames) override;
+		int  GetLatency() const override { return latency; }
+		DLL_API PluginStats GetStats() const override;
+
+		const char* GetName() const { return pPlugin && pPlugin->desc && pPlugin->desc->name ? pPlugin->desc->name : ""; }
+		long long GetLastTicks() const { return lastTicks.load(); }
+		long long GetPeakTicks() const { return peakTicks.load(); }
+		long long GetTotalTicks() const { return totalTicks.load(); }
+		long long GetTotalFrames() const { return totalFrames.load(); }
+		long long GetFrequency() const { return frequency; }
+
+	private:
+		void CheckPorts(bool isInput);
+
+		HMODULE hModule = NULL;
+		const clap_plugin_entry_t* pEntry = NULL;
+		const clap_plugin_t* pPlugin = NULL;
+		clap_host_t host = {};
+		double sampleRate = 0.0;
+		int latency = 0;
+		int64_t steadyTime = 0;
+		bool isActive = false;
+		bool isProcessing = false;
+
+		long long frequency = 1;
+		std::atomic<long long> lastTicks{ 0 };
+		std::atomic<long long> peakTicks{ 0 };
+		std::atomic<long long> totalTicks{ 0 };
+		std::atomic<long long> totalFrames{ 0 };
+	};
+
+	struct SandboxShared;
+
+	class SandboxPlugin : public Plugin
+	{
+	public:
+		SandboxPlugin() {}
+		~SandboxPlugin() { Unload(); }
+		DLL_API void Load(const char* lpPath, int iIndex, int iChannels);
+		DLL_API void Unload();
+		DLL_API void Activate(double dSampleRate, int iMaxFrames) override;
+		DLL_API void Process(float** ppIn, float** ppOut, int iFrames) override;
+		int  GetLatency() const override { return latency; }
+		DLL_API PluginStats GetStats() const override;
+		bool IsCrashed() const { return isCrashed.load(); }
+
+	private:
+		bool WaitSandbox();
+
+		SandboxShared* pShared = NULL;
+		HANDLE hMapping = NULL;
+		HANDLE hWork = NULL;					// host -> sandbox: input or command
+		HANDLE hDone = NULL;					// sandbox -> host: command is done
+		HANDLE hProcess = NULL;
+		double sampleRate = 0.0;
+		int latency = 0;
+		int sandboxLatency = 0;
+		unsigned int owed = 0;					// late output frames to drop
+		std::atomic<unsigned int> underruns{ 0 };
+		std::atomic<bool> isCrashed{ false };
+	};
+
+	class PluginNode : public Node
+	{
+	public:
+		PluginNode(Plugin* pPlugin, NodeType nodeType = EFFECT_NODE) : Node(nodeType, pPlugin->GetChannels()), plugin(pPlugin) {}
+		void Prepare(double dSampleRate, int iMaxFrames) override { plugin->Activate(dSampleRate, iMaxFrames); }
+		void Process(float** ppIn, float** ppOut, int iFrames) override { plugin->Process(ppIn, ppOut, iFrames); }
+		int  GetLatency() const override { return plugin->GetLatency(); }
+
+	private:
+		Plugin* plugin;
+	};
+};
+
+extern "C" DLL_API void CALLBACK PluginSandboxMain(HWND hWnd, HINSTANCE hInstance, LPSTR lpCmdLine, int iShow);
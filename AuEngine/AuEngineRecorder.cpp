@@ -0,0 +1,165 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineRecorder.cpp:
+// capture engine
+/////////////////////////////////
+
+/*******************************************
+* Recording:
+* Audio thread must never wait for disk,
+* so callback only copies captured data
+* to WavStreamWriter ring with
+* RECORD_RING_SECONDS of audio. Its writer
+* thread writes data in WAV_WRITE_CHUNK
+* blocks. If ring is full, we count dropped
+* frames (it's bug or very slow disk).
+*******************************************/
+
+#include "AuEngineRecorder.h"
+#include "AuEngineMemory.h"
+
+/*******************************************
+* Start():
+* Open full-duplex stream, file and
+* writer thread
+*******************************************/
+void AuEngine::Recorder::Start(const char* lpPath, PaDeviceIndex paDeviceInput, PaDeviceIndex paDeviceOutput,
+	int iChannels, double dSampleRate, PaSampleFormat format, LatencyProfile profile)
+{
+	Stop();
+
+	const PaDeviceInfo* pInputInfo = paDeviceInput != paNoDevice ? Pa_GetDeviceInfo(paDeviceInput) : NULL;
+	if (!pInputInfo || pInputInfo->maxInputChannels <= 0)
+	{
+		Msg("AuEngine: No input device for recording");
+		THROW_EXCEPTION(AuEngine::OpSet::NO_AUDIO_DEVICE);
+	}
+	if (iChannels > pInputInfo->maxInputChannels) { iChannels = pInputInfo->maxInputChannels; }
+
+	sampleSize = Pa_GetSampleSize(format);
+	if (sampleSize <= 0) { THROW_EXCEPTION(AuEngine::OpSet::STREAM_ERROR); }
+	inChannels = iChannels;
+	frameSize = iChannels * sampleSize;
+	unsigned long frames = AuEngine::ChooseFramesPerBuffer(profile, 0, dSampleRate);
+
+	PaStreamParameters inputParameters;
+	inputParameters.device = paDeviceInput;
+	inputParameters.channelCount = iChannels;
+	inputParameters.sampleFormat = format;
+	inputParameters.suggestedLatency = AuEngine::ChooseSuggestedLatency(profile, 0.0, pInputInfo, frames, dSampleRate, true);
+	inputParameters.hostApiSpecificStreamInfo = NULL;
+
+	// output is used for monitoring only
+	PaStreamParameters outputParameters;
+	PaStreamParameters* pOutput = NULL;
+	outChannels = 0;
+	const PaDeviceInfo* pOutputInfo = paDeviceOutput != paNoDevice ? Pa_GetDeviceInfo(paDeviceOutput) : NULL;
+	if (pOutputInfo && pOutputInfo->maxOutputChannels > 0)
+	{
+		outChannels = iChannels < pOutputInfo->maxOutputChannels ? iChannels : pOutputInfo->maxOutputChannels;
+		outputParameters.device = paDeviceOutput;
+		outputParameters.channelCount = outChannels;
+		outputParameters.sampleFormat = format;
+		outputParameters.suggestedLatency = AuEngine::ChooseSuggestedLatency(profile, 0.0, pOutputInfo, frames, dSampleRate, false);
+		outputParameters.hostApiSpecificStreamInfo = NULL;
+		pOutput = &outputParameters;
+	}
+
+	// everything is allocated before stream starts
+	writer.Open(lpPath, iChannels, (int)dSampleRate, format, 0,
+		(size_t)(dSampleRate * RECORD_RING_SECONDS) * frameSize);
+	recordedFrames = 0;
+	droppedFrames = 0;
+
+	try
+	{
+		PaError err = Pa_OpenStream(&stream, &inputParameters, pOutput, dSampleRate,
+			frames, paClipOff, &RecordCallback, this);
+		PA_CHECK(err, AuEngine::OpSet::STREAM_ERROR);
+
+		err = Pa_StartStream(stream);
+		PA_CHECK(err, AuEngine::OpSet::STREAM_ERROR);
+	}
+	catch (AuEngine::Exception&)
+	{
+		// nothing was recorded, so placeholder file is removed
+		if (stream) { Pa_CloseStream(stream); }
+		stream = NULL;
+		writer.Close();
+		DeleteFileA(lpPath);
+		throw;
+	}
+
+	isRecording = true;
+	Msg("AuEngine: Recording started, channels: ", iChannels);
+}
+
+/*******************************************
+* Stop():
+* Stop stream, write rest of ring and
+* close file
+*******************************************/
+void AuEngine::Recorder::Stop()
+{
+	if (stream)
+	{
+		Pa_StopStream(stream);
+		Pa_CloseStream(stream);
+		stream = NULL;
+	}
+
+	if (isRecording)
+	{
+		isRecording = false;
+		writer.Close();
+		if (writer.IsFailed()) { Msg("AuEngine: Recording writer failed"); }
+		Msg("AuEngine: Recording stopped, dropped frames: ", (int)droppedFrames.load());
+	}
+	writer.Close();
+}
+
+/*******************************************
+* RecordCallback():
+* Copy input to ring (and to output)
+*******************************************/
+int AuEngine::Recorder::RecordCallback(const void* inputBuffer, void* outputBuffer, unsigned long framesPerBuffer,
+	const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags, void* userData)
+{
+	AuEngine::AudioThreadScope audioScope;
+	Recorder* pThis = (Recorder*)userData;
+	size_t bytes = framesPerBuffer * pThis->frameSize;
+
+	if (inputBuffer)
+	{
+		// whole frames only, so file never gets a half of frame
+		size_t toWrite = pThis->writer.Write(inputBuffer, bytes);
+
+		pThis->recordedFrames.fetch_add(toWrite / pThis->frameSize, std::memory_order_relaxed);
+		if (toWrite < bytes)
+		{
+			pThis->droppedFrames.fetch_add((bytes - toWrite) / pThis->frameSize, std::memory_order_relaxed);
+		}
+	}
+
+	if (outputBuffer)
+	{
+		size_t outFrameSize = pThis->outChannels * pThis->sampleSize;
+		if (inputBuffer && pThis->isMonitoring.load(std::memory_order_relaxed))
+		{
+			const uint8_t* pIn = (const uint8_t*)inputBuffer;
+			uint8_t* pOut = (uint8_t*)outputBuffer;
+			for (unsigned long i = 0; i < framesPerBuffer; i++)
+			{
+				memcpy(pOut + i * outFrameSize, pIn + i * pThis->frameSize, outFrameSize);
+			}
+		}
+		else
+		{
+			memset(outputBuffer, 0, framesPerBuffer * outFrameSize);
+		}
+	}
+	return paContinue;
+}
@@ -0,0 +1,57 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineRecorder.h:
+// header for capture engine
+/////////////////////////////////
+#pragma once
+#include "AuEngine.h"
+#include "AuEngineWav.h"
+#include <atomic>
+
+#define RECORD_RING_SECONDS		8				// disk can stall for this time without drops
+
+/***********************************************
+* class Recorder:
+* Opens full-duplex stream. Callback
+* copies captured blocks to stream writer
+* (and to output if monitoring is on),
+* stream writer puts it to WAV/RF64 file.
+* Buffer and device latency come from
+* latency profile. If Start() throws,
+* stream and file are closed
+***********************************************/
+namespace AuEngine
+{
+	class Recorder
+	{
+	public:
+		Recorder() {}
+		~Recorder() { Stop(); }
+		DLL_API void Start(const char* lpPath, PaDeviceIndex paDeviceInput, PaDeviceIndex paDeviceOutput,
+			int iChannels, double dSampleRate, PaSampleFormat format, LatencyProfile profile = LatencyProfile::LATENCY_LOW);
+		DLL_API void Stop();
+		DLL_API void SetMonitoring(bool isEnabled) { isMonitoring = isEnabled; }
+		DLL_API unsigned long long GetRecordedFrames() const { return recordedFrames.load(std::memory_order_relaxed); }
+		DLL_API unsigned long long GetDroppedFrames() const { return droppedFrames.load(std::memory_order_relaxed); }
+		bool IsRecording() const { return isRecording; }
+
+	private:
+		static int RecordCallback(const void* inputBuffer, void* outputBuffer, unsigned long framesPerBuffer,
+			const PaStreamCallbackTimeInfo* timeInfo, PaStreamCallbackFlags statusFlags, void* userData);
+
+		PaStream* stream = NULL;
+		WavStreamWriter writer;
+
+		std::atomic<bool> isRecording{ false };
+		std::atomic<bool> isMonitoring{ false };
+		std::atomic<unsigned long long> recordedFrames{ 0 };
+		std::atomic<unsigned long long> droppedFrames{ 0 };
+		int frameSize = 0;
+		int inChannels = 0;
+		int outChannels = 0;
+		int sampleSize = 0;
+	};
+};
@@ -0,0 +1,467 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineRender.cpp:
+// parallel offline render
+/////////////////////////////////
+
+/*******************************************
+* Parallel render:
+* Task is one segment (or one channel of
+* segment). Worker has own TrackReader
+* and own chain, so tasks share nothing
+* but slots of output. Chain of segment
+* starts warmup frames before it and goes
+* latency frames after it, that input is
+* dropped. Segment never goes on with
+* chain of previous task, even if the
+* same worker has it: else output would
+* depend on which worker took which task.
+*
+* Writer is the calling thread, it takes
+* slots in order of segments. Worker waits
+* while its segment is too far ahead of
+* writer, so memory is slots * segment
+* and doesn't grow with length of file.
+*
+* Channel split without segments keeps
+* one chain per channel for whole file:
+* segment of channel waits for previous
+* segment of the same channel (always
+* taken earlier, so no deadlock).
+*******************************************/
+
+#include "AuEngineRender.h"
+#include "AuEngineTrack.h"
+#include "AuEngineWav.h"
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <string.h>
+
+namespace
+{
+	struct RenderChain
+	{
+		AuEngine::Graph* pGraph = NULL;
+		unsigned long long latency = 0;
+		unsigned long long fed = 0;				// end of input which chain has
+	};
+
+	struct RenderBuffers
+	{
+		std::vector<float> input;				// channels of chain
+		std::vector<float> output;
+	};
+}
+
+/*******************************************
+* GetThreadTime():
+* CPU time of calling thread (100 ns)
+*******************************************/
+static unsigned long long GetThreadTime()
+{
+	FILETIME creation = {};
+	FILETIME exit = {};
+	FILETIME kernel = {};
+	FILETIME user = {};
+	if (!GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user)) { return 0; }
+	return (((unsigned long long)kernel.dwHighDateTime << 32) | kernel.dwLowDateTime) +
+		(((unsigned long long)user.dwHighDateTime << 32) | user.dwLowDateTime);
+}
+
+static void DestroyChain(RenderChain& chain, const AuEngine::RenderConfig& config);
+
+/*******************************************
+* CreateChain():
+* New chain from factory (NULL - copy),
+* it's given back if it can't be compiled
+*******************************************/
+static void CreateChain(RenderChain& chain, const AuEngine::RenderConfig& config, int iChannels, int iSampleRate)
+{
+	chain.pGraph = NULL;
+	chain.latency = 0;
+	chain.fed = 0;
+	if (!config.pCreate) { return; }
+
+	chain.pGraph = config.pCreate(iChannels, config.pUserData);
+	if (!chain.pGraph) { THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR); }
+	try
+	{
+		chain.pGraph->Compile(iSampleRate, RENDER_BLOCK_FRAMES, NULL);
+	}
+	catch (AuEngine::Exception&)
+	{
+		DestroyChain(chain, config);
+		throw;
+	}
+	chain.latency = chain.pGraph->GetLatency();
+}
+
+/*******************************************
+* DestroyChain():
+* Give chain back to factory
+*******************************************/
+static void DestroyChain(RenderChain& chain, const AuEngine::RenderConfig& config)
+{
+	if (chain.pGraph && config.pDestroy) { config.pDestroy(chain.pGraph, config.pUserData); }
+	chain.pGraph = NULL;
+}
+
+/*******************************************
+* struct ChainsScope:
+* Gives persistent chains back on any
+* exit of Render()
+*******************************************/
+namespace
+{
+	struct ChainsScope
+	{
+		ChainsScope(std::vector<RenderChain>& vChains, const AuEngine::RenderConfig& renderConfig) : chains(vChains), config(renderConfig) {}
+		~ChainsScope()
+		{
+			for (size_t i = 0; i < chains.size(); i++) { DestroyChain(chains[i], config); }
+		}
+
+		std::vector<RenderChain>& chains;
+		const AuEngine::RenderConfig& config;
+	};
+}
+
+/*******************************************
+* LoadInput():
+* Read [from, to) of file, frames after
+* end of file are silence
+*******************************************/
+static void LoadInput(AuEngine::TrackReader& reader, float* pData, unsigned long long from, unsigned long long to,
+	unsigned long long frames, int iChannels)
+{
+	unsigned long long done = 0;
+	if (from < frames)
+	{
+		reader.Seek(from);
+		unsigned long long count = std::min(to, frames) - from;
+		while (done < count)
+		{
+			size_t part = (size_t)std::min((unsigned long long)RENDER_BLOCK_FRAMES, count - done);
+			size_t got = reader.Read(pData + done * iChannels, part, iChannels);
+			done += got;
+			if (got < part) { break; }
+		}
+	}
+	memset(pData + done * iChannels, 0, (size_t)(to - from - done) * iChannels * sizeof(float));
+}
+
+/*******************************************
+* RenderPart():
+* Process [start, end) of channels
+* [iFirst, iFirst + iCount) by chain and
+* write it to interleaved slot. pInput
+* is all channels from frame inputStart,
+* chain goes on from chain.fed
+*******************************************/
+static void RenderPart(RenderChain& chain, RenderBuffers& buffers, const float* pInput, unsigned long long inputStart,
+	unsigned long long start, unsigned long long end, int iChannels, int iFirst, int iCount, float* pSlot)
+{
+	// output of chain is input - latency
+	unsigned long long skip = start + chain.latency - chain.fed;
+	unsigned long long done = 0;
+	while (done < end - start)
+	{
+		size_t part = (size_t)std::min((unsigned long long)RENDER_BLOCK_FRAMES, end + chain.latency - chain.fed);
+		const float* pBlock = pInput + (size_t)(chain.fed - inputStart) * iChannels;
+		chain.fed += part;
+
+		if (iCount != iChannels)
+		{
+			float* pPart = buffers.input.data();
+			for (size_t f = 0; f < part; f++)
+			{
+				for (int c = 0; c < iCount; c++) { pPart[f * iCount + c] = pBlock[f * iChannels + iFirst + c]; }
+			}
+			pBlock = pPart;
+		}
+
+		const float* pOutput = pBlock;
+		if (chain.pGraph)
+		{
+			chain.pGraph->Process(pBlock, buffers.output.data(), iCount, (int)part);
+			pOutput = buffers.output.data();
+		}
+
+		size_t drop = (size_t)std::min(skip, (unsigned long long)part);
+		skip -= drop;
+		for (size_t f = drop; f < part; f++, done++)
+		{
+			float* pDst = pSlot + done * iChannels + iFirst;
+			const float* pSrc = pOutput + f * iCount;
+			for (int c = 0; c < iCount; c++) { pDst[c] = pSrc[c]; }
+		}
+	}
+}
+
+/*******************************************
+* Cancel():
+* Stop Render(), output isn't written
+*******************************************/
+void AuEngine::OfflineRenderer::Cancel()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		isCanceled = true;
+	}
+	condition.notify_all();
+}
+
+/*******************************************
+* Render():
+* Render file to lpPath (blocking)
+*******************************************/
+bool AuEngine::OfflineRenderer::Render(const char* lpSource, const char* lpPath, const RenderConfig& config)
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		isCanceled = false;
+	}
+	progress = 0;
+	stats = RenderStats();
+
+	TrackReader reader;
+	reader.Open(lpSource);
+	PaSampleFormat format = config.format ? config.format : reader.GetFormat();
+	int channels = reader.GetChannels();
+	int sampleRate = reader.GetSampleRate();
+	unsigned long long frames = reader.GetFrames();
+	size_t frameSize = channels * Pa_GetSampleSize(format);
+	reader.Close();
+
+	if (config.pCreate && !config.pDestroy) { THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR); }
+
+	bool isSegments = !!(config.split & RENDER_SEGMENTS);
+	bool isChannels = !!(config.split & RENDER_CHANNELS);
+	int groups = isChannels ? channels : 1;
+	int groupChannels = isChannels ? 1 : channels;
+
+	unsigned long long segmentFrames = std::max(config.segmentFrames, (unsigned long long)RENDER_BLOCK_FRAMES);
+	unsigned long long warmup = isSegments ? (unsigned long long)(std::max(config.warmup, 0.0) * sampleRate) : 0;
+	int segments = (int)((frames + segmentFrames - 1) / segmentFrames);
+	int tasks = segments * groups;
+
+	int workersCount = config.workers > 0 ? config.workers : (int)std::thread::hardware_concurrency();
+	workersCount = std::max(1, std::min(std::min(workersCount, RENDER_MAX_WORKERS), std::max(tasks, 1)));
+
+	// without segments every channel keeps its chain, with them chain is
+	// made on main thread once to fail before any output
+	std::vector<RenderChain> chains(isSegments ? 0 : groups);
+	ChainsScope chainsScope(chains, config);
+	std::vector<int> chainDone(chains.size(), -1);
+	unsigned long long latency = 0;
+	for (size_t i = 0; i < chains.size(); i++) { CreateChain(chains[i], config, groupChannels, sampleRate); }
+	if (isSegments)
+	{
+		RenderChain check;
+		CreateChain(check, config, groupChannels, sampleRate);
+		DestroyChain(check, config);
+		latency = check.latency;
+	}
+	for (size_t i = 0; i < chains.size(); i++) { latency = std::max(latency, chains[i].latency); }
+
+	// input of segment is read once and shared by its channels
+	struct Slot
+	{
+		std::vector<float> input;				// all channels from inputStart to end + latency
+		std::vector<float> data;
+		unsigned long long inputStart = 0;
+		size_t frames = 0;
+		int left = 0;							// tasks of segment still running
+		int inputState = 0;						// 0 - empty, 1 - loading, 2 - ready
+	};
+	unsigned long long slotBytes = (2 * segmentFrames + warmup + latency) * channels * sizeof(float);
+	int slotsCount = (int)std::min(std::max(config.memoryBudget / slotBytes, 1ULL), (unsigned long long)std::max(segments, 1));
+	std::vector<Slot> slots(slotsCount);
+
+	std::atomic<int> nextTask{ 0 };
+	std::atomic<unsigned long long> busyTime{ 0 };
+	int written = 0;
+	bool isFailed = false;
+
+	auto worker = [&]()
+	{
+		try
+		{
+			TrackReader source;
+			source.Open(lpSource);
+			RenderBuffers buffers;
+			buffers.input.resize(RENDER_BLOCK_FRAMES * groupChannels);
+			buffers.output.resize(RENDER_BLOCK_FRAMES * groupChannels);
+
+			int task;
+			while ((task = nextTask.fetch_add(1)) < tasks)
+			{
+				int index = task / groups;
+				int group = task % groups;
+				Slot& slot = slots[index % slotsCount];
+				unsigned long long start = (unsigned long long)index * segmentFrames;
+				unsigned long long end = std::min(start + segmentFrames, frames);
+				bool isLoader = false;
+
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					condition.wait(lock, [&]()
+					{
+						return isFailed || isCanceled || (index < written + slotsCount &&
+							(isSegments || chainDone[group] == index - 1));
+					});
+					if (isFailed || isCanceled) { return; }
+
+					// first task of segment prepares slot
+					if (!slot.left)
+					{
+						slot.frames = (size_t)(end - start);
+						slot.left = groups;
+						slot.inputState = 0;
+						if (isSegments) { slot.inputStart = start > warmup ? start - warmup : 0; }
+						else { slot.inputStart = index ? start + latency : 0; }
+						slot.input.resize((size_t)(end + latency - slot.inputStart) * channels);
+						if (slot.data.size() < slot.frames * channels) { slot.data.resize(slot.frames * channels); }
+					}
+					if (!slot.inputState)
+					{
+						slot.inputState = 1;
+						isLoader = true;
+					}
+				}
+
+				unsigned long long taskStart = GetThreadTime();
+				if (isLoader)
+				{
+					LoadInput(source, slot.input.data(), slot.inputStart, end + latency, frames, channels);
+					{
+						std::lock_guard<std::mutex> lock(mutex);
+						slot.inputState = 2;
+					}
+					condition.notify_all();
+				}
+				else
+				{
+					std::unique_lock<std::mutex> lock(mutex);
+					condition.wait(lock, [&]() { return isFailed || isCanceled || slot.inputState == 2; });
+					if (isFailed || isCanceled) { return; }
+				}
+
+				if (isSegments)
+				{
+					RenderChain chain;
+					CreateChain(chain, config, groupChannels, sampleRate);
+					chain.fed = slot.inputStart;
+					try
+					{
+						RenderPart(chain, buffers, slot.input.data(), slot.inputStart, start, end,
+							channels, group * groupChannels, groupChannels, slot.data.data());
+					}
+					catch (AuEngine::Exception&)
+					{
+						DestroyChain(chain, config);
+						throw;
+					}
+					DestroyChain(chain, config);
+				}
+				else
+				{
+					RenderPart(chains[group], buffers, slot.input.data(), slot.inputStart, start, end,
+						channels, group * groupChannels, groupChannels, slot.data.data());
+				}
+				busyTime += GetThreadTime() - taskStart;
+
+				{
+					std::lock_guard<std::mutex> lock(mutex);
+					slot.left--;
+					if (!isSegments) { chainDone[group] = index; }
+				}
+				condition.notify_all();
+			}
+		}
+		catch (AuEngine::Exception&)
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			isFailed = true;
+		}
+		condition.notify_all();
+	};
+
+	LARGE_INTEGER frequency = {};
+	LARGE_INTEGER renderStart = {};
+	LARGE_INTEGER renderEnd = {};
+	QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&renderStart);
+
+	std::string partPath = std::string(lpPath) + ".part";
+	std::vector<uint8_t> converted;
+	WavStreamWriter writer;
+	writer.Open(partPath.c_str(), channels, sampleRate, format, (long long)(frames * frameSize));
+
+	std::vector<std::thread> workers;
+	for (int i = 0; i < workersCount; i++) { workers.push_back(std::thread(worker)); }
+
+	for (int index = 0; index < segments; index++)
+	{
+		Slot& slot = slots[index % slotsCount];
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			condition.wait(lock, [&]() { return isFailed || isCanceled || (slot.frames && !slot.left); });
+			if (isFailed || isCanceled) { break; }
+		}
+
+		// workers must be stopped and joined before error goes out
+		converted.resize(slot.frames * frameSize);
+		ConvertFromFloat(slot.data.data(), converted.data(), slot.frames * channels, format);
+		try
+		{
+			writer.WriteBlocking(converted.data(), converted.size());
+		}
+		catch (AuEngine::Exception&)
+		{
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				isFailed = true;
+			}
+			condition.notify_all();
+			break;
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			slot.frames = 0;
+			written++;
+		}
+		condition.notify_all();
+		progress = (int)((index + 1) * 100LL / segments);
+	}
+
+	for (size_t i = 0; i < workers.size(); i++) { workers[i].join(); }
+	writer.Close();
+
+	QueryPerformanceCounter(&renderEnd);
+	stats.seconds = (double)(renderEnd.QuadPart - renderStart.QuadPart) / frequency.QuadPart;
+	stats.busySeconds = busyTime.load() * 1e-7;
+	stats.audioSeconds = sampleRate ? (double)frames / sampleRate : 0.0;
+	stats.workers = workersCount;
+	stats.tasks = tasks;
+
+	if (isCanceled)
+	{
+		DeleteFileA(partPath.c_str());
+		return false;
+	}
+
+	if (isFailed || writer.IsFailed() || !MoveFileExA(partPath.c_str(), lpPath, MOVEFILE_REPLACE_EXISTING))
+	{
+		DeleteFileA(partPath.c_str());
+		THROW_EXCEPTION(AuEngine::OpSet::FILESYSYEM_ERROR);
+	}
+
+	progress = 100;
+	return true;
+}
@@ -0,0 +1,118 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineRender.h:
+// header for parallel offline render
+/////////////////////////////////
+#pragma once
+#include "AuEngine.h"
+#include "AuEngineGraph.h"
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+#define RENDER_SEGMENT_FRAMES	262144			// frames of one task
+#define RENDER_BLOCK_FRAMES		8192			// frames of one Graph::Process()
+#define RENDER_WARMUP			1.0				// seconds before segment for state of IIR nodes
+#define RENDER_MEMORY_BUDGET	(256ULL << 20)	// output waiting for writer
+#define RENDER_MAX_WORKERS		64
+
+/***********************************************
+* CreateChainFunc, DestroyChainFunc:
+* Renderer makes own effect chain for
+* every task (or channel) by factory.
+* Chain gets iChannels of input (one for
+* channel split) and must give the same
+* count at output. Destroy function
+* deletes graph and its nodes
+***********************************
+* enum RenderSplit:
+* RENDER_SEGMENTS - file is cut to
+*   segments, every segment gets new
+*   chain which starts warmup frames
+*   before it (decay of IIR state), so
+*   output can differ from one chain
+*   only while warmup is too short
+* RENDER_CHANNELS - every channel gets
+*   own mono chain (only for chains
+*   without links between channels)
+* Both - task is one channel of segment.
+* Only RENDER_CHANNELS - every channel
+* keeps one chain for whole file, its
+* segments go in order (exact result,
+* parallel only by channels)
+***********************************
+* struct RenderStats:
+* Benchmark of last Render(): wall time,
+* CPU time of all workers at tasks and
+* speedup (CPU / wall, ideal is count of
+* workers while they have own cores)
+***********************************
+* class OfflineRenderer:
+* Render() processes file by workers
+* (0 - all cores) and writes segments in
+* order, so output doesn't depend on
+* count of workers or on their timing.
+* Input of segment is read once for all
+* its channels. Count of segments in
+* memory is limited by memoryBudget. Cancel()
+* can be called from any thread, then
+* Render() returns false and file isn't
+* written
+***********************************************/
+namespace AuEngine
+{
+	typedef Graph*(*CreateChainFunc)(int iChannels, void* pUserData);
+	typedef void(*DestroyChainFunc)(Graph* pGraph, void* pUserData);
+
+	enum RenderSplit
+	{
+		RENDER_SEGMENTS = 1,
+		RENDER_CHANNELS = 2
+	};
+
+	struct RenderConfig
+	{
+		CreateChainFunc pCreate = NULL;			// NULL - copy of input
+		DestroyChainFunc pDestroy = NULL;
+		void* pUserData = NULL;
+		int split = RENDER_SEGMENTS;
+		unsigned long long segmentFrames = RENDER_SEGMENT_FRAMES;
+		double warmup = RENDER_WARMUP;
+		int workers = 0;
+		unsigned long long memoryBudget = RENDER_MEMORY_BUDGET;
+		PaSampleFormat format = 0;
+	};
+
+	struct RenderStats
+	{
+		double seconds = 0.0;					// wall time
+		double busySeconds = 0.0;				// CPU time of workers at tasks
+		double audioSeconds = 0.0;				// length of file
+		int workers = 0;
+		int tasks = 0;
+
+		double GetSpeedup() const { return seconds > 0.0 ? busySeconds / seconds : 0.0; }
+		double GetRealtime() const { return seconds > 0.0 ? audioSeconds / seconds : 0.0; }
+	};
+
+	class OfflineRenderer
+	{
+	public:
+		OfflineRenderer() {}
+		DLL_API bool Render(const char* lpSource, const char* lpPath, const RenderConfig& config);
+		DLL_API void Cancel();
+
+		int  GetProgress() const { return progress.load(); }
+		const RenderStats& GetStats() const { return stats; }
+
+	private:
+		std::mutex mutex;
+		std::condition_variable condition;
+		std::atomic<bool> isCanceled{ false };
+		std::atomic<int> progress{ 0 };
+		RenderStats stats;
+	};
+};
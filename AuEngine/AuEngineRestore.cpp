@@ -0,0 +1,555 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineRestore.cpp:
+// declicker and clip repair
+/////////////////////////////////
+
+/*******************************************
+* Restoration:
+* Audio is AR process x[n] = sum a[k] *
+* x[n - k] + e[n] with small excitation
+* e[n]. Click doesn't fit the model, so
+* |e| is much bigger there than median of
+* block (median isn't moved by clicks
+* unlike RMS).
+*
+* Repair (LSAR, Vaseghi/Godsill): missing
+* samples are chosen so sum of e[n]^2 over
+* all n which use them is minimal. It's
+* linear system with band order, so
+* Cholesky of band matrix takes
+* count * order^2.
+*
+* Clipped samples are not just missing:
+* real value was over clip level with the
+* same sign. It's the same least squares
+* with bounds, solved by projected SOR
+* (Gauss-Seidel step, then clamp to the
+* bound), it converges for any SPD matrix.
+*
+* Detection must read all file, repair
+* reads and writes only flagged regions.
+*******************************************/
+
+#include "AuEngineRestore.h"
+#include "AuEngineTrack.h"
+#include "AuEngineWav.h"
+#include <algorithm>
+#include <string>
+#include <string.h>
+
+/*******************************************
+* Levinson():
+* AR coefficients from autocorrelation,
+* x[n] ~ sum a[k] * x[n - k], k = 1..order
+*******************************************/
+static bool Levinson(const double* pR, int iOrder, double* pA)
+{
+	double tmp[RESTORE_MAX_ORDER + 1];
+	double error = pR[0] * (1.0 + 1e-9);		// white noise correction
+	if (error <= 0.0) { return false; }
+
+	for (int k = 0; k <= iOrder; k++) { pA[k] = 0.0; }
+	for (int i = 1; i <= iOrder; i++)
+	{
+		double acc = pR[i];
+		for (int j = 1; j < i; j++) { acc -= pA[j] * pR[i - j]; }
+		double reflection = acc / error;
+
+		for (int j = 1; j < i; j++) { tmp[j] = pA[j] - reflection * pA[i - j]; }
+		for (int j = 1; j < i; j++) { pA[j] = tmp[j]; }
+		pA[i] = reflection;
+
+		error *= 1.0 - reflection * reflection;
+		if (error <= 0.0) { return false; }
+	}
+	return true;
+}
+
+/*******************************************
+* AddCorrelation():
+* Add autocorrelation of part, lags up to
+* order
+*******************************************/
+static void AddCorrelation(const float* pData, size_t frames, int iOrder, double* pR)
+{
+	for (int k = 0; k <= iOrder && (size_t)k < frames; k++)
+	{
+		double sum = 0.0;
+		for (size_t n = k; n < frames; n++) { sum += (double)pData[n] * pData[n - k]; }
+		pR[k] += sum;
+	}
+}
+
+/*******************************************
+* DefectDetector::Create():
+* Allocate block buffers
+*******************************************/
+void AuEngine::DefectDetector::Create(const RestoreConfig& cfg, int iSampleRate, int iChannels)
+{
+	if (iChannels < 1 || iChannels > RESTORE_MAX_CHANNELS || cfg.order < 2 || cfg.order > RESTORE_MAX_ORDER || iSampleRate <= 0)
+	{
+		THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR);
+	}
+
+	config = cfg;
+	channels = iChannels;
+	order = cfg.order;
+	maxClick = (unsigned long long)(cfg.maxClick * iSampleRate) + order;	// error follows click for order frames
+	block.assign(channels * (order + RESTORE_BLOCK), 0.0f);
+	residual.assign(RESTORE_BLOCK, 0.0f);
+	sorted.assign(RESTORE_BLOCK, 0.0f);
+	Reset();
+}
+
+/*******************************************
+* DefectDetector::Reset():
+* Start of new file
+*******************************************/
+void AuEngine::DefectDetector::Reset()
+{
+	std::fill(block.begin(), block.end(), 0.0f);
+	for (int c = 0; c < RESTORE_MAX_CHANNELS; c++) { clicks[c] = clips[c] = OpenRegion(); }
+	regions.clear();
+	position = 0;
+	blockFill = 0;
+}
+
+/*******************************************
+* DefectDetector::Process():
+* Take interleaved frames
+*******************************************/
+void AuEngine::DefectDetector::Process(const float* pData, size_t frames)
+{
+	while (frames)
+	{
+		size_t part = std::min(frames, (size_t)(RESTORE_BLOCK - blockFill));
+		for (int c = 0; c < channels; c++)
+		{
+			float* pBlock = &block[c * (order + RESTORE_BLOCK) + order + blockFill];
+			for (size_t i = 0; i < part; i++) { pBlock[i] = pData[i * channels + c]; }
+		}
+		blockFill += (int)part;
+		pData += part * channels;
+		frames -= part;
+
+		if (blockFill == RESTORE_BLOCK) { ProcessBlock(RESTORE_BLOCK); }
+	}
+}
+
+/*******************************************
+* DefectDetector::Finish():
+* Last block, close regions, sort index
+*******************************************/
+void AuEngine::DefectDetector::Finish()
+{
+	if (blockFill) { ProcessBlock(blockFill); }
+	for (int c = 0; c < channels; c++)
+	{
+		Close(clicks[c], c, DEFECT_CLICK);
+		Close(clips[c], c, DEFECT_CLIP);
+	}
+
+	std::stable_sort(regions.begin(), regions.end(), [](const DefectRegion& a, const DefectRegion& b)
+	{
+		return a.start < b.start;
+	});
+}
+
+/*******************************************
+* DefectDetector::ProcessBlock():
+* Fit AR model of every channel, flag
+* clicks and clipped runs
+*******************************************/
+void AuEngine::DefectDetector::ProcessBlock(int iFrames)
+{
+	double r[RESTORE_MAX_ORDER + 1];
+	double a[RESTORE_MAX_ORDER + 1];
+	int stride = order + RESTORE_BLOCK;
+
+	for (int c = 0; c < channels; c++)
+	{
+		float* pBlock = &block[c * stride];
+		OpenRegion& click = clicks[c];
+		OpenRegion& clip = clips[c];
+
+		// clipping: run of samples at clip level
+		for (int i = 0; i < iFrames; i++)
+		{
+			unsigned long long frame = position + i;
+			if (fabsf(pBlock[order + i]) < config.clipLevel) { clip.clipRun = 0; continue; }
+
+			if (!clip.clipRun++) { clip.clipStart = frame; }
+			if (clip.clipRun < config.clipRun) { continue; }
+
+			Flag(clip, c, DEFECT_CLIP, clip.clipRun == config.clipRun ? clip.clipStart : frame, frame + 1);
+			clip.clipLast = frame + 1;
+		}
+
+		// clicks: prediction error over robust sigma
+		for (int k = 0; k <= order; k++) { r[k] = 0.0; }
+		AddCorrelation(pBlock, order + iFrames, order, r);
+		if (Levinson(r, order, a))
+		{
+			for (int i = 0; i < iFrames; i++)
+			{
+				const float* pX = pBlock + order + i;
+				double prediction = 0.0;
+				for (int k = 1; k <= order; k++) { prediction += a[k] * pX[-k]; }
+				residual[i] = fabsf(pX[0] - (float)prediction);
+				sorted[i] = residual[i];
+			}
+
+			std::nth_element(sorted.begin(), sorted.begin() + iFrames / 2, sorted.begin() + iFrames);
+			float threshold = std::max(config.sensitivity * 1.4826f * sorted[iFrames / 2], 1e-5f);
+			for (int i = 0; i < iFrames; i++)
+			{
+				// error after clipped sample is from clipping
+				unsigned long long frame = position + i;
+				if (clip.clipLast && frame < clip.clipLast + order) { continue; }
+
+				bool isTail = click.isOpen && frame <= click.end + RESTORE_MARGIN && residual[i] > threshold * RESTORE_HYSTERESIS;
+				if (residual[i] > threshold || isTail) { Flag(click, c, DEFECT_CLICK, frame, frame + 1); }
+			}
+		}
+
+		if (click.isOpen && position + iFrames > click.end + order) { Close(click, c, DEFECT_CLICK); }
+		if (clip.isOpen && position + iFrames > clip.end + order) { Close(clip, c, DEFECT_CLIP); }
+		memmove(pBlock, pBlock + iFrames, order * sizeof(float));
+	}
+
+	position += iFrames;
+	blockFill = 0;
+}
+
+/*******************************************
+* DefectDetector::Flag():
+* Add frames to open region (or start
+* new one)
+*******************************************/
+void AuEngine::DefectDetector::Flag(OpenRegion& region, int iChannel, int iType, unsigned long long from, unsigned long long to)
+{
+	if (region.isOpen && from <= region.end + order)
+	{
+		region.start = std::min(region.start, from);
+		region.end = std::max(region.end, to);
+		return;
+	}
+
+	Close(region, iChannel, iType);
+	region.isOpen = true;
+	region.start = from;
+	region.end = to;
+}
+
+/*******************************************
+* DefectDetector::Close():
+* Put region to index. Long click is
+* attack of music, long clipping is split
+*******************************************/
+void AuEngine::DefectDetector::Close(OpenRegion& region, int iChannel, int iType)
+{
+	if (!region.isOpen) { return; }
+	region.isOpen = false;
+	if (iType == DEFECT_CLICK && region.end - region.start > maxClick) { return; }
+
+	unsigned long long start = region.start > RESTORE_MARGIN ? region.start - RESTORE_MARGIN : 0;
+	unsigned long long end = region.end + RESTORE_MARGIN;
+	while (start < end)
+	{
+		DefectRegion defect;
+		defect.start = start;
+		defect.frames = (unsigned int)std::min(end - start, (unsigned long long)RESTORE_MAX_REGION);
+		defect.channel = (unsigned short)iChannel;
+		defect.type = (unsigned short)iType;
+		regions.push_back(defect);
+		start += defect.frames;
+	}
+}
+
+/*******************************************
+* IsMissing():
+* Sample of region is repaired (in clip
+* region only clipped ones)
+*******************************************/
+static bool IsMissing(float value, float fClipLevel)
+{
+	return fClipLevel <= 0.0f || fabsf(value) >= fClipLevel;
+}
+
+/*******************************************
+* RepairAR():
+* LSAR interpolation at mono buffer
+*******************************************/
+bool AuEngine::RepairAR(float* pData, size_t frames, size_t start, size_t count, int iOrder, float fClipLevel)
+{
+	if (iOrder < 1 || iOrder > RESTORE_MAX_ORDER || !count || start + count > frames) { return false; }
+
+	// model from context at both sides
+	double r[RESTORE_MAX_ORDER + 1] = {};
+	double a[RESTORE_MAX_ORDER + 1];
+	AddCorrelation(pData, start, iOrder, r);
+	AddCorrelation(pData + start + count, frames - start - count, iOrder, r);
+	if (frames - count < (size_t)(2 * iOrder) || !Levinson(r, iOrder, a)) { return false; }
+
+	// prediction error filter: e[n] = sum b[k] * x[n - k]
+	double b[RESTORE_MAX_ORDER + 1];
+	b[0] = 1.0;
+	for (int k = 1; k <= iOrder; k++) { b[k] = -a[k]; }
+
+	std::vector<float> original(pData + start, pData + start + count);
+	// in clip region only clipped samples are missing
+	std::vector<int> index(count, -1);			// unknown of frame, -1 - known
+	std::vector<size_t> unknowns;
+	for (size_t i = 0; i < count; i++)
+	{
+		if (!IsMissing(original[i], fClipLevel)) { continue; }
+		index[i] = (int)unknowns.size();
+		unknowns.push_back(start + i);
+	}
+	if (unknowns.empty()) { return false; }
+
+	size_t size = unknowns.size();
+	int band = iOrder + 1;
+	std::vector<double> matrix(size * band, 0.0);	// row, band (matrix[i][d] is (i, i - d))
+	std::vector<double> rhs(size, 0.0);
+	for (size_t i = 0; i < size; i++) { pData[unknowns[i]] = 0.0f; }
+
+	// every error which uses missing sample
+	size_t first = std::max(start, (size_t)iOrder);
+	size_t last = std::min(start + count + iOrder, frames);
+	for (size_t n = first; n < last; n++)
+	{
+		double known = 0.0;
+		for (int k = 0; k <= iOrder; k++) { known += b[k] * pData[n - k]; }
+
+		for (int k1 = 0; k1 <= iOrder; k1++)
+		{
+			size_t p1 = n - k1;
+			if (p1 < start || p1 >= start + count || index[p1 - start] < 0) { continue; }
+			int i = index[p1 - start];
+			rhs[i] -= b[k1] * known;
+
+			for (int k2 = k1; k2 <= iOrder; k2++)
+			{
+				size_t p2 = n - k2;
+				if (p2 < start || index[p2 - start] < 0) { continue; }
+				matrix[i * band + (i - index[p2 - start])] += b[k1] * b[k2];
+			}
+		}
+	}
+
+	double energy = 0.0;
+	for (int k = 0; k <= iOrder; k++) { energy += b[k] * b[k]; }
+	for (size_t i = 0; i < size; i++) { matrix[i * band] += energy * 1e-9; }
+
+	if (fClipLevel > 0.0f)
+	{
+		// projected SOR: every sample stays over its clipped value
+		std::vector<double> x(size);
+		for (size_t i = 0; i < size; i++) { x[i] = original[unknowns[i] - start]; }
+		for (int pass = 0; pass < RESTORE_CLIP_PASSES; pass++)
+		{
+			double change = 0.0;
+			for (size_t i = 0; i < size; i++)
+			{
+				double sum = rhs[i];
+				size_t from = i > (size_t)iOrder ? i - iOrder : 0;
+				for (size_t j = from; j < i; j++) { sum -= matrix[i * band + (i - j)] * x[j]; }
+				for (size_t j = i + 1; j < size && j <= i + iOrder; j++) { sum -= matrix[j * band + (j - i)] * x[j]; }
+
+				double clipped = original[unknowns[i] - start];
+				double value = x[i] + RESTORE_SOR * (sum / matrix[i * band] - x[i]);
+				value = clipped > 0.0 ? std::max(value, clipped) : std::min(value, clipped);
+				change = std::max(change, fabs(value - x[i]));
+				x[i] = value;
+			}
+			if (change < 1e-7) { break; }
+		}
+		for (size_t i = 0; i < size; i++) { pData[unknowns[i]] = (float)x[i]; }
+		return true;
+	}
+
+	// band Cholesky, L is at place of matrix
+	for (size_t i = 0; i < size; i++)
+	{
+		size_t from = i > (size_t)iOrder ? i - iOrder : 0;
+		for (size_t j = from; j <= i; j++)
+		{
+			double sum = matrix[i * band + (i - j)];
+			size_t kFrom = std::max(from, j > (size_t)iOrder ? j - iOrder : 0);
+			for (size_t k = kFrom; k < j; k++) { sum -= matrix[i * band + (i - k)] * matrix[j * band + (j - k)]; }
+
+			if (j == i)
+			{
+				if (sum <= 0.0) { memcpy(pData + start, original.data(), count * sizeof(float)); return false; }
+				matrix[i * band] = sqrt(sum);
+			}
+			else
+			{
+				matrix[i * band + (i - j)] = sum / matrix[j * band];
+			}
+		}
+	}
+
+	for (size_t i = 0; i < size; i++)
+	{
+		double sum = rhs[i];
+		size_t from = i > (size_t)iOrder ? i - iOrder : 0;
+		for (size_t k = from; k < i; k++) { sum -= matrix[i * band + (i - k)] * rhs[k]; }
+		rhs[i] = sum / matrix[i * band];
+	}
+	for (size_t i = size; i-- > 0; )
+	{
+		double sum = rhs[i];
+		for (size_t k = i + 1; k < size && k <= i + iOrder; k++) { sum -= matrix[k * band + (k - i)] * rhs[k]; }
+		rhs[i] = sum / matrix[i * band];
+	}
+	for (size_t i = 0; i < size; i++) { pData[unknowns[i]] = (float)rhs[i]; }
+
+	return true;
+}
+
+/*******************************************
+* DetectDefects():
+* Detection pass for file
+*******************************************/
+void AuEngine::DetectDefects(const char* lpSource, const RestoreConfig& config, std::vector<DefectRegion>& regions,
+	std::atomic<int>* pPercent)
+{
+	TrackReader reader;
+	reader.Open(lpSource);
+	int channels = reader.GetChannels();
+	unsigned long long frames = reader.GetFrames();
+
+	DefectDetector detector;
+	detector.Create(config, reader.GetSampleRate(), channels);
+
+	std::vector<float> data(RESTORE_BLOCK * 4 * channels);
+	unsigned long long done = 0;
+	size_t got = 0;
+	while ((got = reader.Read(data.data(), RESTORE_BLOCK * 4, channels)) > 0)
+	{
+		detector.Process(data.data(), got);
+		done += got;
+		if (pPercent && frames) { *pPercent = (int)(done * 100 / frames); }
+	}
+
+	detector.Finish();
+	regions = detector.GetRegions();
+	Msg("AuEngine: Defects found: ", (int)regions.size());
+	if (pPercent) { *pPercent = 100; }
+}
+
+/*******************************************
+* RepairDefects():
+* Repair pass, region by region in file
+*******************************************/
+void AuEngine::RepairDefects(const char* lpSource, const char* lpPath, const RestoreConfig& config,
+	const std::vector<DefectRegion>& regions, std::atomic<int>* pPercent)
+{
+	std::string target = lpSource;
+	std::string partPath;
+	if (lpPath)
+	{
+		partPath = std::string(lpPath) + ".part";
+		if (!CopyFileA(lpSource, partPath.c_str(), FALSE)) { THROW_EXCEPTION(AuEngine::OpSet::FILESYSYEM_ERROR); }
+		target = partPath;
+	}
+
+	bool isFailed = false;
+	FILE* pFile = NULL;
+	try
+	{
+		TrackReader reader;
+		reader.Open(target.c_str());
+		int channels = reader.GetChannels();
+		unsigned long long frames = reader.GetFrames();
+		PaSampleFormat format = reader.GetFormat();
+		size_t sampleSize = Pa_GetSampleSize(format);
+		size_t frameSize = channels * sampleSize;
+
+		long long dataOffset = -1;
+		const std::vector<TrackChunk>& chunks = reader.GetChunks();
+		for (size_t i = 0; i < chunks.size(); i++)
+		{
+			if (!memcmp(chunks[i].tag, "data", 4)) { dataOffset = chunks[i].offset; }
+		}
+
+		pFile = fopen(target.c_str(), "r+b");
+		if (!pFile || dataOffset < 0) { THROW_EXCEPTION(AuEngine::OpSet::FILESYSYEM_ERROR); }
+
+		std::vector<float> data;
+		std::vector<float> mono;
+		std::vector<uint8_t> converted;
+		std::vector<uint8_t> raw;
+		std::vector<size_t> missing;			// frames of region which RepairAR() changes
+		int repaired = 0;
+		for (size_t r = 0; r < regions.size(); r++)
+		{
+			const DefectRegion& region = regions[r];
+			if (region.channel >= channels || region.start >= frames || region.frames > RESTORE_MAX_REGION) { continue; }
+
+			// context: 4 orders or length of region at each side
+			unsigned long long count = std::min((unsigned long long)region.frames, frames - region.start);
+			unsigned long long context = std::max((unsigned long long)(4 * config.order), count);
+			unsigned long long from = region.start > context ? region.start - context : 0;
+			unsigned long long to = std::min(region.start + count + context, frames);
+			size_t length = (size_t)(to - from);
+
+			data.resize(length * channels);
+			reader.Seek(from);
+			if (reader.Read(data.data(), length, channels) != length) { THROW_EXCEPTION(AuEngine::OpSet::FILESYSYEM_ERROR); }
+
+			mono.resize(length);
+			for (size_t i = 0; i < length; i++) { mono[i] = data[i * channels + region.channel]; }
+			float clipLevel = region.type == DEFECT_CLIP ? config.clipLevel : 0.0f;
+			missing.clear();
+			for (size_t i = 0; i < count; i++)
+			{
+				if (IsMissing(mono[(size_t)(region.start - from) + i], clipLevel)) { missing.push_back(i); }
+			}
+			if (!RepairAR(mono.data(), length, (size_t)(region.start - from), (size_t)count, config.order, clipLevel)) { continue; }
+
+			// only repaired samples are written back, float can't keep 32-bit
+			// integers, so known samples of region keep their bytes
+			converted.resize((size_t)count * sampleSize);
+			ConvertFromFloat(mono.data() + (size_t)(region.start - from), converted.data(), (size_t)count, format);
+
+			long long offset = dataOffset + (long long)(region.start * frameSize);
+			raw.resize((size_t)count * frameSize);
+			if (_fseeki64(pFile, offset, SEEK_SET) || fread(raw.data(), 1, raw.size(), pFile) != raw.size())
+			{
+				THROW_EXCEPTION(AuEngine::OpSet::FILESYSYEM_ERROR);
+			}
+			for (size_t i = 0; i < missing.size(); i++)
+			{
+				size_t frame = missing[i];
+				memcpy(raw.data() + frame * frameSize + region.channel * sampleSize, converted.data() + frame * sampleSize, sampleSize);
+			}
+			if (_fseeki64(pFile, offset, SEEK_SET) || fwrite(raw.data(), 1, raw.size(), pFile) != raw.size() || fflush(pFile))
+			{
+				THROW_EXCEPTION(AuEngine::OpSet::FILESYSYEM_ERROR);
+			}
+			repaired++;
+			if (pPercent) { *pPercent = (int)((r + 1) * 100 / regions.size()); }
+		}
+		Msg("AuEngine: Defects repaired: ", repaired);
+	}
+	catch (AuEngine::Exception&)
+	{
+		isFailed = true;
+	}
+
+	if (pFile) { fclose(pFile); }
+	if (lpPath && (isFailed || !MoveFileExA(partPath.c_str(), lpPath, MOVEFILE_REPLACE_EXISTING)))
+	{
+		DeleteFileA(partPath.c_str());
+		isFailed = true;
+	}
+	if (isFailed) { THROW_EXCEPTION(AuEngine::OpSet::FILESYSYEM_ERROR); }
+	if (pPercent) { *pPercent = 100; }
+}
@@ -0,0 +1,142 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineRestore.h:
+// header for declicker and clip repair
+/////////////////////////////////
+#pragma once
+#include "AuEngine.h"
+#include <atomic>
+#include <vector>
+
+#define RESTORE_MAX_CHANNELS	8
+#define RESTORE_MAX_ORDER		64
+#define RESTORE_BLOCK			4096			// frames of one AR fit at detection
+#define RESTORE_MARGIN			2				// frames around flagged samples
+#define RESTORE_HYSTERESIS		0.3f			// tail of click goes on while error is over it * threshold
+#define RESTORE_MAX_REGION		8192			// longer regions are not repaired
+#define RESTORE_CLIP_PASSES		500				// SOR iterations for clip bounds
+#define RESTORE_SOR				1.6				// over-relaxation
+
+/***********************************************
+* struct DefectRegion:
+* Damaged frames of one channel, type is
+* DEFECT_CLICK or DEFECT_CLIP
+***********************************
+* struct RestoreConfig:
+* order       - of AR model
+* sensitivity - click is residual over
+*   sensitivity * robust sigma (median)
+* maxClick    - seconds, longer flagged
+*   parts are music (attacks), not clicks
+* clipLevel   - |x| of clipped samples,
+*   clipRun frames in a row at least
+***********************************
+* class DefectDetector:
+* Detection pass. Every block gets its AR
+* model (Levinson-Durbin), samples with
+* big prediction error are clicks, runs
+* at clip level are clipping (error next
+* to clipping isn't click). Flagged
+* samples close to each other are one
+* region, long clipping is split to
+* RESTORE_MAX_REGION. Works with any block size,
+* Finish() closes open regions and sorts
+* index by start
+***********************************
+* RepairAR():
+* LSAR interpolation of count frames at
+* start of mono buffer (other frames are
+* context, order * 4 at each side is
+* enough). AR model is from context only,
+* missing samples minimize energy of
+* prediction error (banded Cholesky).
+* For clip region only clipped samples
+* are missing, they're kept over clip
+* level with the same sign
+***********************************
+* DetectDefects():
+* Detection pass for file
+***********************************
+* RepairDefects():
+* Repair pass: only regions are read,
+* repaired and written back to the file,
+* so time is proportional to defects,
+* not to length of file. lpPath - copy
+* to repair (NULL - source in place).
+* Integer files keep full scale, so
+* repaired clip peaks over it are
+* clipped again
+***********************************************/
+namespace AuEngine
+{
+	enum DefectType
+	{
+		DEFECT_CLICK = 1,
+		DEFECT_CLIP = 2
+	};
+
+	struct DefectRegion
+	{
+		unsigned long long start;
+		unsigned int frames;
+		unsigned short channel;
+		unsigned short type;
+	};
+
+	struct RestoreConfig
+	{
+		int order = 24;
+		float sensitivity = 8.0f;
+		float maxClick = 0.004f;
+		float clipLevel = 0.985f;
+		int clipRun = 3;
+	};
+
+	class DefectDetector
+	{
+	public:
+		DefectDetector() {}
+		DLL_API void Create(const RestoreConfig& config, int iSampleRate, int iChannels);
+		DLL_API void Reset();
+		DLL_API void Process(const float* pData, size_t frames);
+		DLL_API void Finish();
+		const std::vector<DefectRegion>& GetRegions() const { return regions; }
+
+	private:
+		struct OpenRegion
+		{
+			unsigned long long start = 0;
+			unsigned long long end = 0;			// after last flagged frame
+			bool isOpen = false;
+			int clipRun = 0;					// clips only
+			unsigned long long clipStart = 0;
+			unsigned long long clipLast = 0;	// after last sample at clip level (0 - none)
+		};
+
+		void ProcessBlock(int iFrames);
+		void Flag(OpenRegion& region, int iChannel, int iType, unsigned long long from, unsigned long long to);
+		void Close(OpenRegion& region, int iChannel, int iType);
+
+		RestoreConfig config;
+		int channels = 0;
+		int order = 0;
+		unsigned long long maxClick = 0;
+		unsigned long long position = 0;		// frame of block start
+		std::vector<float> block;				// channel, order of history + RESTORE_BLOCK
+		int blockFill = 0;
+		std::vector<float> residual;
+		std::vector<float> sorted;
+		OpenRegion clicks[RESTORE_MAX_CHANNELS];
+		OpenRegion clips[RESTORE_MAX_CHANNELS];
+		std::vector<DefectRegion> regions;
+	};
+
+	DLL_API bool RepairAR(float* pData, size_t frames, size_t start, size_t count, int iOrder, float fClipLevel = 0.0f);
+	DLL_API void DetectDefects(const char* lpSource, const RestoreConfig& config, std::vector<DefectRegion>& regions,
+		std::atomic<int>* pPercent = NULL);
+	DLL_API void RepairDefects(const char* lpSource, const char* lpPath, const RestoreConfig& config,
+		const std::vector<DefectRegion>& regions, std::atomic<int>* pPercent = NULL);
+};
@@ -0,0 +1,113 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineRing.h:
+// lock-free ring buffer
+/////////////////////////////////
+#pragma once
+#include "AuEngine.h"
+#include <atomic>
+
+#define RING_CACHE_LINE			64
+
+/***********************************************
+* class RingBuffer:
+* Single producer, single consumer byte
+* ring. Size is power of two, indexes are
+* never wrapped, so full and empty states
+* are different. Write() and Read() never
+* block and never allocate
+***********************************************/
+namespace AuEngine
+{
+	class RingBuffer
+	{
+	public:
+		RingBuffer() {}
+		~RingBuffer() { Destroy(); }
+
+		void Create(size_t szSize)
+		{
+			Destroy();
+			size_t real = RING_CACHE_LINE;
+			while (real < szSize) { real <<= 1; }
+
+			pData = (uint8_t*)_aligned_malloc(real, RING_CACHE_LINE);
+			if (!pData) { THROW_EXCEPTION(AuEngine::OpSet::MEMORY_ERROR); }
+			memset(pData, 0, real);
+			size = real;
+			mask = real - 1;
+			writeIndex.store(0);
+			readIndex.store(0);
+		}
+
+		void Destroy()
+		{
+			if (pData) { _aligned_free(pData); }
+			pData = NULL;
+			size = mask = 0;
+		}
+
+		size_t GetSize() const { return size; }
+		size_t GetReadAvailable() const { return writeIndex.load(std::memory_order_acquire) - readIndex.load(std::memory_order_acquire); }
+		size_t GetWriteAvailable() const { return size - GetReadAvailable(); }
+
+		// producer only
+		size_t Write(const void* pSrc, size_t szBytes)
+		{
+			size_t write = writeIndex.load(std::memory_order_relaxed);
+			size_t space = size - (write - readIndex.load(std::memory_order_acquire));
+			if (szBytes > space) { szBytes = space; }
+
+			size_t offset = write & mask;
+			size_t first = size - offset < szBytes ? size - offset : szBytes;
+			memcpy(pData + offset, pSrc, first);
+			memcpy(pData, (const uint8_t*)pSrc + first, szBytes - first);
+
+			writeIndex.store(write + szBytes, std::memory_order_release);
+			return szBytes;
+		}
+
+		// consumer only
+		size_t Read(void* pDst, size_t szBytes)
+		{
+			size_t read = readIndex.load(std::memory_order_relaxed);
+			size_t avail = writeIndex.load(std::memory_order_acquire) - read;
+			if (szBytes > avail) { szBytes = avail; }
+
+			size_t offset = read & mask;
+			size_t first = size - offset < szBytes ? size - offset : szBytes;
+			memcpy(pDst, pData + offset, first);
+			memcpy((uint8_t*)pDst + first, pData, szBytes - first);
+
+			readIndex.store(read + szBytes, std::memory_order_release);
+			return szBytes;
+		}
+
+		// consumer only: get contiguous readable region without copy
+		size_t Peek(const void** ppData)
+		{
+			size_t read = readIndex.load(std::memory_order_relaxed);
+			size_t avail = writeIndex.load(std::memory_order_acquire) - read;
+			size_t offset = read & mask;
+			*ppData = pData + offset;
+			return size - offset < avail ? size - offset : avail;
+		}
+
+		void Skip(size_t szBytes) { readIndex.fetch_add(szBytes, std::memory_order_release); }
+
+		// consumer only, e.g. after seek
+		void Flush() { readIndex.store(writeIndex.load(std::memory_order_acquire), std::memory_order_release); }
+
+	private:
+		uint8_t* pData = NULL;
+		size_t size = 0;
+		size_t mask = 0;
+
+		// indexes at different cache lines, so producer and consumer don't fight
+		alignas(RING_CACHE_LINE) std::atomic<size_t> writeIndex{ 0 };
+		alignas(RING_CACHE_LINE) std::atomic<size_t> readIndex{ 0 };
+	};
+};
@@ -0,0 +1,517 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineStretch.cpp:
+// time-stretch and pitch-shift
+/////////////////////////////////
+
+/*******************************************
+* Phase vocoder:
+* Analysis frames are Ha frames apart,
+* synthesis frames are Hs = N / 4 apart,
+* stretch is Hs / Ha. Frequency of bin k
+* is w = 2 pi k / N + princarg(phi - phi'
+* - 2 pi k Ha / N) / Ha and output phase
+* goes Hs * w further.
+* With phase locking only peaks of
+* spectrum are computed so, other bins
+* keep their phase difference to the peak
+* of their region, partials stay coherent
+* (less "phasiness").
+*
+* Input starts with N / 2 zeros, so first
+* frame is centered at input 0 and output
+* has N / 2 frames of latency before
+* resampling for any stretch.
+*
+* Analysis and synthesis windows are Hann,
+* sum of squares at overlap 4 is 1.5.
+*******************************************/
+
+#include "AuEngineStretch.h"
+#include "AuEngineTrack.h"
+#include "AuEngineWav.h"
+#include <algorithm>
+#include <string.h>
+
+#define TWO_PI					6.28318530718
+
+/*******************************************
+* PrincipalArgument():
+* Wrap phase to [-pi, pi]
+*******************************************/
+static inline double PrincipalArgument(double phase)
+{
+	return phase - TWO_PI * floor(phase / TWO_PI + 0.5);
+}
+
+/*******************************************
+* Create():
+* Allocate everything for frame size
+*******************************************/
+void AuEngine::TimeStretch::Create(const StretchConfig& config, int iChannels)
+{
+	int size = config.frameSize;
+	if (iChannels < 1 || iChannels > STRETCH_MAX_CHANNELS || size < 256 || (size & (size - 1)) || config.sampleRate <= 0.0)
+	{
+		THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR);
+	}
+
+	channels = iChannels;
+	frameSize = size;
+	bins = size / 2 + 1;
+	hop = size / STRETCH_OVERLAP;
+	plan = GetFFTPlan(size);
+
+	window.resize(size);
+	for (int i = 0; i < size; i++) { window[i] = (float)(0.5 - 0.5 * cos(TWO_PI * i / size)); }
+
+	inputSize = size + STRETCH_WRITE_FRAMES;
+	synthSize = size + 4 * STRETCH_WRITE_FRAMES;
+	input.assign(channels * inputSize, 0.0f);
+	ola.assign(channels * size, 0.0f);
+	synth.assign(channels * synthSize, 0.0f);
+	re.assign(channels * bins, 0.0f);
+	im.assign(channels * bins, 0.0f);
+	midRe.assign(bins, 0.0f);
+	midIm.assign(bins, 0.0f);
+	magnitude.assign(bins, 0.0f);
+	phase.assign(bins, 0.0f);
+	lastPhase.assign(bins, 0.0f);
+	synthPhase.assign(bins, 0.0f);
+	frame.assign(size, 0.0f);
+	peaks.assign(bins, 0);
+
+	time = 1.0;
+	pitch = 1.0;
+	SetTime(config.time);
+	SetPitch(config.semitones);
+	Reset();
+}
+
+/*******************************************
+* Destroy():
+* Free buffers
+*******************************************/
+void AuEngine::TimeStretch::Destroy()
+{
+	plan.reset();
+	input.clear();
+	ola.clear();
+	synth.clear();
+	channels = 0;
+}
+
+/*******************************************
+* Reset():
+* Drop all audio, keep ratios
+*******************************************/
+void AuEngine::TimeStretch::Reset()
+{
+	std::fill(input.begin(), input.end(), 0.0f);
+	std::fill(ola.begin(), ola.end(), 0.0f);
+	std::fill(synth.begin(), synth.end(), 0.0f);
+
+	inputFill = frameSize / 2;
+	synthFill = 1;							// history sample for cubic
+	readPos = 1.0;
+	hopPos = 0.0;
+	hopDebt = 0.0;
+	transientLeft = 0;
+	skip = 0;
+	lastHop = hop;
+	lastEnergy = 0.0f;
+	isFirst = true;
+	wasTransient = false;
+}
+
+/*******************************************
+* SetTime():
+* Output length / input length
+*******************************************/
+void AuEngine::TimeStretch::SetTime(double dTime)
+{
+	time = std::min(std::max(dTime, STRETCH_MIN_TIME), STRETCH_MAX_TIME);
+}
+
+/*******************************************
+* SetPitch():
+* Pitch shift in semitones
+*******************************************/
+void AuEngine::TimeStretch::SetPitch(double dSemitones)
+{
+	dSemitones = std::min(std::max(dSemitones, -STRETCH_MAX_SEMITONES), STRETCH_MAX_SEMITONES);
+	pitch = pow(2.0, dSemitones / 12.0);
+}
+
+/*******************************************
+* Write():
+* Take interleaved input, returns frames
+* taken (less if output isn't read)
+*******************************************/
+size_t AuEngine::TimeStretch::Write(const float* pInput, size_t frames)
+{
+	size_t done = 0;
+	while (done < frames)
+	{
+		// analysis hop was longer than buffered input
+		if (skip)
+		{
+			size_t dropped = std::min(skip, frames - done);
+			skip -= dropped;
+			done += dropped;
+			continue;
+		}
+
+		size_t count = std::min(inputSize - inputFill, frames - done);
+		if (!count) { break; }
+
+		const float* pSrc = pInput + done * channels;
+		for (int c = 0; c < channels; c++)
+		{
+			float* pDst = &input[c * inputSize + inputFill];
+			for (size_t i = 0; i < count; i++) { pDst[i] = pSrc[i * channels + c]; }
+		}
+		inputFill += count;
+		done += count;
+
+		size_t before = inputFill;
+		Run();
+		if (inputFill == before && inputFill == inputSize) { break; }
+	}
+
+	return done;
+}
+
+/*******************************************
+* Run():
+* Analyse all frames which have input
+* and place in synthesis buffer
+*******************************************/
+void AuEngine::TimeStretch::Run()
+{
+	while (!skip && inputFill >= (size_t)frameSize && synthFill + hop <= synthSize)
+	{
+		AnalyseFrame();
+
+		// around transient input goes 1:1, lost stretch is returned later
+		double ideal = hop / (time * pitch);
+		double advance = ideal + hopPos;
+		if (transientLeft)
+		{
+			transientLeft--;
+			hopDebt += ideal - hop;
+			advance = hop + hopPos;
+		}
+		else if (hopDebt != 0.0)
+		{
+			double part = std::max(std::min(hopDebt * 0.25, ideal), -0.5 * ideal);
+			if (fabs(hopDebt) < 1.0) { part = hopDebt; }
+			hopDebt -= part;
+			advance += part;
+		}
+
+		int step = std::max((int)advance, 1);
+		hopPos = advance - step;
+		lastHop = step;
+
+		if ((size_t)step <= inputFill)
+		{
+			for (int c = 0; c < channels; c++)
+			{
+				float* pInput = &input[c * inputSize];
+				memmove(pInput, pInput + step, (inputFill - step) * sizeof(float));
+			}
+			inputFill -= step;
+		}
+		else
+		{
+			skip = step - inputFill;
+			inputFill = 0;
+		}
+	}
+}
+
+/*******************************************
+* AnalyseFrame():
+* One frame of phase vocoder
+*******************************************/
+void AuEngine::TimeStretch::AnalyseFrame()
+{
+	std::fill(midRe.begin(), midRe.end(), 0.0f);
+	std::fill(midIm.begin(), midIm.end(), 0.0f);
+
+	for (int c = 0; c < channels; c++)
+	{
+		const float* pInput = &input[c * inputSize];
+		for (int i = 0; i < frameSize; i++) { frame[i] = pInput[i] * window[i]; }
+
+		float* pRe = &re[c * bins];
+		float* pIm = &im[c * bins];
+		plan->ForwardReal(frame.data(), pRe, pIm);
+		for (int k = 0; k < bins; k++)
+		{
+			midRe[k] += pRe[k];
+			midIm[k] += pIm[k];
+		}
+	}
+
+	// high frequency content rises fast at attack
+	float energy = 0.0f;
+	float maxMagnitude = 0.0f;
+	for (int k = 0; k < bins; k++)
+	{
+		magnitude[k] = sqrtf(midRe[k] * midRe[k] + midIm[k] * midIm[k]);
+		phase[k] = atan2f(midIm[k], midRe[k]);
+		energy += k * magnitude[k] * magnitude[k];
+		maxMagnitude = std::max(maxMagnitude, magnitude[k]);
+	}
+
+	bool isTransient = !isFirst && !wasTransient && energy > STRETCH_TRANSIENT * lastEnergy && energy > 1e-6f * bins;
+	lastEnergy = energy;
+
+	if (isFirst || isTransient)
+	{
+		std::copy(phase.begin(), phase.end(), synthPhase.begin());
+		if (isTransient) { transientLeft = STRETCH_OVERLAP; }
+	}
+	else
+	{
+		int peaksCount = 0;
+		float floorMagnitude = maxMagnitude * 1e-5f;
+		for (int k = 1; k < bins - 1; k++)
+		{
+			if (magnitude[k] > floorMagnitude && magnitude[k] > magnitude[k - 1] && magnitude[k] >= magnitude[k + 1])
+			{
+				peaks[peaksCount++] = k;
+			}
+		}
+
+		if (!peaksCount)
+		{
+			// noise or silence: every bin is its own peak
+			for (int k = 0; k < bins; k++) { peaks[k] = k; }
+			peaksCount = bins;
+		}
+
+		double binPhase = TWO_PI / frameSize;
+		int regionStart = 0;
+		for (int p = 0; p < peaksCount; p++)
+		{
+			int k = peaks[p];
+			double omega = binPhase * k;
+			double delta = PrincipalArgument(phase[k] - lastPhase[k] - omega * lastHop);
+			double frequency = omega + delta / lastHop;
+			float peakPhase = (float)PrincipalArgument(synthPhase[k] + frequency * hop);
+
+			// region of peak ends at minimum before next peak
+			int regionEnd = bins;
+			if (p + 1 < peaksCount)
+			{
+				regionEnd = k + 1;
+				for (int j = k + 1; j < peaks[p + 1]; j++)
+				{
+					if (magnitude[j] < magnitude[regionEnd]) { regionEnd = j; }
+				}
+				regionEnd = std::max(regionEnd, k + 1);
+			}
+
+			for (int j = regionStart; j < regionEnd; j++)
+			{
+				synthPhase[j] = j == k ? peakPhase : (float)PrincipalArgument(peakPhase + phase[j] - phase[k]);
+			}
+			regionStart = regionEnd;
+		}
+	}
+
+	std::copy(phase.begin(), phase.end(), lastPhase.begin());
+	wasTransient = isTransient;
+	isFirst = false;
+
+	// the same rotation for every channel, bins over new Nyquist are removed
+	int maxBin = pitch > 1.0 ? (int)((bins - 1) / pitch) : bins;
+	for (int k = 0; k < bins; k++)
+	{
+		float rotation = synthPhase[k] - phase[k];
+		float cr = k < maxBin ? cosf(rotation) : 0.0f;
+		float sr = k < maxBin ? sinf(rotation) : 0.0f;
+
+		for (int c = 0; c < channels; c++)
+		{
+			float xr = re[c * bins + k];
+			float xi = im[c * bins + k];
+			re[c * bins + k] = xr * cr - xi * sr;
+			im[c * bins + k] = xr * sr + xi * cr;
+		}
+	}
+
+	const float norm = 1.0f / 1.5f;
+	for (int c = 0; c < channels; c++)
+	{
+		plan->InverseReal(&re[c * bins], &im[c * bins], frame.data());
+
+		float* pOla = &ola[c * frameSize];
+		for (int i = 0; i < frameSize; i++) { pOla[i] += frame[i] * window[i] * norm; }
+
+		memcpy(&synth[c * synthSize + synthFill], pOla, hop * sizeof(float));
+		memmove(pOla, pOla + hop, (frameSize - hop) * sizeof(float));
+		memset(pOla + frameSize - hop, 0, hop * sizeof(float));
+	}
+	synthFill += hop;
+}
+
+/*******************************************
+* GetAvailable():
+* Output frames which can be read now
+*******************************************/
+size_t AuEngine::TimeStretch::GetAvailable() const
+{
+	double span = (double)synthFill - 3.0 - readPos;
+	if (span < 0.0) { return 0; }
+	return (size_t)(span / pitch) + 1;
+}
+
+/*******************************************
+* Resample():
+* Cubic (Catmull-Rom) at pitch speed,
+* copy without shift
+*******************************************/
+void AuEngine::TimeStretch::Resample(float* pOutput, size_t frames)
+{
+	for (int c = 0; c < channels; c++)
+	{
+		const float* pSynth = &synth[c * synthSize];
+		double pos = readPos;
+
+		if (pitch == 1.0)
+		{
+			size_t start = (size_t)pos;
+			for (size_t i = 0; i < frames; i++) { pOutput[i * channels + c] = pSynth[start + i]; }
+			continue;
+		}
+
+		for (size_t i = 0; i < frames; i++, pos += pitch)
+		{
+			size_t index = (size_t)pos;
+			float t = (float)(pos - index);
+			float y0 = pSynth[index - 1], y1 = pSynth[index], y2 = pSynth[index + 1], y3 = pSynth[index + 2];
+
+			float a = 0.5f * (y3 - y0) + 1.5f * (y1 - y2);
+			float b = y0 - 2.5f * y1 + 2.0f * y2 - 0.5f * y3;
+			float d = 0.5f * (y2 - y0);
+			pOutput[i * channels + c] = ((a * t + b) * t + d) * t + y1;
+		}
+	}
+
+	readPos += frames * pitch;
+
+	// keep one sample before read position
+	size_t drop = (size_t)readPos - 1;
+	for (int c = 0; c < channels; c++)
+	{
+		float* pSynth = &synth[c * synthSize];
+		memmove(pSynth, pSynth + drop, (synthFill - drop) * sizeof(float));
+	}
+	synthFill -= drop;
+	readPos -= drop;
+}
+
+/*******************************************
+* Read():
+* Give interleaved output, returns frames
+*******************************************/
+size_t AuEngine::TimeStretch::Read(float* pOutput, size_t frames)
+{
+	size_t count = std::min(frames, GetAvailable());
+	if (!count) { return 0; }
+
+	Resample(pOutput, count);
+	Run();
+	return count;
+}
+
+/*******************************************
+* StretchFile():
+* Conform file to new length and pitch
+*******************************************/
+void AuEngine::StretchFile(const char* lpSource, const char* lpPath, const StretchConfig& config,
+	PaSampleFormat format, std::atomic<int>* pPercent)
+{
+	TrackReader reader;
+	reader.Open(lpSource);
+	if (!format) { format = reader.GetFormat(); }
+
+	int channels = reader.GetChannels();
+	size_t frameSize = channels * Pa_GetSampleSize(format);
+	unsigned long long frames = reader.GetFrames();
+
+	StretchConfig cfg = config;
+	cfg.sampleRate = reader.GetSampleRate();
+	TimeStretch stretch;
+	stretch.Create(cfg, channels);
+	unsigned long long total = (unsigned long long)(frames * stretch.GetTime() + 0.5);
+	size_t latency = stretch.GetLatency();
+
+	std::string partPath = std::string(lpPath) + ".part";
+	std::vector<float> block(STRETCH_EXPORT_FRAMES * channels);
+	std::vector<float> output(STRETCH_EXPORT_FRAMES * channels);
+	std::vector<uint8_t> converted(STRETCH_EXPORT_FRAMES * frameSize);
+	WavStreamWriter writer;
+	writer.Open(partPath.c_str(), channels, reader.GetSampleRate(), format, (long long)(total * frameSize));
+
+	unsigned long long written = 0;
+	auto drain = [&]()
+	{
+		size_t got = 0;
+		while (written < total && (got = stretch.Read(output.data(), STRETCH_EXPORT_FRAMES)) > 0)
+		{
+			size_t dropped = std::min(latency, got);
+			latency -= dropped;
+			size_t count = (size_t)std::min((unsigned long long)(got - dropped), total - written);
+			if (!count) { continue; }
+
+			ConvertFromFloat(output.data() + dropped * channels, converted.data(), count * channels, format);
+			writer.WriteBlocking(converted.data(), count * frameSize);
+			written += count;
+		}
+	};
+
+	try
+	{
+		size_t read = 0;
+		while (written < total && (read = reader.Read(block.data(), STRETCH_EXPORT_FRAMES, channels)) > 0)
+		{
+			for (size_t pos = 0; pos < read; )
+			{
+				pos += stretch.Write(block.data() + pos * channels, read - pos);
+				drain();
+			}
+			if (pPercent && total) { *pPercent = (int)(written * 100 / total); }
+		}
+
+		// flush vocoder by silence
+		std::fill(block.begin(), block.end(), 0.0f);
+		while (written < total)
+		{
+			stretch.Write(block.data(), STRETCH_EXPORT_FRAMES);
+			drain();
+		}
+	}
+	catch (AuEngine::Exception&)
+	{
+		writer.Close();
+		DeleteFileA(partPath.c_str());
+		throw;
+	}
+
+	writer.Close();
+	reader.Close();
+	if (writer.IsFailed() || !MoveFileExA(partPath.c_str(), lpPath, MOVEFILE_REPLACE_EXISTING))
+	{
+		DeleteFileA(partPath.c_str());
+		THROW_EXCEPTION(AuEngine::OpSet::FILESYSYEM_ERROR);
+	}
+	if (pPercent) { *pPercent = 100; }
+}
@@ -0,0 +1,132 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineStretch.h:
+// header for time-stretch and pitch-shift
+/////////////////////////////////
+#pragma once
+#include "AuEngine.h"
+#include "AuEngineFFT.h"
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#define STRETCH_MAX_CHANNELS	8
+#define STRETCH_MIN_TIME		0.25			// time ratio, output length / input length
+#define STRETCH_MAX_TIME		4.0
+#define STRETCH_MAX_SEMITONES	12.0
+#define STRETCH_OVERLAP			4				// synthesis hop is frame / 4
+#define STRETCH_WRITE_FRAMES	4096			// input frames for one Write() at least
+#define STRETCH_TRANSIENT		4.0f			// rise of high frequency energy for phase reset
+#define STRETCH_EXPORT_FRAMES	8192
+
+/***********************************************
+* struct StretchConfig:
+* frameSize - FFT, power of two
+* time      - output length / input length
+* semitones - pitch shift
+***********************************
+* class TimeStretch:
+* Phase vocoder with identity phase
+* locking (Laroche-Dolson). Phase is
+* computed for sum of channels and the
+* same rotation is applied to every
+* channel, so stereo image doesn't float.
+* At transient (fast rise of high
+* frequency energy) phases are reset to
+* analysis and next frames go without
+* stretch (it's taken back later), so
+* attacks are not smeared.
+* Pitch is stretch by time * pitch and
+* resampling by pitch (cubic), bins above
+* new Nyquist are removed before it.
+* Streaming: Write() takes input, Read()
+* gives output, GetAvailable() is output
+* which can be read now. Nothing is
+* allocated after Create(), so it works
+* at audio thread. SetTime() and
+* SetPitch() are for the same thread,
+* new values are taken at next frame
+***********************************
+* StretchFile():
+* Offline conforming of file, output is
+* aligned and has length input * time
+***********************************************/
+namespace AuEngine
+{
+	struct StretchConfig
+	{
+		double sampleRate = 48000.0;
+		int frameSize = 2048;
+		double time = 1.0;
+		double semitones = 0.0;
+	};
+
+	class TimeStretch
+	{
+	public:
+		TimeStretch() {}
+		DLL_API void Create(const StretchConfig& config, int iChannels);
+		DLL_API void Destroy();
+		DLL_API void Reset();
+		DLL_API void SetTime(double dTime);
+		DLL_API void SetPitch(double dSemitones);
+
+		DLL_API size_t Write(const float* pInput, size_t frames);
+		DLL_API size_t Read(float* pOutput, size_t frames);
+		DLL_API size_t GetAvailable() const;
+		size_t GetWriteSpace() const { return inputSize - inputFill; }
+
+		int    GetChannels() const { return channels; }
+		double GetTime() const { return time; }
+		double GetPitch() const { return pitch; }
+		int    GetLatency() const { return (int)(frameSize / (2.0 * pitch) + 0.5); }
+
+	private:
+		void Run();
+		void AnalyseFrame();
+		void Resample(float* pOutput, size_t frames);
+
+		std::shared_ptr<const FFTPlan> plan;
+		int frameSize = 0;
+		int bins = 0;
+		int hop = 0;							// synthesis
+		int channels = 0;
+		double time = 1.0;
+		double pitch = 1.0;
+		double hopPos = 0.0;					// fractional part of analysis hop
+		double hopDebt = 0.0;					// input not skipped at transients
+		int transientLeft = 0;					// frames without stretch
+		size_t skip = 0;						// input to drop (hop longer than input)
+
+		std::vector<float> window;
+		std::vector<float> input;				// channel, inputSize
+		size_t inputSize = 0;
+		size_t inputFill = 0;
+		std::vector<float> ola;					// channel, frameSize
+		std::vector<float> synth;				// channel, synthSize (before resampling)
+		size_t synthSize = 0;
+		size_t synthFill = 0;
+		double readPos = 0.0;					// at synth, sample 0 is history for cubic
+
+		std::vector<float> re;					// channel, bins
+		std::vector<float> im;
+		std::vector<float> midRe;
+		std::vector<float> midIm;
+		std::vector<float> magnitude;
+		std::vector<float> phase;				// of sum, this frame
+		std::vector<float> lastPhase;			// of sum, previous frame
+		std::vector<float> synthPhase;
+		std::vector<float> frame;
+		std::vector<int> peaks;
+		float lastEnergy = 0.0f;
+		int lastHop = 0;
+		bool isFirst = true;
+		bool wasTransient = false;
+	};
+
+	DLL_API void StretchFile(const char* lpSource, const char* lpPath, const StretchConfig& config,
+		PaSampleFormat format = 0, std::atomic<int>* pPercent = NULL);
+};
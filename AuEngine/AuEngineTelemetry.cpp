@@ -0,0 +1,200 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineTelemetry.cpp:
+// engine to UI telemetry
+/////////////////////////////////
+
+/*******************************************
+* Telemetry:
+* UI used to ask engine for every value
+* (device, CPU load, levels), and some of
+* getters read the stream themselves. Now
+* audio thread makes one snapshot of all
+* of it TELEMETRY_RATE times per second,
+* and UI timer takes the last one.
+*
+* Triple buffer: three snapshots, writer
+* owns back, reader owns front, third one
+* is latest. Index of latest is atomic,
+* with TELEMETRY_DIRTY flag while reader
+* hasn't taken it. Every swap is one
+* exchange, so there are no locks and no
+* retries: writer is never blocked by
+* reader which copies snapshot, and
+* reader never sees half of snapshot.
+*
+* Spectrum is made only when snapshot is
+* published (one FFT per 1/30 s), so
+* cost of callback is the same as meter.
+*******************************************/
+
+#include "AuEngineTelemetry.h"
+#include <math.h>
+
+#define TWO_PI					6.28318530718
+
+/*******************************************
+* ToDecibels():
+* Power to dB, silence is floor
+*******************************************/
+static float ToDecibels(double power)
+{
+	if (power <= 0.0) { return TELEMETRY_FLOOR_DB; }
+	float db = (float)(10.0 * log10(power));
+	return db > TELEMETRY_FLOOR_DB ? db : TELEMETRY_FLOOR_DB;
+}
+
+/*******************************************
+* Publish():
+* Make back buffer latest one. Writer
+* only (audio thread)
+*******************************************/
+void AuEngine::TelemetryChannel::Publish()
+{
+	buffers[back].sequence = ++sequence;
+	back = latest.exchange(back | TELEMETRY_DIRTY, std::memory_order_acq_rel) & 3;
+}
+
+/*******************************************
+* Read():
+* Copy latest snapshot, true if it's new
+* since last Read(). Reader only (UI)
+*******************************************/
+bool AuEngine::TelemetryChannel::Read(TelemetrySnapshot* pSnapshot)
+{
+	bool isNew = false;
+	if (latest.load(std::memory_order_relaxed) & TELEMETRY_DIRTY)
+	{
+		front = latest.exchange(front, std::memory_order_acq_rel) & 3;
+		isNew = true;
+	}
+	*pSnapshot = buffers[front];
+	return isNew;
+}
+
+/*******************************************
+* Prepare():
+* Allocate window and FFT, make bands for
+* sample rate. Not at audio thread
+*******************************************/
+void AuEngine::TelemetryMeter::Prepare(double dSampleRate, int iChannels)
+{
+	if (iChannels < 1 || iChannels > TELEMETRY_MAX_CHANNELS || dSampleRate <= 0.0)
+	{
+		THROW_EXCEPTION(AuEngine::OpSet::ENGINE_ERROR);
+	}
+
+	plan = GetFFTPlan(TELEMETRY_FFT_SIZE);
+	int bins = plan->GetBins();
+	history.assign(TELEMETRY_FFT_SIZE, 0.0f);
+	frame.resize(TELEMETRY_FFT_SIZE);
+	re.resize(bins);
+	im.resize(bins);
+
+	// periodic Hann, sine of full scale is 0 dB
+	window.resize(TELEMETRY_FFT_SIZE);
+	double sum = 0.0;
+	for (int i = 0; i < TELEMETRY_FFT_SIZE; i++)
+	{
+		window[i] = (float)(0.5 - 0.5 * cos(TWO_PI * i / TELEMETRY_FFT_SIZE));
+		sum += window[i];
+	}
+	scale = (float)(4.0 / (sum * sum));
+
+	// log bands, low ones are shorter than bin, so they take nearest bin
+	double nyquist = dSampleRate / 2.0;
+	double binWidth = dSampleRate / TELEMETRY_FFT_SIZE;
+	for (int b = 0; b < TELEMETRY_BANDS; b++)
+	{
+		double low = TELEMETRY_LOW_FREQ * pow(nyquist / TELEMETRY_LOW_FREQ, (double)b / TELEMETRY_BANDS);
+		double high = TELEMETRY_LOW_FREQ * pow(nyquist / TELEMETRY_LOW_FREQ, (double)(b + 1) / TELEMETRY_BANDS);
+		int start = (int)floor(low / binWidth + 0.5);
+		int end = (int)floor(high / binWidth + 0.5);
+		if (start > bins - 1) { start = bins - 1; }
+		if (end <= start) { end = start + 1; }
+		if (end > bins) { end = bins; }
+		bandStart[b] = start;
+		bandEnd[b] = end;
+		bandFrequency[b] = (float)low;
+	}
+
+	channels = iChannels;
+	historyPos = 0;
+	period = (unsigned long)(dSampleRate / TELEMETRY_RATE);
+	counted = 0;
+	for (int c = 0; c < TELEMETRY_MAX_CHANNELS; c++)
+	{
+		peak[c] = 0.0f;
+		sumSquares[c] = 0.0;
+	}
+}
+
+/*******************************************
+* Process():
+* Take interleaved output of callback,
+* true if snapshot must be filled
+*******************************************/
+bool AuEngine::TelemetryMeter::Process(const float* pData, unsigned long frames)
+{
+	if (!channels) { return false; }
+
+	float norm = 1.0f / channels;
+	for (unsigned long i = 0; i < frames; i++)
+	{
+		float mono = 0.0f;
+		for (int c = 0; c < channels; c++)
+		{
+			float sample = pData[i * channels + c];
+			float level = fabsf(sample);
+			if (level > peak[c]) { peak[c] = level; }
+			sumSquares[c] += (double)sample * sample;
+			mono += sample;
+		}
+		history[historyPos] = mono * norm;
+		historyPos = (historyPos + 1) & (TELEMETRY_FFT_SIZE - 1);
+	}
+
+	counted += frames;
+	return counted >= period;
+}
+
+/*******************************************
+* Fill():
+* Write levels and spectrum to snapshot
+* and start next period
+*******************************************/
+void AuEngine::TelemetryMeter::Fill(TelemetrySnapshot* pSnapshot)
+{
+	pSnapshot->channels = channels;
+	for (int c = 0; c < channels; c++)
+	{
+		pSnapshot->peak[c] = ToDecibels((double)peak[c] * peak[c]);
+		pSnapshot->rms[c] = ToDecibels(counted ? sumSquares[c] / counted : 0.0);
+		peak[c] = 0.0f;
+		sumSquares[c] = 0.0;
+	}
+	counted = 0;
+	if (!channels) { return; }
+
+	// oldest frame of ring is at historyPos
+	for (int i = 0; i < TELEMETRY_FFT_SIZE; i++)
+	{
+		frame[i] = history[(historyPos + i) & (TELEMETRY_FFT_SIZE - 1)] * window[i];
+	}
+	plan->ForwardReal(frame.data(), re.data(), im.data());
+
+	for (int b = 0; b < TELEMETRY_BANDS; b++)
+	{
+		float power = 0.0f;
+		for (int k = bandStart[b]; k < bandEnd[b]; k++)
+		{
+			float binPower = re[k] * re[k] + im[k] * im[k];
+			if (binPower > power) { power = binPower; }
+		}
+		pSnapshot->spectrum[b] = ToDecibels((double)power * scale);
+		pSnapshot->bandFrequency[b] = bandFrequency[b];
+	}
+}
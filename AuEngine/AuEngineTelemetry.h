@@ -0,0 +1,117 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineTelemetry.h:
+// header for engine to UI telemetry
+/////////////////////////////////
+#pragma once
+#include "AuEngine.h"
+#include "AuEngineFFT.h"
+#include "AuEngineRing.h"
+#include "AuEngineTiming.h"
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#define TELEMETRY_MAX_CHANNELS	8
+#define TELEMETRY_RATE			30				// snapshots per second
+#define TELEMETRY_FFT_SIZE		2048			// spectrum window, power of two
+#define TELEMETRY_BANDS			64				// log bands of spectrum frame
+#define TELEMETRY_LOW_FREQ		20.0			// first band (Hz)
+#define TELEMETRY_FLOOR_DB		-120.0f			// silence
+#define TELEMETRY_DIRTY			4				// flag of latest index: not read yet
+
+/***********************************************
+* struct TelemetrySnapshot:
+* State of engine for UI. Levels are
+* dBFS of audio since last snapshot,
+* spectrum is dB of log bands from
+* TELEMETRY_LOW_FREQ to Nyquist (sine of
+* full scale is 0 dB) made from last
+* TELEMETRY_FFT_SIZE frames of output.
+* position is frame of track, load is
+* callback time / buffer time since last
+* snapshot, timing has totals and xruns
+* of callback
+***********************************
+* class TelemetryChannel:
+* Triple buffer, one writer (audio
+* thread) and one reader (UI timer).
+* Writer fills back buffer and swaps it
+* with latest one, reader swaps its front
+* buffer with latest only if it's new.
+* Both sides never wait: writer always
+* has free buffer and reader always has
+* last complete snapshot, old snapshots
+* are dropped if UI is slow
+***********************************
+* class TelemetryMeter:
+* Collects levels and spectrum window at
+* audio thread. Process() returns true
+* once per 1/TELEMETRY_RATE s, then Fill()
+* writes snapshot (FFT is made only there).
+* Prepare() allocates, so it's called
+* while stream is stopped
+***********************************************/
+namespace AuEngine
+{
+	struct TelemetrySnapshot
+	{
+		unsigned long long sequence = 0;		// 0 - nothing is published yet
+		int channels = 0;
+		float peak[TELEMETRY_MAX_CHANNELS] = {};
+		float rms[TELEMETRY_MAX_CHANNELS] = {};
+		float spectrum[TELEMETRY_BANDS] = {};
+		float bandFrequency[TELEMETRY_BANDS] = {};	// low edge of band (Hz)
+		unsigned long long position = 0;
+		int sampleRate = 0;						// of track (for position)
+		bool isPaused = false;
+		double load = 0.0;						// of last period (0.0 - 1.0)
+		TimingSnapshot timing = {};
+	};
+
+	class TelemetryChannel
+	{
+	public:
+		TelemetryChannel() {}
+		TelemetrySnapshot* BeginWrite() { return &buffers[back]; }
+		DLL_API void Publish();
+		DLL_API bool Read(TelemetrySnapshot* pSnapshot);
+
+	private:
+		TelemetrySnapshot buffers[3];
+		alignas(RING_CACHE_LINE) std::atomic<int> latest{ 1 };
+		alignas(RING_CACHE_LINE) int back = 0;	// writer only
+		unsigned long long sequence = 0;
+		alignas(RING_CACHE_LINE) int front = 2;	// reader only
+	};
+
+	class TelemetryMeter
+	{
+	public:
+		TelemetryMeter() {}
+		DLL_API void Prepare(double dSampleRate, int iChannels);
+		DLL_API bool Process(const float* pData, unsigned long frames);
+		DLL_API void Fill(TelemetrySnapshot* pSnapshot);
+
+	private:
+		std::shared_ptr<const FFTPlan> plan;
+		std::vector<float> history;				// mono, ring of TELEMETRY_FFT_SIZE
+		std::vector<float> window;
+		std::vector<float> re;
+		std::vector<float> im;
+		std::vector<float> frame;
+		int bandStart[TELEMETRY_BANDS] = {};	// bins of band
+		int bandEnd[TELEMETRY_BANDS] = {};
+		float bandFrequency[TELEMETRY_BANDS] = {};
+		float scale = 1.0f;						// bin power to dB of sine
+		int channels = 0;
+		int historyPos = 0;
+		unsigned long period = 0;
+		unsigned long counted = 0;
+		float peak[TELEMETRY_MAX_CHANNELS] = {};
+		double sumSquares[TELEMETRY_MAX_CHANNELS] = {};
+	};
+};
@@ -0,0 +1,157 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineTiming.cpp:
+// callback timing
+/////////////////////////////////
+
+/*******************************************
+* Callback timing:
+* Average CPU load can't show us glitches,
+* because one long callback in a minute is
+* enough for click. So we keep time of
+* every callback at histogram and take
+* percentiles and max from it.
+*
+* Buckets: 0-31 ns are linear, after that
+* every octave has 16 buckets, so bucket
+* width is 1/16 of value.
+*******************************************/
+
+#include "AuEngineTiming.h"
+
+/*******************************************
+* TimingHistogram():
+* Constructor
+*******************************************/
+AuEngine::TimingHistogram::TimingHistogram()
+{
+	LARGE_INTEGER freq;
+	QueryPerformanceFrequency(&freq);
+	nsPerTick = 1000000000.0 / (double)freq.QuadPart;
+	Reset();
+}
+
+/*******************************************
+* BucketIndex():
+* Get bucket for time in nanoseconds
+*******************************************/
+int AuEngine::TimingHistogram::BucketIndex(unsigned long long ns)
+{
+	if (ns < TIMING_LINEAR_BUCKETS) { return (int)ns; }
+
+	int msb = 63;
+	while (!(ns >> msb)) { msb--; }
+
+	// 4 bits after most significant bit
+	int sub = (int)((ns >> (msb - 4)) & (TIMING_SUB_BUCKETS - 1));
+	int idx = TIMING_LINEAR_BUCKETS + (msb - 5) * TIMING_SUB_BUCKETS + sub;
+	return idx < TIMING_BUCKETS ? idx : TIMING_BUCKETS - 1;
+}
+
+/*******************************************
+* BucketValue():
+* Get middle of bucket in nanoseconds
+*******************************************/
+double AuEngine::TimingHistogram::BucketValue(int idx)
+{
+	if (idx < TIMING_LINEAR_BUCKETS) { return (double)idx; }
+
+	int msb = (idx - TIMING_LINEAR_BUCKETS) / TIMING_SUB_BUCKETS + 5;
+	int sub = (idx - TIMING_LINEAR_BUCKETS) % TIMING_SUB_BUCKETS;
+	double width = (double)(1ULL << (msb - 4));
+	return (TIMING_SUB_BUCKETS + sub) * width + width / 2;
+}
+
+/*******************************************
+* Record():
+* Add callback time. Audio thread only
+*******************************************/
+void AuEngine::TimingHistogram::Record(long long ticks, double dBufferTime, PaStreamCallbackFlags statusFlags)
+{
+	unsigned long long ns = (unsigned long long)(ticks * nsPerTick);
+	unsigned long long bufferNs = (unsigned long long)(dBufferTime * 1000000000.0);
+
+	buckets[BucketIndex(ns)].fetch_add(1, std::memory_order_relaxed);
+	totalNs.fetch_add(ns, std::memory_order_relaxed);
+	totalBufferNs.fetch_add(bufferNs, std::memory_order_relaxed);
+	if (ns > maxNs.load(std::memory_order_relaxed)) { maxNs.store(ns, std::memory_order_relaxed); }
+
+	if (bufferNs && ns > bufferNs) { deadlineMisses.fetch_add(1, std::memory_order_relaxed); }
+	if (statusFlags & (paOutputUnderflow | paInputUnderflow)) { underflows.fetch_add(1, std::memory_order_relaxed); }
+	if (statusFlags & (paOutputOverflow | paInputOverflow)) { overflows.fetch_add(1, std::memory_order_relaxed); }
+
+	// count is the last, so snapshot never sees more callbacks than buckets
+	callbacks.fetch_add(1, std::memory_order_release);
+}
+
+/*******************************************
+* Percentile():
+* Find bucket for fraction of callbacks
+*******************************************/
+double AuEngine::TimingHistogram::Percentile(const unsigned long long* pBuckets, unsigned long long total, double fraction)
+{
+	if (!total) { return 0.0; }
+
+	unsigned long long target = (unsigned long long)(fraction * total);
+	unsigned long long sum = 0;
+	for (int i = 0; i < TIMING_BUCKETS; i++)
+	{
+		sum += pBuckets[i];
+		if (sum > target) { return BucketValue(i) / 1000.0; }
+	}
+	return BucketValue(TIMING_BUCKETS - 1) / 1000.0;
+}
+
+/*******************************************
+* GetSnapshot():
+* Copy current statistics. Any thread
+*******************************************/
+void AuEngine::TimingHistogram::GetSnapshot(TimingSnapshot* pSnapshot)
+{
+	unsigned long long local[TIMING_BUCKETS];
+	unsigned long long total = 0;
+
+	pSnapshot->callbacks = callbacks.load(std::memory_order_acquire);
+	for (int i = 0; i < TIMING_BUCKETS; i++)
+	{
+		local[i] = buckets[i].load(std::memory_order_relaxed);
+		total += local[i];
+	}
+
+	pSnapshot->deadlineMisses = deadlineMisses.load(std::memory_order_relaxed);
+	pSnapshot->underflows = underflows.load(std::memory_order_relaxed);
+	pSnapshot->overflows = overflows.load(std::memory_order_relaxed);
+	pSnapshot->p50 = Percentile(local, total, 0.5);
+	pSnapshot->p99 = Percentile(local, total, 0.99);
+	pSnapshot->p999 = Percentile(local, total, 0.999);
+	pSnapshot->max = maxNs.load(std::memory_order_relaxed) / 1000.0;
+
+	unsigned long long ns = totalNs.load(std::memory_order_relaxed);
+	unsigned long long bufferNs = totalBufferNs.load(std::memory_order_relaxed);
+	pSnapshot->mean = total ? ns / 1000.0 / total : 0.0;
+	pSnapshot->load = bufferNs ? (double)ns / bufferNs : 0.0;
+	pSnapshot->busyTime = ns / 1000000000.0;
+	pSnapshot->bufferTime = bufferNs / 1000000000.0;
+}
+
+/*******************************************
+* Reset():
+* Clear all statistics
+*******************************************/
+void AuEngine::TimingHistogram::Reset()
+{
+	for (int i = 0; i < TIMING_BUCKETS; i++)
+	{
+		buckets[i].store(0, std::memory_order_relaxed);
+	}
+	callbacks = 0;
+	deadlineMisses = 0;
+	underflows = 0;
+	overflows = 0;
+	maxNs = 0;
+	totalNs = 0;
+	totalBufferNs = 0;
+}
@@ -0,0 +1,96 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineTiming.h:
+// header for callback timing
+/////////////////////////////////
+#pragma once
+#include "AuEngine.h"
+#include <atomic>
+
+#define TIMING_LINEAR_BUCKETS	32			// 0-31 ns, 1 ns per bucket
+#define TIMING_SUB_BUCKETS		16			// buckets per octave after linear part
+#define TIMING_BUCKETS			(TIMING_LINEAR_BUCKETS + 40 * TIMING_SUB_BUCKETS)
+
+/***********************************************
+* struct TimingSnapshot:
+* Copy of callback statistics for UI/CLI.
+* All times are in microseconds
+***********************************
+* class TimingHistogram:
+* Lock-free log-linear histogram of
+* callback time. Audio thread writes,
+* any thread can take snapshot. Error
+* of percentiles is less than 1/16
+*
+* class CallbackTimer:
+* Scope timer for stream callback
+***********************************************/
+namespace AuEngine
+{
+	struct TimingSnapshot
+	{
+		unsigned long long callbacks;
+		unsigned long long deadlineMisses;		// callback was longer than buffer period
+		unsigned long long underflows;			// paOutputUnderflow/paInputUnderflow
+		unsigned long long overflows;			// paOutputOverflow/paInputOverflow
+		double p50;
+		double p99;
+		double p999;
+		double max;
+		double mean;
+		double load;							// callback time / buffer time (0.0 - 1.0)
+		double busyTime;						// all callback time (s)
+		double bufferTime;						// all buffer time (s)
+	};
+
+	class TimingHistogram
+	{
+	public:
+		DLL_API TimingHistogram();
+		DLL_API void Record(long long ticks, double dBufferTime, PaStreamCallbackFlags statusFlags);
+		DLL_API void GetSnapshot(TimingSnapshot* pSnapshot);
+		DLL_API void Reset();
+		unsigned long long GetCallbacks() const { return callbacks.load(std::memory_order_acquire); }
+
+	private:
+		static int BucketIndex(unsigned long long ns);
+		static double BucketValue(int idx);
+		double Percentile(const unsigned long long* pBuckets, unsigned long long total, double fraction);
+
+		std::atomic<unsigned long long> buckets[TIMING_BUCKETS];
+		std::atomic<unsigned long long> callbacks{ 0 };
+		std::atomic<unsigned long long> deadlineMisses{ 0 };
+		std::atomic<unsigned long long> underflows{ 0 };
+		std::atomic<unsigned long long> overflows{ 0 };
+		std::atomic<unsigned long long> maxNs{ 0 };
+		std::atomic<unsigned long long> totalNs{ 0 };
+		std::atomic<unsigned long long> totalBufferNs{ 0 };
+		double nsPerTick;
+	};
+
+	class CallbackTimer
+	{
+	public:
+		CallbackTimer(TimingHistogram& hist, unsigned long frames, double dSampleRate, PaStreamCallbackFlags flags)
+			: histogram(hist), statusFlags(flags)
+		{
+			bufferTime = dSampleRate > 0 ? frames / dSampleRate : 0.0;
+			QueryPerformanceCounter(&start);
+		}
+		~CallbackTimer()
+		{
+			LARGE_INTEGER end;
+			QueryPerformanceCounter(&end);
+			histogram.Record(end.QuadPart - start.QuadPart, bufferTime, statusFlags);
+		}
+
+	private:
+		TimingHistogram& histogram;
+		PaStreamCallbackFlags statusFlags;
+		double bufferTime;
+		LARGE_INTEGER start;
+	};
+};
@@ -0,0 +1,245 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineTrack.cpp:
+// track reader
+/////////////////////////////////
+
+/*******************************************
+* Track reader:
+* All chunks of file are scanned once at
+* Open() and kept at index. RF64 files
+* take sizes from ds64 chunk. Read()
+* converts any PCM/IEEE format to float
+* by sample pipeline of file (no switch
+* per sample) and maps channels: mono is
+* copied to all outputs, extra channels
+* are cut, missing channels are silent.
+*
+* File is opened with delete sharing, so
+* export can replace file which is still
+* played (MoveFileEx() over it).
+*******************************************/
+
+#include "AuEngineTrack.h"
+#include "AuEnginePipeline.h"
+#include <fcntl.h>
+#include <io.h>
+
+static uint32_t GetU32(const uint8_t* p) { uint32_t v; memcpy(&v, p, 4); return v; }	// WAV is LE anyway
+static uint64_t GetU64(const uint8_t* p) { uint64_t v; memcpy(&v, p, 8); return v; }
+
+/*******************************************
+* Open():
+* Open file and build chunk index
+*******************************************/
+void AuEngine::TrackReader::Open(const char* lpPath)
+{
+	Close();
+
+	HANDLE hFile = CreateFileA(lpPath, GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, NULL,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	int fd = hFile != INVALID_HANDLE_VALUE ? _open_osfhandle((intptr_t)hFile, _O_RDONLY | _O_BINARY) : -1;
+	if (fd < 0 && hFile != INVALID_HANDLE_VALUE) { CloseHandle(hFile); }
+	pFile = fd >= 0 ? _fdopen(fd, "rb") : NULL;
+	if (fd >= 0 && !pFile) { _close(fd); }
+	if (!pFile)
+	{
+		Msg("FILE Error: can't open file");
+		THROW_EXCEPTION(AuEngine::OpSet::FILESYSYEM_ERROR);
+	}
+
+	try
+	{
+		ReadChunkIndex();
+	}
+	catch (...)
+	{
+		Close();
+		throw;
+	}
+
+	raw.resize(TRACK_READ_FRAMES * frameSize);
+	decoded.resize(TRACK_READ_FRAMES * channels);
+	pPipeline = AuEngine::GetPipeline(format, channels);
+	position = 0;
+	Seek(0);
+}
+
+/*******************************************
+* ReadChunkIndex():
+* Scan RIFF/RF64 chunks
+*******************************************/
+void AuEngine::TrackReader::ReadChunkIndex()
+{
+	uint8_t header[12];
+	if (fread(header, 1, 12, pFile) != 12 || memcmp(header + 8, "WAVE", 4))
+	{
+		THROW_EXCEPTION(AuEngine::OpSet::FILESYSYEM_ERROR);
+	}
+	bool isRF64 = !memcmp(header, "RF64", 4);
+	if (!isRF64 && memcmp(header, "RIFF", 4)) { THROW_EXCEPTION(AuEngine::OpSet::FILESYSYEM_ERROR); }
+
+	unsigned long long rf64DataSize = 0;
+	long long offset = 12;
+	chunks.clear();
+	while (chunks.size() < TRACK_MAX_CHUNKS)
+	{
+		uint8_t chunkHeader[8];
+		if (_fseeki64(pFile, offset, SEEK_SET) || fread(chunkHeader, 1, 8, pFile) != 8) { break; }
+
+		TrackChunk chunk;
+		memcpy(chunk.tag, chunkHeader, 4);
+		chunk.offset = offset + 8;
+		chunk.size = GetU32(chunkHeader + 4);
+
+		if (isRF64 && !memcmp(chunk.tag, "ds64", 4))
+		{
+			uint8_t ds64[16];
+			if (fread(ds64, 1, 16, pFile) == 16) { rf64DataSize = GetU64(ds64 + 8); }
+		}
+		if (!memcmp(chunk.tag, "data", 4) && chunk.size == 0xFFFFFFFF && isRF64) { chunk.size = rf64DataSize; }
+
+		chunks.push_back(chunk);
+		offset = chunk.offset + chunk.size + (chunk.size & 1);
+	}
+
+	const TrackChunk* pFmt = NULL;
+	const TrackChunk* pData = NULL;
+	for (size_t i = 0; i < chunks.size(); i++)
+	{
+		if (!memcmp(chunks[i].tag, "fmt ", 4)) { pFmt = &chunks[i]; }
+		if (!memcmp(chunks[i].tag, "data", 4)) { pData = &chunks[i]; }
+	}
+	if (!pFmt || !pData)
+	{
+		Msg("FILE Error: no fmt or data chunk");
+		THROW_EXCEPTION(AuEngine::OpSet::FILESYSYEM_ERROR);
+	}
+
+	ReadFormat(*pFmt);
+	dataOffset = pData->offset;
+	frames = pData->size / frameSize;
+}
+
+/*******************************************
+* ReadFormat():
+* Parse fmt chunk
+*******************************************/
+void AuEngine::TrackReader::ReadFormat(const TrackChunk& chunk)
+{
+	uint8_t fmt[16];
+	if (chunk.size < 16 || _fseeki64(pFile, chunk.offset, SEEK_SET) || fread(fmt, 1, 16, pFile) != 16)
+	{
+		THROW_EXCEPTION(AuEngine::OpSet::FILESYSYEM_ERROR);
+	}
+
+	uint16_t fmtTag, numChannels, bits;
+	memcpy(&fmtTag, fmt, 2);
+	memcpy(&numChannels, fmt + 2, 2);
+	memcpy(&bits, fmt + 14, 2);
+	sampleRate = (int)GetU32(fmt + 4);
+
+	// WAVE_FORMAT_EXTENSIBLE has real tag at sub format
+	if (fmtTag == 0xFFFE && chunk.size >= 40)
+	{
+		uint8_t ext[10];
+		if (fread(ext, 1, 10, pFile) == 10) { memcpy(&fmtTag, ext + 8, 2); }
+	}
+
+	if (fmtTag == 1)
+	{
+		switch (bits)
+		{
+		case 8:  format = paUInt8; break;		// 8-bit WAV is unsigned
+		case 16: format = paInt16; break;
+		case 24: format = paInt24; break;
+		case 32: format = paInt32; break;
+		default: THROW_EXCEPTION(AuEngine::OpSet::FILESYSYEM_ERROR);
+		}
+	}
+	else if (fmtTag == 3 && bits == 32)
+	{
+		format = paFloat32;
+	}
+	else
+	{
+		Msg("FILE Error: unsupported format");
+		THROW_EXCEPTION(AuEngine::OpSet::FILESYSYEM_ERROR);
+	}
+
+	channels = numChannels;
+	bytesPerSample = bits / 8;
+	frameSize = channels * bytesPerSample;
+	if (channels <= 0 || sampleRate <= 0) { THROW_EXCEPTION(AuEngine::OpSet::FILESYSYEM_ERROR); }
+}
+
+/*******************************************
+* Close():
+* Close file
+*******************************************/
+void AuEngine::TrackReader::Close()
+{
+	if (pFile) { fclose(pFile); }
+	pFile = NULL;
+	frames = 0;
+	position = 0;
+}
+
+/*******************************************
+* Seek():
+* Go to frame (by chunk index)
+*******************************************/
+void AuEngine::TrackReader::Seek(unsigned long long frame)
+{
+	if (frame > frames) { frame = frames; }
+	if (_fseeki64(pFile, dataOffset + (long long)(frame * frameSize), SEEK_SET))
+	{
+		THROW_EXCEPTION(AuEngine::OpSet::FILESYSYEM_ERROR);
+	}
+	position = frame;
+}
+
+/*******************************************
+* Read():
+* Read and convert frames to float
+*******************************************/
+size_t AuEngine::TrackReader::Read(float* pOut, size_t count, int outChannels)
+{
+	size_t done = 0;
+	while (done < count && position < frames)
+	{
+		size_t part = count - done;
+		if (part > TRACK_READ_FRAMES) { part = TRACK_READ_FRAMES; }
+		if (part > frames - position) { part = (size_t)(frames - position); }
+
+		part = fread(raw.data(), frameSize, part, pFile);
+		if (!part) { break; }
+
+		// same layout: pipeline writes to output directly
+		float* pDst = pOut + done * outChannels;
+		if (outChannels == channels)
+		{
+			pPipeline->decode(raw.data(), pDst, part, channels, 1.0f, NULL);
+		}
+		else
+		{
+			pPipeline->decode(raw.data(), decoded.data(), part, channels, 1.0f, NULL);
+			for (size_t i = 0; i < part; i++)
+			{
+				const float* pFrame = &decoded[i * channels];
+				for (int c = 0; c < outChannels; c++)
+				{
+					int source = channels == 1 ? 0 : c;
+					pDst[i * outChannels + c] = source < channels ? pFrame[source] : 0.0f;
+				}
+			}
+		}
+
+		done += part;
+		position += part;
+	}
+	return done;
+}
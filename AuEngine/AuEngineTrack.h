@@ -0,0 +1,74 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineTrack.h:
+// header for track reader
+/////////////////////////////////
+#pragma once
+#include "AuEngine.h"
+#include <vector>
+
+#define TRACK_READ_FRAMES		4096			// frames for one fread()
+#define TRACK_MAX_CHUNKS		32
+
+/***********************************************
+* struct TrackChunk:
+* Position of RIFF chunk at file
+***********************************
+* class TrackReader:
+* Reads WAV/RF64 file (not global, unlike
+* Input::ReadAudioFile) and gives float
+* frames with needy count of channels.
+* Chunk index is built at Open(), so
+* Seek() is only one fseek()
+***********************************************/
+namespace AuEngine
+{
+	struct PipelineFuncs;
+
+	struct TrackChunk
+	{
+		char tag[4];
+		long long offset;				// offset of chunk data
+		unsigned long long size;
+	};
+
+	class TrackReader
+	{
+	public:
+		TrackReader() {}
+		~TrackReader() { Close(); }
+		DLL_API void Open(const char* lpPath);
+		DLL_API void Close();
+		DLL_API size_t Read(float* pOut, size_t frames, int outChannels);
+		DLL_API void Seek(unsigned long long frame);
+
+		bool IsOpen() const { return pFile != NULL; }
+		unsigned long long GetFrames() const { return frames; }
+		unsigned long long GetPosition() const { return position; }
+		int GetChannels() const { return channels; }
+		int GetSampleRate() const { return sampleRate; }
+		PaSampleFormat GetFormat() const { return format; }
+		const std::vector<TrackChunk>& GetChunks() const { return chunks; }
+
+	private:
+		void ReadChunkIndex();
+		void ReadFormat(const TrackChunk& chunk);
+
+		FILE* pFile = NULL;
+		std::vector<TrackChunk> chunks;
+		std::vector<uint8_t> raw;				// file data before conversion
+		std::vector<float> decoded;				// raw as float, if channels are mapped
+		const PipelineFuncs* pPipeline = NULL;	// conversion for format and channels of file
+		long long dataOffset = 0;
+		unsigned long long frames = 0;
+		unsigned long long position = 0;
+		int channels = 0;
+		int sampleRate = 0;
+		int bytesPerSample = 0;
+		int frameSize = 0;
+		PaSampleFormat format = 0;
+	};
+};
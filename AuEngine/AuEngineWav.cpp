@@ -0,0 +1,381 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineWav.cpp:
+// WAV/RF64 writer
+/////////////////////////////////
+
+/*******************************************
+* WAV writer:
+* File is opened without system cache,
+* so every write must be aligned to sector
+* and has size of sector multiple. We
+* collect data to 4 MB staging buffer and
+* write it in one call. File is grown by
+* big steps to keep it unfragmented.
+*
+* Header (80 bytes):
+* RIFF/RF64, WAVE, JUNK/ds64 (28 bytes),
+* fmt (16 bytes), data. Header is patched
+* at Close(), when we know size of data.
+*******************************************/
+
+#include "AuEngineWav.h"
+#include "AuEnginePipeline.h"
+
+static void PutTag(uint8_t* p, const char* szTag) { memcpy(p, szTag, 4); }
+static void PutU16(uint8_t* p, uint16_t v) { memcpy(p, &v, 2); }		// WAV is LE anyway
+static void PutU32(uint8_t* p, uint32_t v) { memcpy(p, &v, 4); }
+static void PutU64(uint8_t* p, uint64_t v) { memcpy(p, &v, 8); }
+
+/*******************************************
+* Open():
+* Create file and write placeholder header
+*******************************************/
+void AuEngine::WavFileWriter::Open(const char* lpPath, int iChannels, int iSampleRate, PaSampleFormat format, long long llExpectedSize)
+{
+	Close();
+
+	switch (format)
+	{
+	case paUInt8:	bitsPerSample = 8;  isFloat = false; break;	// 8-bit WAV is unsigned
+	case paInt16:	bitsPerSample = 16; isFloat = false; break;
+	case paInt24:	bitsPerSample = 24; isFloat = false; break;
+	case paInt32:	bitsPerSample = 32; isFloat = false; break;
+	case paFloat32:	bitsPerSample = 32; isFloat = true;  break;
+	default:		THROW_EXCEPTION(AuEngine::OpSet::FILESYSYEM_ERROR);
+	}
+	channels = iChannels;
+	sampleRate = iSampleRate;
+	frameSize = iChannels * bitsPerSample / 8;
+
+	hFile = CreateFileA(lpPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL | FILE_FLAG_NO_BUFFERING | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (hFile == INVALID_HANDLE_VALUE)
+	{
+		Msg("FILE Error: can't create file");
+		THROW_EXCEPTION(AuEngine::OpSet::FILESYSYEM_ERROR);
+	}
+
+	// unbuffered writes need aligned memory, header sector too
+	chunkUsed = 0;
+	pChunk = (uint8_t*)_aligned_malloc(WAV_WRITE_CHUNK, WAV_SECTOR_SIZE);
+	pFirstSector = (uint8_t*)_aligned_malloc(WAV_SECTOR_SIZE, WAV_SECTOR_SIZE);
+	if (!pChunk || !pFirstSector) { THROW_EXCEPTION(AuEngine::OpSet::MEMORY_ERROR); }
+
+	dataSize = 0;
+	fileOffset = 0;
+	allocated = 0;
+	BuildHeader(pChunk, false);
+	chunkUsed = WAV_HEADER_SIZE;
+
+	Preallocate(llExpectedSize > 0 ? llExpectedSize + WAV_HEADER_SIZE : WAV_PREALLOC_STEP);
+}
+
+/*******************************************
+* BuildHeader():
+* Fill 80 bytes of header for current size
+*******************************************/
+void AuEngine::WavFileWriter::BuildHeader(uint8_t* pHeader, bool isRF64)
+{
+	unsigned long long fileSize = WAV_HEADER_SIZE + dataSize + (dataSize & 1);
+	int bytesPerSample = bitsPerSample / 8;
+
+	PutTag(pHeader, isRF64 ? "RF64" : "RIFF");
+	PutU32(pHeader + 4, isRF64 ? 0xFFFFFFFF : (uint32_t)(fileSize - 8));
+	PutTag(pHeader + 8, "WAVE");
+
+	// JUNK has the same size as ds64, so file can be promoted in place
+	PutTag(pHeader + 12, isRF64 ? "ds64" : "JUNK");
+	PutU32(pHeader + 16, 28);
+	memset(pHeader + 20, 0, 28);
+	if (isRF64)
+	{
+		PutU64(pHeader + 20, fileSize - 8);
+		PutU64(pHeader + 28, dataSize);
+		PutU64(pHeader + 36, frameSize ? dataSize / frameSize : 0);
+		PutU32(pHeader + 44, 0);			// no table
+	}
+
+	PutTag(pHeader + 48, "fmt ");
+	PutU32(pHeader + 52, 16);
+	PutU16(pHeader + 56, isFloat ? 3 : 1);	// IEEE or PCM
+	PutU16(pHeader + 58, (uint16_t)channels);
+	PutU32(pHeader + 60, sampleRate);
+	PutU32(pHeader + 64, sampleRate * channels * bytesPerSample);
+	PutU16(pHeader + 68, (uint16_t)(channels * bytesPerSample));
+	PutU16(pHeader + 70, (uint16_t)bitsPerSample);
+
+	PutTag(pHeader + 72, "data");
+	PutU32(pHeader + 76, isRF64 ? 0xFFFFFFFF : (uint32_t)dataSize);
+}
+
+/*******************************************
+* Preallocate():
+* Grow file, so NTFS gives us one big
+* extent instead of many small
+*******************************************/
+void AuEngine::WavFileWriter::Preallocate(long long llSize)
+{
+	llSize = (llSize + WAV_SECTOR_SIZE - 1) & ~(long long)(WAV_SECTOR_SIZE - 1);
+	if (llSize <= allocated) { return; }
+
+	LARGE_INTEGER pos;
+	pos.QuadPart = llSize;
+	if (SetFilePointerEx(hFile, pos, NULL, FILE_BEGIN) && SetEndOfFile(hFile))
+	{
+		allocated = llSize;
+	}
+	else
+	{
+		// not critical, disk can be full only at the end
+		Msg("FILE Warning: can't preallocate file");
+	}
+}
+
+/*******************************************
+* FlushChunk():
+* Write staging buffer (sector multiple)
+*******************************************/
+void AuEngine::WavFileWriter::FlushChunk(size_t szBytes)
+{
+	if (fileOffset + (long long)szBytes > allocated)
+	{
+		Preallocate(allocated + (WAV_PREALLOC_STEP > (long long)szBytes ? WAV_PREALLOC_STEP : szBytes));
+	}
+
+	if (!fileOffset) { memcpy(pFirstSector, pChunk, WAV_SECTOR_SIZE); }
+
+	LARGE_INTEGER pos;
+	pos.QuadPart = fileOffset;
+	DWORD written = 0;
+	if (!SetFilePointerEx(hFile, pos, NULL, FILE_BEGIN) ||
+		!WriteFile(hFile, pChunk, (DWORD)szBytes, &written, NULL) || written != szBytes)
+	{
+		Msg("FILE Error: can't write file");
+		THROW_EXCEPTION(AuEngine::OpSet::FILESYSYEM_ERROR);
+	}
+	fileOffset += szBytes;
+}
+
+/*******************************************
+* Write():
+* Add data to file (whole frames)
+*******************************************/
+void AuEngine::WavFileWriter::Write(const void* pData, size_t szBytes)
+{
+	const uint8_t* pSrc = (const uint8_t*)pData;
+	dataSize += szBytes;
+
+	while (szBytes)
+	{
+		size_t part = WAV_WRITE_CHUNK - chunkUsed;
+		if (part > szBytes) { part = szBytes; }
+
+		memcpy(pChunk + chunkUsed, pSrc, part);
+		chunkUsed += part;
+		pSrc += part;
+		szBytes -= part;
+
+		if (chunkUsed == WAV_WRITE_CHUNK)
+		{
+			FlushChunk(WAV_WRITE_CHUNK);
+			chunkUsed = 0;
+		}
+	}
+}
+
+/*******************************************
+* Close():
+* Write tail, patch header, cut file to
+* real size. File and buffer are freed
+* on any error (it's called by destructor
+* too), so it returns false instead of
+* throwing
+*******************************************/
+bool AuEngine::WavFileWriter::Close()
+{
+	if (hFile == INVALID_HANDLE_VALUE) { return true; }
+
+	// Open() failed to allocate, nothing was written
+	bool isDone = pChunk && pFirstSector;
+	size_t tail = isDone ? (chunkUsed + WAV_SECTOR_SIZE - 1) & ~(size_t)(WAV_SECTOR_SIZE - 1) : 0;
+
+	// tail is padded to sector, the pad is cut below
+	if (tail)
+	{
+		memset(pChunk + chunkUsed, 0, tail - chunkUsed);
+		try
+		{
+			FlushChunk(tail);
+		}
+		catch (AuEngine::Exception&)
+		{
+			isDone = false;
+		}
+	}
+
+	unsigned long long fileSize = WAV_HEADER_SIZE + dataSize + (dataSize & 1);
+	bool isRF64 = fileSize - 8 > WAV_RIFF_LIMIT || dataSize > WAV_RIFF_LIMIT;
+	LARGE_INTEGER pos;
+	DWORD written = 0;
+	pos.QuadPart = 0;
+	if (pFirstSector && fileOffset)
+	{
+		BuildHeader(pFirstSector, isRF64);
+		if (!SetFilePointerEx(hFile, pos, NULL, FILE_BEGIN) ||
+			!WriteFile(hFile, pFirstSector, WAV_SECTOR_SIZE, &written, NULL) || written != WAV_SECTOR_SIZE)
+		{
+			Msg("FILE Error: can't write header");
+			isDone = false;
+		}
+	}
+
+	pos.QuadPart = (long long)fileSize;
+	SetFilePointerEx(hFile, pos, NULL, FILE_BEGIN);
+	SetEndOfFile(hFile);
+	CloseHandle(hFile);
+	hFile = INVALID_HANDLE_VALUE;
+
+	if (pChunk) { _aligned_free(pChunk); }
+	if (pFirstSector) { _aligned_free(pFirstSector); }
+	pChunk = NULL;
+	pFirstSector = NULL;
+	chunkUsed = 0;
+	if (isRF64) { Msg("FILE: promoted to RF64"); }
+	return isDone;
+}
+
+/*******************************************
+* Open():
+* Open file, ring and writer thread
+*******************************************/
+void AuEngine::WavStreamWriter::Open(const char* lpPath, int iChannels, int iSampleRate, PaSampleFormat format,
+	long long llExpectedSize, size_t szRing)
+{
+	Close();
+
+	writer.Open(lpPath, iChannels, iSampleRate, format, llExpectedSize);
+	frameSize = writer.GetFrameSize();
+	ring.Create(szRing > 2 * WAV_WRITE_CHUNK ? szRing : 2 * WAV_WRITE_CHUNK);
+	hDataEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
+	hSpaceEvent = CreateEventA(NULL, FALSE, FALSE, NULL);
+	written = 0;
+	isFailed = false;
+
+	isOpen = true;
+	writerThread = std::thread(&WavStreamWriter::WriterThread, this);
+}
+
+/*******************************************
+* Write():
+* Copy whole frames which fit to ring
+* (never waits)
+*******************************************/
+size_t AuEngine::WavStreamWriter::Write(const void* pData, size_t szBytes)
+{
+	size_t space = ring.GetWriteAvailable();
+	size_t toWrite = szBytes <= space ? szBytes : space - space % frameSize;
+	ring.Write(pData, toWrite);
+	written.fetch_add(toWrite, std::memory_order_relaxed);
+
+	if (ring.GetReadAvailable() >= WAV_WRITE_CHUNK) { SetEvent(hDataEvent); }
+	return toWrite;
+}
+
+/*******************************************
+* WriteBlocking():
+* Write all data, wait for writer if ring
+* is full
+*******************************************/
+void AuEngine::WavStreamWriter::WriteBlocking(const void* pData, size_t szBytes)
+{
+	const uint8_t* pSrc = (const uint8_t*)pData;
+	while (szBytes)
+	{
+		if (isFailed) { THROW_EXCEPTION(AuEngine::OpSet::FILESYSYEM_ERROR); }
+
+		size_t done = Write(pSrc, szBytes);
+		pSrc += done;
+		szBytes -= done;
+		if (szBytes)
+		{
+			SetEvent(hDataEvent);
+			WaitForSingleObject(hSpaceEvent, WAV_STREAM_WAIT);
+		}
+	}
+}
+
+/*******************************************
+* Close():
+* Write rest of ring, patch header
+*******************************************/
+void AuEngine::WavStreamWriter::Close()
+{
+	if (!isOpen) { return; }
+
+	isOpen = false;
+	SetEvent(hDataEvent);
+	writerThread.join();
+
+	if (!writer.Close()) { isFailed = true; }
+
+	ring.Destroy();
+	CloseHandle(hDataEvent);
+	CloseHandle(hSpaceEvent);
+	hDataEvent = hSpaceEvent = NULL;
+}
+
+/*******************************************
+* WriterThread():
+* Take data from ring and write to file
+*******************************************/
+void AuEngine::WavStreamWriter::WriterThread()
+{
+	SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_ABOVE_NORMAL);
+
+	while (true)
+	{
+		WaitForSingleObject(hDataEvent, WAV_STREAM_WAIT);
+		bool isLast = !isOpen;
+
+		// take big blocks while writing, everything at the end
+		while (ring.GetReadAvailable() >= WAV_WRITE_CHUNK || (isLast && ring.GetReadAvailable()))
+		{
+			const void* pData = NULL;
+			size_t bytes = ring.Peek(&pData);
+			try
+			{
+				writer.Write(pData, bytes);
+			}
+			catch (AuEngine::Exception&)
+			{
+				// disk is full or removed
+				Msg("AuEngine: Stream writer failed");
+				isFailed = true;
+				SetEvent(hSpaceEvent);
+				return;
+			}
+			ring.Skip(bytes);
+			SetEvent(hSpaceEvent);
+		}
+
+		if (isLast) { break; }
+	}
+}
+
+/*******************************************
+* ConvertFromFloat():
+* Convert float samples to file format.
+* Store is per sample, so mono loop of
+* pipeline takes interleaved data of any
+* channels
+*******************************************/
+void AuEngine::ConvertFromFloat(const float* pSrc, void* pDst, size_t szSamples, PaSampleFormat format)
+{
+	const AuEngine::PipelineFuncs* pFuncs = AuEngine::GetPipeline(format, 1);
+	if (pFuncs) { pFuncs->encode(pSrc, pDst, szSamples, 1); }
+	else { memcpy(pDst, pSrc, szSamples * sizeof(float)); }
+}
@@ -0,0 +1,110 @@
+/////////////////////////////////
+// VERTVER, 2018 (C)
+// OpenAu, Open Audio Utility
+// MIT-License
+/////////////////////////////////
+// AuEngineWav.h:
+// header for WAV/RF64 writer
+/////////////////////////////////
+#pragma once
+#include "AuEngine.h"
+#include "AuEngineRing.h"
+#include <atomic>
+#include <thread>
+
+#define WAV_SECTOR_SIZE			4096				// alignment for unbuffered I/O
+#define WAV_WRITE_CHUNK			(4 << 20)			// 4 MB for every WriteFile()
+#define WAV_PREALLOC_STEP		(256LL << 20)		// grow file by 256 MB
+#define WAV_HEADER_SIZE			80					// RIFF + JUNK/ds64 + fmt + data header
+#define WAV_RIFF_LIMIT			0xFFFFFFFFULL
+#define WAV_STREAM_RING			(32 << 20)			// 8 chunks between producer and disk
+#define WAV_STREAM_WAIT			20					// ms between checks of ring
+#define WAV_EXPORT_FRAMES		65536				// frames of one export block
+
+/***********************************************
+* class WavFileWriter:
+* Writes WAV file with unbuffered aligned
+* writes. Header has JUNK chunk with size
+* of ds64, so Close() can promote file to
+* RF64 if data is bigger than 4 GB.
+* Write() is synchronous, call it from
+* writer thread, not from audio thread.
+* Close() never throws, it returns false
+* if tail or header wasn't written
+***********************************
+* class WavStreamWriter:
+* WavFileWriter with own writer thread.
+* Write() only copies data to ring and
+* never waits (audio thread can call it),
+* WriteBlocking() waits for free space
+* (export, render). Disk error is kept
+* at IsFailed()
+***********************************
+* ConvertFromFloat():
+* Float samples to file format with clip,
+* exact inverse of TrackReader conversion
+***********************************************/
+namespace AuEngine
+{
+	DLL_API void ConvertFromFloat(const float* pSrc, void* pDst, size_t szSamples, PaSampleFormat format);
+
+	class WavFileWriter
+	{
+	public:
+		WavFileWriter() {}
+		~WavFileWriter() { Close(); }
+		DLL_API void Open(const char* lpPath, int iChannels, int iSampleRate, PaSampleFormat format, long long llExpectedSize = 0);
+		DLL_API void Write(const void* pData, size_t szBytes);
+		DLL_API bool Close();
+		bool IsOpen() const { return hFile != INVALID_HANDLE_VALUE; }
+		unsigned long long GetDataSize() const { return dataSize; }
+		int GetFrameSize() const { return frameSize; }
+
+	private:
+		void FlushChunk(size_t szBytes);
+		void Preallocate(long long llSize);
+		void BuildHeader(uint8_t* pHeader, bool isRF64);
+
+		HANDLE hFile = INVALID_HANDLE_VALUE;
+		uint8_t* pChunk = NULL;					// aligned staging buffer
+		size_t chunkUsed = 0;
+		long long fileOffset = 0;				// offset of staging buffer at file
+		long long allocated = 0;
+		unsigned long long dataSize = 0;
+		uint8_t* pFirstSector = NULL;			// aligned copy of sector with header
+
+		int channels = 0;
+		int sampleRate = 0;
+		int bitsPerSample = 0;
+		int frameSize = 0;
+		bool isFloat = false;
+	};
+
+	class WavStreamWriter
+	{
+	public:
+		WavStreamWriter() {}
+		~WavStreamWriter() { Close(); }
+		DLL_API void Open(const char* lpPath, int iChannels, int iSampleRate, PaSampleFormat format,
+			long long llExpectedSize = 0, size_t szRing = WAV_STREAM_RING);
+		DLL_API size_t Write(const void* pData, size_t szBytes);
+		DLL_API void WriteBlocking(const void* pData, size_t szBytes);
+		DLL_API void Close();
+		bool IsOpen() const { return isOpen; }
+		bool IsFailed() const { return isFailed; }
+		unsigned long long GetWritten() const { return written.load(std::memory_order_relaxed); }
+
+	private:
+		void WriterThread();
+
+		WavFileWriter writer;
+		RingBuffer ring;
+		std::thread writerThread;
+		HANDLE hDataEvent = NULL;
+		HANDLE hSpaceEvent = NULL;
+		std::atomic<bool> isOpen{ false };
+		std::atomic<bool> isFailed{ false };
+		std::atomic<unsigned long long> written{ 0 };
+		size_t frameSize = 0;
+	};
+};
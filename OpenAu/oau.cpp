@@ -19,6 +19,40 @@
 OAU::OAU(QWidget *parent) : QMainWindow(parent), ui(new Ui::OAU)
 {
     ui->setupUi(this);
+	input.InitDevices();		// probe devices in background
+	equalizer.Create(44100.0, PLAYLIST_CHANNELS);		// playlist sets rate of stream
+	playlist.SetEqualizer(&equalizer);
+
+	AuEngine::DynamicsConfig limiterConfig;
+	limiterConfig.mode = AuEngine::DYN_LIMITER;
+	limiterConfig.sampleRate = 44100.0;
+	limiterConfig.lookahead = LIMITER_LOOKAHEAD;
+	limiterConfig.release = LIMITER_RELEASE;
+	limiterConfig.isTruePeak = true;
+	limiter.Create(limiterConfig, PLAYLIST_CHANNELS);
+	connect(&exportTimer, &QTimer::timeout, this, &OAU::UpdateExportProgress);
+
+	// UI only takes last snapshot of engine, it never waits for callback
+	ui->statusBar->addPermanentWidget(&telemetryLabel);
+	connect(&telemetryTimer, &QTimer::timeout, this, &OAU::UpdateTelemetry);
+	telemetryTimer.start(TELEMETRY_TIMER_MS);
+}
+
+/***********************************************
+* nativeEvent():
+* Mark device cache stale on hot-plug,
+* it is rebuilt before next stream
+***********************************************/
+bool OAU::nativeEvent(const QByteArray &eventType, void *message, long *result)
+{
+#ifdef _WIN32
+	MSG* pMsg = (MSG*)message;
+	if (pMsg->message == WM_DEVICECHANGE)
+	{
+		input.OnDevicesChanged();
+	}
+#endif
+	return QMainWindow::nativeEvent(eventType, message, result);
 }
 
 /***********************************************
@@ -32,7 +66,7 @@ QString OAU::OpenAudioFile()
 
 /***********************************************
 * PlayAudioFile():
-* Send current file to stream
+* Add file to playlist
 ***********************************************/
 void OAU::PlayAudioFile(QString aFile)
 {
@@ -44,7 +78,13 @@ void OAU::PlayAudioFile(QString aFile)
 		Sleep(0);
 	}
 	else
-		output.CreateOutput(aFile.toLocal8Bit());
+	{
+		// one stream for all files, next file is played without gap
+		openedFiles.removeAll(aFile);
+		openedFiles.append(aFile);
+		playlist.Add(aFile.toLocal8Bit());
+		playlist.Play();
+	}
 }
 
 /***********************************************
@@ -53,6 +93,9 @@ void OAU::PlayAudioFile(QString aFile)
 ***********************************************/
 OAU::~OAU()
 {
+	exporter.Cancel();
+	playlist.SetEffectGraph(NULL);
+	delete pPluginGraph;
     delete ui;
 }
 
@@ -78,3 +121,259 @@ void OAU::on_pushButton_clicked()
 {
 	PlayAudioFile(OpenAudioFile());
 }
+
+/***********************************************
+* ExportFiles():
+* Write files at export workers, so UI
+* isn't blocked by disk
+***********************************************/
+void OAU::ExportFiles(QStringList sources, QStringList targets, PaSampleFormat format)
+{
+	if (!exporter.IsDone())
+	{
+		QMessageBox::information(this, tr("Export"), tr("Previous export is not finished yet"));
+		return;
+	}
+	exporter.Clear();
+
+	for (int i = 0; i < sources.size(); i++)
+	{
+		AuEngine::ExportJob job;
+		job.source = sources[i].toLocal8Bit().constData();
+		job.target = targets[i].toLocal8Bit().constData();
+		job.format = format;
+		exporter.AddJob(job);
+	}
+
+	// budget keeps memory bounded for any count of files
+	exporter.Start(EXPORT_WORKERS, BATCH_MEMORY_BUDGET);
+	exportTimer.start(EXPORT_TIMER_MS);
+}
+
+/***********************************************
+* UpdateExportProgress():
+* Show progress of every file
+***********************************************/
+void OAU::UpdateExportProgress()
+{
+	int count = exporter.GetJobsCount();
+	if (exporter.IsDone())
+	{
+		exportTimer.stop();
+		exporter.Wait();
+
+		int failed = 0;
+		for (int i = 0; i < count; i++)
+		{
+			if (exporter.GetState(i) != AuEngine::BATCH_DONE) { failed++; }
+		}
+		ui->statusBar->showMessage(failed ? tr("Export failed for %1 file(s)").arg(failed)
+			: tr("Export finished"), 3000);
+		return;
+	}
+
+	QString message = tr("Exporting %1%").arg(exporter.GetTotalProgress());
+	for (int i = 0; i < count; i++)
+	{
+		if (exporter.GetState(i) != AuEngine::BATCH_RUNNING) { continue; }
+		message += QString("  %1: %2%").arg(QFileInfo(exporter.GetJobName(i)).fileName()).arg(exporter.GetProgress(i));
+	}
+	ui->statusBar->showMessage(message);
+}
+
+/***********************************************
+* UpdateTelemetry():
+* Show levels, position and load of
+* playback
+***********************************************/
+void OAU::UpdateTelemetry()
+{
+	AuEngine::TelemetrySnapshot snapshot;
+	if (!playlist.GetTelemetry(&snapshot))
+	{
+		if (!playlist.IsPlaying()) { telemetryLabel.clear(); }
+		return;
+	}
+
+	QString text;
+	for (int c = 0; c < snapshot.channels; c++)
+	{
+		text += QString("%1 dB  ").arg(snapshot.peak[c], 0, 'f', 1);
+	}
+
+	if (snapshot.sampleRate)
+	{
+		int seconds = (int)(snapshot.position / snapshot.sampleRate);
+		text += QString("%1:%2  ").arg(seconds / 60).arg(seconds % 60, 2, 10, QChar('0'));
+	}
+
+	unsigned long long xruns = snapshot.timing.deadlineMisses + snapshot.timing.underflows;
+	text += tr("CPU %1%  xruns %2").arg(snapshot.load * 100.0, 0, 'f', 1).arg(xruns);
+	if (pPluginGraph)
+	{
+		AuEngine::PluginStats stats = plugin.GetStats();
+		text += stats.isCrashed ? tr("  plugin crashed") : tr("  plugin %1%  late %2").arg(stats.load * 100.0, 0, 'f', 1).arg(stats.underruns);
+	}
+	telemetryLabel.setText(text);
+}
+
+/***********************************************
+* on_actionSave_triggered():
+* Rewrite current file
+***********************************************/
+void OAU::on_actionSave_triggered()
+{
+	if (openedFiles.isEmpty()) { return; }
+	ExportFiles(QStringList(openedFiles.last()), QStringList(openedFiles.last()), 0);
+}
+
+/***********************************************
+* on_actionSave_as_triggered():
+* Write current file to new path
+***********************************************/
+void OAU::on_actionSave_as_triggered()
+{
+	if (openedFiles.isEmpty()) { return; }
+
+	QString path = QFileDialog::getSaveFileName(this, tr("Save Audio"), openedFiles.last(), tr("Audio Files (*.wav)"));
+	if (path.isEmpty()) { return; }
+	ExportFiles(QStringList(openedFiles.last()), QStringList(path), 0);
+}
+
+/***********************************************
+* on_actionSave_all_triggered():
+* Write all opened files to directory
+***********************************************/
+void OAU::on_actionSave_all_triggered()
+{
+	if (openedFiles.isEmpty()) { return; }
+
+	QString dir = QFileDialog::getExistingDirectory(this, tr("Save all files"));
+	if (dir.isEmpty()) { return; }
+
+	QStringList targets;
+	for (const QString& file : openedFiles)
+	{
+		targets.append(QDir(dir).filePath(QFileInfo(file).fileName()));
+	}
+	ExportFiles(openedFiles, targets, 0);
+}
+
+/***********************************************
+* on_actionExport_triggered():
+* Write current file with other format
+***********************************************/
+void OAU::on_actionExport_triggered()
+{
+	if (openedFiles.isEmpty()) { return; }
+
+	QStringList filters;
+	filters << tr("WAV 16-bit (*.wav)") << tr("WAV 24-bit (*.wav)") << tr("WAV 32-bit float (*.wav)");
+	QString filter = filters[0];
+	QString path = QFileDialog::getSaveFileName(this, tr("Export Audio"), openedFiles.last(), filters.join(";;"), &filter);
+	if (path.isEmpty()) { return; }
+
+	// files bigger than 4 GB are written as RF64
+	PaSampleFormat format = paInt16;
+	if (filter == filters[1]) { format = paInt24; }
+	if (filter == filters[2]) { format = paFloat32; }
+	ExportFiles(QStringList(openedFiles.last()), QStringList(path), format);
+}
+
+/***********************************************
+* on_actionClose_and_save_files_triggered():
+* Stop playing, save and close all files
+***********************************************/
+void OAU::on_actionClose_and_save_files_triggered()
+{
+	if (openedFiles.isEmpty()) { return; }
+
+	// playlist keeps files open, so it must release them first
+	playlist.Stop();
+	playlist.Clear();
+	ExportFiles(openedFiles, openedFiles, 0);
+	openedFiles.clear();
+}
+
+/***********************************************
+* on_actionFast_high_freq_boost_triggered():
+* Toggle +6 dB high shelf at 8 kHz
+***********************************************/
+void OAU::on_actionFast_high_freq_boost_triggered(bool checked)
+{
+	AuEngine::EQBandParams band;
+	band.type = AuEngine::EQ_HIGHSHELF;
+	band.frequency = 8000.0f;
+	band.gain = 6.0f;
+	band.isEnabled = checked;
+	equalizer.SetBand(EQ_BAND_HIGH_BOOST, band);
+}
+
+/***********************************************
+* on_actionFast_LowFreq_Boost_triggered():
+* Toggle +6 dB low shelf at 100 Hz
+***********************************************/
+void OAU::on_actionFast_LowFreq_Boost_triggered(bool checked)
+{
+	AuEngine::EQBandParams band;
+	band.type = AuEngine::EQ_LOWSHELF;
+	band.frequency = 100.0f;
+	band.gain = 6.0f;
+	band.isEnabled = checked;
+	equalizer.SetBand(EQ_BAND_LOW_BOOST, band);
+}
+
+/***********************************************
+* on_actionLimit_to_3dBFS_triggered():
+* Toggle true-peak limiter of playback
+***********************************************/
+void OAU::on_actionLimit_to_3dBFS_triggered(bool checked)
+{
+	ui->actionLimitt_to_0dbFS->setChecked(false);
+	limiter.SetThreshold(-3.0f);
+	playlist.SetDynamics(checked ? &limiter : NULL);
+}
+
+/***********************************************
+* on_actionLimitt_to_0dbFS_triggered():
+* Toggle true-peak limiter of playback
+***********************************************/
+void OAU::on_actionLimitt_to_0dbFS_triggered(bool checked)
+{
+	ui->actionLimit_to_3dBFS->setChecked(false);
+	limiter.SetThreshold(0.0f);
+	playlist.SetDynamics(checked ? &limiter : NULL);
+}
+
+/***********************************************
+* on_actionVST_triggered():
+* Load CLAP plugin to sandbox and play
+* through it
+***********************************************/
+void OAU::on_actionVST_triggered()
+{
+	QString path = QFileDialog::getOpenFileName(this, tr("Load Plugin"), NULL, tr("CLAP Plugins (*.clap)"));
+	if (path.isEmpty()) { return; }
+
+	// playlist leaves old graph before plugin is reloaded
+	playlist.SetEffectGraph(NULL);
+	delete pPluginGraph;
+	pPluginGraph = NULL;
+
+	try
+	{
+		plugin.Load(path.toLocal8Bit(), 0, PLAYLIST_CHANNELS);
+		pPluginGraph = new AuEngine::Graph();
+		int source = pPluginGraph->AddNode(new AuEngine::PluginNode(&plugin, AuEngine::SOURCE_NODE));
+		int output = pPluginGraph->AddNode(new AuEngine::MixerNode(PLAYLIST_CHANNELS, AuEngine::OUTPUT_NODE));
+		pPluginGraph->Connect(source, output);
+		playlist.SetEffectGraph(pPluginGraph);
+	}
+	catch (AuEngine::Exception&)
+	{
+		delete pPluginGraph;
+		pPluginGraph = NULL;
+		plugin.Unload();
+		QMessageBox::warning(this, tr("Load Plugin"), tr("Can't load plugin"));
+	}
+}
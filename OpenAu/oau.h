@@ -14,12 +14,28 @@
 #include <QApplication>
 #include <QMainWindow>
 #include <QFileDialog>
+#include <QDir>
+#include <QFileInfo>
 #include "ui_oau.h"
 #include <QMessageBox>
+#include <QTimer>
+#include <QLabel>
 #include <math.h>
 #include "../AuEngine/AuEngine.h"
+#include "../AuEngine/AuEnginePlaylist.h"
+#include "../AuEngine/AuEngineBatch.h"
+#include "../AuEngine/AuEngineDynamics.h"
+#include "../AuEngine/AuEngineEQ.h"
+#include "../AuEngine/AuEnginePlugin.h"
 
 #define	MAX_NUM_ARGVS 128
+#define EXPORT_TIMER_MS 200
+#define TELEMETRY_TIMER_MS 50
+#define EXPORT_WORKERS 4
+#define EQ_BAND_LOW_BOOST 0
+#define EQ_BAND_HIGH_BOOST 1
+#define LIMITER_LOOKAHEAD 0.0015f
+#define LIMITER_RELEASE 0.05f
 
 
 extern "C"
@@ -44,15 +60,43 @@ public:
 	~OAU();
 	void ThrowExceptionDialog(QString szException, QString szDescription);
 
+protected:
+	bool nativeEvent(const QByteArray &eventType, void *message, long *result) override;
 
 private slots:
     void on_pushButton_clicked();
+	void on_actionSave_triggered();
+	void on_actionSave_as_triggered();
+	void on_actionSave_all_triggered();
+	void on_actionExport_triggered();
+	void on_actionClose_and_save_files_triggered();
+	void on_actionFast_high_freq_boost_triggered(bool checked);
+	void on_actionFast_LowFreq_Boost_triggered(bool checked);
+	void on_actionLimit_to_3dBFS_triggered(bool checked);
+	void on_actionLimitt_to_0dbFS_triggered(bool checked);
+	void on_actionVST_triggered();
+	void UpdateExportProgress();
+	void UpdateTelemetry();
 
 private:
+	void ExportFiles(QStringList sources, QStringList targets, PaSampleFormat format);
+
     Ui::OAU *ui;
 
 	eOutput output;
 	eInput input;
+	AuEngine::ParametricEQ equalizer;		// must live longer than playlist
+	AuEngine::Dynamics limiter;
+	AuEngine::SandboxPlugin plugin;			// crash of plugin only bypasses it
+	AuEngine::Graph* pPluginGraph = NULL;	// owns node of plugin, deleted before plugin
+	AuEngine::Playlist playlist;
+	eFS fileSystem;
+
+	QStringList openedFiles;
+	AuEngine::BatchExporter exporter;
+	QTimer exportTimer;
+	QTimer telemetryTimer;
+	QLabel telemetryLabel;
 };
 
 